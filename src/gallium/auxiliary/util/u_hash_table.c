@@ -44,6 +44,7 @@
 #include "cso_cache/cso_hash.h"
 
 #include "util/u_memory.h"
+#include "util/u_pointer.h"
 #include "util/u_hash_table.h"
 
 
@@ -101,6 +102,31 @@ util_hash_table_create(unsigned (*hash)(void *key),
 }
 
 
+static unsigned
+pointer_hash(void *key)
+{
+   return (unsigned)(pointer_to_intptr(key) & 0xffffffff);
+}
+
+
+static int
+pointer_compare(void *key1, void *key2)
+{
+   if (key1 < key2)
+      return -1;
+   if (key1 > key2)
+      return 1;
+   return 0;
+}
+
+
+struct util_hash_table *
+util_hash_table_create_ptr_keys(void (*destroy)(void *value))
+{
+   return util_hash_table_create(pointer_hash, pointer_compare, destroy);
+}
+
+
 static inline struct cso_hash_iter
 util_hash_table_find_iter(struct util_hash_table *ht,
                           void *key,
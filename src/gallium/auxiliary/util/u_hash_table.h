@@ -61,6 +61,14 @@ util_hash_table_create(unsigned (*hash)(void *key),
                        void (*destroy)(void *value));
 
 
+/**
+ * Create an hash table whose keys are the pointer values themselves,
+ * typically integer handles stored with intptr_to_pointer().
+ */
+struct util_hash_table *
+util_hash_table_create_ptr_keys(void (*destroy)(void *value));
+
+
 enum pipe_error
 util_hash_table_set(struct util_hash_table *ht,
                     void *key,
@@ -42,6 +42,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include "vrend_iov.h"
+#include "vrend_simd.h"
+#include "vrend_copy_pool.h"
 
 size_t vrend_get_iovec_size(const struct iovec *iov, int iovlen) {
   size_t size = 0;
@@ -55,6 +57,62 @@ size_t vrend_get_iovec_size(const struct iovec *iov, int iovlen) {
   return size;
 }
 
+static void copy_memcpy(void *dst, const void *src, size_t size)
+{
+  memcpy(dst, src, size);
+}
+
+/* Hands a copy between an iovec and a linear buffer to the copy pool if
+ * it is large enough, returns the number of bytes copied or 0 if the pool
+ * did not take it.
+ */
+static size_t copy_iovec_threaded(const struct iovec *iov, int iovlen,
+				  size_t offset, char *buf, size_t count,
+				  bool to_iov)
+{
+  struct vrend_copy_range *ranges;
+  unsigned num_ranges = 0;
+  size_t copied = 0;
+  size_t len;
+
+  if (!vrend_copy_pool_wants(count) || iovlen <= 0)
+    return 0;
+
+  ranges = malloc(iovlen * sizeof(*ranges));
+  if (!ranges)
+    return 0;
+
+  while (count > 0 && iovlen > 0) {
+    if (iov->iov_len > offset) {
+      char *ptr = (char*)iov->iov_base + offset;
+
+      len = iov->iov_len - offset;
+      if (count < len) len = count;
+
+      ranges[num_ranges].dst = to_iov ? ptr : buf + copied;
+      ranges[num_ranges].src = to_iov ? buf + copied : ptr;
+      ranges[num_ranges].size = len;
+      num_ranges++;
+
+      copied += len;
+      count -= len;
+      offset = 0;
+    } else {
+      offset -= iov->iov_len;
+    }
+    iov++;
+    iovlen--;
+  }
+
+  /* writes go to guest memory the host won't read again */
+  if (!vrend_copy_pool_run(ranges, num_ranges,
+                           to_iov ? vrend_copy : copy_memcpy))
+    copied = 0;
+
+  free(ranges);
+  return copied;
+}
+
 size_t vrend_read_from_iovec(const struct iovec *iov, int iovlen,
 			     size_t offset,
 			     char *buf, size_t count)
@@ -62,6 +120,10 @@ size_t vrend_read_from_iovec(const struct iovec *iov, int iovlen,
   size_t read = 0;
   size_t len;
 
+  read = copy_iovec_threaded(iov, iovlen, offset, buf, count, false);
+  if (read)
+    return read;
+
   while (count > 0 && iovlen > 0) {
     if (iov->iov_len > offset) {
       len = iov->iov_len - offset;
@@ -91,13 +153,18 @@ size_t vrend_write_to_iovec(const struct iovec *iov, int iovlen,
   size_t written = 0;
   size_t len;
 
+  written = copy_iovec_threaded(iov, iovlen, offset, (char*)buf, count, true);
+  if (written)
+    return written;
+
   while (count > 0 && iovlen > 0) {
     if (iov->iov_len > offset) {
       len = iov->iov_len - offset;
 
       if (count < len) len = count;
 
-      memcpy((char*)iov->iov_base + offset, buf, len);
+      /* guest memory, the host won't read it again */
+      vrend_copy((char*)iov->iov_base + offset, buf, len);
       written += len;
 
       offset = 0;
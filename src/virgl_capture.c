@@ -0,0 +1,473 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipe/p_state.h"
+#include "util/u_memory.h"
+#include "util/u_math.h"
+#include "util/u_hash_table.h"
+#include "util/u_pointer.h"
+#include "virglrenderer.h"
+#include "virgl_capture.h"
+#include "virgl_protocol.h"
+#include "vrend_debug.h"
+
+/* guest memory attached to a resource, and what the capture last saw in
+ * the part of it a transfer read */
+struct capture_backing {
+   struct iovec *iov;
+   int num_iovs;
+   size_t size;
+   size_t hash_start;
+   size_t hash_end;
+   uint64_t hash;
+   bool written;
+};
+
+/* the format isn't known here, so assume the largest element */
+#define CAPTURE_MAX_ELEMENT_SIZE 16
+
+/* distinct resources whose backing in-stream transfers of one submit
+ * read, the part of each backing is merged before it is hashed */
+#define CAPTURE_MAX_STREAM_RANGES 32
+
+struct capture_range {
+   uint32_t handle;
+   struct capture_backing *backing;
+   size_t start;
+   size_t end;
+};
+
+static struct {
+   FILE *file;
+   struct util_hash_table *backings;
+} capture;
+
+static void free_backing(void *value)
+{
+   struct capture_backing *backing = value;
+   free(backing->iov);
+   free(backing);
+}
+
+static uint64_t capture_hash_iov(const struct iovec *iov, int num_iovs,
+                                 size_t start, size_t end)
+{
+   uint64_t hash = 0xcbf29ce484222325ull;
+   size_t pos = 0;
+
+   /* 64 bit FNV-1a */
+   for (int i = 0; i < num_iovs && pos < end; i++) {
+      const uint8_t *p = iov[i].iov_base;
+      size_t j = start > pos ? MIN2(start - pos, iov[i].iov_len) : 0;
+      size_t len = MIN2(iov[i].iov_len, end - pos);
+
+      for (; j < len; j++) {
+         hash ^= p[j];
+         hash *= 0x100000001b3ull;
+      }
+      pos += iov[i].iov_len;
+   }
+   return hash;
+}
+
+/* a conservative range of the backing that a transfer of box at offset
+ * reads, the whole backing if the strides are left to the renderer */
+static void capture_transfer_range(const struct capture_backing *backing,
+                                   uint32_t stride, uint32_t layer_stride,
+                                   const struct pipe_box *box, uint64_t offset,
+                                   size_t *start, size_t *end)
+{
+   uint64_t last = offset + (uint64_t)box->width * CAPTURE_MAX_ELEMENT_SIZE;
+
+   *start = 0;
+   *end = backing->size;
+
+   if (box->height > 1) {
+      if (!stride)
+         return;
+      last += (uint64_t)(box->height - 1) * stride;
+   }
+   if (box->depth > 1) {
+      if (!layer_stride)
+         return;
+      last += (uint64_t)(box->depth - 1) * layer_stride;
+   }
+
+   *start = MIN2(offset, backing->size);
+   *end = MIN2(last, backing->size);
+}
+
+static void capture_write(const void *data, size_t size)
+{
+   if (fwrite(data, 1, size, capture.file) != size) {
+      vrend_printf("capture: write failed, stopping the capture\n");
+      virgl_capture_fini();
+   }
+}
+
+/* a record with a dword header followed by data_size bytes of data,
+ * padded to a dword */
+static void capture_record(uint32_t type, const uint32_t *dwords, uint32_t num_dwords,
+                           const struct iovec *iov, int num_iovs, size_t data_size)
+{
+   static const uint8_t zero[4];
+   uint32_t hdr[VIRGL_CAPTURE_HDR_SIZE];
+   size_t left = data_size;
+
+   hdr[VIRGL_CAPTURE_LEN] = num_dwords + (data_size + 3) / 4;
+   hdr[VIRGL_CAPTURE_TYPE] = type;
+   capture_write(hdr, sizeof(hdr));
+   if (capture.file && num_dwords)
+      capture_write(dwords, num_dwords * 4);
+
+   for (int i = 0; i < num_iovs && capture.file && left; i++) {
+      size_t len = MIN2(iov[i].iov_len, left);
+      capture_write(iov[i].iov_base, len);
+      left -= len;
+   }
+   if (capture.file && data_size & 3)
+      capture_write(zero, 4 - (data_size & 3));
+}
+
+bool virgl_capture_init(const char *path)
+{
+   uint32_t header[2] = { VIRGL_CAPTURE_MAGIC, VIRGL_CAPTURE_VERSION };
+
+   if (capture.file)
+      return true;
+
+   capture.file = fopen(path, "wb");
+   if (!capture.file) {
+      vrend_printf("capture: unable to open %s\n", path);
+      return false;
+   }
+
+   capture.backings = util_hash_table_create_ptr_keys(free_backing);
+   if (!capture.backings) {
+      fclose(capture.file);
+      capture.file = NULL;
+      return false;
+   }
+
+   capture_record(VIRGL_CAPTURE_HEADER, header, 2, NULL, 0, 0);
+   return capture.file != NULL;
+}
+
+void virgl_capture_fini(void)
+{
+   if (capture.file) {
+      fclose(capture.file);
+      capture.file = NULL;
+   }
+   if (capture.backings) {
+      util_hash_table_destroy(capture.backings);
+      capture.backings = NULL;
+   }
+}
+
+void virgl_capture_ctx_create(uint32_t ctx_id, uint32_t nlen, const char *name)
+{
+   uint32_t dwords[2] = { ctx_id, nlen };
+   struct iovec iov = { (void *)name, nlen };
+
+   if (!capture.file)
+      return;
+   capture_record(VIRGL_CAPTURE_CTX_CREATE, dwords, 2, &iov, 1, nlen);
+}
+
+void virgl_capture_ctx_destroy(uint32_t ctx_id)
+{
+   if (!capture.file)
+      return;
+   capture_record(VIRGL_CAPTURE_CTX_DESTROY, &ctx_id, 1, NULL, 0, 0);
+}
+
+void virgl_capture_resource_create(const struct virgl_renderer_resource_create_args *args,
+                                   const struct iovec *iov, uint32_t num_iovs)
+{
+   if (!capture.file)
+      return;
+
+   capture_record(VIRGL_CAPTURE_RES_CREATE, (const uint32_t *)args, sizeof(*args) / 4,
+                  NULL, 0, 0);
+   if (num_iovs)
+      virgl_capture_attach_iov(args->handle, iov, num_iovs);
+}
+
+void virgl_capture_resource_unref(uint32_t handle)
+{
+   if (!capture.file)
+      return;
+   util_hash_table_remove(capture.backings, intptr_to_pointer(handle));
+   capture_record(VIRGL_CAPTURE_RES_UNREF, &handle, 1, NULL, 0, 0);
+}
+
+void virgl_capture_attach_iov(uint32_t handle, const struct iovec *iov, int num_iovs)
+{
+   struct capture_backing *backing;
+   uint32_t dwords[2];
+
+   if (!capture.file)
+      return;
+
+   /* like the renderer, keep the first backing attached */
+   if (util_hash_table_get(capture.backings, intptr_to_pointer(handle)))
+      return;
+
+   backing = CALLOC_STRUCT(capture_backing);
+   if (!backing)
+      return;
+   backing->iov = malloc(num_iovs * sizeof(*iov));
+   if (!backing->iov) {
+      free(backing);
+      return;
+   }
+   memcpy(backing->iov, iov, num_iovs * sizeof(*iov));
+   backing->num_iovs = num_iovs;
+   backing->size = vrend_get_iovec_size(iov, num_iovs);
+   util_hash_table_set(capture.backings, intptr_to_pointer(handle), backing);
+
+   dwords[0] = handle;
+   dwords[1] = backing->size;
+   capture_record(VIRGL_CAPTURE_ATTACH_BACKING, dwords, 2, NULL, 0, 0);
+}
+
+void virgl_capture_detach_iov(uint32_t handle)
+{
+   if (!capture.file)
+      return;
+   util_hash_table_remove(capture.backings, intptr_to_pointer(handle));
+   capture_record(VIRGL_CAPTURE_DETACH_BACKING, &handle, 1, NULL, 0, 0);
+}
+
+void virgl_capture_ctx_resource(uint32_t ctx_id, uint32_t handle, bool attach)
+{
+   uint32_t dwords[2] = { ctx_id, handle };
+
+   if (!capture.file)
+      return;
+   capture_record(attach ? VIRGL_CAPTURE_CTX_ATTACH_RES : VIRGL_CAPTURE_CTX_DETACH_RES,
+                  dwords, 2, NULL, 0, 0);
+}
+
+/* write out the backing of a resource if the guest changed the part
+ * between start and end.  Only that part is hashed, a full hash of a
+ * large backing on every write transfer would cost more than the
+ * transfer. */
+static void capture_sync_range(uint32_t handle, struct capture_backing *backing,
+                               size_t start, size_t end)
+{
+   uint32_t dwords[2];
+   uint64_t hash;
+
+   hash = capture_hash_iov(backing->iov, backing->num_iovs, start, end);
+   if (backing->written && hash == backing->hash &&
+       start == backing->hash_start && end == backing->hash_end)
+      return;
+
+   dwords[0] = handle;
+   dwords[1] = backing->size;
+   capture_record(VIRGL_CAPTURE_BACKING_DATA, dwords, 2,
+                  backing->iov, backing->num_iovs, backing->size);
+   backing->hash_start = start;
+   backing->hash_end = end;
+   backing->hash = hash;
+   backing->written = true;
+}
+
+static void capture_sync_backing(uint32_t handle, uint32_t stride,
+                                 uint32_t layer_stride,
+                                 const struct pipe_box *box, uint64_t offset)
+{
+   struct capture_backing *backing;
+   size_t start, end;
+
+   backing = util_hash_table_get(capture.backings, intptr_to_pointer(handle));
+   if (!backing)
+      return;
+
+   capture_transfer_range(backing, stride, layer_stride, box, offset, &start, &end);
+   capture_sync_range(handle, backing, start, end);
+}
+
+/* add the part of the backing of handle that an in-stream transfer
+ * reads, cmd points at the command header */
+static void capture_add_stream_range(struct capture_range *ranges,
+                                     unsigned *num_ranges,
+                                     const uint32_t *cmd, uint32_t handle,
+                                     uint64_t offset)
+{
+   struct capture_backing *backing;
+   struct pipe_box box;
+   size_t start, end;
+   unsigned i;
+
+   backing = util_hash_table_get(capture.backings, intptr_to_pointer(handle));
+   if (!backing)
+      return;
+
+   box.x = cmd[VIRGL_RESOURCE_IW_X];
+   box.y = cmd[VIRGL_RESOURCE_IW_Y];
+   box.z = cmd[VIRGL_RESOURCE_IW_Z];
+   box.width = cmd[VIRGL_RESOURCE_IW_W];
+   box.height = cmd[VIRGL_RESOURCE_IW_H];
+   box.depth = cmd[VIRGL_RESOURCE_IW_D];
+   capture_transfer_range(backing, cmd[VIRGL_RESOURCE_IW_STRIDE],
+                          cmd[VIRGL_RESOURCE_IW_LAYER_STRIDE], &box, offset,
+                          &start, &end);
+
+   for (i = 0; i < *num_ranges; i++) {
+      if (ranges[i].handle == handle) {
+         ranges[i].start = MIN2(ranges[i].start, start);
+         ranges[i].end = MAX2(ranges[i].end, end);
+         return;
+      }
+   }
+
+   if (*num_ranges == CAPTURE_MAX_STREAM_RANGES) {
+      capture_sync_range(handle, backing, start, end);
+      return;
+   }
+
+   ranges[i].handle = handle;
+   ranges[i].backing = backing;
+   ranges[i].start = start;
+   ranges[i].end = end;
+   (*num_ranges)++;
+}
+
+/* TRANSFER3D to the host and COPY_TRANSFER3D read guest backing while
+ * the stream is decoded, write out what they will read before the
+ * submit that carries them */
+static void capture_sync_stream(const uint32_t *buf, int ndw)
+{
+   struct capture_range ranges[CAPTURE_MAX_STREAM_RANGES];
+   unsigned num_ranges = 0;
+   unsigned i;
+   int pos = 0;
+
+   while (pos < ndw) {
+      const uint32_t *cmd = buf + pos;
+      uint32_t len = cmd[0] >> 16;
+
+      if ((uint64_t)pos + len + 1 > (uint64_t)ndw)
+         break;
+
+      switch (cmd[0] & 0xff) {
+      case VIRGL_CCMD_TRANSFER3D:
+         if (len >= VIRGL_TRANSFER3D_SIZE &&
+             cmd[VIRGL_TRANSFER3D_DIRECTION] == VIRGL_TRANSFER_TO_HOST)
+            capture_add_stream_range(ranges, &num_ranges, cmd,
+                                     cmd[VIRGL_RESOURCE_IW_RES_HANDLE],
+                                     cmd[VIRGL_TRANSFER3D_DATA_OFFSET]);
+         break;
+      case VIRGL_CCMD_COPY_TRANSFER3D:
+         if (len == VIRGL_COPY_TRANSFER3D_SIZE)
+            capture_add_stream_range(ranges, &num_ranges, cmd,
+                                     cmd[VIRGL_COPY_TRANSFER3D_SRC_RES_HANDLE],
+                                     cmd[VIRGL_COPY_TRANSFER3D_SRC_RES_OFFSET]);
+         break;
+      default:
+         break;
+      }
+      pos += len + 1;
+   }
+
+   for (i = 0; i < num_ranges; i++)
+      capture_sync_range(ranges[i].handle, ranges[i].backing,
+                         ranges[i].start, ranges[i].end);
+}
+
+void virgl_capture_transfer(bool write, uint32_t handle, uint32_t ctx_id,
+                            uint32_t level, uint32_t stride, uint32_t layer_stride,
+                            const struct virgl_box *box, uint64_t offset,
+                            const struct iovec *iov, unsigned int iov_cnt)
+{
+   const struct pipe_box *pbox = (const struct pipe_box *)box;
+   uint32_t dwords[VIRGL_CAPTURE_TRANSFER_HDR_SIZE];
+   size_t data_size = 0;
+
+   if (!capture.file)
+      return;
+
+   if (iov && iov_cnt)
+      data_size = vrend_get_iovec_size(iov, iov_cnt);
+   else if (write)
+      capture_sync_backing(handle, stride, layer_stride, pbox, offset);
+
+   dwords[VIRGL_CAPTURE_TRANSFER_HANDLE] = handle;
+   dwords[VIRGL_CAPTURE_TRANSFER_CTX_ID] = ctx_id;
+   dwords[VIRGL_CAPTURE_TRANSFER_LEVEL] = level;
+   dwords[VIRGL_CAPTURE_TRANSFER_STRIDE] = stride;
+   dwords[VIRGL_CAPTURE_TRANSFER_LAYER_STRIDE] = layer_stride;
+   dwords[VIRGL_CAPTURE_TRANSFER_X] = pbox->x;
+   dwords[VIRGL_CAPTURE_TRANSFER_Y] = pbox->y;
+   dwords[VIRGL_CAPTURE_TRANSFER_Z] = pbox->z;
+   dwords[VIRGL_CAPTURE_TRANSFER_WIDTH] = pbox->width;
+   dwords[VIRGL_CAPTURE_TRANSFER_HEIGHT] = pbox->height;
+   dwords[VIRGL_CAPTURE_TRANSFER_DEPTH] = pbox->depth;
+   dwords[VIRGL_CAPTURE_TRANSFER_OFFSET_LO] = offset;
+   dwords[VIRGL_CAPTURE_TRANSFER_OFFSET_HI] = offset >> 32;
+   dwords[VIRGL_CAPTURE_TRANSFER_DATA_SIZE] = data_size;
+
+   /* reads only need the size of the destination */
+   capture_record(write ? VIRGL_CAPTURE_TRANSFER_WRITE : VIRGL_CAPTURE_TRANSFER_READ,
+                  dwords, VIRGL_CAPTURE_TRANSFER_HDR_SIZE,
+                  iov, iov_cnt, write ? data_size : 0);
+}
+
+void virgl_capture_submit(uint32_t ctx_id, const void *buffer, int ndw)
+{
+   struct iovec iov = { (void *)buffer, ndw * 4 };
+
+   if (!capture.file || ndw < 0)
+      return;
+   capture_sync_stream(buffer, ndw);
+   if (!capture.file)
+      return;
+   capture_record(VIRGL_CAPTURE_SUBMIT, &ctx_id, 1, &iov, 1, ndw * 4);
+}
+
+void virgl_capture_fence(uint32_t fence_id, uint32_t ctx_id)
+{
+   uint32_t dwords[2] = { fence_id, ctx_id };
+
+   if (!capture.file)
+      return;
+   capture_record(VIRGL_CAPTURE_FENCE, dwords, 2, NULL, 0, 0);
+}
+
+void virgl_capture_reset(void)
+{
+   if (!capture.file)
+      return;
+   /* the resources are gone, so are their backings */
+   util_hash_table_clear(capture.backings);
+   capture_record(VIRGL_CAPTURE_RESET, NULL, 0, NULL, 0, 0);
+}
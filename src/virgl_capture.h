@@ -0,0 +1,115 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef VIRGL_CAPTURE_H
+#define VIRGL_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vrend_iov.h"
+
+struct virgl_box;
+struct virgl_renderer_resource_create_args;
+
+/* Capture of the virgl_renderer calls a client makes, replayed by
+ * virgl_test_replay. The file is a sequence of records laid out like
+ * vtest commands: payload length in dwords, record type, then the
+ * payload. Guest memory is only written out when a transfer reads from
+ * it and it changed since it was last written.
+ */
+
+#define VIRGL_CAPTURE_MAGIC 0x50414356 /* "VCAP" */
+#define VIRGL_CAPTURE_VERSION 1
+
+#define VIRGL_CAPTURE_HDR_SIZE 2
+#define VIRGL_CAPTURE_LEN 0
+#define VIRGL_CAPTURE_TYPE 1
+
+/* magic, version */
+#define VIRGL_CAPTURE_HEADER 1
+/* ctx_id, name length, name */
+#define VIRGL_CAPTURE_CTX_CREATE 2
+/* ctx_id */
+#define VIRGL_CAPTURE_CTX_DESTROY 3
+/* struct virgl_renderer_resource_create_args */
+#define VIRGL_CAPTURE_RES_CREATE 4
+/* handle */
+#define VIRGL_CAPTURE_RES_UNREF 5
+/* handle, size */
+#define VIRGL_CAPTURE_ATTACH_BACKING 6
+/* handle */
+#define VIRGL_CAPTURE_DETACH_BACKING 7
+/* handle, size, data */
+#define VIRGL_CAPTURE_BACKING_DATA 8
+/* ctx_id, handle */
+#define VIRGL_CAPTURE_CTX_ATTACH_RES 9
+#define VIRGL_CAPTURE_CTX_DETACH_RES 10
+/* transfer header, then data_size bytes for explicit iovecs on writes */
+#define VIRGL_CAPTURE_TRANSFER_WRITE 11
+#define VIRGL_CAPTURE_TRANSFER_READ 12
+/* ctx_id, command dwords */
+#define VIRGL_CAPTURE_SUBMIT 13
+/* fence_id, ctx_id */
+#define VIRGL_CAPTURE_FENCE 14
+#define VIRGL_CAPTURE_RESET 15
+
+#define VIRGL_CAPTURE_TRANSFER_HDR_SIZE 14
+#define VIRGL_CAPTURE_TRANSFER_HANDLE 0
+#define VIRGL_CAPTURE_TRANSFER_CTX_ID 1
+#define VIRGL_CAPTURE_TRANSFER_LEVEL 2
+#define VIRGL_CAPTURE_TRANSFER_STRIDE 3
+#define VIRGL_CAPTURE_TRANSFER_LAYER_STRIDE 4
+#define VIRGL_CAPTURE_TRANSFER_X 5
+#define VIRGL_CAPTURE_TRANSFER_Y 6
+#define VIRGL_CAPTURE_TRANSFER_Z 7
+#define VIRGL_CAPTURE_TRANSFER_WIDTH 8
+#define VIRGL_CAPTURE_TRANSFER_HEIGHT 9
+#define VIRGL_CAPTURE_TRANSFER_DEPTH 10
+#define VIRGL_CAPTURE_TRANSFER_OFFSET_LO 11
+#define VIRGL_CAPTURE_TRANSFER_OFFSET_HI 12
+/* 0 when the resource backing is used */
+#define VIRGL_CAPTURE_TRANSFER_DATA_SIZE 13
+
+bool virgl_capture_init(const char *path);
+void virgl_capture_fini(void);
+
+void virgl_capture_ctx_create(uint32_t ctx_id, uint32_t nlen, const char *name);
+void virgl_capture_ctx_destroy(uint32_t ctx_id);
+void virgl_capture_resource_create(const struct virgl_renderer_resource_create_args *args,
+                                   const struct iovec *iov, uint32_t num_iovs);
+void virgl_capture_resource_unref(uint32_t handle);
+void virgl_capture_attach_iov(uint32_t handle, const struct iovec *iov, int num_iovs);
+void virgl_capture_detach_iov(uint32_t handle);
+void virgl_capture_ctx_resource(uint32_t ctx_id, uint32_t handle, bool attach);
+void virgl_capture_transfer(bool write, uint32_t handle, uint32_t ctx_id,
+                            uint32_t level, uint32_t stride, uint32_t layer_stride,
+                            const struct virgl_box *box, uint64_t offset,
+                            const struct iovec *iov, unsigned int iov_cnt);
+void virgl_capture_submit(uint32_t ctx_id, const void *buffer, int ndw);
+void virgl_capture_fence(uint32_t fence_id, uint32_t ctx_id);
+void virgl_capture_reset(void);
+
+#endif
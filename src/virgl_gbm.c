@@ -41,6 +41,7 @@
 #include "virgl_gbm.h"
 #include "virgl_hw.h"
 #include "vrend_debug.h"
+#include "vrend_simd.h"
 
 struct planar_layout {
     size_t num_planes;
@@ -206,9 +207,9 @@ static void virgl_gbm_transfer_internal(uint32_t planar_bytes_per_pixel,
                                (max_start - box_start_offset);
 
          if (direction == VIRGL_TRANSFER_TO_HOST)
-            memcpy(host_start, guest_start, copy_iovec_size);
+            vrend_copy(host_start, guest_start, copy_iovec_size);
          else
-            memcpy(guest_start, host_start, copy_iovec_size);
+            vrend_copy(guest_start, host_start, copy_iovec_size);
       } else {
          if (box_start_offset >= iovec_start_offset) {
             next_iovec = true;
@@ -263,6 +263,12 @@ enum virgl_formats {
 #define VIRGL_CAP_APP_TWEAK_SUPPORT    (1 << 28)
 #define VIRGL_CAP_BGRA_SRGB_IS_EMULATED  (1 << 29)
 
+/* These are used by the capability_bits_v2 field in virgl_caps_v2.
+ * Bits are taken from the top so they stay clear of the ones allocated
+ * upstream. They are not reserved there, so the host only advertises
+ * them when asked to, see VREND_TGSI_TOKENS. */
+#define VIRGL_CAP_V2_TGSI_TOKENS       (1u << 31)
+
 /* virgl bind flags - these are compatible with mesa 10.5 gallium.
  * but are fixed, no other should be passed to virgl either.
  */
@@ -399,6 +405,7 @@ struct virgl_caps_v2 {
         uint32_t host_feature_check_version;
         struct virgl_supported_format_mask supported_readback_formats;
         struct virgl_supported_format_mask scanout;
+        uint32_t capability_bits_v2;
 };
 
 union virgl_caps {
@@ -229,6 +229,15 @@ enum virgl_context_cmd {
 #define VIRGL_OBJ_SHADER_HDR_SIZE(nso) (5 + ((nso) ? (2 * nso) + 4 : 0))
 #define VIRGL_OBJ_SHADER_HANDLE 1
 #define VIRGL_OBJ_SHADER_TYPE 2
+/* the top byte of the type selects the payload format, it must be zero
+ * unless the host advertises VIRGL_CAP_V2_TGSI_TOKENS. The formats are
+ * not reserved upstream, hosts only accept them with VREND_TGSI_TOKENS
+ * set. */
+#define VIRGL_OBJ_SHADER_TYPE_FORMAT_SHIFT 24
+#define VIRGL_OBJ_SHADER_TYPE_FORMAT(x) (((x) & 0xff) << VIRGL_OBJ_SHADER_TYPE_FORMAT_SHIFT)
+#define VIRGL_OBJ_SHADER_FORMAT_TGSI_TEXT 0
+/* payload is an array of tgsi_token */
+#define VIRGL_OBJ_SHADER_FORMAT_TGSI_TOKENS 1
 #define VIRGL_OBJ_SHADER_OFFSET 3
 #define VIRGL_OBJ_SHADER_OFFSET_VAL(x) (((x) & 0x7fffffff) << 0)
 /* start contains full length in VAL - also implies continuations */
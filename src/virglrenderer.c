@@ -23,6 +23,7 @@
  **************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include <epoxy/gl.h>
@@ -35,6 +36,8 @@
 #include "util/u_format.h"
 #include "util/u_math.h"
 #include "vrend_renderer.h"
+#include "vrend_slab.h"
+#include "virgl_capture.h"
 
 #include "virglrenderer.h"
 
@@ -60,15 +63,31 @@ static int use_context = CONTEXT_NONE;
 
 /* new API - just wrap internal API for now */
 
+/* With threaded decode transfers and context attachments are queued
+ * with the commands of their context, every other call that touches the
+ * renderer state waits for the queued commands and runs with the GL
+ * contexts bound to the calling thread.
+ */
+
 int virgl_renderer_resource_create(struct virgl_renderer_resource_create_args *args, struct iovec *iov, uint32_t num_iovs)
 {
-   return vrend_renderer_resource_create((struct vrend_renderer_resource_create_args *)args, iov, num_iovs, NULL);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_resource_create((struct vrend_renderer_resource_create_args *)args, iov, num_iovs, NULL);
+   vrend_decode_thread_release();
+   if (ret == 0)
+      virgl_capture_resource_create(args, iov, num_iovs);
+   return ret;
 }
 
 int virgl_renderer_resource_import_eglimage(struct virgl_renderer_resource_create_args *args, void *image)
 {
 #ifdef HAVE_EPOXY_EGL_H
-   return vrend_renderer_resource_create((struct vrend_renderer_resource_create_args *)args, 0, 0, image);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_resource_create((struct vrend_renderer_resource_create_args *)args, 0, 0, image);
+   vrend_decode_thread_release();
+   return ret;
 #else
    return EINVAL;
 #endif
@@ -76,39 +95,64 @@ int virgl_renderer_resource_import_eglimage(struct virgl_renderer_resource_creat
 
 void virgl_renderer_resource_set_priv(uint32_t res_handle, void *priv)
 {
+   vrend_decode_thread_acquire();
    vrend_renderer_resource_set_priv(res_handle, priv);
+   vrend_decode_thread_release();
 }
 
 void *virgl_renderer_resource_get_priv(uint32_t res_handle)
 {
-   return vrend_renderer_resource_get_priv(res_handle);
+   void *priv;
+   vrend_decode_thread_acquire();
+   priv = vrend_renderer_resource_get_priv(res_handle);
+   vrend_decode_thread_release();
+   return priv;
 }
 
 void virgl_renderer_resource_unref(uint32_t res_handle)
 {
+   virgl_capture_resource_unref(res_handle);
+   vrend_decode_thread_acquire();
    vrend_renderer_resource_unref(res_handle);
+   vrend_decode_thread_release();
+   vrend_decode_thread_forget_resource(res_handle);
 }
 
 void virgl_renderer_fill_caps(uint32_t set, uint32_t version,
                               void *caps)
 {
+   vrend_decode_thread_acquire();
    vrend_renderer_fill_caps(set, version, (union virgl_caps *)caps);
+   vrend_decode_thread_release();
 }
 
 int virgl_renderer_context_create(uint32_t handle, uint32_t nlen, const char *name)
 {
-   return vrend_renderer_context_create(handle, nlen, name);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_context_create(handle, nlen, name);
+   vrend_decode_thread_release();
+   if (ret == 0)
+      virgl_capture_ctx_create(handle, nlen, name);
+   return ret;
 }
 
 void virgl_renderer_context_destroy(uint32_t handle)
 {
+   virgl_capture_ctx_destroy(handle);
+   vrend_decode_thread_acquire();
    vrend_renderer_context_destroy(handle);
+   vrend_decode_thread_release();
+   vrend_decode_thread_forget_ctx(handle);
 }
 
 int virgl_renderer_submit_cmd(void *buffer,
                               int ctx_id,
                               int ndw)
 {
+   virgl_capture_submit(ctx_id, buffer, ndw);
+   if (vrend_decode_thread_running())
+      return vrend_decode_queue_block(ctx_id, buffer, ndw);
    return vrend_decode_block(ctx_id, buffer, ndw);
 }
 
@@ -123,6 +167,7 @@ int virgl_renderer_transfer_write_iov(uint32_t handle,
                                       unsigned int iovec_cnt)
 {
    struct vrend_transfer_info transfer_info;
+   int ret;
 
    transfer_info.handle = handle;
    transfer_info.ctx_id = ctx_id;
@@ -136,7 +181,16 @@ int virgl_renderer_transfer_write_iov(uint32_t handle,
    transfer_info.context0 = true;
    transfer_info.synchronized = false;
 
-   return vrend_renderer_transfer_iov(&transfer_info, VIRGL_TRANSFER_TO_HOST);
+   virgl_capture_transfer(true, handle, ctx_id, level, stride, layer_stride,
+                          box, offset, iovec, iovec_cnt);
+
+   if (vrend_decode_thread_running())
+      return vrend_decode_queue_transfer(&transfer_info, VIRGL_TRANSFER_TO_HOST);
+
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_transfer_iov(&transfer_info, VIRGL_TRANSFER_TO_HOST);
+   vrend_decode_thread_release();
+   return ret;
 }
 
 int virgl_renderer_transfer_read_iov(uint32_t handle, uint32_t ctx_id,
@@ -147,6 +201,7 @@ int virgl_renderer_transfer_read_iov(uint32_t handle, uint32_t ctx_id,
                                      int iovec_cnt)
 {
    struct vrend_transfer_info transfer_info;
+   int ret;
 
    transfer_info.handle = handle;
    transfer_info.ctx_id = ctx_id;
@@ -160,49 +215,89 @@ int virgl_renderer_transfer_read_iov(uint32_t handle, uint32_t ctx_id,
    transfer_info.context0 = true;
    transfer_info.synchronized = false;
 
-   return vrend_renderer_transfer_iov(&transfer_info, VIRGL_TRANSFER_FROM_HOST);
+   virgl_capture_transfer(false, handle, ctx_id, level, stride, layer_stride,
+                          box, offset, iovec, iovec_cnt);
+
+   if (vrend_decode_thread_running())
+      return vrend_decode_queue_transfer(&transfer_info, VIRGL_TRANSFER_FROM_HOST);
+
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_transfer_iov(&transfer_info, VIRGL_TRANSFER_FROM_HOST);
+   vrend_decode_thread_release();
+   return ret;
 }
 
 int virgl_renderer_resource_attach_iov(int res_handle, struct iovec *iov,
                                        int num_iovs)
 {
-   return vrend_renderer_resource_attach_iov(res_handle, iov, num_iovs);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_resource_attach_iov(res_handle, iov, num_iovs);
+   vrend_decode_thread_release();
+   if (ret == 0)
+      virgl_capture_attach_iov(res_handle, iov, num_iovs);
+   return ret;
 }
 
 void virgl_renderer_resource_detach_iov(int res_handle, struct iovec **iov_p, int *num_iovs_p)
 {
-   return vrend_renderer_resource_detach_iov(res_handle, iov_p, num_iovs_p);
+   virgl_capture_detach_iov(res_handle);
+   vrend_decode_thread_acquire();
+   vrend_renderer_resource_detach_iov(res_handle, iov_p, num_iovs_p);
+   vrend_decode_thread_release();
 }
 
 int virgl_renderer_create_fence(int client_fence_id, uint32_t ctx_id)
 {
+   virgl_capture_fence(client_fence_id, ctx_id);
+   if (vrend_decode_thread_running())
+      return vrend_decode_queue_fence(client_fence_id, ctx_id);
    return vrend_renderer_create_fence(client_fence_id, ctx_id);
 }
 
 void virgl_renderer_force_ctx_0(void)
 {
+   /* with threaded decode contexts are only bound inside of calls */
+   if (vrend_decode_thread_running())
+      return;
    vrend_renderer_force_ctx_0();
 }
 
 void virgl_renderer_ctx_attach_resource(int ctx_id, int res_handle)
 {
+   virgl_capture_ctx_resource(ctx_id, res_handle, true);
+   if (vrend_decode_thread_running()) {
+      vrend_decode_queue_ctx_resource(ctx_id, res_handle, true);
+      return;
+   }
+   vrend_decode_thread_acquire();
    vrend_renderer_attach_res_ctx(ctx_id, res_handle);
+   vrend_decode_thread_release();
 }
 
 void virgl_renderer_ctx_detach_resource(int ctx_id, int res_handle)
 {
+   virgl_capture_ctx_resource(ctx_id, res_handle, false);
+   if (vrend_decode_thread_running()) {
+      vrend_decode_queue_ctx_resource(ctx_id, res_handle, false);
+      return;
+   }
+   vrend_decode_thread_acquire();
    vrend_renderer_detach_res_ctx(ctx_id, res_handle);
+   vrend_decode_thread_release();
 }
 
 int virgl_renderer_resource_get_info(int res_handle,
                                      struct virgl_renderer_resource_info *info)
 {
    int ret;
+   vrend_decode_thread_acquire();
    ret = vrend_renderer_resource_get_info(res_handle, (struct vrend_renderer_resource_info *)info);
 #ifdef HAVE_EPOXY_EGL_H
    if (ret == 0 && use_context == CONTEXT_EGL)
-      return virgl_egl_get_fourcc_for_texture(egl, info->tex_id, info->virgl_format, &info->drm_fourcc);
+      ret = virgl_egl_get_fourcc_for_texture(egl, info->tex_id, info->virgl_format, &info->drm_fourcc);
 #endif
+   vrend_decode_thread_release();
 
    return ret;
 }
@@ -222,13 +317,17 @@ int virgl_has_gl_colorspace(void)
 void virgl_renderer_get_cap_set(uint32_t cap_set, uint32_t *max_ver,
                                 uint32_t *max_size)
 {
+   vrend_decode_thread_acquire();
    vrend_renderer_get_cap_set(cap_set, max_ver, max_size);
+   vrend_decode_thread_release();
 }
 
 void virgl_renderer_get_rect(int resource_id, struct iovec *iov, unsigned int num_iovs,
                              uint32_t offset, int x, int y, int width, int height)
 {
+   vrend_decode_thread_acquire();
    vrend_renderer_get_rect(resource_id, iov, num_iovs, offset, x, y, width, height);
+   vrend_decode_thread_release();
 }
 
 
@@ -297,17 +396,26 @@ static struct vrend_if_cbs virgl_cbs = {
 
 void *virgl_renderer_get_cursor_data(uint32_t resource_id, uint32_t *width, uint32_t *height)
 {
+   void *data;
+   vrend_decode_thread_acquire();
    vrend_renderer_force_ctx_0();
-   return vrend_renderer_get_cursor_contents(resource_id, width, height);
+   data = vrend_renderer_get_cursor_contents(resource_id, width, height);
+   vrend_decode_thread_release();
+   return data;
 }
 
 void virgl_renderer_poll(void)
 {
-   vrend_renderer_check_fences();
+   if (vrend_decode_thread_running()) {
+      vrend_renderer_deliver_fences();
+      vrend_decode_queue_poll();
+   } else
+      vrend_renderer_check_fences();
 }
 
 void virgl_renderer_cleanup(UNUSED void *cookie)
 {
+   virgl_capture_fini();
    vrend_renderer_fini();
 #ifdef HAVE_EPOXY_EGL_H
    if (use_context == CONTEXT_EGL) {
@@ -332,6 +440,9 @@ void virgl_renderer_cleanup(UNUSED void *cookie)
 int virgl_renderer_init(void *cookie, int flags, struct virgl_renderer_callbacks *cbs)
 {
    uint32_t renderer_flags = 0;
+   const char *capture_file;
+   int ret;
+
    if (!cookie || !cbs)
       return -1;
 
@@ -386,14 +497,32 @@ int virgl_renderer_init(void *cookie, int flags, struct virgl_renderer_callbacks
 
    if (flags & VIRGL_RENDERER_THREAD_SYNC)
       renderer_flags |= VREND_USE_THREAD_SYNC;
+   if (flags & VIRGL_RENDERER_THREADED_DECODE)
+      renderer_flags |= VREND_USE_THREADED_DECODE;
+   if (flags & VIRGL_RENDERER_CMD_STATS)
+      renderer_flags |= VREND_USE_CMD_STATS;
+   if (flags & VIRGL_RENDERER_ASYNC_READBACK)
+      renderer_flags |= VREND_USE_ASYNC_READBACK;
 
-   return vrend_renderer_init(&virgl_cbs, renderer_flags);
+   ret = vrend_renderer_init(&virgl_cbs, renderer_flags);
+   if (ret)
+      return ret;
+
+   /* record every call for virgl_test_replay */
+   capture_file = getenv("VIRGL_CAPTURE_FILE");
+   if (capture_file)
+      virgl_capture_init(capture_file);
+   return 0;
 }
 
 int virgl_renderer_get_fd_for_texture(uint32_t tex_id, int *fd)
 {
 #ifdef HAVE_EPOXY_EGL_H
-   return virgl_egl_get_fd_for_texture(egl, tex_id, fd);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = virgl_egl_get_fd_for_texture(egl, tex_id, fd);
+   vrend_decode_thread_release();
+   return ret;
 #else
    return -1;
 #endif
@@ -402,7 +531,11 @@ int virgl_renderer_get_fd_for_texture(uint32_t tex_id, int *fd)
 int virgl_renderer_get_fd_for_texture2(uint32_t tex_id, int *fd, int *stride, int *offset)
 {
 #ifdef HAVE_EPOXY_EGL_H
-   return virgl_egl_get_fd_for_texture2(egl, tex_id, fd, stride, offset);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = virgl_egl_get_fd_for_texture2(egl, tex_id, fd, stride, offset);
+   vrend_decode_thread_release();
+   return ret;
 #else
    return -1;
 #endif
@@ -410,7 +543,10 @@ int virgl_renderer_get_fd_for_texture2(uint32_t tex_id, int *fd, int *stride, in
 
 void virgl_renderer_reset(void)
 {
+   virgl_capture_reset();
+   vrend_decode_thread_acquire();
    vrend_renderer_reset();
+   vrend_decode_thread_release();
 }
 
 int virgl_renderer_get_poll_fd(void)
@@ -423,7 +559,39 @@ virgl_debug_callback_type virgl_set_debug_callback(virgl_debug_callback_type cb)
    return vrend_set_debug_callback(cb);
 }
 
+int virgl_renderer_get_cmd_stats(uint32_t ctx_id, uint32_t cmd,
+                                 struct virgl_renderer_cmd_stats *stats)
+{
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = vrend_decode_get_cmd_stats(ctx_id, cmd, (struct vrend_cmd_stats *)stats);
+   vrend_decode_thread_release();
+   return ret;
+}
+
+void virgl_renderer_get_upload_stats(struct virgl_renderer_upload_stats *stats)
+{
+   vrend_renderer_get_upload_stats((struct vrend_upload_stats *)stats);
+}
+
+void virgl_renderer_get_shader_stats(struct virgl_renderer_shader_stats *stats)
+{
+   vrend_renderer_get_shader_stats((struct vrend_shader_stats *)stats);
+}
+
+void virgl_renderer_get_alloc_stats(struct virgl_renderer_alloc_stats *stats)
+{
+   /* the slabs of the contexts are only touched by the decode threads */
+   vrend_decode_thread_acquire();
+   vrend_slab_get_stats((struct vrend_slab_stats *)stats);
+   vrend_decode_thread_release();
+}
+
 int virgl_renderer_execute(void *execute_args, uint32_t execute_size)
 {
-   return vrend_renderer_execute(execute_args, execute_size);
+   int ret;
+   vrend_decode_thread_acquire();
+   ret = vrend_renderer_execute(execute_args, execute_size);
+   vrend_decode_thread_release();
+   return ret;
 }
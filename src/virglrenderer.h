@@ -69,6 +69,30 @@ struct virgl_renderer_callbacks {
 #define VIRGL_RENDERER_USE_GLX (1 << 2)
 #define VIRGL_RENDERER_USE_SURFACELESS (1 << 3)
 #define VIRGL_RENDERER_USE_GLES (1 << 4)
+/*
+ * Execute command buffers on renderer threads, virgl_renderer_submit_cmd
+ * only queues them. Fences are still signalled in submission order, and
+ * write_fence is only called from virgl_renderer_poll, on the thread that
+ * calls it. With VIRGL_RENDERER_THREAD_SYNC the poll fd becomes readable
+ * when a fence retired. No GL context is current on the calling thread
+ * between calls.
+ * VREND_DECODE_THREADS sets the number of threads contexts are spread
+ * over, with more than one the create_gl_context and make_current
+ * callbacks can be called from several threads at the same time.
+ * Calls may then come from several threads too, except for init, reset
+ * and cleanup, and while capturing to VIRGL_CAPTURE_FILE. Calls that
+ * touch the renderer state run one at a time.
+ */
+#define VIRGL_RENDERER_THREADED_DECODE (1 << 5)
+/* time every command, see virgl_renderer_get_cmd_stats */
+#define VIRGL_RENDERER_CMD_STATS (1 << 6)
+/*
+ * Reads from the host into the iovecs attached to a resource are only
+ * guaranteed to have landed once a fence created after the transfer has
+ * been signalled through write_fence, instead of when the transfer call
+ * returns. Reads into caller provided iovecs are not affected.
+ */
+#define VIRGL_RENDERER_ASYNC_READBACK (1 << 7)
 
 VIRGL_EXPORT int virgl_renderer_init(void *cookie, int flags, struct virgl_renderer_callbacks *cb);
 VIRGL_EXPORT void virgl_renderer_poll(void); /* force fences */
@@ -236,4 +260,73 @@ VIRGL_EXPORT int virgl_renderer_get_poll_fd(void);
 
 VIRGL_EXPORT int virgl_renderer_execute(void *execute_args, uint32_t execute_size);
 
+/* CPU time spent decoding and executing one VIRGL_CCMD_* command type.
+ * buckets[i] counts the commands that took less than 2^i ns but at least
+ * 2^(i-1) ns, the last bucket also counts anything slower. Draws merged
+ * into one multi draw, and the index buffer sets between them, are all
+ * counted, but the merged run is timed as one DRAW_VBO.
+ */
+#define VIRGL_RENDERER_CMD_STATS_BUCKETS 32
+
+struct virgl_renderer_cmd_stats {
+   const char *name;
+   uint64_t count;
+   uint64_t total_ns;
+   uint64_t max_ns;
+   uint64_t buckets[VIRGL_RENDERER_CMD_STATS_BUCKETS];
+   /* commands dropped because they would not change any state */
+   uint64_t elided;
+};
+
+/* Needs VIRGL_RENDERER_CMD_STATS. Returns the stats for cmd in ctx_id,
+ * or summed over all contexts, including destroyed ones, if ctx_id is 0.
+ * Returns EINVAL past the last command.
+ */
+VIRGL_EXPORT int virgl_renderer_get_cmd_stats(uint32_t ctx_id, uint32_t cmd,
+                                              struct virgl_renderer_cmd_stats *stats);
+
+/* Texture uploads that were copied into the host staging ring and sourced
+ * from there, versus handed to the driver straight from guest memory.
+ * Needs VIRGL_RENDERER_CMD_STATS.
+ */
+struct virgl_renderer_upload_stats {
+   uint64_t staged_count;
+   uint64_t staged_bytes;
+   uint64_t direct_count;
+   uint64_t direct_bytes;
+};
+
+VIRGL_EXPORT void virgl_renderer_get_upload_stats(struct virgl_renderer_upload_stats *stats);
+
+/* Shader objects created since the renderer was initialized, and the
+ * variants compiled for them because they were used with state their
+ * code depends on. Needs VIRGL_RENDERER_CMD_STATS.
+ */
+struct virgl_renderer_shader_stats {
+   uint64_t selectors;
+   uint64_t variants;
+   /* shader objects that needed more than one variant */
+   uint64_t multi_variant_selectors;
+   /* most variants any one shader object had */
+   uint64_t max_variants;
+   /* draws that switched a shader object to a variant it already had */
+   uint64_t variant_switches;
+};
+
+VIRGL_EXPORT void virgl_renderer_get_shader_stats(struct virgl_renderer_shader_stats *stats);
+
+/* Objects handed out by the slab allocators since the renderer was
+ * initialized, against the pages they had to take from the heap for them,
+ * so allocs - page_allocs heap allocations were saved in elapsed_ns.
+ */
+struct virgl_renderer_alloc_stats {
+   uint64_t allocs;
+   uint64_t page_allocs;
+   /* objects currently allocated */
+   uint64_t live;
+   uint64_t elapsed_ns;
+};
+
+VIRGL_EXPORT void virgl_renderer_get_alloc_stats(struct virgl_renderer_alloc_stats *stats);
+
 #endif
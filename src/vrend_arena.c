@@ -0,0 +1,215 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os/os_thread.h"
+#include "util/u_math.h"
+
+#include "vrend_arena.h"
+
+struct vrend_arena_block {
+   struct vrend_arena_block *next;
+   size_t size;
+};
+
+#define VREND_ARENA_ALIGN(x) (((x) + 15) & ~(size_t)15)
+#define VREND_ARENA_HEADER VREND_ARENA_ALIGN(sizeof(struct vrend_arena_block))
+
+static __thread struct vrend_arena thread_arena;
+static __thread bool thread_arena_registered;
+
+/* frees the blocks of a thread's arena when the thread exits, in case it
+ * did not call vrend_arena_fini itself */
+static tss_t thread_arena_key;
+static once_flag thread_arena_once = ONCE_FLAG_INIT;
+
+static void vrend_arena_thread_exit(void *arena)
+{
+   vrend_arena_fini(arena);
+}
+
+static void vrend_arena_create_key(void)
+{
+   tss_create(&thread_arena_key, vrend_arena_thread_exit);
+}
+
+void vrend_arena_init(struct vrend_arena *arena)
+{
+   memset(arena, 0, sizeof(*arena));
+}
+
+static void vrend_arena_free_blocks(struct vrend_arena_block *block)
+{
+   while (block) {
+      struct vrend_arena_block *next = block->next;
+      free(block);
+      block = next;
+   }
+}
+
+void vrend_arena_fini(struct vrend_arena *arena)
+{
+   vrend_arena_free_blocks(arena->blocks);
+   arena->blocks = NULL;
+   arena->used = 0;
+   arena->total = 0;
+   arena->peak = 0;
+}
+
+static bool vrend_arena_add_block(struct vrend_arena *arena, size_t size)
+{
+   struct vrend_arena_block *block;
+
+   block = malloc(VREND_ARENA_HEADER + size);
+   if (!block)
+      return false;
+
+   block->size = size;
+   block->next = arena->blocks;
+   arena->blocks = block;
+
+   if (arena == &thread_arena && !thread_arena_registered) {
+      call_once(&thread_arena_once, vrend_arena_create_key);
+      tss_set(thread_arena_key, arena);
+      thread_arena_registered = true;
+   }
+   arena->used = 0;
+   arena->num_block_allocs++;
+   return true;
+}
+
+static void vrend_arena_reset(struct vrend_arena *arena)
+{
+   struct vrend_arena_block *block = arena->blocks;
+   size_t keep;
+
+   /* one block that would have held everything, so the next scope doing
+    * the same work does not have to grow, inner scopes may already have
+    * returned the blocks they needed */
+   keep = MIN2(arena->peak, VREND_ARENA_MAX_KEEP);
+   keep = util_next_power_of_two(MAX2(keep, VREND_ARENA_MIN_BLOCK));
+
+   if (arena->peak && (!block || block->next || block->size < keep ||
+                       block->size > VREND_ARENA_MAX_KEEP)) {
+      vrend_arena_free_blocks(block);
+      arena->blocks = NULL;
+      vrend_arena_add_block(arena, keep);
+   }
+
+   arena->used = 0;
+   arena->total = 0;
+   arena->peak = 0;
+}
+
+/* releases everything allocated since the mark, blocks added after it go
+ * back to the heap */
+static void vrend_arena_rewind(struct vrend_arena *arena,
+                               const struct vrend_arena_mark *mark)
+{
+   while (arena->blocks != mark->block) {
+      struct vrend_arena_block *block = arena->blocks;
+
+      arena->blocks = block->next;
+      free(block);
+   }
+
+   arena->used = mark->used;
+   arena->total = mark->total;
+}
+
+void vrend_arena_begin(struct vrend_arena *arena)
+{
+   assert(arena->depth < VREND_ARENA_MAX_DEPTH);
+   if (arena->depth < VREND_ARENA_MAX_DEPTH) {
+      struct vrend_arena_mark *mark = &arena->marks[arena->depth];
+
+      mark->block = arena->blocks;
+      mark->used = arena->used;
+      mark->total = arena->total;
+   }
+   arena->depth++;
+}
+
+void vrend_arena_end(struct vrend_arena *arena)
+{
+   assert(arena->depth);
+   if (!arena->depth)
+      return;
+
+   arena->depth--;
+   if (!arena->depth)
+      vrend_arena_reset(arena);
+   else if (arena->depth < VREND_ARENA_MAX_DEPTH)
+      vrend_arena_rewind(arena, &arena->marks[arena->depth]);
+}
+
+void *vrend_arena_alloc(struct vrend_arena *arena, size_t size)
+{
+   struct vrend_arena_block *block;
+   void *ptr;
+
+   assert(arena->depth);
+
+   if (size > SIZE_MAX - VREND_ARENA_HEADER - 15)
+      return NULL;
+   size = VREND_ARENA_ALIGN(size ? size : 1);
+
+   block = arena->blocks;
+   if (!block || arena->used + size > block->size) {
+      size_t block_size = block ? block->size * 2 : VREND_ARENA_MIN_BLOCK;
+
+      if (!vrend_arena_add_block(arena, MAX2(block_size, size)))
+         return NULL;
+      block = arena->blocks;
+   }
+
+   ptr = (char *)block + VREND_ARENA_HEADER + arena->used;
+   arena->used += size;
+   arena->total += size;
+   arena->peak = MAX2(arena->peak, arena->total);
+   arena->high_water = MAX2(arena->high_water, arena->total);
+   return ptr;
+}
+
+void *vrend_arena_calloc(struct vrend_arena *arena, size_t count, size_t size)
+{
+   void *ptr;
+
+   if (size && count > SIZE_MAX / size)
+      return NULL;
+
+   ptr = vrend_arena_alloc(arena, count * size);
+   if (ptr)
+      memset(ptr, 0, count * size);
+   return ptr;
+}
+
+struct vrend_arena *vrend_arena_thread(void)
+{
+   return &thread_arena;
+}
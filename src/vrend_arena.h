@@ -0,0 +1,97 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef VREND_ARENA_H
+#define VREND_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bump allocator for temporaries that only live while one command buffer
+ * or one renderer call is processed.
+ *
+ * Every allocation has to be made inside a vrend_arena_begin/vrend_arena_end
+ * scope and stays valid until that scope ends. Scopes nest: the end of an
+ * inner scope releases what was allocated in it, blocks it had to add
+ * included, and leaves the allocations of the outer scopes alone. So a
+ * command opening its own scope for a big temporary does not make the
+ * temporaries of all following commands pile up.
+ *
+ * Memory comes from large blocks and is never freed on its own. When the
+ * outermost scope ends the memory is kept for the next one: once a scope
+ * needed more than one block, they are replaced by a single block big
+ * enough for the most it held at once, so repeating the same work makes no
+ * heap allocations. Only up to VREND_ARENA_MAX_KEEP bytes are kept, larger
+ * temporaries still go to the heap every time.
+ */
+
+#define VREND_ARENA_MIN_BLOCK (64 * 1024)
+#define VREND_ARENA_MAX_KEEP (4 * 1024 * 1024)
+/* deeper scopes do not release anything until an outer one ends */
+#define VREND_ARENA_MAX_DEPTH 8
+
+struct vrend_arena_block;
+
+/* where a scope started allocating */
+struct vrend_arena_mark {
+   struct vrend_arena_block *block;
+   size_t used;
+   size_t total;
+};
+
+struct vrend_arena {
+   /* the block allocations come from is first */
+   struct vrend_arena_block *blocks;
+   size_t used;
+   /* bytes handed out and not yet released since the last reset */
+   size_t total;
+   /* most bytes held at once since the last reset */
+   size_t peak;
+   /* most bytes ever held at once, for testing */
+   size_t high_water;
+   unsigned depth;
+   struct vrend_arena_mark marks[VREND_ARENA_MAX_DEPTH];
+   /* blocks taken from the heap, for testing */
+   uint64_t num_block_allocs;
+};
+
+void vrend_arena_init(struct vrend_arena *arena);
+
+void vrend_arena_fini(struct vrend_arena *arena);
+
+void vrend_arena_begin(struct vrend_arena *arena);
+
+void vrend_arena_end(struct vrend_arena *arena);
+
+/* 16 byte aligned, NULL if out of memory, only valid inside a scope */
+void *vrend_arena_alloc(struct vrend_arena *arena, size_t size);
+
+void *vrend_arena_calloc(struct vrend_arena *arena, size_t count, size_t size);
+
+/* the arena of the calling thread */
+struct vrend_arena *vrend_arena_thread(void);
+
+#endif
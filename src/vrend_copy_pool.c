@@ -0,0 +1,254 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "os/os_misc.h"
+#include "os/os_thread.h"
+#include "util/u_math.h"
+
+#include "vrend_copy_pool.h"
+
+/* Parts are split where the destination is aligned to a huge page, so
+ * that on hosts with transparent huge pages each page of a range is only
+ * written by a single thread and gets first touched on that thread's
+ * node. Copies are not split below this size either.
+ */
+#define VREND_COPY_POOL_CHUNK (2 * 1024 * 1024)
+
+static struct {
+   bool active;
+   size_t min_size;
+   int num_threads;
+   pipe_thread threads[VREND_COPY_POOL_MAX_THREADS];
+
+   pipe_mutex mutex;
+   pipe_condvar work_cond;
+   pipe_condvar done_cond;
+   bool stop;
+   unsigned generation;
+
+   /* set while a thread owns the current copy */
+   bool busy;
+
+   /* the current copy, protected by mutex */
+   const struct vrend_copy_range *ranges;
+   unsigned num_ranges;
+   vrend_copy_func copy;
+   /* part i covers bytes bounds[i] to bounds[i + 1] of the ranges */
+   size_t bounds[VREND_COPY_POOL_MAX_THREADS + 2];
+   unsigned num_parts;
+   unsigned next_part;
+   unsigned parts_done;
+} pool;
+
+static void vrend_copy_pool_copy_part(unsigned part)
+{
+   size_t begin = pool.bounds[part];
+   size_t end = pool.bounds[part + 1];
+   size_t pos = 0;
+   unsigned i;
+
+   for (i = 0; i < pool.num_ranges && pos < end; i++) {
+      const struct vrend_copy_range *range = &pool.ranges[i];
+      size_t range_begin = MAX2(begin, pos);
+      size_t range_end = MIN2(end, pos + range->size);
+
+      if (range_begin < range_end)
+         pool.copy((char *)range->dst + (range_begin - pos),
+                   (const char *)range->src + (range_begin - pos),
+                   range_end - range_begin);
+      pos += range->size;
+   }
+}
+
+/* copies parts of the current copy until none are left, the mutex is held
+ * on entry and on return */
+static void vrend_copy_pool_run_parts(void)
+{
+   while (pool.next_part < pool.num_parts) {
+      unsigned part = pool.next_part++;
+
+      pipe_mutex_unlock(pool.mutex);
+      vrend_copy_pool_copy_part(part);
+      pipe_mutex_lock(pool.mutex);
+
+      if (++pool.parts_done == pool.num_parts)
+         pipe_condvar_signal(pool.done_cond);
+   }
+}
+
+/* moves a split point forward to where the destination of the range it
+ * falls in is aligned to a chunk, or to the end of that range */
+static size_t vrend_copy_pool_align_split(const struct vrend_copy_range *ranges,
+                                          unsigned num_ranges, size_t split)
+{
+   size_t pos = 0;
+   unsigned i;
+
+   for (i = 0; i < num_ranges; i++) {
+      if (split < pos + ranges[i].size) {
+         uintptr_t dst = (uintptr_t)ranges[i].dst + (split - pos);
+         uintptr_t aligned = (dst + VREND_COPY_POOL_CHUNK - 1) &
+                             ~(uintptr_t)(VREND_COPY_POOL_CHUNK - 1);
+
+         return MIN2(split + (aligned - dst), pos + ranges[i].size);
+      }
+      pos += ranges[i].size;
+   }
+   return pos;
+}
+
+static int vrend_copy_pool_thread(UNUSED void *arg)
+{
+   unsigned generation = 0;
+
+   pipe_mutex_lock(pool.mutex);
+   while (true) {
+      while (!pool.stop && pool.generation == generation)
+         pipe_condvar_wait(pool.work_cond, pool.mutex);
+      if (pool.stop)
+         break;
+
+      generation = pool.generation;
+      vrend_copy_pool_run_parts();
+   }
+   pipe_mutex_unlock(pool.mutex);
+   return 0;
+}
+
+void vrend_copy_pool_init(int num_threads, size_t min_size)
+{
+   int i;
+
+   if (pool.active || num_threads <= 0)
+      return;
+   if (num_threads > VREND_COPY_POOL_MAX_THREADS)
+      num_threads = VREND_COPY_POOL_MAX_THREADS;
+
+   pool.stop = false;
+   pool.busy = false;
+   pool.generation = 0;
+   pool.num_threads = 0;
+   pool.min_size = MAX2(min_size, VREND_COPY_POOL_CHUNK * 2);
+   pipe_mutex_init(pool.mutex);
+   pipe_condvar_init(pool.work_cond);
+   pipe_condvar_init(pool.done_cond);
+
+   for (i = 0; i < num_threads; i++) {
+      pool.threads[i] = pipe_thread_create(vrend_copy_pool_thread, NULL);
+      if (!pool.threads[i])
+         break;
+      pool.num_threads++;
+   }
+
+   pool.active = true;
+   if (!pool.num_threads)
+      vrend_copy_pool_fini();
+}
+
+void vrend_copy_pool_fini(void)
+{
+   int i;
+
+   if (!pool.active)
+      return;
+
+   pipe_mutex_lock(pool.mutex);
+   pool.stop = true;
+   pipe_condvar_broadcast(pool.work_cond);
+   pipe_mutex_unlock(pool.mutex);
+
+   for (i = 0; i < pool.num_threads; i++)
+      pipe_thread_wait(pool.threads[i]);
+   pool.num_threads = 0;
+
+   pipe_condvar_destroy(pool.work_cond);
+   pipe_condvar_destroy(pool.done_cond);
+   pipe_mutex_destroy(pool.mutex);
+   pool.active = false;
+}
+
+int vrend_copy_pool_num_threads(void)
+{
+   return pool.active ? pool.num_threads : 0;
+}
+
+bool vrend_copy_pool_wants(size_t size)
+{
+   return pool.active && size >= pool.min_size;
+}
+
+bool vrend_copy_pool_run(const struct vrend_copy_range *ranges,
+                         unsigned num_ranges, vrend_copy_func copy)
+{
+   size_t total = 0, part_size;
+   unsigned i;
+
+   if (!pool.active)
+      return false;
+
+   pipe_mutex_lock(pool.mutex);
+
+   /* a second renderer thread copying at the same time has the cores busy
+    * already, it is better off doing the copy by itself */
+   if (pool.busy) {
+      pipe_mutex_unlock(pool.mutex);
+      return false;
+   }
+   pool.busy = true;
+
+   for (i = 0; i < num_ranges; i++)
+      total += ranges[i].size;
+
+   /* the calling thread takes parts as well */
+   part_size = (total + pool.num_threads) / (pool.num_threads + 1);
+   part_size = MAX2(part_size, VREND_COPY_POOL_CHUNK);
+
+   pool.ranges = ranges;
+   pool.num_ranges = num_ranges;
+   pool.copy = copy;
+   pool.num_parts = (total + part_size - 1) / part_size;
+   pool.bounds[0] = 0;
+   for (i = 1; i < pool.num_parts; i++)
+      pool.bounds[i] = vrend_copy_pool_align_split(ranges, num_ranges, i * part_size);
+   pool.bounds[pool.num_parts] = total;
+   pool.next_part = 0;
+   pool.parts_done = 0;
+   pool.generation++;
+   pipe_condvar_broadcast(pool.work_cond);
+
+   vrend_copy_pool_run_parts();
+   while (pool.parts_done < pool.num_parts)
+      pipe_condvar_wait(pool.done_cond, pool.mutex);
+
+   pool.ranges = NULL;
+   pool.num_ranges = 0;
+   pool.busy = false;
+   pipe_mutex_unlock(pool.mutex);
+   return true;
+}
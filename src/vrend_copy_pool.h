@@ -0,0 +1,65 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef VREND_COPY_POOL_H
+#define VREND_COPY_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A few threads that take over copies too large for one core to move
+ * while the renderer waits, e.g. a whole 4K RGBA16F texture going to or
+ * from guest memory. The ranges of a copy are treated as one stream of
+ * bytes which is cut into one contiguous part per thread, so every thread
+ * streams through its own run of pages.
+ */
+
+#define VREND_COPY_POOL_MAX_THREADS 16
+
+struct vrend_copy_range {
+   void *dst;
+   const void *src;
+   size_t size;
+};
+
+typedef void (*vrend_copy_func)(void *dst, const void *src, size_t size);
+
+/* the pool stays off if num_threads is not positive */
+void vrend_copy_pool_init(int num_threads, size_t min_size);
+
+void vrend_copy_pool_fini(void);
+
+int vrend_copy_pool_num_threads(void);
+
+/* whether a copy of size bytes should go through the pool */
+bool vrend_copy_pool_wants(size_t size);
+
+/* Copies all ranges with copy and returns true, or returns false without
+ * copying anything if the pool is off or busy with another copy.
+ */
+bool vrend_copy_pool_run(const struct vrend_copy_range *ranges,
+                         unsigned num_ranges, vrend_copy_func copy);
+
+#endif
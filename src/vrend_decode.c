@@ -21,21 +21,32 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  *
  **************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <epoxy/gl.h>
 
 #include "util/u_memory.h"
+#include "util/u_double_list.h"
+#include "util/u_atomic.h"
+#include "util/u_hash_table.h"
+#include "util/u_pointer.h"
 #include "pipe/p_defines.h"
 #include "pipe/p_state.h"
 #include "pipe/p_shader_tokens.h"
+#include "os/os_thread.h"
 #include "vrend_renderer.h"
 #include "vrend_object.h"
 #include "tgsi/tgsi_text.h"
 #include "vrend_debug.h"
 #include "vrend_tweaks.h"
+#include "vrend_arena.h"
 
 /* decode side */
 #define DECODE_MAX_TOKENS 8000
@@ -46,12 +57,131 @@ struct vrend_decoder_state {
    uint32_t buf_offset;
 };
 
+/* Last value applied for the state the guest tends to re-send between
+ * draws, as raw command dwords. A command that matches is dropped before
+ * it reaches vrend. The valid masks are cleared whenever the value vrend
+ * holds could differ from the one recorded here.
+ */
+struct vrend_decode_filter {
+   uint32_t viewport_valid;
+   uint32_t viewports[PIPE_MAX_VIEWPORTS][6];
+   uint32_t scissor_valid;
+   uint32_t scissors[PIPE_MAX_VIEWPORTS][2];
+   bool blend_color_valid;
+   uint32_t blend_color[4];
+   bool stencil_ref_valid;
+   uint32_t stencil_ref;
+   uint32_t bind_valid;
+   uint32_t binds[VIRGL_MAX_OBJECTS];
+   uint32_t views_valid;
+   struct {
+      uint32_t start_slot;
+      uint32_t num_views;
+      uint32_t handles[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   } views[PIPE_SHADER_TYPES];
+};
+
 struct vrend_decode_ctx {
    struct vrend_decoder_state ids, *ds;
    struct vrend_context *grctx;
+   /* VIRGL_MAX_COMMANDS entries, NULL unless command stats are enabled */
+   struct vrend_cmd_stats *cmd_stats;
+   /* NULL unless the state filter is enabled */
+   struct vrend_decode_filter *filter;
+   /* the index buffer of the current sub context, as last set */
+   struct {
+      bool valid;
+      uint32_t handle;
+      uint32_t index_size;
+      uint32_t offset;
+   } ib;
+   /* first error of a queued command buffer or transfer, returned by the
+    * next submit or fence of the context */
+   int32_t queued_error;
 };
-#define VREND_MAX_CTX 64
-static struct vrend_decode_ctx *dec_ctx[VREND_MAX_CTX];
+
+static bool state_filter_enabled;
+static bool draw_coalescing_enabled;
+
+static struct {
+   bool enabled;
+   /* stats of the contexts that were destroyed */
+   struct vrend_cmd_stats destroyed[VIRGL_MAX_COMMANDS];
+} cmd_stats;
+
+/* Contexts are kept in a two level table indexed by id: the top level
+ * grows on demand and points to chunks of VREND_CTX_CHUNK_SIZE entries,
+ * so a lookup is two loads and sparse ids only cost the chunks in use.
+ */
+#define VREND_CTX_CHUNK_SHIFT 6
+#define VREND_CTX_CHUNK_SIZE (1 << VREND_CTX_CHUNK_SHIFT)
+#define VREND_MAX_CTX (1u << 24)
+
+static struct {
+   struct vrend_decode_ctx ***chunks;
+   uint32_t num_chunks;
+} dec_ctx_table;
+
+/* With threaded decode, calls that only queue work look contexts up
+ * without holding the GL contexts, so adding and removing them, and those
+ * lookups, take this lock. */
+pipe_static_mutex(dec_ctx_mutex);
+
+static inline struct vrend_decode_ctx *vrend_decode_ctx_lookup(uint32_t ctx_id)
+{
+   uint32_t chunk = ctx_id >> VREND_CTX_CHUNK_SHIFT;
+
+   if (chunk >= dec_ctx_table.num_chunks || !dec_ctx_table.chunks[chunk])
+      return NULL;
+   return dec_ctx_table.chunks[chunk][ctx_id & (VREND_CTX_CHUNK_SIZE - 1)];
+}
+
+static bool vrend_decode_ctx_set(uint32_t ctx_id, struct vrend_decode_ctx *dctx)
+{
+   uint32_t chunk = ctx_id >> VREND_CTX_CHUNK_SHIFT;
+
+   if (ctx_id >= VREND_MAX_CTX)
+      return false;
+
+   if (chunk >= dec_ctx_table.num_chunks) {
+      uint32_t num_chunks = MAX2(dec_ctx_table.num_chunks * 2, 4);
+      struct vrend_decode_ctx ***chunks;
+
+      if (!dctx)
+         return true;
+
+      while (num_chunks <= chunk)
+         num_chunks *= 2;
+      chunks = realloc(dec_ctx_table.chunks, num_chunks * sizeof(*chunks));
+      if (!chunks)
+         return false;
+      memset(chunks + dec_ctx_table.num_chunks, 0,
+             (num_chunks - dec_ctx_table.num_chunks) * sizeof(*chunks));
+      dec_ctx_table.chunks = chunks;
+      dec_ctx_table.num_chunks = num_chunks;
+   }
+
+   if (!dec_ctx_table.chunks[chunk]) {
+      if (!dctx)
+         return true;
+      dec_ctx_table.chunks[chunk] = calloc(VREND_CTX_CHUNK_SIZE,
+                                           sizeof(struct vrend_decode_ctx *));
+      if (!dec_ctx_table.chunks[chunk])
+         return false;
+   }
+
+   dec_ctx_table.chunks[chunk][ctx_id & (VREND_CTX_CHUNK_SIZE - 1)] = dctx;
+   return true;
+}
+
+static void vrend_decode_ctx_table_fini(void)
+{
+   for (uint32_t i = 0; i < dec_ctx_table.num_chunks; i++)
+      free(dec_ctx_table.chunks[i]);
+   free(dec_ctx_table.chunks);
+   dec_ctx_table.chunks = NULL;
+   dec_ctx_table.num_chunks = 0;
+}
 
 static inline uint32_t get_buf_entry(struct vrend_decode_ctx *ctx, uint32_t offset)
 {
@@ -74,12 +204,16 @@ static int vrend_decode_create_shader(struct vrend_decode_ctx *ctx,
    uint32_t shader_offset, req_local_mem = 0;
    unsigned num_tokens, num_so_outputs, offlen;
    uint8_t *shd_text;
-   uint32_t type;
+   uint32_t type, format;
 
    if (length < VIRGL_OBJ_SHADER_HDR_SIZE(0))
       return EINVAL;
 
    type = get_buf_entry(ctx, VIRGL_OBJ_SHADER_TYPE);
+   format = type >> VIRGL_OBJ_SHADER_TYPE_FORMAT_SHIFT;
+   type &= (1u << VIRGL_OBJ_SHADER_TYPE_FORMAT_SHIFT) - 1;
+   if (format > VIRGL_OBJ_SHADER_FORMAT_TGSI_TOKENS)
+      return EINVAL;
    num_tokens = get_buf_entry(ctx, VIRGL_OBJ_SHADER_NUM_TOKENS);
    offlen = get_buf_entry(ctx, VIRGL_OBJ_SHADER_OFFSET);
 
@@ -126,7 +260,8 @@ static int vrend_decode_create_shader(struct vrend_decode_ctx *ctx,
      memset(&so_info, 0, sizeof(so_info));
 
    shd_text = get_buf_ptr(ctx, shader_offset);
-   ret = vrend_create_shader(ctx->grctx, handle, &so_info, req_local_mem, (const char *)shd_text, offlen, num_tokens, type, length - shader_offset + 1);
+   ret = vrend_create_shader(ctx->grctx, handle, &so_info, req_local_mem, (const char *)shd_text, offlen, num_tokens, type, length - shader_offset + 1,
+                             format == VIRGL_OBJ_SHADER_FORMAT_TGSI_TOKENS);
 
    return ret;
 }
@@ -249,10 +384,12 @@ static int vrend_decode_set_index_buffer(struct vrend_decode_ctx *ctx, int lengt
 {
    if (length != 1 && length != 3)
       return EINVAL;
-   vrend_set_index_buffer(ctx->grctx,
-                          get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_HANDLE),
-                          (length == 3) ? get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_INDEX_SIZE) : 0,
-                          (length == 3) ? get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_OFFSET) : 0);
+
+   ctx->ib.valid = true;
+   ctx->ib.handle = get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_HANDLE);
+   ctx->ib.index_size = (length == 3) ? get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_INDEX_SIZE) : 0;
+   ctx->ib.offset = (length == 3) ? get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_OFFSET) : 0;
+   vrend_set_index_buffer(ctx->grctx, ctx->ib.handle, ctx->ib.index_size, ctx->ib.offset);
    return 0;
 }
 
@@ -392,47 +529,181 @@ static int vrend_decode_resource_inline_write(struct vrend_decode_ctx *ctx, uint
    return vrend_transfer_inline_write(ctx->grctx, &info);
 }
 
-static int vrend_decode_draw_vbo(struct vrend_decode_ctx *ctx, int length)
+static int vrend_decode_draw_info(struct vrend_decode_ctx *ctx, int length,
+                                  struct pipe_draw_info *info, uint32_t *cso,
+                                  uint32_t *handle, uint32_t *indirect_draw_count_handle)
 {
-   struct pipe_draw_info info;
-   uint32_t cso;
-   uint32_t handle = 0, indirect_draw_count_handle = 0;
    if (length != VIRGL_DRAW_VBO_SIZE && length != VIRGL_DRAW_VBO_SIZE_TESS &&
        length != VIRGL_DRAW_VBO_SIZE_INDIRECT)
       return EINVAL;
-   memset(&info, 0, sizeof(struct pipe_draw_info));
-
-   info.start = get_buf_entry(ctx, VIRGL_DRAW_VBO_START);
-   info.count = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT);
-   info.mode = get_buf_entry(ctx, VIRGL_DRAW_VBO_MODE);
-   info.indexed = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEXED);
-   info.instance_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INSTANCE_COUNT);
-   info.index_bias = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEX_BIAS);
-   info.start_instance = get_buf_entry(ctx, VIRGL_DRAW_VBO_START_INSTANCE);
-   info.primitive_restart = get_buf_entry(ctx, VIRGL_DRAW_VBO_PRIMITIVE_RESTART);
-   info.restart_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_RESTART_INDEX);
-   info.min_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MIN_INDEX);
-   info.max_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MAX_INDEX);
+   memset(info, 0, sizeof(struct pipe_draw_info));
+   *handle = 0;
+   *indirect_draw_count_handle = 0;
+
+   info->start = get_buf_entry(ctx, VIRGL_DRAW_VBO_START);
+   info->count = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT);
+   info->mode = get_buf_entry(ctx, VIRGL_DRAW_VBO_MODE);
+   info->indexed = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEXED);
+   info->instance_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INSTANCE_COUNT);
+   info->index_bias = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDEX_BIAS);
+   info->start_instance = get_buf_entry(ctx, VIRGL_DRAW_VBO_START_INSTANCE);
+   info->primitive_restart = get_buf_entry(ctx, VIRGL_DRAW_VBO_PRIMITIVE_RESTART);
+   info->restart_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_RESTART_INDEX);
+   info->min_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MIN_INDEX);
+   info->max_index = get_buf_entry(ctx, VIRGL_DRAW_VBO_MAX_INDEX);
 
    if (length >= VIRGL_DRAW_VBO_SIZE_TESS) {
-      info.vertices_per_patch = get_buf_entry(ctx, VIRGL_DRAW_VBO_VERTICES_PER_PATCH);
-      info.drawid = get_buf_entry(ctx, VIRGL_DRAW_VBO_DRAWID);
+      info->vertices_per_patch = get_buf_entry(ctx, VIRGL_DRAW_VBO_VERTICES_PER_PATCH);
+      info->drawid = get_buf_entry(ctx, VIRGL_DRAW_VBO_DRAWID);
    }
 
    if (length == VIRGL_DRAW_VBO_SIZE_INDIRECT) {
-      handle = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_HANDLE);
-      info.indirect.offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_OFFSET);
-      info.indirect.stride = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_STRIDE);
-      info.indirect.draw_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT);
-      info.indirect.indirect_draw_count_offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_OFFSET);
-      indirect_draw_count_handle = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_HANDLE);
+      *handle = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_HANDLE);
+      info->indirect.offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_OFFSET);
+      info->indirect.stride = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_STRIDE);
+      info->indirect.draw_count = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT);
+      info->indirect.indirect_draw_count_offset = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_OFFSET);
+      *indirect_draw_count_handle = get_buf_entry(ctx, VIRGL_DRAW_VBO_INDIRECT_DRAW_COUNT_HANDLE);
    }
 
-   cso = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT_FROM_SO);
+   *cso = get_buf_entry(ctx, VIRGL_DRAW_VBO_COUNT_FROM_SO);
+   return 0;
+}
+
+static int vrend_decode_draw_vbo(struct vrend_decode_ctx *ctx, int length)
+{
+   struct pipe_draw_info info;
+   uint32_t cso, handle, indirect_draw_count_handle;
+   int ret;
+
+   ret = vrend_decode_draw_info(ctx, length, &info, &cso, &handle,
+                                &indirect_draw_count_handle);
+   if (ret)
+      return ret;
 
    return vrend_draw_vbo(ctx->grctx, &info, cso, handle, indirect_draw_count_handle);
 }
 
+/* a draw that can be merged with others: no instancing, indirection or
+ * stream output count */
+static bool vrend_decode_draw_is_plain(int length, const struct pipe_draw_info *info,
+                                       uint32_t cso)
+{
+   return length != VIRGL_DRAW_VBO_SIZE_INDIRECT && !cso &&
+          info->instance_count <= 1 && !info->start_instance;
+}
+
+/* the draw id the guest gave is part of the draw, so only draws that
+ * agree on it are merged */
+static bool vrend_decode_draws_compatible(const struct pipe_draw_info *a,
+                                          const struct pipe_draw_info *b)
+{
+   return a->mode == b->mode &&
+          a->indexed == b->indexed &&
+          a->instance_count == b->instance_count &&
+          a->primitive_restart == b->primitive_restart &&
+          a->restart_index == b->restart_index &&
+          a->vertices_per_patch == b->vertices_per_patch &&
+          a->drawid == b->drawid;
+}
+
+/* Look ahead from the DRAW_VBO at the current offset for draws that only
+ * differ in their range, and submit them together. Index buffer updates
+ * that only move the offset may sit between indexed draws. On return the
+ * offset and *length describe the last command that was consumed, and
+ * *num_draws how many draws were submitted.
+ */
+static int vrend_decode_draw_vbo_run(struct vrend_decode_ctx *ctx, uint32_t *length,
+                                     uint32_t *num_draws, uint32_t *num_ib_sets)
+{
+   struct vrend_draw_range draws[VREND_MAX_DRAW_RANGES];
+   struct pipe_draw_info info, next;
+   uint32_t cso, handle, indirect_draw_count_handle;
+   uint32_t pos, end, last_len, ib_offset, last_ib_offset;
+   uint32_t start_offset = ctx->ds->buf_offset;
+   uint32_t n = 0, n_ib = 0, last_n_ib = 0;
+   int ret;
+
+   *num_draws = 1;
+   *num_ib_sets = 0;
+   ret = vrend_decode_draw_info(ctx, *length, &info, &cso, &handle,
+                                &indirect_draw_count_handle);
+   if (ret)
+      return ret;
+
+   if (!vrend_decode_draw_is_plain(*length, &info, cso) ||
+       (info.indexed && !ctx->ib.valid))
+      return vrend_draw_vbo(ctx->grctx, &info, cso, handle, indirect_draw_count_handle);
+
+   ib_offset = last_ib_offset = ctx->ib.offset;
+   end = start_offset;
+   last_len = *length;
+   pos = start_offset;
+   while (pos < ctx->ds->buf_total && n < VREND_MAX_DRAW_RANGES) {
+      uint32_t header = ctx->ds->buf[pos];
+      uint32_t len = header >> 16;
+
+      if (pos + len + 1 > ctx->ds->buf_total)
+         break;
+
+      ctx->ds->buf_offset = pos;
+      if ((header & 0xff) == VIRGL_CCMD_SET_INDEX_BUFFER) {
+         if (!info.indexed || len != 3 ||
+             get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_HANDLE) != ctx->ib.handle ||
+             get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_INDEX_SIZE) != ctx->ib.index_size)
+            break;
+         ib_offset = get_buf_entry(ctx, VIRGL_SET_INDEX_BUFFER_OFFSET);
+         n_ib++;
+      } else if ((header & 0xff) == VIRGL_CCMD_DRAW_VBO) {
+         if (vrend_decode_draw_info(ctx, len, &next, &cso, &handle,
+                                    &indirect_draw_count_handle) ||
+             !vrend_decode_draw_is_plain(len, &next, cso) ||
+             !vrend_decode_draws_compatible(&info, &next))
+            break;
+         draws[n].start = next.start;
+         draws[n].count = next.count;
+         draws[n].index_bias = next.index_bias;
+         draws[n].index_offset = ib_offset;
+         draws[n].min_index = next.min_index;
+         draws[n].max_index = next.max_index;
+         n++;
+         end = pos;
+         last_len = len;
+         last_ib_offset = ib_offset;
+         last_n_ib = n_ib;
+      } else {
+         break;
+      }
+      pos += len + 1;
+   }
+
+   if (n < 2) {
+      ctx->ds->buf_offset = start_offset;
+      return vrend_draw_vbo(ctx->grctx, &info, 0, 0, 0);
+   }
+
+   /* the merged draw covers the indices of all of them */
+   for (uint32_t i = 1; i < n; i++) {
+      info.min_index = MIN2(info.min_index, draws[i].min_index);
+      info.max_index = MAX2(info.max_index, draws[i].max_index);
+   }
+
+   ret = vrend_draw_vbo_ranges(ctx->grctx, &info, draws, n);
+
+   /* leave vrend with the index buffer offset of the last merged draw */
+   if (info.indexed && last_ib_offset != ctx->ib.offset) {
+      vrend_set_index_buffer(ctx->grctx, ctx->ib.handle, ctx->ib.index_size,
+                             last_ib_offset);
+      ctx->ib.offset = last_ib_offset;
+   }
+
+   ctx->ds->buf_offset = end;
+   *length = last_len;
+   *num_draws = n;
+   *num_ib_sets = last_n_ib;
+   return ret;
+}
+
 static int vrend_decode_create_blend(struct vrend_decode_ctx *ctx, uint32_t handle, uint16_t length)
 {
    struct pipe_blend_state *blend_state;
@@ -670,7 +941,8 @@ static int vrend_decode_create_ve(struct vrend_decode_ctx *ctx, uint32_t handle,
    num_elements = (length - 1) / 4;
 
    if (num_elements) {
-      ve = calloc(num_elements, sizeof(struct pipe_vertex_element));
+      ve = vrend_arena_calloc(vrend_arena_thread(), num_elements,
+                              sizeof(struct pipe_vertex_element));
 
       if (!ve)
          return ENOMEM;
@@ -680,10 +952,8 @@ static int vrend_decode_create_ve(struct vrend_decode_ctx *ctx, uint32_t handle,
          ve[i].instance_divisor = get_buf_entry(ctx, VIRGL_OBJ_VERTEX_ELEMENTS_V0_INSTANCE_DIVISOR(i));
          ve[i].vertex_buffer_index = get_buf_entry(ctx, VIRGL_OBJ_VERTEX_ELEMENTS_V0_VERTEX_BUFFER_INDEX(i));
 
-         if (ve[i].vertex_buffer_index >= PIPE_MAX_ATTRIBS) {
-            FREE(ve);
+         if (ve[i].vertex_buffer_index >= PIPE_MAX_ATTRIBS)
             return EINVAL;
-         }
 
          ve[i].src_format = get_buf_entry(ctx, VIRGL_OBJ_VERTEX_ELEMENTS_V0_SRC_FORMAT(i));
       }
@@ -691,7 +961,6 @@ static int vrend_decode_create_ve(struct vrend_decode_ctx *ctx, uint32_t handle,
 
    ret = vrend_create_vertex_elements_state(ctx->grctx, handle, num_elements, ve);
 
-   FREE(ve);
    return ret;
 }
 
@@ -1094,6 +1363,7 @@ static int vrend_decode_set_sub_ctx(struct vrend_decode_ctx *ctx, int length)
    uint32_t ctx_sub_id = get_buf_entry(ctx, 1);
 
    vrend_renderer_set_sub_ctx(ctx->grctx, ctx_sub_id);
+   ctx->ib.valid = false;
    return 0;
 }
 
@@ -1105,6 +1375,7 @@ static int vrend_decode_create_sub_ctx(struct vrend_decode_ctx *ctx, int length)
    uint32_t ctx_sub_id = get_buf_entry(ctx, 1);
 
    vrend_renderer_create_sub_ctx(ctx->grctx, ctx_sub_id);
+   ctx->ib.valid = false;
    return 0;
 }
 
@@ -1116,6 +1387,7 @@ static int vrend_decode_destroy_sub_ctx(struct vrend_decode_ctx *ctx, int length
    uint32_t ctx_sub_id = get_buf_entry(ctx, 1);
 
    vrend_renderer_destroy_sub_ctx(ctx->grctx, ctx_sub_id);
+   ctx->ib.valid = false;
    return 0;
 }
 
@@ -1307,7 +1579,7 @@ static int vrend_decode_set_debug_mask(struct vrend_decode_ctx *ctx, int length)
       return EINVAL;
 
    buf = get_buf_ptr(ctx, VIRGL_SET_DEBUG_FLAGSTRING_OFFSET);
-   flagstring = malloc(slen+1);
+   flagstring = vrend_arena_alloc(vrend_arena_thread(), slen+1);
 
    if (!flagstring) {
       return ENOMEM;
@@ -1317,8 +1589,6 @@ static int vrend_decode_set_debug_mask(struct vrend_decode_ctx *ctx, int length)
    flagstring[slen] = 0;
    vrend_context_set_debug_flags(ctx->grctx, flagstring);
 
-   free(flagstring);
-
    return 0;
 }
 
@@ -1380,6 +1650,227 @@ static int vrend_decode_copy_transfer3d(struct vrend_decode_ctx *ctx, int length
    return vrend_renderer_copy_transfer3d(ctx->grctx, &info, src_handle);
 }
 
+static void vrend_decode_filter_forget_handle(struct vrend_decode_filter *filter,
+                                              uint32_t handle)
+{
+   uint32_t i, s;
+
+   for (i = 0; i < VIRGL_MAX_OBJECTS; i++) {
+      if (filter->binds[i] == handle)
+         filter->bind_valid &= ~(1u << i);
+   }
+
+   for (s = 0; s < PIPE_SHADER_TYPES; s++) {
+      for (i = 0; i < filter->views[s].num_views; i++) {
+         if (filter->views[s].handles[i] == handle) {
+            filter->views_valid &= ~(1u << s);
+            break;
+         }
+      }
+   }
+}
+
+/* Returns true if the command at the current offset would not change the
+ * state vrend already has, otherwise records its value and returns false.
+ * Commands with a bad length are passed on so the decoder reports them.
+ */
+static bool vrend_decode_filter_cmd(struct vrend_decode_ctx *ctx,
+                                    uint32_t cmd, uint32_t length)
+{
+   struct vrend_decode_filter *filter = ctx->filter;
+   const uint32_t *buf = get_buf_ptr(ctx, 1);
+   uint32_t start_slot, num, mask, i;
+
+   switch (cmd) {
+   case VIRGL_CCMD_SET_VIEWPORT_STATE:
+      if (length < 1 || (length - 1) % 6)
+         return false;
+      start_slot = buf[0];
+      num = (length - 1) / 6;
+      if (num > PIPE_MAX_VIEWPORTS || start_slot > PIPE_MAX_VIEWPORTS - num)
+         return false;
+      mask = ((1ull << num) - 1) << start_slot;
+      if ((filter->viewport_valid & mask) == mask &&
+          !memcmp(filter->viewports[start_slot], buf + 1, num * 6 * 4))
+         return true;
+      memcpy(filter->viewports[start_slot], buf + 1, num * 6 * 4);
+      filter->viewport_valid |= mask;
+      return false;
+   case VIRGL_CCMD_SET_SCISSOR_STATE:
+      if (length < 1 || (length - 1) % 2)
+         return false;
+      start_slot = buf[0];
+      num = (length - 1) / 2;
+      if (num > PIPE_MAX_VIEWPORTS || start_slot > PIPE_MAX_VIEWPORTS - num)
+         return false;
+      mask = ((1ull << num) - 1) << start_slot;
+      if ((filter->scissor_valid & mask) == mask &&
+          !memcmp(filter->scissors[start_slot], buf + 1, num * 2 * 4))
+         return true;
+      memcpy(filter->scissors[start_slot], buf + 1, num * 2 * 4);
+      filter->scissor_valid |= mask;
+      return false;
+   case VIRGL_CCMD_SET_BLEND_COLOR:
+      if (length != VIRGL_SET_BLEND_COLOR_SIZE)
+         return false;
+      if (filter->blend_color_valid &&
+          !memcmp(filter->blend_color, buf, sizeof(filter->blend_color)))
+         return true;
+      memcpy(filter->blend_color, buf, sizeof(filter->blend_color));
+      filter->blend_color_valid = true;
+      return false;
+   case VIRGL_CCMD_SET_STENCIL_REF:
+      if (length != VIRGL_SET_STENCIL_REF_SIZE)
+         return false;
+      if (filter->stencil_ref_valid && filter->stencil_ref == buf[0])
+         return true;
+      filter->stencil_ref = buf[0];
+      filter->stencil_ref_valid = true;
+      return false;
+   case VIRGL_CCMD_SET_SAMPLER_VIEWS:
+      if (length < 2)
+         return false;
+      i = buf[0];
+      start_slot = buf[1];
+      num = length - 2;
+      if (i >= PIPE_SHADER_TYPES || num > PIPE_MAX_SHADER_SAMPLER_VIEWS)
+         return false;
+      if ((filter->views_valid & (1u << i)) &&
+          filter->views[i].start_slot == start_slot &&
+          filter->views[i].num_views == num &&
+          !memcmp(filter->views[i].handles, buf + 2, num * 4))
+         return true;
+      filter->views[i].start_slot = start_slot;
+      filter->views[i].num_views = num;
+      memcpy(filter->views[i].handles, buf + 2, num * 4);
+      filter->views_valid |= 1u << i;
+      return false;
+   case VIRGL_CCMD_BIND_OBJECT:
+      if (length != 1)
+         return false;
+      i = (get_buf_entry(ctx, VIRGL_OBJ_BIND_HEADER) >> 8) & 0xff;
+      if (i >= VIRGL_MAX_OBJECTS)
+         return false;
+      if ((filter->bind_valid & (1u << i)) && filter->binds[i] == buf[0])
+         return true;
+      /* the viewport depth range depends on the rasterizer clip_halfz */
+      if (i == VIRGL_OBJECT_RASTERIZER)
+         filter->viewport_valid = 0;
+      filter->binds[i] = buf[0];
+      filter->bind_valid |= 1u << i;
+      return false;
+   case VIRGL_CCMD_CREATE_OBJECT:
+   case VIRGL_CCMD_DESTROY_OBJECT:
+      /* a new object may reuse the handle of one that is recorded */
+      if (length >= 1)
+         vrend_decode_filter_forget_handle(filter, buf[0]);
+      return false;
+   case VIRGL_CCMD_SET_SUB_CTX:
+   case VIRGL_CCMD_CREATE_SUB_CTX:
+   case VIRGL_CCMD_DESTROY_SUB_CTX:
+      memset(filter, 0, sizeof(*filter));
+      return false;
+   default:
+      return false;
+   }
+}
+
+void vrend_decode_set_state_filter(bool enable)
+{
+   state_filter_enabled = enable;
+}
+
+void vrend_decode_set_draw_coalescing(bool enable)
+{
+   draw_coalescing_enabled = enable;
+}
+
+static void vrend_cmd_stats_add(struct vrend_cmd_stats *dst,
+                                const struct vrend_cmd_stats *src)
+{
+   dst->count += src->count;
+   dst->total_ns += src->total_ns;
+   dst->max_ns = MAX2(dst->max_ns, src->max_ns);
+   dst->elided += src->elided;
+   for (unsigned i = 0; i < VREND_CMD_STATS_BUCKETS; i++)
+      dst->buckets[i] += src->buckets[i];
+}
+
+static void vrend_decode_ctx_free(struct vrend_decode_ctx *dctx)
+{
+   if (dctx->cmd_stats) {
+      for (unsigned i = 0; i < VIRGL_MAX_COMMANDS; i++)
+         vrend_cmd_stats_add(&cmd_stats.destroyed[i], &dctx->cmd_stats[i]);
+      free(dctx->cmd_stats);
+   }
+   free(dctx->filter);
+   free(dctx);
+}
+
+static inline uint64_t vrend_decode_time_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void vrend_decode_record_cmd(struct vrend_cmd_stats *stats,
+                                    uint32_t cmd, uint64_t start)
+{
+   uint64_t ns = vrend_decode_time_ns() - start;
+   unsigned bucket = 0;
+
+   if (cmd >= VIRGL_MAX_COMMANDS)
+      return;
+
+   while (bucket < VREND_CMD_STATS_BUCKETS - 1 && (ns >> bucket))
+      bucket++;
+
+   stats = &stats[cmd];
+   stats->count++;
+   stats->total_ns += ns;
+   stats->max_ns = MAX2(stats->max_ns, ns);
+   stats->buckets[bucket]++;
+}
+
+void vrend_decode_set_cmd_stats(bool enable)
+{
+   cmd_stats.enabled = enable;
+}
+
+int vrend_decode_get_cmd_stats(uint32_t ctx_id, uint32_t cmd, struct vrend_cmd_stats *stats)
+{
+   struct vrend_decode_ctx *dctx;
+
+   if (!cmd_stats.enabled || cmd >= VIRGL_MAX_COMMANDS)
+      return EINVAL;
+
+   memset(stats, 0, sizeof(*stats));
+   stats->name = vrend_get_comand_name(cmd);
+
+   if (ctx_id) {
+      dctx = vrend_decode_ctx_lookup(ctx_id);
+      if (!dctx)
+         return EINVAL;
+      if (dctx->cmd_stats)
+         vrend_cmd_stats_add(stats, &dctx->cmd_stats[cmd]);
+      return 0;
+   }
+
+   vrend_cmd_stats_add(stats, &cmd_stats.destroyed[cmd]);
+   for (uint32_t c = 0; c < dec_ctx_table.num_chunks; c++) {
+      if (!dec_ctx_table.chunks[c])
+         continue;
+      for (uint32_t i = 0; i < VREND_CTX_CHUNK_SIZE; i++) {
+         dctx = dec_ctx_table.chunks[c][i];
+         if (dctx && dctx->cmd_stats)
+            vrend_cmd_stats_add(stats, &dctx->cmd_stats[cmd]);
+      }
+   }
+   return 0;
+}
+
 void vrend_renderer_context_create_internal(uint32_t handle, uint32_t nlen,
                                             const char *debug_name)
 {
@@ -1388,7 +1879,7 @@ void vrend_renderer_context_create_internal(uint32_t handle, uint32_t nlen,
    if (handle >= VREND_MAX_CTX)
       return;
 
-   dctx = dec_ctx[handle];
+   dctx = vrend_decode_ctx_lookup(handle);
    if (dctx)
       return;
 
@@ -1403,8 +1894,23 @@ void vrend_renderer_context_create_internal(uint32_t handle, uint32_t nlen,
    }
 
    dctx->ds = &dctx->ids;
-
-   dec_ctx[handle] = dctx;
+   dctx->cmd_stats = NULL;
+   if (cmd_stats.enabled)
+      dctx->cmd_stats = calloc(VIRGL_MAX_COMMANDS, sizeof(struct vrend_cmd_stats));
+   dctx->ib.valid = false;
+   dctx->queued_error = 0;
+   dctx->filter = NULL;
+   if (state_filter_enabled)
+      dctx->filter = calloc(1, sizeof(struct vrend_decode_filter));
+
+   pipe_mutex_lock(dec_ctx_mutex);
+   if (!vrend_decode_ctx_set(handle, dctx)) {
+      pipe_mutex_unlock(dec_ctx_mutex);
+      vrend_destroy_context(dctx->grctx);
+      vrend_decode_ctx_free(dctx);
+      return;
+   }
+   pipe_mutex_unlock(dec_ctx_mutex);
 }
 
 int vrend_renderer_context_create(uint32_t handle, uint32_t nlen, const char *debug_name)
@@ -1433,26 +1939,28 @@ void vrend_renderer_context_destroy(uint32_t handle)
       return;
    }
 
-   ctx = dec_ctx[handle];
+   pipe_mutex_lock(dec_ctx_mutex);
+   ctx = vrend_decode_ctx_lookup(handle);
+   if (ctx)
+      vrend_decode_ctx_set(handle, NULL);
+   pipe_mutex_unlock(dec_ctx_mutex);
    if (!ctx)
       return;
-   dec_ctx[handle] = NULL;
    ret = vrend_destroy_context(ctx->grctx);
-   free(ctx);
+   vrend_decode_ctx_free(ctx);
    /* switch to ctx 0 */
    if (ret && handle != 0)
-      vrend_hw_switch_context(dec_ctx[0]->grctx, true);
+      vrend_hw_switch_context(vrend_decode_ctx_lookup(0)->grctx, true);
 }
 
 struct vrend_context *vrend_lookup_renderer_ctx(uint32_t ctx_id)
 {
-   if (ctx_id >= VREND_MAX_CTX)
-      return NULL;
+   struct vrend_decode_ctx *dctx = vrend_decode_ctx_lookup(ctx_id);
 
-   if (dec_ctx[ctx_id] == NULL)
+   if (dctx == NULL)
       return NULL;
 
-   return dec_ctx[ctx_id]->grctx;
+   return dctx->grctx;
 }
 
 int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
@@ -1460,18 +1968,17 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
    struct vrend_decode_ctx *gdctx;
    bool bret;
    int ret;
-   if (ctx_id >= VREND_MAX_CTX)
+   gdctx = vrend_decode_ctx_lookup(ctx_id);
+   if (gdctx == NULL)
       return EINVAL;
 
-   if (dec_ctx[ctx_id] == NULL)
-      return EINVAL;
-
-   gdctx = dec_ctx[ctx_id];
-
    bret = vrend_hw_switch_context(gdctx->grctx, true);
    if (bret == false)
       return EINVAL;
 
+   /* temporaries of the commands in this block are released together */
+   vrend_arena_begin(vrend_arena_thread());
+
    gdctx->ds->buf = block;
    gdctx->ds->buf_total = ndw;
    gdctx->ds->buf_offset = 0;
@@ -1479,6 +1986,8 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
    while (gdctx->ds->buf_offset < gdctx->ds->buf_total) {
       uint32_t header = gdctx->ds->buf[gdctx->ds->buf_offset];
       uint32_t len = header >> 16;
+      uint32_t num_draws = 1, num_ib_sets = 0;
+      uint64_t start = 0;
 
       ret = 0;
       /* check if the guest is doing something bad */
@@ -1490,6 +1999,16 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
       VREND_DEBUG(dbg_cmd, gdctx->grctx,"%-4d %-20s len:%d\n",
                   gdctx->ds->buf_offset, vrend_get_comand_name(header & 0xff), len);
 
+      if (gdctx->filter && vrend_decode_filter_cmd(gdctx, header & 0xff, len)) {
+         if (gdctx->cmd_stats && (header & 0xff) < VIRGL_MAX_COMMANDS)
+            gdctx->cmd_stats[header & 0xff].elided++;
+         gdctx->ds->buf_offset += len + 1;
+         continue;
+      }
+
+      if (gdctx->cmd_stats)
+         start = vrend_decode_time_ns();
+
       switch (header & 0xff) {
       case VIRGL_CCMD_CREATE_OBJECT:
          ret = vrend_decode_create_object(gdctx, len);
@@ -1504,7 +2023,10 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
          ret = vrend_decode_clear(gdctx, len);
          break;
       case VIRGL_CCMD_DRAW_VBO:
-         ret = vrend_decode_draw_vbo(gdctx, len);
+         if (draw_coalescing_enabled)
+            ret = vrend_decode_draw_vbo_run(gdctx, &len, &num_draws, &num_ib_sets);
+         else
+            ret = vrend_decode_draw_vbo(gdctx, len);
          break;
       case VIRGL_CCMD_SET_FRAMEBUFFER_STATE:
          ret = vrend_decode_set_framebuffer_state(gdctx, len);
@@ -1633,6 +2155,17 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
          ret = EINVAL;
       }
 
+      /* a merged run of draws takes the index buffer sets in between with
+       * it, they are counted but their time goes to the draws */
+      if (gdctx->cmd_stats) {
+         vrend_decode_record_cmd(gdctx->cmd_stats, header & 0xff, start);
+         gdctx->cmd_stats[header & 0xff].count += num_draws - 1;
+         gdctx->cmd_stats[VIRGL_CCMD_SET_INDEX_BUFFER].count += num_ib_sets;
+      }
+
+      if (ret && gdctx->filter)
+         memset(gdctx->filter, 0, sizeof(*gdctx->filter));
+
       if (ret == EINVAL) {
          vrend_report_buffer_error(gdctx->grctx, header);
          goto out;
@@ -1641,32 +2174,892 @@ int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw)
          goto out;
       gdctx->ds->buf_offset += (len) + 1;
    }
-   return 0;
+   ret = 0;
  out:
+   vrend_arena_end(vrend_arena_thread());
    return ret;
 }
 
 void vrend_decode_reset(bool ctx_0_only)
 {
-   int i;
+   struct vrend_decode_ctx *dctx0 = vrend_decode_ctx_lookup(0);
 
-   vrend_hw_switch_context(dec_ctx[0]->grctx, true);
+   vrend_hw_switch_context(dctx0->grctx, true);
 
    if (ctx_0_only == false) {
-      for (i = 1; i < VREND_MAX_CTX; i++) {
-         if (!dec_ctx[i])
-            continue;
+      for (uint32_t c = 0; c < dec_ctx_table.num_chunks; c++) {
+         struct vrend_decode_ctx **chunk = dec_ctx_table.chunks[c];
 
-         if (!dec_ctx[i]->grctx)
+         if (!chunk)
             continue;
 
-         vrend_destroy_context(dec_ctx[i]->grctx);
-         free(dec_ctx[i]);
-         dec_ctx[i] = NULL;
+         for (uint32_t i = 0; i < VREND_CTX_CHUNK_SIZE; i++) {
+            if (!chunk[i] || chunk[i] == dctx0)
+               continue;
+
+            if (!chunk[i]->grctx)
+               continue;
+
+            vrend_destroy_context(chunk[i]->grctx);
+            vrend_decode_ctx_free(chunk[i]);
+            chunk[i] = NULL;
+         }
       }
    } else {
-      vrend_destroy_context(dec_ctx[0]->grctx);
-      free(dec_ctx[0]);
-      dec_ctx[0] = NULL;
+      vrend_destroy_context(dctx0->grctx);
+      vrend_decode_ctx_free(dctx0);
+      vrend_decode_ctx_table_fini();
+      memset(cmd_stats.destroyed, 0, sizeof(cmd_stats.destroyed));
    }
 }
+
+/* Threaded decode: command buffers are copied to a queue and executed
+ * by decode threads, so the submitting thread does not wait for GL.
+ * Contexts are spread over the threads by id and each thread binds the
+ * GL contexts of its own vrend contexts, so independent contexts run in
+ * parallel while the commands of one context keep their order.
+ *
+ * Fences are barriers over all threads: every thread that ran commands
+ * since the previous fence adds a sync object for them, and the first
+ * thread, which also owns context 0 and checks the fences, submits them
+ * in the order they were created.
+ *
+ * Transfers and resource attachments of a context are queued behind its
+ * commands, only transfers into or out of caller owned iovecs wait for
+ * their item to run. Any other renderer call drains the queues and
+ * borrows the GL contexts for its duration, one calling thread at a
+ * time, see vrend_decode_thread_acquire.
+ *
+ * Threads whose contexts have a resource attached in common are ordered
+ * against each other: their items end with a GL sync object, and an item
+ * of one of them waits until the other threads ran the items queued
+ * before it, then waits for their sync objects on the GPU.
+ */
+#define VREND_MAX_DECODE_THREADS 16
+
+enum vrend_decode_item_type {
+   VREND_DECODE_ITEM_CMD,
+   VREND_DECODE_ITEM_FENCE,
+   VREND_DECODE_ITEM_POLL,
+   VREND_DECODE_ITEM_TRANSFER,
+   VREND_DECODE_ITEM_ATTACH,
+   VREND_DECODE_ITEM_DETACH,
+   /* only creates a sync object for what the thread ran so far */
+   VREND_DECODE_ITEM_SIGNAL,
+};
+
+struct vrend_decode_fence {
+   struct list_head head;
+   int fence_id;
+   uint32_t ctx_id;
+   /* threads that did not reach the fence yet */
+   unsigned pending;
+   unsigned num_syncs;
+   struct vrend_fence *syncs[VREND_MAX_DECODE_THREADS];
+};
+
+/* lets a caller wait for the result of its item */
+struct vrend_decode_wait {
+   bool done;
+   int ret;
+};
+
+struct vrend_decode_item {
+   struct list_head head;
+   enum vrend_decode_item_type type;
+   uint32_t ctx_id;
+   int ndw;
+   /* position in the queue of its thread */
+   uint64_t seq;
+   /* create a sync object once the item ran */
+   bool signal;
+   /* items of the other threads to run first, 0 for none */
+   uint64_t wait_seq[VREND_MAX_DECODE_THREADS];
+   struct vrend_decode_fence *fence;
+   struct vrend_decode_wait *wait;
+   /* transfers */
+   struct vrend_transfer_info info;
+   struct pipe_box box;
+   int transfer_mode;
+   /* attachments */
+   uint32_t res_handle;
+   uint32_t buf[];
+};
+
+struct vrend_decode_worker {
+   unsigned index;
+   pipe_thread thread;
+   struct list_head queue;
+   bool busy;
+   /* commands ran since the last fence, and in which context */
+   bool dirty;
+   bool ran_ctx;
+   uint32_t last_ctx_id;
+   /* items queued and ran, and the sync object of the last signal */
+   uint64_t queued_seq;
+   uint64_t done_seq;
+   uint64_t last_signal_seq;
+   bool signal_next;
+   GLsync sync;
+};
+
+/* contexts a resource is attached to, kept under decode_thread.mutex */
+struct vrend_decode_share {
+   uint32_t num_ctx_ids;
+   uint32_t max_ctx_ids;
+   uint32_t *ctx_ids;
+   /* attached contexts per thread */
+   unsigned num_per_worker[VREND_MAX_DECODE_THREADS];
+};
+
+static struct {
+   bool running;
+   bool stop;
+   bool borrowed;
+   bool poll_queued;
+   unsigned num_workers;
+   pipe_mutex mutex;
+   pipe_condvar cond;
+   pipe_condvar idle_cond;
+   /* fences in creation order, submitted by the first thread */
+   struct list_head fences;
+   struct vrend_decode_worker workers[VREND_MAX_DECODE_THREADS];
+   /* resource handle to vrend_decode_share */
+   struct util_hash_table *shares;
+   /* resources attached on both threads */
+   unsigned num_shared[VREND_MAX_DECODE_THREADS][VREND_MAX_DECODE_THREADS];
+} decode_thread;
+
+static struct vrend_decode_worker *vrend_decode_ctx_worker(uint32_t ctx_id)
+{
+   return &decode_thread.workers[ctx_id % decode_thread.num_workers];
+}
+
+static void vrend_decode_queue_item(struct vrend_decode_worker *worker,
+                                    struct vrend_decode_item *item)
+{
+   if (worker->signal_next) {
+      item->signal = true;
+      worker->signal_next = false;
+   }
+   item->seq = ++worker->queued_seq;
+   if (item->signal)
+      worker->last_signal_seq = item->seq;
+   list_addtail(&item->head, &worker->queue);
+   pipe_condvar_broadcast(decode_thread.cond);
+}
+
+static void vrend_decode_queue_signal_locked(struct vrend_decode_worker *worker)
+{
+   struct vrend_decode_item *item = CALLOC_STRUCT(vrend_decode_item);
+
+   /* without it the next item of the thread signals */
+   if (!item) {
+      worker->signal_next = true;
+      worker->last_signal_seq = worker->queued_seq + 1;
+      return;
+   }
+
+   item->type = VREND_DECODE_ITEM_SIGNAL;
+   item->signal = true;
+   vrend_decode_queue_item(worker, item);
+}
+
+/* makes an item of the context wait for the threads it shares with */
+static void vrend_decode_order_item(struct vrend_decode_worker *worker,
+                                    struct vrend_decode_item *item)
+{
+   for (unsigned i = 0; i < decode_thread.num_workers; i++) {
+      if (i == worker->index || !decode_thread.num_shared[worker->index][i])
+         continue;
+      item->signal = true;
+      item->wait_seq[i] = decode_thread.workers[i].last_signal_seq;
+   }
+}
+
+static void vrend_decode_queue_poll_locked(void)
+{
+   struct vrend_decode_item *item;
+
+   if (decode_thread.poll_queued)
+      return;
+
+   item = CALLOC_STRUCT(vrend_decode_item);
+   if (!item)
+      return;
+
+   item->type = VREND_DECODE_ITEM_POLL;
+   decode_thread.poll_queued = true;
+   vrend_decode_queue_item(&decode_thread.workers[0], item);
+}
+
+/* Submits the fences all threads went past, must be called from the
+ * first thread or with all threads stopped.
+ */
+static void vrend_decode_submit_fences(void)
+{
+   struct vrend_decode_fence *fence;
+   struct vrend_fence *sync;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   while (!LIST_IS_EMPTY(&decode_thread.fences)) {
+      fence = LIST_ENTRY(struct vrend_decode_fence, decode_thread.fences.next, head);
+      if (fence->pending)
+         break;
+      list_del(&fence->head);
+      pipe_mutex_unlock(decode_thread.mutex);
+
+      /* nothing ran since the previous fence, it signals right away */
+      if (!fence->num_syncs) {
+         vrend_renderer_force_ctx_0();
+         sync = vrend_renderer_fence_sync(fence->fence_id, fence->ctx_id);
+         if (sync)
+            fence->syncs[fence->num_syncs++] = sync;
+      }
+      for (unsigned i = 0; i < fence->num_syncs; i++)
+         vrend_renderer_fence_submit(fence->syncs[i]);
+      free(fence);
+
+      pipe_mutex_lock(decode_thread.mutex);
+   }
+   pipe_mutex_unlock(decode_thread.mutex);
+}
+
+static void vrend_decode_run_fence(struct vrend_decode_worker *worker,
+                                   struct vrend_decode_fence *fence)
+{
+   struct vrend_fence *sync = NULL;
+
+   if (worker->dirty) {
+      struct vrend_context *ctx = vrend_lookup_renderer_ctx(worker->last_ctx_id);
+      if (ctx && vrend_hw_switch_context(ctx, true))
+         sync = vrend_renderer_fence_sync(fence->fence_id, fence->ctx_id);
+      worker->dirty = false;
+   }
+
+   pipe_mutex_lock(decode_thread.mutex);
+   if (sync)
+      fence->syncs[fence->num_syncs++] = sync;
+   if (--fence->pending == 0 && worker->index != 0)
+      vrend_decode_queue_poll_locked();
+   pipe_mutex_unlock(decode_thread.mutex);
+}
+
+static int vrend_decode_run_transfer(struct vrend_decode_item *item)
+{
+   struct vrend_context *ctx;
+
+   /* context 0 belongs to the first thread, the other contexts transfer
+    * with their own GL context */
+   if (item->ctx_id) {
+      ctx = vrend_lookup_renderer_ctx(item->ctx_id);
+      if (!ctx || !vrend_hw_switch_context(ctx, true))
+         return EINVAL;
+      item->info.context0 = false;
+   } else {
+      item->info.context0 = true;
+   }
+
+   item->info.box = &item->box;
+   return vrend_renderer_transfer_iov(&item->info, item->transfer_mode);
+}
+
+static void vrend_decode_set_queued_error(uint32_t ctx_id, int ret)
+{
+   struct vrend_decode_ctx *dctx = vrend_decode_ctx_lookup(ctx_id);
+
+   if (dctx)
+      p_atomic_cmpxchg(&dctx->queued_error, 0, ret);
+}
+
+static void vrend_decode_wait_items(struct vrend_decode_item *item)
+{
+   struct vrend_context *ctx;
+   unsigned i;
+
+   for (i = 0; i < decode_thread.num_workers; i++) {
+      if (item->wait_seq[i])
+         break;
+   }
+   if (i == decode_thread.num_workers)
+      return;
+
+   /* the waits go into the command stream of the context */
+   ctx = vrend_lookup_renderer_ctx(item->ctx_id);
+   if (!ctx || !vrend_hw_switch_context(ctx, true))
+      return;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   for (; i < decode_thread.num_workers; i++) {
+      struct vrend_decode_worker *other = &decode_thread.workers[i];
+
+      if (!item->wait_seq[i])
+         continue;
+      while (other->done_seq < item->wait_seq[i])
+         pipe_condvar_wait(decode_thread.idle_cond, decode_thread.mutex);
+      /* the other thread only replaces its sync with the mutex held */
+      if (other->sync)
+         vrend_renderer_sync_wait(other->sync);
+   }
+   pipe_mutex_unlock(decode_thread.mutex);
+}
+
+/* the sync object covers the last context the thread ran, the others
+ * were flushed when the thread switched away from them */
+static GLsync vrend_decode_signal(struct vrend_decode_worker *worker)
+{
+   struct vrend_context *ctx;
+
+   if (!worker->ran_ctx)
+      return NULL;
+
+   ctx = vrend_lookup_renderer_ctx(worker->last_ctx_id);
+   if (!ctx || !vrend_hw_switch_context(ctx, true))
+      return NULL;
+   return vrend_renderer_sync_signal();
+}
+
+static void vrend_decode_run_item(struct vrend_decode_worker *worker,
+                                  struct vrend_decode_item *item)
+{
+   int ret = 0;
+
+   vrend_decode_wait_items(item);
+
+   switch (item->type) {
+   case VREND_DECODE_ITEM_CMD:
+      ret = vrend_decode_block(item->ctx_id, item->buf, item->ndw);
+      worker->dirty = true;
+      worker->ran_ctx = true;
+      worker->last_ctx_id = item->ctx_id;
+      break;
+   case VREND_DECODE_ITEM_FENCE:
+      vrend_decode_run_fence(worker, item->fence);
+      break;
+   case VREND_DECODE_ITEM_POLL:
+      /* fences are checked once the queue is drained */
+      break;
+   case VREND_DECODE_ITEM_TRANSFER:
+      ret = vrend_decode_run_transfer(item);
+      worker->dirty = true;
+      worker->ran_ctx = true;
+      worker->last_ctx_id = item->ctx_id;
+      break;
+   case VREND_DECODE_ITEM_ATTACH:
+      vrend_renderer_attach_res_ctx(item->ctx_id, item->res_handle);
+      break;
+   case VREND_DECODE_ITEM_DETACH:
+      vrend_renderer_detach_res_ctx(item->ctx_id, item->res_handle);
+      break;
+   case VREND_DECODE_ITEM_SIGNAL:
+      break;
+   }
+
+   if (item->wait) {
+      pipe_mutex_lock(decode_thread.mutex);
+      item->wait->ret = ret;
+      item->wait->done = true;
+      pipe_condvar_broadcast(decode_thread.idle_cond);
+      pipe_mutex_unlock(decode_thread.mutex);
+   } else if (ret) {
+      vrend_printf("failed to run queued %s for context %d: %d\n",
+                   item->type == VREND_DECODE_ITEM_CMD ? "commands" : "transfer",
+                   item->ctx_id, ret);
+      vrend_decode_set_queued_error(item->ctx_id, ret);
+   }
+}
+
+static int thread_decode(void *arg)
+{
+   struct vrend_decode_worker *worker = arg;
+   struct vrend_decode_item *item;
+   uint64_t seq;
+   GLsync sync;
+   bool signal;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   while (true) {
+      while ((LIST_IS_EMPTY(&worker->queue) && !decode_thread.stop) ||
+             decode_thread.borrowed)
+         pipe_condvar_wait(decode_thread.cond, decode_thread.mutex);
+
+      if (LIST_IS_EMPTY(&worker->queue))
+         break;
+
+      worker->busy = true;
+      while (!LIST_IS_EMPTY(&worker->queue)) {
+         item = LIST_ENTRY(struct vrend_decode_item, worker->queue.next, head);
+         list_del(&item->head);
+         if (item->type == VREND_DECODE_ITEM_POLL)
+            decode_thread.poll_queued = false;
+         pipe_mutex_unlock(decode_thread.mutex);
+
+         vrend_decode_run_item(worker, item);
+         seq = item->seq;
+         sync = item->signal ? vrend_decode_signal(worker) : NULL;
+         signal = item->signal;
+         free(item);
+
+         pipe_mutex_lock(decode_thread.mutex);
+         worker->done_seq = seq;
+         if (sync) {
+            if (worker->sync)
+               vrend_renderer_sync_delete(worker->sync);
+            worker->sync = sync;
+         }
+         if (signal)
+            pipe_condvar_broadcast(decode_thread.idle_cond);
+      }
+      pipe_mutex_unlock(decode_thread.mutex);
+
+      if (worker->index == 0) {
+         vrend_decode_submit_fences();
+         vrend_renderer_check_fences();
+      } else {
+         vrend_renderer_check_queries();
+      }
+      vrend_renderer_release_current();
+
+      pipe_mutex_lock(decode_thread.mutex);
+      worker->busy = false;
+      pipe_condvar_broadcast(decode_thread.idle_cond);
+   }
+   pipe_mutex_unlock(decode_thread.mutex);
+
+   vrend_renderer_thread_fini();
+   vrend_arena_fini(vrend_arena_thread());
+   return 0;
+}
+
+static void vrend_decode_share_destroy(void *data)
+{
+   struct vrend_decode_share *share = data;
+
+   free(share->ctx_ids);
+   free(share);
+}
+
+static void vrend_decode_share_add(struct vrend_decode_share *share, unsigned w)
+{
+   if (share->num_per_worker[w]++)
+      return;
+
+   for (unsigned i = 0; i < decode_thread.num_workers; i++) {
+      if (i == w || !share->num_per_worker[i])
+         continue;
+      /* everything the two threads ran so far goes before their next
+       * items that may use the resource */
+      if (!decode_thread.num_shared[w][i]++) {
+         vrend_decode_queue_signal_locked(&decode_thread.workers[w]);
+         vrend_decode_queue_signal_locked(&decode_thread.workers[i]);
+      }
+      decode_thread.num_shared[i][w]++;
+   }
+}
+
+static void vrend_decode_share_remove(struct vrend_decode_share *share, unsigned w)
+{
+   if (--share->num_per_worker[w])
+      return;
+
+   for (unsigned i = 0; i < decode_thread.num_workers; i++) {
+      if (i == w || !share->num_per_worker[i])
+         continue;
+      decode_thread.num_shared[w][i]--;
+      decode_thread.num_shared[i][w]--;
+   }
+}
+
+static void vrend_decode_share_attach(uint32_t ctx_id, uint32_t res_handle)
+{
+   struct vrend_decode_share *share;
+
+   share = util_hash_table_get(decode_thread.shares, intptr_to_pointer(res_handle));
+   if (!share) {
+      share = CALLOC_STRUCT(vrend_decode_share);
+      if (!share)
+         return;
+      if (util_hash_table_set(decode_thread.shares, intptr_to_pointer(res_handle),
+                              share) != PIPE_OK) {
+         FREE(share);
+         return;
+      }
+   }
+
+   for (uint32_t i = 0; i < share->num_ctx_ids; i++) {
+      if (share->ctx_ids[i] == ctx_id)
+         return;
+   }
+
+   if (share->num_ctx_ids == share->max_ctx_ids) {
+      uint32_t new_max = MAX2(share->max_ctx_ids * 2, 4);
+      uint32_t *new_ids = realloc(share->ctx_ids, new_max * sizeof(*new_ids));
+      if (!new_ids)
+         return;
+      share->ctx_ids = new_ids;
+      share->max_ctx_ids = new_max;
+   }
+   share->ctx_ids[share->num_ctx_ids++] = ctx_id;
+   vrend_decode_share_add(share, vrend_decode_ctx_worker(ctx_id)->index);
+}
+
+static bool vrend_decode_share_detach(struct vrend_decode_share *share, uint32_t ctx_id)
+{
+   for (uint32_t i = 0; i < share->num_ctx_ids; i++) {
+      if (share->ctx_ids[i] != ctx_id)
+         continue;
+      share->ctx_ids[i] = share->ctx_ids[--share->num_ctx_ids];
+      vrend_decode_share_remove(share, vrend_decode_ctx_worker(ctx_id)->index);
+      return true;
+   }
+   return false;
+}
+
+static enum pipe_error vrend_decode_share_detach_cb(UNUSED void *key, void *value,
+                                                    void *data)
+{
+   vrend_decode_share_detach(value, *(uint32_t *)data);
+   return PIPE_OK;
+}
+
+/* the resource was destroyed, so it no longer orders any threads */
+void vrend_decode_thread_forget_resource(uint32_t res_handle)
+{
+   struct vrend_decode_share *share;
+
+   if (!decode_thread.running)
+      return;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   share = util_hash_table_get(decode_thread.shares, intptr_to_pointer(res_handle));
+   if (share) {
+      while (share->num_ctx_ids)
+         vrend_decode_share_detach(share, share->ctx_ids[0]);
+      util_hash_table_remove(decode_thread.shares, intptr_to_pointer(res_handle));
+   }
+   pipe_mutex_unlock(decode_thread.mutex);
+}
+
+void vrend_decode_thread_forget_ctx(uint32_t ctx_id)
+{
+   if (!decode_thread.running)
+      return;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   util_hash_table_foreach(decode_thread.shares, vrend_decode_share_detach_cb, &ctx_id);
+   pipe_mutex_unlock(decode_thread.mutex);
+}
+
+int vrend_decode_thread_start(int num_threads)
+{
+   unsigned i;
+
+   if (decode_thread.running)
+      return 0;
+
+   decode_thread.num_workers = CLAMP(num_threads, 1, VREND_MAX_DECODE_THREADS);
+   decode_thread.stop = false;
+   decode_thread.borrowed = false;
+   decode_thread.poll_queued = false;
+   list_inithead(&decode_thread.fences);
+   decode_thread.shares = util_hash_table_create_ptr_keys(vrend_decode_share_destroy);
+   if (!decode_thread.shares)
+      return ENOMEM;
+   memset(decode_thread.num_shared, 0, sizeof(decode_thread.num_shared));
+   pipe_mutex_init(decode_thread.mutex);
+   pipe_condvar_init(decode_thread.cond);
+   pipe_condvar_init(decode_thread.idle_cond);
+
+   /* the decode threads bind the contexts from now on */
+   vrend_renderer_release_current();
+
+   for (i = 0; i < decode_thread.num_workers; i++) {
+      struct vrend_decode_worker *worker = &decode_thread.workers[i];
+
+      memset(worker, 0, sizeof(*worker));
+      worker->index = i;
+      list_inithead(&worker->queue);
+      worker->thread = pipe_thread_create(thread_decode, worker);
+      if (!worker->thread)
+         break;
+   }
+
+   if (i < decode_thread.num_workers) {
+      if (i == 0) {
+         pipe_condvar_destroy(decode_thread.cond);
+         pipe_condvar_destroy(decode_thread.idle_cond);
+         pipe_mutex_destroy(decode_thread.mutex);
+         util_hash_table_destroy(decode_thread.shares);
+         decode_thread.shares = NULL;
+         vrend_renderer_force_ctx_0();
+         return ENOMEM;
+      }
+      vrend_printf("only started %u of %u decode threads\n", i,
+                   decode_thread.num_workers);
+      decode_thread.num_workers = i;
+   }
+
+   decode_thread.running = true;
+   return 0;
+}
+
+void vrend_decode_thread_stop(void)
+{
+   if (!decode_thread.running)
+      return;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   decode_thread.stop = true;
+   pipe_condvar_broadcast(decode_thread.cond);
+   pipe_mutex_unlock(decode_thread.mutex);
+
+   /* the queues are drained before the threads exit */
+   for (unsigned i = 0; i < decode_thread.num_workers; i++)
+      pipe_thread_wait(decode_thread.workers[i].thread);
+   decode_thread.running = false;
+
+   /* the first thread may have exited before the others went past
+    * the last fences */
+   vrend_decode_submit_fences();
+
+   pipe_condvar_destroy(decode_thread.cond);
+   pipe_condvar_destroy(decode_thread.idle_cond);
+   pipe_mutex_destroy(decode_thread.mutex);
+   util_hash_table_destroy(decode_thread.shares);
+   decode_thread.shares = NULL;
+
+   vrend_renderer_force_ctx_0();
+   for (unsigned i = 0; i < decode_thread.num_workers; i++) {
+      if (decode_thread.workers[i].sync)
+         vrend_renderer_sync_delete(decode_thread.workers[i].sync);
+      decode_thread.workers[i].sync = NULL;
+   }
+}
+
+bool vrend_decode_thread_running(void)
+{
+   return decode_thread.running;
+}
+
+static bool vrend_decode_ctx_exists(uint32_t ctx_id)
+{
+   bool ret;
+
+   pipe_mutex_lock(dec_ctx_mutex);
+   ret = vrend_decode_ctx_lookup(ctx_id) != NULL;
+   pipe_mutex_unlock(dec_ctx_mutex);
+   return ret;
+}
+
+/* the error of an earlier item of the context, reported once */
+static int vrend_decode_take_queued_error(uint32_t ctx_id)
+{
+   struct vrend_decode_ctx *dctx;
+   int32_t ret = 0;
+
+   pipe_mutex_lock(dec_ctx_mutex);
+   dctx = vrend_decode_ctx_lookup(ctx_id);
+   /* only the decode threads set it, and only while it is clear */
+   if (dctx)
+      ret = p_atomic_read(&dctx->queued_error);
+   if (ret)
+      p_atomic_cmpxchg(&dctx->queued_error, ret, 0);
+   pipe_mutex_unlock(dec_ctx_mutex);
+   return ret;
+}
+
+int vrend_decode_queue_block(uint32_t ctx_id, const uint32_t *block, int ndw)
+{
+   struct vrend_decode_item *item;
+
+   if (!vrend_decode_ctx_exists(ctx_id) || ndw < 0)
+      return EINVAL;
+
+   item = malloc(sizeof(*item) + ndw * sizeof(uint32_t));
+   if (!item)
+      return ENOMEM;
+
+   memset(item, 0, sizeof(*item));
+   item->type = VREND_DECODE_ITEM_CMD;
+   item->ctx_id = ctx_id;
+   item->ndw = ndw;
+   memcpy(item->buf, block, ndw * sizeof(uint32_t));
+
+   pipe_mutex_lock(decode_thread.mutex);
+   vrend_decode_order_item(vrend_decode_ctx_worker(ctx_id), item);
+   vrend_decode_queue_item(vrend_decode_ctx_worker(ctx_id), item);
+   pipe_mutex_unlock(decode_thread.mutex);
+   return vrend_decode_take_queued_error(ctx_id);
+}
+
+/* Transfers into the attached backing run in order with the commands of
+ * the context, as the guest waits for a fence before it touches the
+ * backing again. Caller owned iovecs are only valid during the call.
+ */
+int vrend_decode_queue_transfer(const struct vrend_transfer_info *info,
+                                int transfer_mode)
+{
+   struct vrend_decode_wait wait = { false, 0 };
+   struct vrend_decode_item *item;
+   bool sync = info->iovec && info->iovec_cnt;
+   int ret;
+
+   if (!vrend_decode_ctx_exists(info->ctx_id) || !info->box)
+      return EINVAL;
+
+   /* context 0 may transfer any resource, with more than one thread it
+    * has to wait for all of them */
+   if (!info->ctx_id && decode_thread.num_workers > 1) {
+      vrend_decode_thread_acquire();
+      ret = vrend_renderer_transfer_iov(info, transfer_mode);
+      vrend_decode_thread_release();
+      return ret;
+   }
+
+   item = CALLOC_STRUCT(vrend_decode_item);
+   if (!item)
+      return ENOMEM;
+
+   item->type = VREND_DECODE_ITEM_TRANSFER;
+   item->ctx_id = info->ctx_id;
+   item->info = *info;
+   item->box = *info->box;
+   item->transfer_mode = transfer_mode;
+   if (sync)
+      item->wait = &wait;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   vrend_decode_order_item(vrend_decode_ctx_worker(info->ctx_id), item);
+   vrend_decode_queue_item(vrend_decode_ctx_worker(info->ctx_id), item);
+   while (sync && !wait.done)
+      pipe_condvar_wait(decode_thread.idle_cond, decode_thread.mutex);
+   pipe_mutex_unlock(decode_thread.mutex);
+
+   return sync ? wait.ret : 0;
+}
+
+int vrend_decode_queue_ctx_resource(uint32_t ctx_id, uint32_t res_handle,
+                                    bool attach)
+{
+   struct vrend_decode_item *item;
+
+   if (!vrend_decode_ctx_exists(ctx_id))
+      return EINVAL;
+
+   item = CALLOC_STRUCT(vrend_decode_item);
+   if (!item)
+      return ENOMEM;
+
+   item->type = attach ? VREND_DECODE_ITEM_ATTACH : VREND_DECODE_ITEM_DETACH;
+   item->ctx_id = ctx_id;
+   item->res_handle = res_handle;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   if (attach) {
+      vrend_decode_share_attach(ctx_id, res_handle);
+   } else {
+      struct vrend_decode_share *share =
+         util_hash_table_get(decode_thread.shares, intptr_to_pointer(res_handle));
+      if (share)
+         vrend_decode_share_detach(share, ctx_id);
+   }
+   vrend_decode_queue_item(vrend_decode_ctx_worker(ctx_id), item);
+   pipe_mutex_unlock(decode_thread.mutex);
+   return 0;
+}
+
+int vrend_decode_queue_fence(int client_fence_id, uint32_t ctx_id)
+{
+   struct vrend_decode_item *items[VREND_MAX_DECODE_THREADS];
+   struct vrend_decode_fence *fence;
+   unsigned i;
+
+   fence = CALLOC_STRUCT(vrend_decode_fence);
+   if (!fence)
+      return ENOMEM;
+
+   for (i = 0; i < decode_thread.num_workers; i++) {
+      items[i] = CALLOC_STRUCT(vrend_decode_item);
+      if (!items[i]) {
+         while (i--)
+            free(items[i]);
+         free(fence);
+         return ENOMEM;
+      }
+      items[i]->type = VREND_DECODE_ITEM_FENCE;
+      items[i]->ctx_id = ctx_id;
+      items[i]->fence = fence;
+   }
+
+   fence->fence_id = client_fence_id;
+   fence->ctx_id = ctx_id;
+   fence->pending = decode_thread.num_workers;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   list_addtail(&fence->head, &decode_thread.fences);
+   for (i = 0; i < decode_thread.num_workers; i++)
+      vrend_decode_queue_item(&decode_thread.workers[i], items[i]);
+   pipe_mutex_unlock(decode_thread.mutex);
+
+   /* the fence is queued regardless, the guest waits for it */
+   return vrend_decode_take_queued_error(ctx_id);
+}
+
+void vrend_decode_queue_poll(void)
+{
+   pipe_mutex_lock(decode_thread.mutex);
+   vrend_decode_queue_poll_locked();
+   pipe_mutex_unlock(decode_thread.mutex);
+}
+
+static bool vrend_decode_threads_idle(void)
+{
+   for (unsigned i = 0; i < decode_thread.num_workers; i++) {
+      if (decode_thread.workers[i].busy ||
+          !LIST_IS_EMPTY(&decode_thread.workers[i].queue))
+         return false;
+   }
+   return true;
+}
+
+/* how often the calling thread holds the GL contexts, calls nest */
+static __thread unsigned decode_thread_borrows;
+
+/* Waits for the queued work to finish and binds the GL contexts to the
+ * calling thread until vrend_decode_thread_release. Only one thread can
+ * hold them at a time, others wait here until it is done.
+ */
+void vrend_decode_thread_acquire(void)
+{
+   if (!decode_thread.running)
+      return;
+
+   if (decode_thread_borrows++)
+      return;
+
+   pipe_mutex_lock(decode_thread.mutex);
+   while (decode_thread.borrowed || !vrend_decode_threads_idle())
+      pipe_condvar_wait(decode_thread.idle_cond, decode_thread.mutex);
+   decode_thread.borrowed = true;
+   pipe_mutex_unlock(decode_thread.mutex);
+
+   vrend_renderer_force_ctx_0();
+}
+
+void vrend_decode_thread_release(void)
+{
+   if (!decode_thread.running)
+      return;
+
+   assert(decode_thread_borrows);
+   if (--decode_thread_borrows)
+      return;
+
+   vrend_renderer_release_current();
+
+   pipe_mutex_lock(decode_thread.mutex);
+   decode_thread.borrowed = false;
+   pipe_condvar_broadcast(decode_thread.cond);
+   pipe_condvar_broadcast(decode_thread.idle_cond);
+   pipe_mutex_unlock(decode_thread.mutex);
+}
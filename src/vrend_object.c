@@ -22,9 +22,10 @@
  *
  **************************************************************************/
 
-#include "util/u_pointer.h"
 #include "util/u_memory.h"
+#include "util/u_math.h"
 #include "util/u_hash_table.h"
+#include "util/u_pointer.h"
 
 #include "vrend_object.h"
 
@@ -44,37 +45,314 @@ void vrend_resource_set_destroy_callback(void (*cb)(void *))
    resource_unref = cb;
 }
 
-static unsigned
-hash_func(void *key)
+/* Objects are kept in a three level table indexed by handle, like a page
+ * table: a directory that grows on demand covers handle >> 16, the two
+ * lower levels are pages of 256 slots allocated on first use and freed
+ * again once empty. Guest handles come from counters, so the live ones
+ * are packed into a few pages and a lookup is three loads, without any
+ * hashing or a separate allocation per object.
+ *
+ * The guest picks the handles though, and spreading them out would cost a
+ * page per handle. So only handles below VREND_OBJECT_MAX_DIRS << 16 go
+ * into pages, and only up to VREND_OBJECT_MAX_PAGES pages and directories
+ * per table. Other handles are kept in a hash table instead.
+ */
+#define VREND_OBJECT_PAGE_SHIFT 8
+#define VREND_OBJECT_PAGE_SIZE (1 << VREND_OBJECT_PAGE_SHIFT)
+#define VREND_OBJECT_PAGE_MASK (VREND_OBJECT_PAGE_SIZE - 1)
+#define VREND_OBJECT_MAX_DIRS 1024
+#define VREND_OBJECT_MAX_PAGES 256
+
+/* a slot is in use if data is set */
+struct vrend_object {
+   void *data;
+   enum virgl_object_type type;
+   bool free_data;
+};
+
+struct vrend_object_page {
+   uint32_t num_used;
+   struct vrend_object slots[VREND_OBJECT_PAGE_SIZE];
+};
+
+struct vrend_object_dir {
+   uint32_t num_used;
+   struct vrend_object_page *pages[VREND_OBJECT_PAGE_SIZE];
+};
+
+struct vrend_object_table {
+   struct vrend_object_dir **dirs;
+   uint32_t num_dirs;
+   /* pages and directories allocated */
+   uint32_t num_pages;
+   /* handles that didn't fit in pages, created on first use */
+   struct util_hash_table *sparse;
+   void (*free_object)(struct vrend_object *obj);
+};
+
+static struct vrend_object_table *res_table;
+
+static struct vrend_object_table *
+vrend_object_table_create(void (*free_object)(struct vrend_object *obj))
 {
-   intptr_t ip = pointer_to_intptr(key);
-   return (unsigned)(ip & 0xffffffff);
+   struct vrend_object_table *table = CALLOC_STRUCT(vrend_object_table);
+
+   if (table)
+      table->free_object = free_object;
+   return table;
 }
 
-static int
-compare(void *key1, void *key2)
+static inline struct vrend_object *
+vrend_object_table_get(const struct vrend_object_table *table, uint32_t handle)
 {
-   if (key1 < key2)
-      return -1;
-   if (key1 > key2)
-      return 1;
-   else
-      return 0;
+   uint32_t dir = handle >> (2 * VREND_OBJECT_PAGE_SHIFT);
+   struct vrend_object_page *page;
+   struct vrend_object *obj;
+
+   if (dir < table->num_dirs && table->dirs[dir]) {
+      page = table->dirs[dir]->pages[(handle >> VREND_OBJECT_PAGE_SHIFT) & VREND_OBJECT_PAGE_MASK];
+      if (page) {
+         obj = &page->slots[handle & VREND_OBJECT_PAGE_MASK];
+         if (obj->data)
+            return obj;
+      }
+   }
+
+   if (unlikely(table->sparse))
+      return util_hash_table_get(table->sparse, intptr_to_pointer(handle));
+   return NULL;
 }
 
-static struct util_hash_table *res_hash;
+/* returns the slot for handle, allocating the pages on the way, the slot
+ * may still hold an older object. NULL if the handle doesn't fit in pages.
+ */
+static struct vrend_object *
+vrend_object_table_slot(struct vrend_object_table *table, uint32_t handle)
+{
+   uint32_t dir = handle >> (2 * VREND_OBJECT_PAGE_SHIFT);
+   uint32_t page_idx = (handle >> VREND_OBJECT_PAGE_SHIFT) & VREND_OBJECT_PAGE_MASK;
+   struct vrend_object_dir *d;
+   struct vrend_object_page *page;
 
-struct vrend_object {
-   enum virgl_object_type type;
-   uint32_t handle;
-   void *data;
-   bool free_data;
+   if (dir >= VREND_OBJECT_MAX_DIRS)
+      return NULL;
+
+   if (dir >= table->num_dirs) {
+      uint32_t num_dirs = MAX2(table->num_dirs * 2, 4);
+      struct vrend_object_dir **dirs;
+
+      while (num_dirs <= dir)
+         num_dirs *= 2;
+      num_dirs = MIN2(num_dirs, VREND_OBJECT_MAX_DIRS);
+
+      dirs = realloc(table->dirs, num_dirs * sizeof(*dirs));
+      if (!dirs)
+         return NULL;
+      memset(dirs + table->num_dirs, 0,
+             (num_dirs - table->num_dirs) * sizeof(*dirs));
+      table->dirs = dirs;
+      table->num_dirs = num_dirs;
+   }
+
+   d = table->dirs[dir];
+   if (!d) {
+      if (table->num_pages + 2 > VREND_OBJECT_MAX_PAGES)
+         return NULL;
+      d = CALLOC_STRUCT(vrend_object_dir);
+      if (!d)
+         return NULL;
+      table->dirs[dir] = d;
+      table->num_pages++;
+   }
+
+   page = d->pages[page_idx];
+   if (!page) {
+      if (table->num_pages < VREND_OBJECT_MAX_PAGES)
+         page = CALLOC_STRUCT(vrend_object_page);
+      if (!page) {
+         if (!d->num_used) {
+            FREE(d);
+            table->dirs[dir] = NULL;
+            table->num_pages--;
+         }
+         return NULL;
+      }
+      d->pages[page_idx] = page;
+      d->num_used++;
+      table->num_pages++;
+   }
+
+   return &page->slots[handle & VREND_OBJECT_PAGE_MASK];
+}
+
+static void vrend_object_table_set(struct vrend_object_table *table,
+                                   struct vrend_object *slot,
+                                   uint32_t handle,
+                                   const struct vrend_object *obj)
+{
+   struct vrend_object old = *slot;
+
+   *slot = *obj;
+   if (old.data) {
+      table->free_object(&old);
+   } else {
+      uint32_t dir = handle >> (2 * VREND_OBJECT_PAGE_SHIFT);
+      uint32_t page_idx = (handle >> VREND_OBJECT_PAGE_SHIFT) & VREND_OBJECT_PAGE_MASK;
+      table->dirs[dir]->pages[page_idx]->num_used++;
+   }
+}
+
+static bool vrend_object_table_set_sparse(struct vrend_object_table *table,
+                                          uint32_t handle,
+                                          const struct vrend_object *obj)
+{
+   struct vrend_object *old, *copy;
+   struct vrend_object old_obj = { NULL };
+
+   if (!table->sparse) {
+      table->sparse = util_hash_table_create_ptr_keys(free);
+      if (!table->sparse)
+         return false;
+   }
+
+   copy = malloc(sizeof(*copy));
+   if (!copy)
+      return false;
+   *copy = *obj;
+
+   old = util_hash_table_get(table->sparse, intptr_to_pointer(handle));
+   if (old)
+      old_obj = *old;
+   if (util_hash_table_set(table->sparse, intptr_to_pointer(handle), copy) != PIPE_OK) {
+      free(copy);
+      return false;
+   }
+   if (old_obj.data)
+      table->free_object(&old_obj);
+   return true;
+}
+
+static bool vrend_object_table_insert(struct vrend_object_table *table,
+                                      uint32_t handle,
+                                      const struct vrend_object *obj)
+{
+   struct vrend_object *slot = NULL;
+
+   /* a handle only lives in one of the two */
+   if (!table->sparse ||
+       !util_hash_table_get(table->sparse, intptr_to_pointer(handle)))
+      slot = vrend_object_table_slot(table, handle);
+   if (!slot)
+      return vrend_object_table_set_sparse(table, handle, obj);
+
+   vrend_object_table_set(table, slot, handle, obj);
+   return true;
+}
+
+/* clears the slot of handle and frees pages that became empty, the
+ * removed object is returned in obj */
+static bool vrend_object_table_take(struct vrend_object_table *table,
+                                    uint32_t handle, struct vrend_object *obj)
+{
+   uint32_t dir = handle >> (2 * VREND_OBJECT_PAGE_SHIFT);
+   uint32_t page_idx = (handle >> VREND_OBJECT_PAGE_SHIFT) & VREND_OBJECT_PAGE_MASK;
+   struct vrend_object *slot = vrend_object_table_get(table, handle);
+   struct vrend_object_dir *d;
+   struct vrend_object_page *page;
+
+   if (!slot)
+      return false;
+
+   *obj = *slot;
+
+   d = dir < table->num_dirs ? table->dirs[dir] : NULL;
+   page = d ? d->pages[page_idx] : NULL;
+   if (!page || slot != &page->slots[handle & VREND_OBJECT_PAGE_MASK]) {
+      util_hash_table_remove(table->sparse, intptr_to_pointer(handle));
+      return true;
+   }
+
+   memset(slot, 0, sizeof(*slot));
+   if (--page->num_used == 0) {
+      FREE(page);
+      d->pages[page_idx] = NULL;
+      table->num_pages--;
+      if (--d->num_used == 0) {
+         FREE(d);
+         table->dirs[dir] = NULL;
+         table->num_pages--;
+      }
+   }
+   return true;
+}
+
+/* Objects are taken out of the table before their free callback runs, so
+ * the callbacks may remove other objects from the same table.
+ */
+static void vrend_object_table_remove(struct vrend_object_table *table, uint32_t handle)
+{
+   struct vrend_object obj;
+
+   if (vrend_object_table_take(table, handle, &obj))
+      table->free_object(&obj);
+}
+
+struct vrend_sparse_handles {
+   uint32_t *handles;
+   uint32_t num;
+   uint32_t alloc;
 };
 
-static void free_object(void *value)
+static enum pipe_error collect_sparse_handle(void *key, UNUSED void *value, void *data)
+{
+   struct vrend_sparse_handles *handles = data;
+
+   if (handles->num == handles->alloc) {
+      uint32_t alloc = MAX2(handles->alloc * 2, 64);
+      uint32_t *new_handles = realloc(handles->handles, alloc * sizeof(uint32_t));
+
+      if (!new_handles)
+         return PIPE_ERROR_OUT_OF_MEMORY;
+      handles->handles = new_handles;
+      handles->alloc = alloc;
+   }
+   handles->handles[handles->num++] = pointer_to_intptr(key);
+   return PIPE_OK;
+}
+
+static void vrend_object_table_destroy(struct vrend_object_table *table)
 {
-   struct vrend_object *obj = value;
+   uint32_t dir, page, slot;
+
+   for (dir = 0; dir < table->num_dirs; dir++) {
+      for (page = 0; table->dirs[dir] && page < VREND_OBJECT_PAGE_SIZE; page++) {
+         for (slot = 0; slot < VREND_OBJECT_PAGE_SIZE; slot++) {
+            if (!table->dirs[dir] || !table->dirs[dir]->pages[page])
+               break;
+            vrend_object_table_remove(table, (dir << (2 * VREND_OBJECT_PAGE_SHIFT)) |
+                                             (page << VREND_OBJECT_PAGE_SHIFT) | slot);
+         }
+      }
+   }
+
+   /* the free callbacks may remove other sparse objects, so collect the
+    * handles first and go through the normal removal */
+   if (table->sparse) {
+      struct vrend_sparse_handles handles = { NULL };
 
+      util_hash_table_foreach(table->sparse, collect_sparse_handle, &handles);
+      for (uint32_t i = 0; i < handles.num; i++)
+         vrend_object_table_remove(table, handles.handles[i]);
+      free(handles.handles);
+      util_hash_table_destroy(table->sparse);
+   }
+
+   free(table->dirs);
+   FREE(table);
+}
+
+static void free_object(struct vrend_object *obj)
+{
    if (obj->free_data) {
       if (obj_types[obj->type].unref)
          obj_types[obj->type].unref(obj->data);
@@ -83,84 +361,77 @@ static void free_object(void *value)
          free(obj->data);
       }
    }
-   free(obj);
 }
 
-struct util_hash_table *vrend_object_init_ctx_table(void)
+struct vrend_object_table *vrend_object_init_ctx_table(void)
 {
-   struct util_hash_table *ctx_hash;
-   ctx_hash = util_hash_table_create(hash_func, compare, free_object);
-   return ctx_hash;
+   return vrend_object_table_create(free_object);
 }
 
-void vrend_object_fini_ctx_table(struct util_hash_table *ctx_hash)
+void vrend_object_fini_ctx_table(struct vrend_object_table *ctx_table)
 {
-   if (!ctx_hash)
+   if (!ctx_table)
       return;
 
-   util_hash_table_destroy(ctx_hash);
+   vrend_object_table_destroy(ctx_table);
 }
 
-static void free_res(void *value)
+static void free_res(struct vrend_object *obj)
 {
-   struct vrend_object *obj = value;
    (*resource_unref)(obj->data);
-   free(obj);
 }
 
 void
 vrend_object_init_resource_table(void)
 {
-   if (!res_hash)
-      res_hash = util_hash_table_create(hash_func, compare, free_res);
+   if (!res_table)
+      res_table = vrend_object_table_create(free_res);
 }
 
 void vrend_object_fini_resource_table(void)
 {
-   if (res_hash) {
-      util_hash_table_destroy(res_hash);
+   if (res_table) {
+      vrend_object_table_destroy(res_table);
    }
-   res_hash = NULL;
+   res_table = NULL;
 }
 
 uint32_t
-vrend_object_insert_nofree(struct util_hash_table *handle_hash,
+vrend_object_insert_nofree(struct vrend_object_table *ctx_table,
                            void *data, UNUSED uint32_t length, uint32_t handle,
                            enum virgl_object_type type, bool free_data)
 {
-   struct vrend_object *obj = CALLOC_STRUCT(vrend_object);
+   struct vrend_object obj = { data, type, free_data };
 
-   if (!obj)
+   if (!data)
       return 0;
-   obj->handle = handle;
-   obj->data = data;
-   obj->type = type;
-   obj->free_data = free_data;
-   util_hash_table_set(handle_hash, intptr_to_pointer(obj->handle), obj);
-   return obj->handle;
+
+   if (!vrend_object_table_insert(ctx_table, handle, &obj))
+      return 0;
+   return handle;
 }
 
 uint32_t
-vrend_object_insert(struct util_hash_table *handle_hash,
+vrend_object_insert(struct vrend_object_table *ctx_table,
                     void *data, uint32_t length, uint32_t handle, enum virgl_object_type type)
 {
-   return vrend_object_insert_nofree(handle_hash, data, length,
+   return vrend_object_insert_nofree(ctx_table, data, length,
                                      handle, type, true);
 }
 
 void
-vrend_object_remove(struct util_hash_table *handle_hash,
+vrend_object_remove(struct vrend_object_table *ctx_table,
                     uint32_t handle, UNUSED enum virgl_object_type type)
 {
-   util_hash_table_remove(handle_hash, intptr_to_pointer(handle));
+   vrend_object_table_remove(ctx_table, handle);
 }
 
-void *vrend_object_lookup(struct util_hash_table *handle_hash,
+void *vrend_object_lookup(struct vrend_object_table *ctx_table,
                           uint32_t handle, enum virgl_object_type type)
 {
    struct vrend_object *obj;
 
-   obj = util_hash_table_get(handle_hash, intptr_to_pointer(handle));
+   obj = vrend_object_table_get(ctx_table, handle);
    if (!obj) {
       return NULL;
    }
@@ -172,30 +443,25 @@ void *vrend_object_lookup(struct util_hash_table *handle_hash,
 
 int vrend_resource_insert(void *data, uint32_t handle)
 {
-   struct vrend_object *obj;
+   struct vrend_object obj = { data, VIRGL_OBJECT_NULL, true };
 
-   if (!handle)
+   if (!handle || !data)
       return 0;
 
-   obj = CALLOC_STRUCT(vrend_object);
-   if (!obj)
+   if (!vrend_object_table_insert(res_table, handle, &obj))
       return 0;
-
-   obj->handle = handle;
-   obj->data = data;
-   util_hash_table_set(res_hash, intptr_to_pointer(obj->handle), obj);
-   return obj->handle;
+   return handle;
 }
 
 void vrend_resource_remove(uint32_t handle)
 {
-   util_hash_table_remove(res_hash, intptr_to_pointer(handle));
+   vrend_object_table_remove(res_table, handle);
 }
 
 void *vrend_resource_lookup(uint32_t handle, UNUSED uint32_t ctx_id)
 {
    struct vrend_object *obj;
-   obj = util_hash_table_get(res_hash, intptr_to_pointer(handle));
+   obj = vrend_object_table_get(res_table, handle);
    if (!obj)
       return NULL;
    return obj->data;
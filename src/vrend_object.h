@@ -30,13 +30,16 @@
 void vrend_object_init_resource_table(void);
 void vrend_object_fini_resource_table(void);
 
-struct util_hash_table *vrend_object_init_ctx_table(void);
-void vrend_object_fini_ctx_table(struct util_hash_table *ctx_hash);
+/* per context objects, in a table indexed by their handle */
+struct vrend_object_table;
 
-void vrend_object_remove(struct util_hash_table *handle_hash, uint32_t handle, enum virgl_object_type obj);
-void *vrend_object_lookup(struct util_hash_table *handle_hash, uint32_t handle, enum virgl_object_type obj);
-uint32_t vrend_object_insert(struct util_hash_table *handle_hash, void *data, uint32_t length, uint32_t handle, enum virgl_object_type type);
-uint32_t vrend_object_insert_nofree(struct util_hash_table *handle_hash,
+struct vrend_object_table *vrend_object_init_ctx_table(void);
+void vrend_object_fini_ctx_table(struct vrend_object_table *ctx_table);
+
+void vrend_object_remove(struct vrend_object_table *ctx_table, uint32_t handle, enum virgl_object_type obj);
+void *vrend_object_lookup(struct vrend_object_table *ctx_table, uint32_t handle, enum virgl_object_type obj);
+uint32_t vrend_object_insert(struct vrend_object_table *ctx_table, void *data, uint32_t length, uint32_t handle, enum virgl_object_type type);
+uint32_t vrend_object_insert_nofree(struct vrend_object_table *ctx_table,
                                     void *data, uint32_t length,
                                     uint32_t handle,
                                     enum virgl_object_type type,
@@ -0,0 +1,159 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+
+#include "util/u_memory.h"
+#include "util/u_hash_table.h"
+
+#include "vrend_program_table.h"
+
+struct vrend_program_mru {
+   struct vrend_program_key key;
+   void *program;
+};
+
+struct vrend_program_table {
+   struct util_hash_table *programs;
+   struct vrend_program_mru mru[VREND_PROGRAM_MRU_SIZE];
+   unsigned num_mru;
+};
+
+static unsigned
+hash_func(void *key)
+{
+   const uint32_t *words = key;
+   uint32_t hash = 2166136261u;
+   unsigned i;
+
+   for (i = 0; i < sizeof(struct vrend_program_key) / sizeof(uint32_t); i++) {
+      hash ^= words[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+static int
+compare(void *key1, void *key2)
+{
+   return memcmp(key1, key2, sizeof(struct vrend_program_key));
+}
+
+static void
+free_program(UNUSED void *program)
+{
+   /* programs are owned by the sub context */
+}
+
+struct vrend_program_table *vrend_program_table_create(void)
+{
+   struct vrend_program_table *table = CALLOC_STRUCT(vrend_program_table);
+   if (!table)
+      return NULL;
+
+   table->programs = util_hash_table_create(hash_func, compare, free_program);
+   if (!table->programs) {
+      FREE(table);
+      return NULL;
+   }
+   return table;
+}
+
+void vrend_program_table_destroy(struct vrend_program_table *table)
+{
+   if (!table)
+      return;
+
+   util_hash_table_destroy(table->programs);
+   FREE(table);
+}
+
+static void mru_push(struct vrend_program_table *table,
+                     const struct vrend_program_key *key,
+                     void *program)
+{
+   unsigned n = table->num_mru;
+
+   if (n == VREND_PROGRAM_MRU_SIZE)
+      n--;
+   else
+      table->num_mru++;
+
+   memmove(&table->mru[1], &table->mru[0], n * sizeof(table->mru[0]));
+   table->mru[0].key = *key;
+   table->mru[0].program = program;
+}
+
+int vrend_program_table_insert(struct vrend_program_table *table,
+                               const struct vrend_program_key *key,
+                               void *program)
+{
+   if (util_hash_table_set(table->programs, (void *)key, program) != PIPE_OK)
+      return ENOMEM;
+
+   mru_push(table, key, program);
+   return 0;
+}
+
+void *vrend_program_table_lookup(struct vrend_program_table *table,
+                                 const struct vrend_program_key *key)
+{
+   struct vrend_program_mru hit;
+   void *program;
+   unsigned i;
+
+   for (i = 0; i < table->num_mru; i++) {
+      if (!memcmp(&table->mru[i].key, key, sizeof(*key))) {
+         if (i) {
+            hit = table->mru[i];
+            memmove(&table->mru[1], &table->mru[0], i * sizeof(table->mru[0]));
+            table->mru[0] = hit;
+         }
+         return table->mru[0].program;
+      }
+   }
+
+   program = util_hash_table_get(table->programs, (void *)key);
+   if (program)
+      mru_push(table, key, program);
+   return program;
+}
+
+void vrend_program_table_remove(struct vrend_program_table *table,
+                                const struct vrend_program_key *key)
+{
+   unsigned i;
+
+   for (i = 0; i < table->num_mru; i++) {
+      if (!memcmp(&table->mru[i].key, key, sizeof(*key))) {
+         table->num_mru--;
+         memmove(&table->mru[i], &table->mru[i + 1],
+                 (table->num_mru - i) * sizeof(table->mru[0]));
+         break;
+      }
+   }
+
+   util_hash_table_remove(table->programs, (void *)key);
+}
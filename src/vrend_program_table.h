@@ -0,0 +1,63 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef VREND_PROGRAM_TABLE_H
+#define VREND_PROGRAM_TABLE_H
+
+#include <stdint.h>
+
+#include "pipe/p_defines.h"
+
+/* Index of the linked programs of a sub context.
+ *
+ * Programs are found by the ids of the shaders linked into them, a
+ * handful of recently used programs is checked before the hash table
+ * so that switching between a few programs stays cheap.
+ */
+
+#define VREND_PROGRAM_MRU_SIZE 4
+
+struct vrend_program_key {
+   uint32_t ids[PIPE_SHADER_TYPES];
+   uint32_t dual_src;
+};
+
+struct vrend_program_table;
+
+struct vrend_program_table *vrend_program_table_create(void);
+
+void vrend_program_table_destroy(struct vrend_program_table *table);
+
+/* the key is not copied, it must stay valid until the program is removed */
+int vrend_program_table_insert(struct vrend_program_table *table,
+                               const struct vrend_program_key *key,
+                               void *program);
+
+void *vrend_program_table_lookup(struct vrend_program_table *table,
+                                 const struct vrend_program_key *key);
+
+void vrend_program_table_remove(struct vrend_program_table *table,
+                                const struct vrend_program_key *key);
+
+#endif
@@ -41,10 +41,19 @@
 #include "os/os_thread.h"
 #include "util/u_double_list.h"
 #include "util/u_format.h"
+#include "util/u_hash_table.h"
+#include "util/u_cpu_detect.h"
 #include "tgsi/tgsi_parse.h"
 
 #include "vrend_object.h"
 #include "vrend_shader.h"
+#include "vrend_shader_cache.h"
+#include "vrend_simd.h"
+#include "vrend_copy_pool.h"
+#include "vrend_slab.h"
+#include "vrend_arena.h"
+#include "vrend_tgsi_validate.h"
+#include "vrend_program_table.h"
 
 #include "vrend_renderer.h"
 #include "vrend_debug.h"
@@ -53,6 +62,7 @@
 #include "virglrenderer.h"
 
 #include "tgsi/tgsi_text.h"
+#include "tgsi/tgsi_dump.h"
 
 #ifdef HAVE_EVENTFD
 #include <sys/eventfd.h>
@@ -75,10 +85,34 @@ struct vrend_if_cbs *vrend_clicbs;
 struct vrend_fence {
    uint32_t fence_id;
    uint32_t ctx_id;
+   /* orders the fence against pending readbacks */
+   uint32_t seq;
    GLsync syncobj;
    struct list_head fences;
 };
 
+/* A transfer from a texture into the iovecs attached to the resource that
+ * was read into a pixel pack buffer, the data is copied out when the first
+ * fence created after it signals.
+ */
+struct vrend_readback {
+   struct list_head head;
+   struct vrend_resource *res;
+   uint32_t seq;
+   GLuint pbo_id;
+   /* allocated size of the pack buffer, at least size */
+   uint32_t pbo_size;
+   GLsync syncobj;
+   uint32_t size;
+   /* where the data for box starts in the pack buffer */
+   uint32_t data_offset;
+   struct pipe_box box;
+   uint32_t level;
+   uint32_t stride;
+   uint64_t offset;
+   bool invert;
+};
+
 struct vrend_query {
    struct list_head waiting_queries;
 
@@ -98,6 +132,7 @@ struct global_error_state {
 
 enum features_id
 {
+   feat_arb_buffer_storage,
    feat_arb_or_gles_ext_texture_buffer,
    feat_arb_robustness,
    feat_arrays_of_arrays,
@@ -121,6 +156,7 @@ enum features_id
    feat_framebuffer_fetch,
    feat_framebuffer_fetch_non_coherent,
    feat_geometry_shader,
+   feat_get_program_binary,
    feat_gl_conditional_render,
    feat_gl_prim_restart,
    feat_gles_khr_robustness,
@@ -135,9 +171,11 @@ enum features_id
    feat_mesa_invert,
    feat_ms_scaled_blit,
    feat_multisample,
+   feat_multi_draw,
    feat_multi_draw_indirect,
    feat_nv_conditional_render,
    feat_nv_prim_restart,
+   feat_parallel_shader_compile,
    feat_polygon_offset_clamp,
    feat_occlusion_query,
    feat_occlusion_query_boolean,
@@ -186,6 +224,7 @@ static const  struct {
    const char *gl_ext[FEAT_MAX_EXTS];
    const char *log_name;
 } feature_list[] = {
+   FEAT(arb_buffer_storage, 44, UNAVAIL, "GL_ARB_buffer_storage", "GL_EXT_buffer_storage"),
    FEAT(arb_or_gles_ext_texture_buffer, 31, UNAVAIL, "GL_ARB_texture_buffer_object", "GL_EXT_texture_buffer", NULL),
    FEAT(arb_robustness, UNAVAIL, UNAVAIL,  "GL_ARB_robustness" ),
    FEAT(arrays_of_arrays, 43, 31, "GL_ARB_arrays_of_arrays"),
@@ -209,6 +248,7 @@ static const  struct {
    FEAT(framebuffer_fetch, UNAVAIL, UNAVAIL,  "GL_EXT_shader_framebuffer_fetch" ),
    FEAT(framebuffer_fetch_non_coherent, UNAVAIL, UNAVAIL,  "GL_EXT_shader_framebuffer_fetch_non_coherent" ),
    FEAT(geometry_shader, 32, 32, "GL_EXT_geometry_shader", "GL_OES_geometry_shader"),
+   FEAT(get_program_binary, 41, 30, "GL_ARB_get_program_binary", "GL_OES_get_program_binary"),
    FEAT(gl_conditional_render, 30, UNAVAIL, NULL),
    FEAT(gl_prim_restart, 31, 30, NULL),
    FEAT(gles_khr_robustness, UNAVAIL, UNAVAIL,  "GL_KHR_robustness" ),
@@ -223,9 +263,11 @@ static const  struct {
    FEAT(mesa_invert, UNAVAIL, UNAVAIL,  "GL_MESA_pack_invert" ),
    FEAT(ms_scaled_blit, UNAVAIL, UNAVAIL,  "GL_EXT_framebuffer_multisample_blit_scaled" ),
    FEAT(multisample, 32, 30,  "GL_ARB_texture_multisample" ),
+   FEAT(multi_draw, 32, UNAVAIL, NULL),
    FEAT(multi_draw_indirect, 43, UNAVAIL,  "GL_ARB_multi_draw_indirect", "GL_EXT_multi_draw_indirect" ),
    FEAT(nv_conditional_render, UNAVAIL, UNAVAIL,  "GL_NV_conditional_render" ),
    FEAT(nv_prim_restart, UNAVAIL, UNAVAIL,  "GL_NV_primitive_restart" ),
+   FEAT(parallel_shader_compile, UNAVAIL, UNAVAIL, "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile"),
    FEAT(polygon_offset_clamp, 46, UNAVAIL,  "GL_ARB_polygon_offset_clamp", "GL_EXT_polygon_offset_clamp"),
    FEAT(occlusion_query, 15, UNAVAIL, "GL_ARB_occlusion_query"),
    FEAT(occlusion_query_boolean, 33, 30, "GL_EXT_occlusion_query_boolean", "GL_ARB_occlusion_query2"),
@@ -261,14 +303,12 @@ static const  struct {
    FEAT(viewport_array, 41, UNAVAIL,  "GL_ARB_viewport_array", "GL_OES_viewport_array"),
 };
 
+#define VREND_MAX_COMPILE_THREADS 8
+
 struct global_renderer_state {
    int gl_major_ver;
    int gl_minor_ver;
 
-   struct vrend_context *current_ctx;
-   struct vrend_context *current_hw_ctx;
-   struct list_head waiting_query_list;
-
    bool inited;
    bool use_gles;
    bool use_core_profile;
@@ -277,6 +317,11 @@ struct global_renderer_state {
 
    /* these appeared broken on at least one driver */
    bool use_explicit_locations;
+   /* vertex and fragment shaders are combined in program pipelines */
+   bool use_separable_shaders;
+   /* guests may send shaders as binary TGSI tokens, the wire values are
+    * not reserved upstream yet, so this is off unless asked for */
+   bool use_tgsi_tokens;
    uint32_t max_draw_buffers;
    struct list_head active_ctx_list;
 
@@ -284,6 +329,11 @@ struct global_renderer_state {
    bool stop_sync_thread;
    int eventfd;
 
+   /* with threaded decode fences retire on a decode thread, the latest
+    * one waits here until vrend_renderer_deliver_fences is called */
+   bool defer_fences;
+   uint32_t deferred_fence_id;
+
    pipe_mutex fence_mutex;
    struct list_head fence_list;
    struct list_head fence_wait_list;
@@ -292,14 +342,72 @@ struct global_renderer_state {
    pipe_thread sync_thread;
    virgl_gl_context sync_context;
 
-   /* Needed on GLES to inject a TCS */
-   float tess_factors[6];
+   /* shader compile workers */
+   bool async_compile;
+   bool stop_compile_threads;
+   int num_compile_threads;
+   pipe_mutex compile_mutex;
+   pipe_condvar compile_cond;
+   pipe_condvar compile_done_cond;
+   struct list_head compile_queue;
+   pipe_thread compile_threads[VREND_MAX_COMPILE_THREADS];
+   virgl_gl_context compile_contexts[VREND_MAX_COMPILE_THREADS];
+
+   /* per sub context staging ring for uploads, 0 disables it */
+   uint32_t stream_ring_size;
+   /* texture uploads in this size range are staged through the ring */
+   uint32_t upload_stage_min;
+   uint32_t upload_stage_max;
+   bool stats_enabled;
+   struct vrend_upload_stats upload_stats;
+   struct vrend_shader_stats shader_stats;
+
+   /* fences and resources are freed from any thread */
+   struct vrend_slab *fence_slab;
+   struct vrend_slab *resource_slab;
+
+   /* readbacks waiting for a fence, ordered by seq */
+   bool async_readback;
+   uint32_t readback_seq;
+   pipe_mutex readback_mutex;
+   struct list_head readback_list;
+   /* retired readbacks that kept their pack buffer for reuse */
+   struct list_head readback_pool;
+   uint32_t readback_pool_count;
+
    bool bgra_srgb_emulation_loaded;
 
+   /* identifies the driver that produced cached program binaries */
+   uint64_t program_cache_driver_hash;
+
 };
 
 static struct global_renderer_state vrend_state;
 
+/* GL bindings are per thread, with threaded decode every decode thread
+ * keeps its own current context and queries waiting for a result.
+ */
+struct thread_renderer_state {
+   struct vrend_context *current_ctx;
+   struct vrend_context *current_hw_ctx;
+   struct list_head waiting_query_list;
+};
+
+static __thread struct thread_renderer_state vrend_tls;
+
+pipe_static_mutex(vrend_blit_mutex);
+pipe_static_mutex(vrend_upload_stats_mutex);
+pipe_static_mutex(vrend_shader_stats_mutex);
+pipe_static_mutex(vrend_format_mutex);
+pipe_static_mutex(vrend_fence_deliver_mutex);
+
+static struct list_head *vrend_waiting_query_list(void)
+{
+   if (!vrend_tls.waiting_query_list.next)
+      list_inithead(&vrend_tls.waiting_query_list);
+   return &vrend_tls.waiting_query_list;
+}
+
 static inline bool has_feature(enum features_id feature_id)
 {
    VREND_DEBUG(dbg_feature_use, NULL, "Try using feature %s:%d\n",
@@ -318,14 +426,27 @@ struct vrend_linked_shader_program {
    struct list_head sl[PIPE_SHADER_TYPES];
    GLuint id;
 
+   /* index in the program table of sub_ctx */
+   struct vrend_program_key key;
+   struct vrend_sub_context *sub_ctx;
+
    bool dual_src_linked;
    struct vrend_shader *ss[PIPE_SHADER_TYPES];
 
+   /* id is a program pipeline of the separable programs in stage_ids,
+    * whose sampler units and uniform blocks start at these bases */
+   bool is_pipeline;
+   GLuint stage_ids[PIPE_SHADER_TYPES];
+   int sampler_base[PIPE_SHADER_TYPES];
+   int ubo_base[PIPE_SHADER_TYPES];
+
    uint32_t ubo_used_mask[PIPE_SHADER_TYPES];
    uint32_t samplers_used_mask[PIPE_SHADER_TYPES];
 
+   GLint *samp_locs[PIPE_SHADER_TYPES];
    GLuint *shadow_samp_mask_locs[PIPE_SHADER_TYPES];
    GLuint *shadow_samp_add_locs[PIPE_SHADER_TYPES];
+   GLuint *ubo_locs[PIPE_SHADER_TYPES];
 
    GLint const_location[PIPE_SHADER_TYPES];
 
@@ -348,6 +469,57 @@ struct vrend_linked_shader_program {
    struct vrend_sub_context *ref_context;
 };
 
+enum vrend_compile_state {
+   VREND_COMPILE_DONE,
+   VREND_COMPILE_PENDING,
+   VREND_COMPILE_FAILED,
+};
+
+struct vrend_compile_job {
+   struct list_head head;
+   /* shader to compile, if any, then the program to link into *link_status */
+   GLuint id;
+   GLuint program;
+   GLint *link_status;
+   int num_parts;
+   bool done;
+   const char *parts[];
+};
+
+/* identifies a variant in the variant table of its selector */
+struct vrend_variant_key {
+   unsigned hash;
+   const struct vrend_shader_key *key;
+};
+
+#define VREND_MAX_INTERP_VARIANTS 8
+
+/* A compiled copy of a shader with its outputs patched for the
+ * interpolation qualifiers of another fragment shader, so that switching
+ * between fragment shaders does not recompile the previous stage.
+ */
+struct vrend_interp_variant {
+   struct list_head head;
+   struct vrend_cache_blob interp_sig;
+   GLuint id;
+   struct vrend_strarray glsl_strings;
+   enum vrend_compile_state compile_state;
+   struct vrend_compile_job *compile_job;
+};
+
+/* A shader linked on its own into a separable program. The sampler units
+ * and uniform block bindings written into it depend on the stages that
+ * come before it in a pipeline, the bases record the current ones.
+ */
+struct vrend_separable_program {
+   GLuint id;
+   /* -1 until the link is done, it may run on a compile thread */
+   GLint link_status;
+   struct vrend_compile_job *link_job;
+   int sampler_base;
+   int ubo_base;
+};
+
 struct vrend_shader {
    struct vrend_shader *next_variant;
    struct vrend_shader_selector *sel;
@@ -355,24 +527,41 @@ struct vrend_shader {
    struct vrend_strarray glsl_strings;
    GLuint id;
    GLuint compiled_fs_id;
+   /* compilation may still be running, see vrend_shader_wait_compiled */
+   enum vrend_compile_state compile_state;
+   struct vrend_compile_job *compile_job;
+   /* fragment shader interpolation the outputs are patched for, and the
+    * compiled objects for the ones used before */
+   struct vrend_cache_blob interp_sig;
+   struct list_head interp_variants;
+   unsigned num_interp_variants;
    struct vrend_shader_key key;
+   struct vrend_variant_key variant_key;
    struct list_head programs;
+   /* fragment shaders are linked once for each dual source state */
+   struct vrend_separable_program separable[2];
 };
 
 struct vrend_shader_selector {
    struct pipe_reference reference;
 
+   /* variants compiled, see vrend_shader_stats_add */
    unsigned num_shaders;
    unsigned type;
    struct vrend_shader_info sinfo;
 
    struct vrend_shader *current;
+   /* all variants, chained by next_variant */
+   struct vrend_shader *variants;
+   struct util_hash_table *variant_table;
    struct tgsi_token *tokens;
 
    uint32_t req_local_mem;
    char *tmp_buf;
    uint32_t buf_len;
    uint32_t buf_offset;
+   /* the long shader being received is binary tokens, not text */
+   bool tmp_buf_tokens;
 };
 
 struct vrend_texture {
@@ -501,6 +690,25 @@ struct vrend_streamout_object {
 #define XFB_STATE_STARTED 2
 #define XFB_STATE_PAUSED 3
 
+/* Buffer uploads are copied into a persistently mapped staging buffer and
+ * from there into the resource on the GPU, so they are ordered with the
+ * draws that use the resource without mapping it. Texture uploads use it
+ * as the pixel unpack buffer. The ring is split in
+ * segments, each one fenced when the ring moves past it and waited for
+ * before it is written again. Fences only cover the GL context that
+ * created them, so each sub context has its own ring.
+ */
+#define VREND_STREAM_RING_SEGMENTS 4
+
+struct vrend_stream_ring {
+   GLuint id;
+   uint8_t *map;
+   uint32_t segment_size;
+   uint32_t segment;
+   uint32_t segment_offset;
+   GLsync fences[VREND_STREAM_RING_SEGMENTS];
+};
+
 struct vrend_sub_context {
    struct list_head head;
 
@@ -512,7 +720,8 @@ struct vrend_sub_context {
    uint32_t enabled_attribs_bitmask;
 
    struct list_head programs;
-   struct util_hash_table *object_hash;
+   struct vrend_program_table *program_table;
+   struct vrend_object_table *object_hash;
 
    struct vrend_vertex_element_array *ve;
    int num_vbos;
@@ -533,6 +742,8 @@ struct vrend_sub_context {
    uint32_t long_shader_in_progress_handle[PIPE_SHADER_TYPES];
    struct vrend_shader_selector *shaders[PIPE_SHADER_TYPES];
    struct vrend_linked_shader_program *prog;
+   /* Needed on GLES to inject a TCS */
+   float tess_factors[6];
 
    int prog_ids[PIPE_SHADER_TYPES];
    struct vrend_shader_view views[PIPE_SHADER_TYPES];
@@ -585,6 +796,7 @@ struct vrend_sub_context {
    bool stencil_test_enabled;
 
    GLuint program_id;
+   GLuint pipeline_id;
    int last_shader_idx;
 
    GLint draw_indirect_buffer;
@@ -613,6 +825,15 @@ struct vrend_sub_context {
    struct vrend_context_tweaks tweaks;
    uint8_t swizzle_output_rgb_to_bgr;
    int fake_occlusion_query_samples_passed_multiplier;
+
+   struct vrend_stream_ring *stream_ring;
+
+   /* objects of this sub context that come and go with the guest frames */
+   struct vrend_slab *surface_slab;
+   struct vrend_slab *view_slab;
+   struct vrend_slab *so_target_slab;
+   struct vrend_slab *query_slab;
+   struct vrend_slab *shader_slab;
 };
 
 struct vrend_context {
@@ -634,7 +855,7 @@ struct vrend_context {
    enum virgl_ctx_errors last_error;
 
    /* resource bounds to this context */
-   struct util_hash_table *res_hash;
+   struct vrend_object_table *res_hash;
 
    struct list_head active_nontimer_query_list;
    struct list_head ctx_entry;
@@ -654,8 +875,17 @@ static void vrend_patch_blend_state(struct vrend_context *ctx);
 static void vrend_update_frontface_state(struct vrend_context *ctx);
 static void vrender_get_glsl_version(int *glsl_version);
 static void vrend_destroy_resource_object(void *obj_ptr);
+static void vrend_readback_flush_resource(struct vrend_resource *res);
+static void vrend_readback_discard(void);
 static void vrend_renderer_detach_res_ctx_p(struct vrend_context *ctx, int res_handle);
 static void vrend_destroy_program(struct vrend_linked_shader_program *ent);
+static struct vrend_linked_shader_program *lookup_shader_program(struct vrend_context *ctx,
+                                                                 GLuint vs_id,
+                                                                 GLuint fs_id,
+                                                                 GLuint gs_id,
+                                                                 GLuint tcs_id,
+                                                                 GLuint tes_id,
+                                                                 bool dual_src);
 static void vrend_apply_sampler_state(struct vrend_context *ctx,
                                       struct vrend_resource *res,
                                       uint32_t shader_type,
@@ -880,7 +1110,7 @@ static void vrend_destroy_surface(struct vrend_surface *surf)
    if (surf->id != surf->texture->id)
       glDeleteTextures(1, &surf->id);
    vrend_resource_reference(&surf->texture, NULL);
-   free(surf);
+   vrend_slab_free(surf);
 }
 
 static inline void
@@ -898,7 +1128,7 @@ static void vrend_destroy_sampler_view(struct vrend_sampler_view *samp)
    if (samp->texture->id != samp->id)
       glDeleteTextures(1, &samp->id);
    vrend_resource_reference(&samp->texture, NULL);
-   free(samp);
+   vrend_slab_free(samp);
 }
 
 static inline void
@@ -914,7 +1144,7 @@ vrend_sampler_view_reference(struct vrend_sampler_view **ptr, struct vrend_sampl
 static void vrend_destroy_so_target(struct vrend_so_target *target)
 {
    vrend_resource_reference(&target->buffer, NULL);
-   free(target);
+   vrend_slab_free(target);
 }
 
 static inline void
@@ -935,23 +1165,195 @@ static void vrend_shader_dump(struct vrend_shader *shader)
    vrend_printf("\n");
 }
 
+static unsigned vrend_shader_key_hash(const struct vrend_shader_key *key)
+{
+   return (unsigned)vrend_shader_cache_hash(VREND_SHADER_CACHE_HASH_SEED, key,
+                                            vrend_shader_key_size(key));
+}
+
+static void vrend_shader_set_variant_key(struct vrend_shader *shader)
+{
+   shader->variant_key.key = &shader->key;
+   shader->variant_key.hash = vrend_shader_key_hash(&shader->key);
+}
+
+static unsigned variant_key_hash(void *key)
+{
+   return ((struct vrend_variant_key *)key)->hash;
+}
+
+static int variant_key_compare(void *key1, void *key2)
+{
+   const struct vrend_variant_key *a = key1, *b = key2;
+   size_t size;
+
+   if (a->hash != b->hash)
+      return 1;
+   size = vrend_shader_key_size(a->key);
+   if (size != vrend_shader_key_size(b->key))
+      return 1;
+   return memcmp(a->key, b->key, size);
+}
+
+static void variant_free(UNUSED void *value)
+{
+   /* variants are owned by the selector list */
+}
+
+/* Wait for a queued compile without looking at its result, this has to
+ * happen before the sources or the shader object are touched again.
+ */
+static void vrend_wait_compile_job(struct vrend_compile_job **job)
+{
+   if (!*job)
+      return;
+
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   while (!(*job)->done)
+      pipe_condvar_wait(vrend_state.compile_done_cond, vrend_state.compile_mutex);
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+
+   free(*job);
+   *job = NULL;
+}
+
+static void vrend_shader_sync_compile(struct vrend_shader *shader)
+{
+   vrend_wait_compile_job(&shader->compile_job);
+}
+
+static void vrend_queue_compile_job(struct vrend_compile_job *job)
+{
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   list_addtail(&job->head, &vrend_state.compile_queue);
+   pipe_condvar_signal(vrend_state.compile_cond);
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+}
+
+/* Starts linking the program, on a compile thread if there are any, so
+ * that the decode thread does not run the linker. With
+ * KHR_parallel_shader_compile the driver links in the background.
+ */
+static void vrend_start_link(GLuint prog_id, struct vrend_compile_job **job,
+                             GLint *status)
+{
+   *status = -1;
+
+   if (vrend_state.num_compile_threads) {
+      *job = CALLOC_STRUCT(vrend_compile_job);
+      if (*job) {
+         (*job)->program = prog_id;
+         (*job)->link_status = status;
+         vrend_queue_compile_job(*job);
+         return;
+      }
+   }
+
+   glLinkProgram(prog_id);
+}
+
+static bool vrend_finish_link(GLuint prog_id, struct vrend_compile_job **job,
+                              GLint *status)
+{
+   vrend_wait_compile_job(job);
+   if (*status == -1)
+      glGetProgramiv(prog_id, GL_LINK_STATUS, status);
+   return *status != GL_FALSE;
+}
+
+static bool vrend_shader_is_separable(const struct vrend_shader *shader)
+{
+   if (!vrend_state.use_separable_shaders)
+      return false;
+
+   switch (shader->sel->type) {
+   case PIPE_SHADER_VERTEX:
+      return !shader->key.gs_present && !shader->key.tes_present;
+   case PIPE_SHADER_FRAGMENT:
+      return true;
+   default:
+      return false;
+   }
+}
+
+static void set_stream_out_varyings(struct vrend_context *ctx, int prog_id,
+                                    struct vrend_shader_info *sinfo);
+static void vrend_bind_frag_data_locations(GLuint prog_id, struct vrend_shader *fs,
+                                           bool dual_src);
+static void vrend_bind_attrib_locations(GLuint prog_id, struct vrend_shader *vs);
+
+/* Creates the separable program of the shader and starts linking it. If
+ * the shader is still to be compiled by a compile thread, the link is
+ * added to that job.
+ */
+static void vrend_start_separable(struct vrend_context *ctx,
+                                  struct vrend_shader *shader,
+                                  bool dual_src,
+                                  struct vrend_compile_job *compile_job)
+{
+   struct vrend_separable_program *sep = &shader->separable[dual_src];
+
+   sep->id = glCreateProgram();
+   sep->sampler_base = -1;
+   sep->ubo_base = -1;
+   glProgramParameteri(sep->id, GL_PROGRAM_SEPARABLE, GL_TRUE);
+   glAttachShader(sep->id, shader->id);
+
+   if (shader->sel->type == PIPE_SHADER_VERTEX) {
+      set_stream_out_varyings(ctx, sep->id, &shader->sel->sinfo);
+      vrend_bind_attrib_locations(sep->id, shader);
+   } else
+      vrend_bind_frag_data_locations(sep->id, shader, dual_src);
+
+   if (compile_job) {
+      sep->link_status = -1;
+      compile_job->program = sep->id;
+      compile_job->link_status = &sep->link_status;
+   } else
+      vrend_start_link(sep->id, &sep->link_job, &sep->link_status);
+}
+
+static void vrend_interp_variant_destroy(struct vrend_interp_variant *variant)
+{
+   list_del(&variant->head);
+   vrend_wait_compile_job(&variant->compile_job);
+   glDeleteShader(variant->id);
+   strarray_free(&variant->glsl_strings, true);
+   free(variant->interp_sig.data);
+   free(variant);
+}
+
 static void vrend_shader_destroy(struct vrend_shader *shader)
 {
    struct vrend_linked_shader_program *ent, *tmp;
+   struct vrend_interp_variant *variant, *vtmp;
 
    LIST_FOR_EACH_ENTRY_SAFE(ent, tmp, &shader->programs, sl[shader->sel->type]) {
       vrend_destroy_program(ent);
    }
 
+   LIST_FOR_EACH_ENTRY_SAFE(variant, vtmp, &shader->interp_variants, head) {
+      vrend_interp_variant_destroy(variant);
+   }
+
+   vrend_shader_sync_compile(shader);
+   for (unsigned i = 0; i < ARRAY_SIZE(shader->separable); i++) {
+      vrend_wait_compile_job(&shader->separable[i].link_job);
+      if (shader->separable[i].id)
+         glDeleteProgram(shader->separable[i].id);
+   }
    glDeleteShader(shader->id);
    strarray_free(&shader->glsl_strings, true);
-   free(shader);
+   free(shader->interp_sig.data);
+   vrend_slab_free(shader);
 }
 
 static void vrend_destroy_shader_selector(struct vrend_shader_selector *sel)
 {
-   struct vrend_shader *p = sel->current, *c;
+   struct vrend_shader *p = sel->variants, *c;
    unsigned i;
+   if (sel->variant_table)
+      util_hash_table_destroy(sel->variant_table);
    while (p) {
       c = p->next_variant;
       vrend_shader_destroy(p);
@@ -969,29 +1371,90 @@ static void vrend_destroy_shader_selector(struct vrend_shader_selector *sel)
    free(sel);
 }
 
-static bool vrend_compile_shader(struct vrend_context *ctx,
-                                 struct vrend_shader *shader)
+static bool vrend_shader_wait_compiled(struct vrend_context *ctx,
+                                       struct vrend_shader *shader)
 {
    GLint param;
-   const char *shader_parts[SHADER_MAX_STRINGS];
 
-   for (int i = 0; i < shader->glsl_strings.num_strings; i++)
-      shader_parts[i] = shader->glsl_strings.strings[i].buf;
-   glShaderSource(shader->id, shader->glsl_strings.num_strings, shader_parts, NULL);
-   glCompileShader(shader->id);
+   if (shader->compile_state != VREND_COMPILE_PENDING)
+      return shader->compile_state == VREND_COMPILE_DONE;
+
+   vrend_shader_sync_compile(shader);
+
    glGetShaderiv(shader->id, GL_COMPILE_STATUS, &param);
    if (param == GL_FALSE) {
       char infolog[65536];
       int len;
       glGetShaderInfoLog(shader->id, 65536, &len, infolog);
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
-      vrend_printf("shader failed to compile\n%s\n", infolog);
+      vrend_printf("%s shader %d failed to compile\n%s\n",
+                   pipe_shader_to_prefix(shader->sel->type), shader->id, infolog);
       vrend_shader_dump(shader);
+      shader->compile_state = VREND_COMPILE_FAILED;
       return false;
    }
+   shader->compile_state = VREND_COMPILE_DONE;
    return true;
 }
 
+/* Starts compiling the shader. With async compiles, done by the compile
+ * threads or by the driver in the background, the result is only checked
+ * once the shader is linked, see vrend_shader_wait_compiled.
+ */
+static bool vrend_compile_shader(struct vrend_context *ctx,
+                                 struct vrend_shader *shader)
+{
+   int num_parts = shader->glsl_strings.num_strings;
+   struct vrend_arena *arena = vrend_arena_thread();
+   const char **shader_parts;
+
+   vrend_shader_sync_compile(shader);
+
+   shader->compile_state = VREND_COMPILE_PENDING;
+
+   if (vrend_state.num_compile_threads) {
+      struct vrend_compile_job *job =
+         CALLOC_VARIANT_LENGTH_STRUCT(vrend_compile_job, num_parts * sizeof(const char *));
+      if (job) {
+         job->id = shader->id;
+         job->num_parts = num_parts;
+         for (int i = 0; i < num_parts; i++)
+            job->parts[i] = shader->glsl_strings.strings[i].buf;
+         shader->compile_job = job;
+
+         /* the separable program is linked right after the compile */
+         if (vrend_shader_is_separable(shader) && !shader->separable[0].id)
+            vrend_start_separable(ctx, shader, false, job);
+
+         vrend_queue_compile_job(job);
+         return true;
+      }
+   }
+
+   /* the translation hands out the source in many pieces */
+   vrend_arena_begin(arena);
+   shader_parts = vrend_arena_calloc(arena, num_parts, sizeof(const char *));
+   if (!shader_parts) {
+      vrend_arena_end(arena);
+      report_context_error(ctx, VIRGL_ERROR_CTX_UNKNOWN, 0);
+      shader->compile_state = VREND_COMPILE_FAILED;
+      return false;
+   }
+   for (int i = 0; i < num_parts; i++)
+      shader_parts[i] = shader->glsl_strings.strings[i].buf;
+   glShaderSource(shader->id, num_parts, shader_parts, NULL);
+   vrend_arena_end(arena);
+
+   glCompileShader(shader->id);
+   if (vrend_state.async_compile) {
+      if (vrend_shader_is_separable(shader) && !shader->separable[0].id)
+         vrend_start_separable(ctx, shader, false, NULL);
+      return true;
+   }
+
+   return vrend_shader_wait_compiled(ctx, shader);
+}
+
 static inline void
 vrend_shader_state_reference(struct vrend_shader_selector **ptr, struct vrend_shader_selector *shader)
 {
@@ -1028,22 +1491,27 @@ vrend_format_replace_emulated(uint32_t bind, enum pipe_format format)
    enum virgl_formats retval = (enum virgl_formats)format;
 
    if (vrend_state.use_gles && (bind & VIRGL_BIND_PREFER_EMULATED_BGRA)) {
-      VREND_DEBUG(dbg_tweak, vrend_state.current_ctx, "Check tweak for format %s", util_format_name(format));
-      if (!vrend_state.bgra_srgb_emulation_loaded) {
-         GLint err = glGetError();
-         if (err != GL_NO_ERROR)
-            vrend_printf("Warning: stale error state when calling %s\n", __func__);
-         VREND_DEBUG_NOCTX(dbg_tweak, vrend_state.current_ctx, " ... add swizzled formats\n");
-         vrend_build_emulated_format_list_gles();
-         vrend_check_texture_storage(tex_conv_table);
-         vrend_state.bgra_srgb_emulation_loaded = true;
+      VREND_DEBUG(dbg_tweak, vrend_tls.current_ctx, "Check tweak for format %s", util_format_name(format));
+      /* decode threads can get here at the same time */
+      if (!p_atomic_read(&vrend_state.bgra_srgb_emulation_loaded)) {
+         pipe_mutex_lock(vrend_format_mutex);
+         if (!vrend_state.bgra_srgb_emulation_loaded) {
+            GLint err = glGetError();
+            if (err != GL_NO_ERROR)
+               vrend_printf("Warning: stale error state when calling %s\n", __func__);
+            VREND_DEBUG_NOCTX(dbg_tweak, vrend_tls.current_ctx, " ... add swizzled formats\n");
+            vrend_build_emulated_format_list_gles();
+            vrend_check_texture_storage(tex_conv_table);
+            p_atomic_set(&vrend_state.bgra_srgb_emulation_loaded, true);
+         }
+         pipe_mutex_unlock(vrend_format_mutex);
       }
       if (format == PIPE_FORMAT_B8G8R8A8_UNORM)
          retval = VIRGL_FORMAT_B8G8R8A8_UNORM_EMULATED;
       else if (format == PIPE_FORMAT_B8G8R8X8_UNORM)
          retval = VIRGL_FORMAT_B8G8R8X8_UNORM_EMULATED;
 
-      VREND_DEBUG_NOCTX(dbg_tweak, vrend_state.current_ctx,
+      VREND_DEBUG_NOCTX(dbg_tweak, vrend_tls.current_ctx,
                         "%s\n", (retval != (enum virgl_formats)format ? "... replace" : ""));
    }
    return retval;
@@ -1074,6 +1542,43 @@ static void vrend_use_program(struct vrend_context *ctx, GLuint program_id)
    }
 }
 
+/* a pipeline is only used while no program is */
+static void vrend_use_linked_program(struct vrend_context *ctx,
+                                     struct vrend_linked_shader_program *sprog)
+{
+   if (!sprog->is_pipeline) {
+      vrend_use_program(ctx, sprog->id);
+      return;
+   }
+
+   vrend_use_program(ctx, 0);
+   if (ctx->sub->pipeline_id != sprog->id) {
+      glBindProgramPipeline(sprog->id);
+      ctx->sub->pipeline_id = sprog->id;
+   }
+}
+
+static inline GLuint vrend_program_stage_id(const struct vrend_linked_shader_program *sprog,
+                                            int type)
+{
+   return sprog->is_pipeline ? sprog->stage_ids[type] : sprog->id;
+}
+
+/* makes glUniform* of a pipeline go to the program of the given stage */
+static inline void vrend_program_select_stage(const struct vrend_linked_shader_program *sprog,
+                                              int type)
+{
+   if (sprog->is_pipeline && sprog->stage_ids[type])
+      glActiveShaderProgram(sprog->id, sprog->stage_ids[type]);
+}
+
+static inline struct vrend_separable_program *
+vrend_program_separable(struct vrend_linked_shader_program *sprog, int type)
+{
+   return &sprog->ss[type]->separable[type == PIPE_SHADER_FRAGMENT &&
+                                      sprog->dual_src_linked];
+}
+
 static void vrend_init_pstipple_texture(struct vrend_context *ctx)
 {
    glGenTextures(1, &ctx->pstipple_tex_id);
@@ -1233,11 +1738,14 @@ static void set_stream_out_varyings(struct vrend_context *ctx, int prog_id,
 static int bind_sampler_locs(struct vrend_linked_shader_program *sprog,
                              int id, int next_sampler_id)
 {
+   GLuint prog_id = vrend_program_stage_id(sprog, id);
+
    if (sprog->ss[id]->sel->sinfo.samplers_used_mask) {
       uint32_t mask = sprog->ss[id]->sel->sinfo.samplers_used_mask;
       int nsamp = util_bitcount(sprog->ss[id]->sel->sinfo.samplers_used_mask);
       int index;
       sprog->shadow_samp_mask[id] = sprog->ss[id]->sel->sinfo.shadow_samp_mask;
+      sprog->samp_locs[id] = calloc(nsamp, sizeof(GLint));
       if (sprog->ss[id]->sel->sinfo.shadow_samp_mask) {
          sprog->shadow_samp_mask_locs[id] = calloc(nsamp, sizeof(uint32_t));
          sprog->shadow_samp_add_locs[id] = calloc(nsamp, sizeof(uint32_t));
@@ -1255,17 +1763,24 @@ static int bind_sampler_locs(struct vrend_linked_shader_program *sprog,
          } else
             snprintf(name, 32, "%ssamp%d", prefix, i);
 
-         glUniform1i(glGetUniformLocation(sprog->id, name), next_sampler_id++);
+         GLint loc = glGetUniformLocation(prog_id, name);
+         if (sprog->samp_locs[id])
+            sprog->samp_locs[id][index] = loc;
+         if (sprog->is_pipeline)
+            glProgramUniform1i(prog_id, loc, next_sampler_id++);
+         else
+            glUniform1i(loc, next_sampler_id++);
 
          if (sprog->ss[id]->sel->sinfo.shadow_samp_mask & (1 << i)) {
             snprintf(name, 32, "%sshadmask%d", prefix, i);
-            sprog->shadow_samp_mask_locs[id][index] = glGetUniformLocation(sprog->id, name);
+            sprog->shadow_samp_mask_locs[id][index] = glGetUniformLocation(prog_id, name);
             snprintf(name, 32, "%sshadadd%d", prefix, i);
-            sprog->shadow_samp_add_locs[id][index] = glGetUniformLocation(sprog->id, name);
+            sprog->shadow_samp_add_locs[id][index] = glGetUniformLocation(prog_id, name);
          }
          index++;
       }
    } else {
+      sprog->samp_locs[id] = NULL;
       sprog->shadow_samp_mask_locs[id] = NULL;
       sprog->shadow_samp_add_locs[id] = NULL;
       sprog->shadow_samp_mask[id] = 0;
@@ -1281,7 +1796,7 @@ static void bind_const_locs(struct vrend_linked_shader_program *sprog,
   if (sprog->ss[id]->sel->sinfo.num_consts) {
      char name[32];
      snprintf(name, 32, "%sconst0", pipe_shader_to_prefix(id));
-     sprog->const_location[id] = glGetUniformLocation(sprog->id, name);
+     sprog->const_location[id] = glGetUniformLocation(vrend_program_stage_id(sprog, id), name);
   } else
       sprog->const_location[id] = -1;
 }
@@ -1293,8 +1808,11 @@ static int bind_ubo_locs(struct vrend_linked_shader_program *sprog,
       return next_ubo_id;
    if (sprog->ss[id]->sel->sinfo.ubo_used_mask) {
       const char *prefix = pipe_shader_to_prefix(id);
+      GLuint prog_id = vrend_program_stage_id(sprog, id);
 
       unsigned mask = sprog->ss[id]->sel->sinfo.ubo_used_mask;
+      int index = 0;
+      sprog->ubo_locs[id] = calloc(util_bitcount(mask), sizeof(GLuint));
       while (mask) {
          uint32_t ubo_idx = u_bit_scan(&mask);
          char name[32];
@@ -1303,8 +1821,10 @@ static int bind_ubo_locs(struct vrend_linked_shader_program *sprog,
          else
             snprintf(name, 32, "%subo%d", prefix, ubo_idx);
 
-         GLuint loc = glGetUniformBlockIndex(sprog->id, name);
-         glUniformBlockBinding(sprog->id, loc, next_ubo_id++);
+         GLuint loc = glGetUniformBlockIndex(prog_id, name);
+         if (sprog->ubo_locs[id])
+            sprog->ubo_locs[id][index++] = loc;
+         glUniformBlockBinding(prog_id, loc, next_ubo_id++);
       }
    }
 
@@ -1328,7 +1848,8 @@ static void bind_ssbo_locs(struct vrend_linked_shader_program *sprog,
       while (mask) {
          i = u_bit_scan(&mask);
          snprintf(name, 32, "%sssbo%d", prefix, i);
-         sprog->ssbo_locs[id][i] = glGetProgramResourceIndex(sprog->id, GL_SHADER_STORAGE_BLOCK, name);
+         sprog->ssbo_locs[id][i] = glGetProgramResourceIndex(vrend_program_stage_id(sprog, id),
+                                                             GL_SHADER_STORAGE_BLOCK, name);
       }
    } else
       sprog->ssbo_locs[id] = NULL;
@@ -1341,6 +1862,7 @@ static void bind_image_locs(struct vrend_linked_shader_program *sprog,
    int i;
    char name[32];
    const char *prefix = pipe_shader_to_prefix(id);
+   GLuint prog_id = vrend_program_stage_id(sprog, id);
 
    uint32_t mask = sprog->ss[id]->sel->sinfo.images_used_mask;
    if (!mask && ! sprog->ss[id]->sel->sinfo.num_image_arrays)
@@ -1362,7 +1884,7 @@ static void bind_image_locs(struct vrend_linked_shader_program *sprog,
          struct vrend_array *img_array = &sprog->ss[id]->sel->sinfo.image_arrays[i];
          for (int j = 0; j < img_array->array_size; j++) {
             snprintf(name, 32, "%simg%d[%d]", prefix, img_array->first, j);
-            sprog->img_locs[id][img_array->first + j] = glGetUniformLocation(sprog->id, name);
+            sprog->img_locs[id][img_array->first + j] = glGetUniformLocation(prog_id, name);
             if (sprog->img_locs[id][img_array->first + j] == -1)
                vrend_printf( "failed to get uniform loc for image %s\n", name);
          }
@@ -1371,7 +1893,7 @@ static void bind_image_locs(struct vrend_linked_shader_program *sprog,
       for (i = 0; i < nsamp; i++) {
          if (mask & (1 << i)) {
             snprintf(name, 32, "%simg%d", prefix, i);
-            sprog->img_locs[id][i] = glGetUniformLocation(sprog->id, name);
+            sprog->img_locs[id][i] = glGetUniformLocation(prog_id, name);
             if (sprog->img_locs[id][i] == -1)
                vrend_printf( "failed to get uniform loc for image %s\n", name);
          } else {
@@ -1382,18 +1904,47 @@ static void bind_image_locs(struct vrend_linked_shader_program *sprog,
    sprog->images_used_mask[id] = mask;
 }
 
+/* programs are linked and looked up with the same dual source state, a
+ * fragment shader with a single output never links as dual source */
+static bool vrend_program_dual_src(struct vrend_context *ctx,
+                                   struct vrend_shader *fs)
+{
+   return fs->sel->sinfo.num_outputs > 1 &&
+          util_blend_state_is_dual(&ctx->sub->blend_state, 0);
+}
+
+static void vrend_add_program(struct vrend_sub_context *sub,
+                              struct vrend_linked_shader_program *sprog)
+{
+   int i;
+
+   for (i = 0; i < PIPE_SHADER_TYPES; i++)
+      sprog->key.ids[i] = sprog->ss[i] ? sprog->ss[i]->id : 0;
+   sprog->key.dual_src = sprog->dual_src_linked;
+   sprog->sub_ctx = sub;
+
+   list_addtail(&sprog->head, &sub->programs);
+   if (vrend_program_table_insert(sub->program_table, &sprog->key, sprog))
+      vrend_printf("failed to index linked program %d\n", sprog->id);
+}
+
 static struct vrend_linked_shader_program *add_cs_shader_program(struct vrend_context *ctx,
                                                                  struct vrend_shader *cs)
 {
-   struct vrend_linked_shader_program *sprog = CALLOC_STRUCT(vrend_linked_shader_program);
+   struct vrend_linked_shader_program *sprog;
+   struct vrend_compile_job *link_job = NULL;
    GLuint prog_id;
    GLint lret;
+
+   if (!vrend_shader_wait_compiled(ctx, cs))
+      return NULL;
+
+   sprog = CALLOC_STRUCT(vrend_linked_shader_program);
    prog_id = glCreateProgram();
    glAttachShader(prog_id, cs->id);
-   glLinkProgram(prog_id);
+   vrend_start_link(prog_id, &link_job, &lret);
 
-   glGetProgramiv(prog_id, GL_LINK_STATUS, &lret);
-   if (lret == GL_FALSE) {
+   if (!vrend_finish_link(prog_id, &link_job, &lret)) {
       char infolog[65536];
       int len;
       glGetProgramInfoLog(prog_id, 65536, &len, infolog);
@@ -1409,7 +1960,7 @@ static struct vrend_linked_shader_program *add_cs_shader_program(struct vrend_co
 
    list_add(&sprog->sl[PIPE_SHADER_COMPUTE], &cs->programs);
    sprog->id = prog_id;
-   list_addtail(&sprog->head, &ctx->sub->programs);
+   vrend_add_program(ctx->sub, sprog);
 
    vrend_use_program(ctx, prog_id);
 
@@ -1421,6 +1972,514 @@ static struct vrend_linked_shader_program *add_cs_shader_program(struct vrend_co
    return sprog;
 }
 
+static void vrend_free_program_locs(struct vrend_linked_shader_program *sprog)
+{
+   for (int i = PIPE_SHADER_VERTEX; i <= PIPE_SHADER_COMPUTE; i++) {
+      free(sprog->samp_locs[i]);
+      free(sprog->shadow_samp_mask_locs[i]);
+      free(sprog->shadow_samp_add_locs[i]);
+      free(sprog->ubo_locs[i]);
+      free(sprog->ssbo_locs[i]);
+      free(sprog->img_locs[i]);
+      sprog->samp_locs[i] = NULL;
+      sprog->shadow_samp_mask_locs[i] = NULL;
+      sprog->shadow_samp_add_locs[i] = NULL;
+      sprog->ubo_locs[i] = NULL;
+      sprog->ssbo_locs[i] = NULL;
+      sprog->img_locs[i] = NULL;
+   }
+   free(sprog->attrib_locs);
+   sprog->attrib_locs = NULL;
+}
+
+/* Linked programs can be stored as driver binaries in the shader cache.
+ * The key identifies the driver and the GLSL sources of the attached
+ * shaders; the data holds the binary together with every location that
+ * add_shader_program would otherwise have to query after linking.
+ */
+struct vrend_program_cache_key {
+   uint64_t driver_hash;
+   uint64_t source_hash[PIPE_SHADER_TYPES];
+   struct pipe_stream_output_info so_info;
+   bool dual_src;
+   bool bind_attribs;
+};
+
+static bool vrend_program_cache_enabled(void)
+{
+   return vrend_shader_cache_enabled() && has_feature(feat_get_program_binary);
+}
+
+static uint64_t hash_shader_sources(const struct vrend_shader *shader)
+{
+   uint64_t hash = VREND_SHADER_CACHE_HASH_SEED;
+
+   for (int i = 0; i < shader->glsl_strings.num_strings; i++)
+      hash = vrend_shader_cache_hash(hash, shader->glsl_strings.strings[i].buf,
+                                     shader->glsl_strings.strings[i].size);
+   return hash;
+}
+
+static void program_cache_key(struct vrend_cache_blob *blob,
+                              const struct vrend_linked_shader_program *sprog,
+                              const struct vrend_shader_info *so_sinfo)
+{
+   struct vrend_program_cache_key key;
+
+   memset(&key, 0, sizeof(key));
+   key.driver_hash = vrend_state.program_cache_driver_hash;
+   for (int i = PIPE_SHADER_VERTEX; i < PIPE_SHADER_COMPUTE; i++) {
+      if (sprog->ss[i] && sprog->ss[i]->id > 0)
+         key.source_hash[i] = hash_shader_sources(sprog->ss[i]);
+   }
+   key.so_info = so_sinfo->so_info;
+   key.dual_src = sprog->dual_src_linked;
+   key.bind_attribs = has_feature(feat_gles31_vertex_attrib_binding);
+   vrend_cache_blob_write(blob, &key, sizeof(key));
+}
+
+static void program_cache_write_locs(struct vrend_cache_blob *blob,
+                                     const void *locs, uint32_t count)
+{
+   STATIC_ASSERT(sizeof(GLint) == sizeof(uint32_t));
+   if (!locs)
+      count = 0;
+   vrend_cache_blob_write_u32(blob, count);
+   vrend_cache_blob_write(blob, locs, count * sizeof(uint32_t));
+}
+
+static bool program_cache_read_locs(struct vrend_cache_reader *reader,
+                                    void *locs, uint32_t count)
+{
+   const void *ptr;
+
+   if (vrend_cache_reader_read_u32(reader) != count)
+      return false;
+   ptr = vrend_cache_reader_read(reader, count * sizeof(uint32_t));
+   if (!ptr)
+      return false;
+   memcpy(locs, ptr, count * sizeof(uint32_t));
+   return true;
+}
+
+static bool program_cache_read_locs_alloc(struct vrend_cache_reader *reader,
+                                          void *plocs, uint32_t count)
+{
+   void **locs = plocs;
+
+   *locs = NULL;
+   if (!count)
+      return program_cache_read_locs(reader, NULL, 0);
+
+   *locs = calloc(count, sizeof(uint32_t));
+   if (!*locs)
+      return false;
+   return program_cache_read_locs(reader, *locs, count);
+}
+
+static void program_cache_store(struct vrend_linked_shader_program *sprog,
+                                const struct vrend_cache_blob *key,
+                                int last_shader)
+{
+   struct vrend_cache_blob blob = {0};
+   const struct vrend_shader_info *vs_info = &sprog->ss[PIPE_SHADER_VERTEX]->sel->sinfo;
+   GLint length = 0;
+   GLenum format;
+   void *binary;
+
+   glGetProgramiv(sprog->id, GL_PROGRAM_BINARY_LENGTH, &length);
+   if (length <= 0)
+      return;
+
+   binary = malloc(length);
+   if (!binary)
+      return;
+
+   glGetProgramBinary(sprog->id, length, &length, &format, binary);
+   vrend_cache_blob_write_u32(&blob, format);
+   vrend_cache_blob_write_u32(&blob, length);
+   vrend_cache_blob_write(&blob, binary, length);
+   free(binary);
+
+   program_cache_write_locs(&blob, &sprog->fs_stipple_loc, 1);
+   program_cache_write_locs(&blob, &sprog->vs_ws_adjust_loc, 1);
+
+   for (int id = PIPE_SHADER_VERTEX; id <= last_shader; id++) {
+      if (!sprog->ss[id])
+         continue;
+
+      uint32_t nsamp = util_bitcount(sprog->samplers_used_mask[id]);
+      program_cache_write_locs(&blob, sprog->samp_locs[id], nsamp);
+      program_cache_write_locs(&blob, sprog->shadow_samp_mask_locs[id], nsamp);
+      program_cache_write_locs(&blob, sprog->shadow_samp_add_locs[id], nsamp);
+      program_cache_write_locs(&blob, &sprog->const_location[id], 1);
+      program_cache_write_locs(&blob, sprog->ubo_locs[id],
+                               util_bitcount(sprog->ubo_used_mask[id]));
+      program_cache_write_locs(&blob, sprog->img_locs[id],
+                               util_last_bit(sprog->images_used_mask[id]));
+      program_cache_write_locs(&blob, sprog->ssbo_locs[id],
+                               util_last_bit(sprog->ssbo_used_mask[id]));
+   }
+
+   program_cache_write_locs(&blob, sprog->attrib_locs, vs_info->num_inputs);
+   program_cache_write_locs(&blob, sprog->clip_locs, vs_info->num_ucp);
+
+   vrend_program_cache_store(key, &blob);
+   free(blob.data);
+}
+
+/* Mirrors what the bind_*_locs functions set up after a full link. */
+static bool program_cache_restore_locs(struct vrend_linked_shader_program *sprog,
+                                       struct vrend_cache_reader *reader,
+                                       int last_shader)
+{
+   const struct vrend_shader_info *vs_info = &sprog->ss[PIPE_SHADER_VERTEX]->sel->sinfo;
+   int next_ubo_id = 0, next_sampler_id = 0;
+
+   if (!program_cache_read_locs(reader, &sprog->fs_stipple_loc, 1) ||
+       !program_cache_read_locs(reader, &sprog->vs_ws_adjust_loc, 1))
+      return false;
+
+   for (int id = PIPE_SHADER_VERTEX; id <= last_shader; id++) {
+      if (!sprog->ss[id])
+         continue;
+
+      const struct vrend_shader_info *sinfo = &sprog->ss[id]->sel->sinfo;
+      uint32_t nsamp = util_bitcount(sinfo->samplers_used_mask);
+      uint32_t nshadow = nsamp && sinfo->shadow_samp_mask ? nsamp : 0;
+      uint32_t ubo_mask = has_feature(feat_ubo) ? sinfo->ubo_used_mask : 0;
+      uint32_t img_mask = has_feature(feat_images) ? sinfo->images_used_mask : 0;
+      uint32_t ssbo_mask = has_feature(feat_ssbo) ? sinfo->ssbo_used_mask : 0;
+
+      sprog->samplers_used_mask[id] = sinfo->samplers_used_mask;
+      sprog->shadow_samp_mask[id] = nsamp ? sinfo->shadow_samp_mask : 0;
+      if (has_feature(feat_ubo))
+         sprog->ubo_used_mask[id] = sinfo->ubo_used_mask;
+      if (img_mask)
+         sprog->images_used_mask[id] = img_mask;
+      if (has_feature(feat_ssbo))
+         sprog->ssbo_used_mask[id] = sinfo->ssbo_used_mask;
+
+      if (!program_cache_read_locs_alloc(reader, &sprog->samp_locs[id], nsamp) ||
+          !program_cache_read_locs_alloc(reader, &sprog->shadow_samp_mask_locs[id], nshadow) ||
+          !program_cache_read_locs_alloc(reader, &sprog->shadow_samp_add_locs[id], nshadow) ||
+          !program_cache_read_locs(reader, &sprog->const_location[id], 1) ||
+          !program_cache_read_locs_alloc(reader, &sprog->ubo_locs[id], util_bitcount(ubo_mask)) ||
+          !program_cache_read_locs_alloc(reader, &sprog->img_locs[id], util_last_bit(img_mask)) ||
+          !program_cache_read_locs_alloc(reader, &sprog->ssbo_locs[id], util_last_bit(ssbo_mask)))
+         return false;
+
+      /* loading a binary resets the uniforms and block bindings */
+      for (uint32_t i = 0; i < nsamp; i++)
+         glUniform1i(sprog->samp_locs[id][i], next_sampler_id++);
+      for (uint32_t i = 0; i < util_bitcount(ubo_mask); i++)
+         glUniformBlockBinding(sprog->id, sprog->ubo_locs[id][i], next_ubo_id++);
+   }
+
+   if (!program_cache_read_locs_alloc(reader, &sprog->attrib_locs,
+                                      has_feature(feat_gles31_vertex_attrib_binding) ?
+                                      0 : vs_info->num_inputs) ||
+       !program_cache_read_locs(reader, sprog->clip_locs, vs_info->num_ucp))
+      return false;
+
+   return !reader->error && reader->offset == reader->size;
+}
+
+static GLuint program_cache_load(struct vrend_context *ctx,
+                                 struct vrend_linked_shader_program *sprog,
+                                 const struct vrend_cache_blob *key,
+                                 int last_shader)
+{
+   struct vrend_cache_blob data = {0};
+   struct vrend_cache_reader reader = {0};
+   const void *binary;
+   GLenum format;
+   GLint lret;
+   uint32_t length;
+
+   if (!vrend_program_cache_lookup(key, &data))
+      return 0;
+
+   reader.data = data.data;
+   reader.size = data.size;
+   format = vrend_cache_reader_read_u32(&reader);
+   length = vrend_cache_reader_read_u32(&reader);
+   binary = vrend_cache_reader_read(&reader, length);
+   if (!binary)
+      goto fail;
+
+   sprog->id = glCreateProgram();
+   glProgramBinary(sprog->id, format, binary, length);
+   glGetProgramiv(sprog->id, GL_LINK_STATUS, &lret);
+   if (lret == GL_FALSE) {
+      VREND_DEBUG(dbg_shader, ctx, "driver rejected cached program binary\n");
+      goto fail;
+   }
+
+   vrend_use_program(ctx, sprog->id);
+   if (!program_cache_restore_locs(sprog, &reader, last_shader)) {
+      vrend_use_program(ctx, 0);
+      goto fail;
+   }
+
+   free(data.data);
+   return sprog->id;
+
+fail:
+   vrend_free_program_locs(sprog);
+   if (sprog->id)
+      glDeleteProgram(sprog->id);
+   sprog->id = 0;
+   vrend_program_cache_reject(key);
+   free(data.data);
+   return 0;
+}
+
+static inline int conv_shader_type(int type)
+{
+   switch (type) {
+   case PIPE_SHADER_VERTEX: return GL_VERTEX_SHADER;
+   case PIPE_SHADER_FRAGMENT: return GL_FRAGMENT_SHADER;
+   case PIPE_SHADER_GEOMETRY: return GL_GEOMETRY_SHADER;
+   case PIPE_SHADER_TESS_CTRL: return GL_TESS_CONTROL_SHADER;
+   case PIPE_SHADER_TESS_EVAL: return GL_TESS_EVALUATION_SHADER;
+   case PIPE_SHADER_COMPUTE: return GL_COMPUTE_SHADER;
+   default:
+      return 0;
+   };
+}
+
+static bool vrend_strarray_copy(struct vrend_strarray *dst,
+                                const struct vrend_strarray *src)
+{
+   if (!strarray_alloc(dst, src->num_alloced_strings))
+      return false;
+
+   for (int i = 0; i < src->num_strings; i++) {
+      struct vrend_strbuf sb;
+      if (!strbuf_alloc(&sb, src->strings[i].size + 1)) {
+         strarray_free(dst, true);
+         return false;
+      }
+      strbuf_append_buffer(&sb, src->strings[i].buf, src->strings[i].size);
+      sb.tag = src->strings[i].tag;
+      strarray_addstrbuf(dst, &sb);
+   }
+   return true;
+}
+
+static void vrend_interp_sig(struct vrend_cache_blob *sig,
+                             const struct vrend_shader *fs)
+{
+   const struct vrend_shader_info *fs_info = &fs->sel->sinfo;
+   int num_interps = fs_info->interpinfo ? fs_info->num_interps : 0;
+
+   vrend_cache_blob_write_u32(sig, fs->key.flatshade);
+   vrend_cache_blob_write_u32(sig, fs_info->has_sample_input);
+   vrend_cache_blob_write_u32(sig, fs_info->glsl_ver < 140);
+   vrend_cache_blob_write_u32(sig, num_interps);
+   vrend_cache_blob_write(sig, fs_info->interpinfo,
+                          num_interps * sizeof(struct vrend_interp_info));
+}
+
+static bool vrend_interp_sig_equal(const struct vrend_cache_blob *a,
+                                   const struct vrend_cache_blob *b)
+{
+   return a->size == b->size && !memcmp(a->data, b->data, a->size);
+}
+
+static void vrend_interp_variant_swap(struct vrend_shader *shader,
+                                      struct vrend_interp_variant *variant)
+{
+   struct vrend_interp_variant tmp = *variant;
+
+   variant->interp_sig = shader->interp_sig;
+   variant->id = shader->id;
+   variant->glsl_strings = shader->glsl_strings;
+   variant->compile_state = shader->compile_state;
+   variant->compile_job = shader->compile_job;
+
+   shader->interp_sig = tmp.interp_sig;
+   shader->id = tmp.id;
+   shader->glsl_strings = tmp.glsl_strings;
+   shader->compile_state = tmp.compile_state;
+   shader->compile_job = tmp.compile_job;
+}
+
+/* Moves the current object of the shader to the variant list and leaves
+ * an unpatched copy of the sources to be compiled into a new object.
+ */
+static bool vrend_shader_stash_interp_variant(struct vrend_shader *shader)
+{
+   struct vrend_interp_variant *variant = CALLOC_STRUCT(vrend_interp_variant);
+   struct vrend_strarray strings;
+
+   if (!variant)
+      return false;
+
+   if (!vrend_strarray_copy(&strings, &shader->glsl_strings)) {
+      free(variant);
+      return false;
+   }
+
+   vrend_interp_variant_swap(shader, variant);
+   shader->glsl_strings = strings;
+   shader->id = glCreateShader(conv_shader_type(shader->sel->type));
+
+   list_add(&variant->head, &shader->interp_variants);
+   if (++shader->num_interp_variants > VREND_MAX_INTERP_VARIANTS) {
+      struct vrend_interp_variant *oldest = LIST_ENTRY(struct vrend_interp_variant,
+                                                       shader->interp_variants.prev, head);
+      struct vrend_linked_shader_program *ent, *tmp;
+      unsigned type = shader->sel->type;
+
+      /* GL may hand out the id again, drop the programs that use it */
+      LIST_FOR_EACH_ENTRY_SAFE(ent, tmp, &shader->programs, sl[type]) {
+         if (ent->key.ids[type] == oldest->id)
+            vrend_destroy_program(ent);
+      }
+      vrend_interp_variant_destroy(oldest);
+      shader->num_interp_variants--;
+   }
+   return true;
+}
+
+/* Makes the outputs of shader match the interpolation qualifiers of fs,
+ * reusing the object compiled for an earlier fragment shader if possible.
+ */
+static bool vrend_shader_patch_interp(struct vrend_context *ctx,
+                                      struct vrend_shader *shader,
+                                      struct vrend_shader *fs)
+{
+   struct vrend_cache_blob sig = {0};
+   struct vrend_interp_variant *variant;
+
+   vrend_interp_sig(&sig, fs);
+   if (!sig.error) {
+      if (vrend_interp_sig_equal(&shader->interp_sig, &sig)) {
+         free(sig.data);
+         return true;
+      }
+
+      LIST_FOR_EACH_ENTRY(variant, &shader->interp_variants, head) {
+         if (vrend_interp_sig_equal(&variant->interp_sig, &sig)) {
+            list_del(&variant->head);
+            vrend_interp_variant_swap(shader, variant);
+            list_add(&variant->head, &shader->interp_variants);
+            free(sig.data);
+            return true;
+         }
+      }
+
+      /* an object that was never patched is not worth keeping */
+      if (shader->interp_sig.size)
+         vrend_shader_stash_interp_variant(shader);
+   }
+
+   vrend_shader_sync_compile(shader);
+   vrend_patch_vertex_shader_interpolants(ctx, &ctx->shader_cfg, &shader->glsl_strings,
+                                          &shader->sel->sinfo, &fs->sel->sinfo,
+                                          fs->key.flatshade);
+
+   free(shader->interp_sig.data);
+   if (sig.error) {
+      free(sig.data);
+      memset(&shader->interp_sig, 0, sizeof(shader->interp_sig));
+   } else
+      shader->interp_sig = sig;
+
+   return vrend_compile_shader(ctx, shader);
+}
+
+static void vrend_bind_frag_data_locations(GLuint prog_id, struct vrend_shader *fs,
+                                           bool dual_src)
+{
+   if (fs->sel->sinfo.num_outputs <= 1)
+      return;
+
+   if (dual_src) {
+      glBindFragDataLocationIndexed(prog_id, 0, 0, "fsout_c0");
+      glBindFragDataLocationIndexed(prog_id, 0, 1, "fsout_c1");
+   } else {
+      glBindFragDataLocationIndexed(prog_id, 0, 0, "fsout_c0");
+      glBindFragDataLocationIndexed(prog_id, 1, 0, "fsout_c1");
+   }
+}
+
+static void vrend_bind_attrib_locations(GLuint prog_id, struct vrend_shader *vs)
+{
+   uint32_t mask = vs->sel->sinfo.attrib_input_mask;
+   char name[32];
+
+   if (!has_feature(feat_gles31_vertex_attrib_binding))
+      return;
+
+   while (mask) {
+      int i = u_bit_scan(&mask);
+      snprintf(name, 32, "in_%d", i);
+      glBindAttribLocation(prog_id, i, name);
+   }
+}
+
+/* Finishes the link of the vertex or fragment shader into a separable
+ * program, starting it first if that was not done when the shader was
+ * compiled. Its outputs are never patched for a fragment shader, GLSL 4.40
+ * lets the interpolation of the fragment shader win.
+ */
+static bool vrend_link_separable(struct vrend_context *ctx,
+                                 struct vrend_shader *shader,
+                                 bool dual_src)
+{
+   struct vrend_separable_program *sep = &shader->separable[dual_src];
+
+   if (!vrend_shader_wait_compiled(ctx, shader))
+      return false;
+
+   if (!sep->id)
+      vrend_start_separable(ctx, shader, dual_src, NULL);
+   else if (sep->link_status == GL_TRUE)
+      return true;
+
+   if (!vrend_finish_link(sep->id, &sep->link_job, &sep->link_status)) {
+      char infolog[65536];
+      int len;
+      glGetProgramInfoLog(sep->id, 65536, &len, infolog);
+      vrend_printf("got error linking separable %s shader\n%s\n",
+                   pipe_shader_to_prefix(shader->sel->type), infolog);
+      report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
+      vrend_shader_dump(shader);
+      glDeleteProgram(sep->id);
+      sep->id = 0;
+      return false;
+   }
+   return true;
+}
+
+/* A separable program keeps the sampler units and uniform block bindings
+ * of the pipeline that last wrote them, rewrite them if they differ.
+ */
+static void vrend_pipeline_update_bindings(struct vrend_linked_shader_program *sprog)
+{
+   for (int id = PIPE_SHADER_VERTEX; id <= PIPE_SHADER_FRAGMENT; id++) {
+      struct vrend_separable_program *sep = vrend_program_separable(sprog, id);
+      unsigned i;
+
+      if (sep->sampler_base != sprog->sampler_base[id]) {
+         for (i = 0; i < util_bitcount(sprog->samplers_used_mask[id]); i++)
+            glProgramUniform1i(sep->id, sprog->samp_locs[id][i],
+                               sprog->sampler_base[id] + i);
+         sep->sampler_base = sprog->sampler_base[id];
+      }
+
+      if (sep->ubo_base != sprog->ubo_base[id]) {
+         for (i = 0; i < util_bitcount(sprog->ubo_used_mask[id]); i++)
+            glUniformBlockBinding(sep->id, sprog->ubo_locs[id][i],
+                                  sprog->ubo_base[id] + i);
+         sep->ubo_base = sprog->ubo_base[id];
+      }
+   }
+}
+
 static struct vrend_linked_shader_program *add_shader_program(struct vrend_context *ctx,
                                                               struct vrend_shader *vs,
                                                               struct vrend_shader *fs,
@@ -1429,16 +2488,22 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
                                                               struct vrend_shader *tes)
 {
    struct vrend_linked_shader_program *sprog = CALLOC_STRUCT(vrend_linked_shader_program);
+   struct vrend_cache_blob cache_key = {0};
    char name[64];
    int i;
-   GLuint prog_id;
+   struct vrend_compile_job *link_job = NULL;
+   GLuint prog_id = 0;
    GLint lret;
    int id;
    int last_shader;
    bool do_patch = false;
+   bool cached = false;
    if (!sprog)
       return NULL;
 
+   sprog->dual_src_linked = vrend_program_dual_src(ctx, fs);
+   sprog->is_pipeline = vrend_state.use_separable_shaders && !gs && !tcs && !tes;
+
    /* need to rewrite VS code to add interpolation params */
    if (gs && gs->compiled_fs_id != fs->id)
       do_patch = true;
@@ -1447,99 +2512,106 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
    if (!gs && !tes && vs->compiled_fs_id != fs->id)
       do_patch = true;
 
-   if (do_patch) {
-      bool ret;
-
-      if (gs)
-         vrend_patch_vertex_shader_interpolants(ctx, &ctx->shader_cfg, &gs->glsl_strings,
-                                                &gs->sel->sinfo,
-                                                &fs->sel->sinfo, "gso", fs->key.flatshade);
-      else if (tes)
-         vrend_patch_vertex_shader_interpolants(ctx, &ctx->shader_cfg, &tes->glsl_strings,
-                                                &tes->sel->sinfo,
-                                                &fs->sel->sinfo, "teo", fs->key.flatshade);
-      else
-         vrend_patch_vertex_shader_interpolants(ctx, &ctx->shader_cfg, &vs->glsl_strings,
-                                                &vs->sel->sinfo,
-                                                &fs->sel->sinfo, "vso", fs->key.flatshade);
-      ret = vrend_compile_shader(ctx, gs ? gs : (tes ? tes : vs));
-      if (ret == false) {
-         glDeleteShader(gs ? gs->id : (tes ? tes->id : vs->id));
+   if (sprog->is_pipeline) {
+      if (!vrend_link_separable(ctx, vs, false) ||
+          !vrend_link_separable(ctx, fs, sprog->dual_src_linked)) {
          free(sprog);
          return NULL;
       }
-      if (gs)
-         gs->compiled_fs_id = fs->id;
-      else if (tes)
-         tes->compiled_fs_id = fs->id;
-      else
-         vs->compiled_fs_id = fs->id;
-   }
+   } else if (do_patch) {
+      struct vrend_shader *patched = gs ? gs : (tes ? tes : vs);
+      struct vrend_linked_shader_program *existing;
 
-   prog_id = glCreateProgram();
-   glAttachShader(prog_id, vs->id);
-   if (tcs && tcs->id > 0)
-      glAttachShader(prog_id, tcs->id);
-   if (tes && tes->id > 0)
-      glAttachShader(prog_id, tes->id);
-
-   if (gs) {
-      if (gs->id > 0)
-         glAttachShader(prog_id, gs->id);
-      set_stream_out_varyings(ctx, prog_id, &gs->sel->sinfo);
-   } else if (tes)
-      set_stream_out_varyings(ctx, prog_id, &tes->sel->sinfo);
-   else
-      set_stream_out_varyings(ctx, prog_id, &vs->sel->sinfo);
-   glAttachShader(prog_id, fs->id);
-
-   if (fs->sel->sinfo.num_outputs > 1) {
-      if (util_blend_state_is_dual(&ctx->sub->blend_state, 0)) {
-         glBindFragDataLocationIndexed(prog_id, 0, 0, "fsout_c0");
-         glBindFragDataLocationIndexed(prog_id, 0, 1, "fsout_c1");
-         sprog->dual_src_linked = true;
-      } else {
-         glBindFragDataLocationIndexed(prog_id, 0, 0, "fsout_c0");
-         glBindFragDataLocationIndexed(prog_id, 1, 0, "fsout_c1");
-         sprog->dual_src_linked = false;
+      if (!vrend_shader_patch_interp(ctx, patched, fs)) {
+         free(sprog);
+         return NULL;
       }
-   } else
-      sprog->dual_src_linked = false;
+      patched->compiled_fs_id = fs->id;
 
-   if (has_feature(feat_gles31_vertex_attrib_binding)) {
-      uint32_t mask = vs->sel->sinfo.attrib_input_mask;
-      while (mask) {
-         i = u_bit_scan(&mask);
-         snprintf(name, 32, "in_%d", i);
-         glBindAttribLocation(prog_id, i, name);
+      /* switching back to an earlier object may find its program */
+      existing = lookup_shader_program(ctx, vs->id, fs->id, gs ? gs->id : 0,
+                                       tcs ? tcs->id : 0, tes ? tes->id : 0,
+                                       sprog->dual_src_linked);
+      if (existing) {
+         free(sprog);
+         return existing;
       }
    }
 
-   glLinkProgram(prog_id);
-
-   glGetProgramiv(prog_id, GL_LINK_STATUS, &lret);
-   if (lret == GL_FALSE) {
-      char infolog[65536];
-      int len;
-      glGetProgramInfoLog(prog_id, 65536, &len, infolog);
-      vrend_printf("got error linking\n%s\n", infolog);
-      /* dump shaders */
-      report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
-      vrend_shader_dump(vs);
-      if (gs)
-         vrend_shader_dump(gs);
-      vrend_shader_dump(fs);
-      glDeleteProgram(prog_id);
-      free(sprog);
-      return NULL;
-   }
-
    sprog->ss[PIPE_SHADER_VERTEX] = vs;
    sprog->ss[PIPE_SHADER_FRAGMENT] = fs;
    sprog->ss[PIPE_SHADER_GEOMETRY] = gs;
    sprog->ss[PIPE_SHADER_TESS_CTRL] = tcs;
    sprog->ss[PIPE_SHADER_TESS_EVAL] = tes;
 
+   last_shader = tes ? PIPE_SHADER_TESS_EVAL : (gs ? PIPE_SHADER_GEOMETRY : PIPE_SHADER_FRAGMENT);
+
+   if (vrend_program_cache_enabled() && !sprog->is_pipeline) {
+      program_cache_key(&cache_key, sprog, gs ? &gs->sel->sinfo :
+                                           (tes ? &tes->sel->sinfo : &vs->sel->sinfo));
+      prog_id = program_cache_load(ctx, sprog, &cache_key, last_shader);
+      cached = prog_id != 0;
+   }
+
+   if (sprog->is_pipeline) {
+      sprog->stage_ids[PIPE_SHADER_VERTEX] = vs->separable[0].id;
+      sprog->stage_ids[PIPE_SHADER_FRAGMENT] = fs->separable[sprog->dual_src_linked].id;
+      glGenProgramPipelines(1, &prog_id);
+      glUseProgramStages(prog_id, GL_VERTEX_SHADER_BIT, sprog->stage_ids[PIPE_SHADER_VERTEX]);
+      glUseProgramStages(prog_id, GL_FRAGMENT_SHADER_BIT, sprog->stage_ids[PIPE_SHADER_FRAGMENT]);
+   } else if (!cached) {
+      for (id = PIPE_SHADER_VERTEX; id <= PIPE_SHADER_TESS_EVAL; id++) {
+         if (sprog->ss[id] && sprog->ss[id]->id > 0 &&
+             !vrend_shader_wait_compiled(ctx, sprog->ss[id])) {
+            free(cache_key.data);
+            free(sprog);
+            return NULL;
+         }
+      }
+
+      prog_id = glCreateProgram();
+      glAttachShader(prog_id, vs->id);
+      if (tcs && tcs->id > 0)
+         glAttachShader(prog_id, tcs->id);
+      if (tes && tes->id > 0)
+         glAttachShader(prog_id, tes->id);
+
+      if (gs) {
+         if (gs->id > 0)
+            glAttachShader(prog_id, gs->id);
+         set_stream_out_varyings(ctx, prog_id, &gs->sel->sinfo);
+      } else if (tes)
+         set_stream_out_varyings(ctx, prog_id, &tes->sel->sinfo);
+      else
+         set_stream_out_varyings(ctx, prog_id, &vs->sel->sinfo);
+      glAttachShader(prog_id, fs->id);
+
+      vrend_bind_frag_data_locations(prog_id, fs, sprog->dual_src_linked);
+      vrend_bind_attrib_locations(prog_id, vs);
+
+      if (cache_key.data)
+         glProgramParameteri(prog_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+      vrend_start_link(prog_id, &link_job, &lret);
+
+      if (!vrend_finish_link(prog_id, &link_job, &lret)) {
+         char infolog[65536];
+         int len;
+         glGetProgramInfoLog(prog_id, 65536, &len, infolog);
+         vrend_printf("got error linking\n%s\n", infolog);
+         /* dump shaders */
+         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, 0);
+         vrend_shader_dump(vs);
+         if (gs)
+            vrend_shader_dump(gs);
+         vrend_shader_dump(fs);
+         glDeleteProgram(prog_id);
+         free(cache_key.data);
+         free(sprog);
+         return NULL;
+      }
+   }
+
    list_add(&sprog->sl[PIPE_SHADER_VERTEX], &vs->programs);
    list_add(&sprog->sl[PIPE_SHADER_FRAGMENT], &fs->programs);
    if (gs)
@@ -1549,29 +2621,43 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
    if (tes)
       list_add(&sprog->sl[PIPE_SHADER_TESS_EVAL], &tes->programs);
 
-   last_shader = tes ? PIPE_SHADER_TESS_EVAL : (gs ? PIPE_SHADER_GEOMETRY : PIPE_SHADER_FRAGMENT);
    sprog->id = prog_id;
 
-   list_addtail(&sprog->head, &ctx->sub->programs);
+   vrend_add_program(ctx->sub, sprog);
+
+   if (cached) {
+      free(cache_key.data);
+      return sprog;
+   }
 
    if (fs->key.pstipple_tex)
-      sprog->fs_stipple_loc = glGetUniformLocation(prog_id, "pstipple_sampler");
+      sprog->fs_stipple_loc = glGetUniformLocation(vrend_program_stage_id(sprog, PIPE_SHADER_FRAGMENT),
+                                                   "pstipple_sampler");
    else
       sprog->fs_stipple_loc = -1;
-   sprog->vs_ws_adjust_loc = glGetUniformLocation(prog_id, "winsys_adjust_y");
+   sprog->vs_ws_adjust_loc = glGetUniformLocation(vrend_program_stage_id(sprog, PIPE_SHADER_VERTEX),
+                                                  "winsys_adjust_y");
 
-   vrend_use_program(ctx, prog_id);
+   if (!sprog->is_pipeline)
+      vrend_use_program(ctx, prog_id);
 
    int next_ubo_id = 0, next_sampler_id = 0;
    for (id = PIPE_SHADER_VERTEX; id <= last_shader; id++) {
       if (!sprog->ss[id])
          continue;
 
+      sprog->sampler_base[id] = next_sampler_id;
+      sprog->ubo_base[id] = next_ubo_id;
       next_sampler_id = bind_sampler_locs(sprog, id, next_sampler_id);
       bind_const_locs(sprog, id);
       next_ubo_id = bind_ubo_locs(sprog, id, next_ubo_id);
       bind_image_locs(sprog, id);
       bind_ssbo_locs(sprog, id);
+
+      if (sprog->is_pipeline) {
+         vrend_program_separable(sprog, id)->sampler_base = sprog->sampler_base[id];
+         vrend_program_separable(sprog, id)->ubo_base = sprog->ubo_base[id];
+      }
    }
 
    if (!has_feature(feat_gles31_vertex_attrib_binding)) {
@@ -1580,7 +2666,8 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
          if (sprog->attrib_locs) {
             for (i = 0; i < vs->sel->sinfo.num_inputs; i++) {
                snprintf(name, 32, "in_%d", i);
-               sprog->attrib_locs[i] = glGetAttribLocation(prog_id, name);
+               sprog->attrib_locs[i] = glGetAttribLocation(vrend_program_stage_id(sprog, PIPE_SHADER_VERTEX),
+                                                           name);
             }
          }
       } else
@@ -1590,23 +2677,25 @@ static struct vrend_linked_shader_program *add_shader_program(struct vrend_conte
    if (vs->sel->sinfo.num_ucp) {
       for (i = 0; i < vs->sel->sinfo.num_ucp; i++) {
          snprintf(name, 32, "clipp[%d]", i);
-         sprog->clip_locs[i] = glGetUniformLocation(prog_id, name);
+         sprog->clip_locs[i] = glGetUniformLocation(vrend_program_stage_id(sprog, PIPE_SHADER_VERTEX),
+                                                    name);
       }
    }
+
+   if (cache_key.data)
+      program_cache_store(sprog, &cache_key, last_shader);
+   free(cache_key.data);
    return sprog;
 }
 
 static struct vrend_linked_shader_program *lookup_cs_shader_program(struct vrend_context *ctx,
                                                                     GLuint cs_id)
 {
-   struct vrend_linked_shader_program *ent;
-   LIST_FOR_EACH_ENTRY(ent, &ctx->sub->programs, head) {
-      if (!ent->ss[PIPE_SHADER_COMPUTE])
-         continue;
-      if (ent->ss[PIPE_SHADER_COMPUTE]->id == cs_id)
-         return ent;
-   }
-   return NULL;
+   struct vrend_program_key key;
+
+   memset(&key, 0, sizeof(key));
+   key.ids[PIPE_SHADER_COMPUTE] = cs_id;
+   return vrend_program_table_lookup(ctx->sub->program_table, &key);
 }
 
 static struct vrend_linked_shader_program *lookup_shader_program(struct vrend_context *ctx,
@@ -1617,28 +2706,38 @@ static struct vrend_linked_shader_program *lookup_shader_program(struct vrend_co
                                                                  GLuint tes_id,
                                                                  bool dual_src)
 {
-   struct vrend_linked_shader_program *ent;
-   LIST_FOR_EACH_ENTRY(ent, &ctx->sub->programs, head) {
-      if (ent->dual_src_linked != dual_src)
-         continue;
-      if (ent->ss[PIPE_SHADER_COMPUTE])
-         continue;
-      if (ent->ss[PIPE_SHADER_VERTEX]->id != vs_id)
-        continue;
-      if (ent->ss[PIPE_SHADER_FRAGMENT]->id != fs_id)
-        continue;
-      if (ent->ss[PIPE_SHADER_GEOMETRY] &&
-          ent->ss[PIPE_SHADER_GEOMETRY]->id != gs_id)
-        continue;
-      if (ent->ss[PIPE_SHADER_TESS_CTRL] &&
-          ent->ss[PIPE_SHADER_TESS_CTRL]->id != tcs_id)
-         continue;
-      if (ent->ss[PIPE_SHADER_TESS_EVAL] &&
-          ent->ss[PIPE_SHADER_TESS_EVAL]->id != tes_id)
-         continue;
-      return ent;
+   struct vrend_program_key key;
+
+   memset(&key, 0, sizeof(key));
+   key.ids[PIPE_SHADER_VERTEX] = vs_id;
+   key.ids[PIPE_SHADER_FRAGMENT] = fs_id;
+   key.ids[PIPE_SHADER_GEOMETRY] = gs_id;
+   key.ids[PIPE_SHADER_TESS_CTRL] = tcs_id;
+   key.ids[PIPE_SHADER_TESS_EVAL] = tes_id;
+   key.dual_src = dual_src;
+   return vrend_program_table_lookup(ctx->sub->program_table, &key);
+}
+
+/* Program pipelines are not shared between GL contexts, delete them in the
+ * context of the sub context that created them.
+ */
+static void vrend_delete_pipeline(struct vrend_sub_context *sub, GLuint id)
+{
+   struct vrend_context *cur = vrend_tls.current_hw_ctx;
+   bool switch_ctx = cur && cur->sub != sub;
+
+   if (switch_ctx)
+      vrend_clicbs->make_current(sub->gl_context);
+
+   /* the name may be handed out again */
+   if (sub->pipeline_id == id) {
+      glBindProgramPipeline(0);
+      sub->pipeline_id = 0;
    }
-   return NULL;
+   glDeleteProgramPipelines(1, &id);
+
+   if (switch_ctx)
+      vrend_clicbs->make_current(cur->sub->gl_context);
 }
 
 static void vrend_destroy_program(struct vrend_linked_shader_program *ent)
@@ -1647,18 +2746,18 @@ static void vrend_destroy_program(struct vrend_linked_shader_program *ent)
    if (ent->ref_context && ent->ref_context->prog == ent)
       ent->ref_context->prog = NULL;
 
-   glDeleteProgram(ent->id);
+   if (ent->is_pipeline)
+      vrend_delete_pipeline(ent->sub_ctx, ent->id);
+   else
+      glDeleteProgram(ent->id);
    list_del(&ent->head);
+   vrend_program_table_remove(ent->sub_ctx->program_table, &ent->key);
 
    for (i = PIPE_SHADER_VERTEX; i <= PIPE_SHADER_COMPUTE; i++) {
       if (ent->ss[i])
          list_del(&ent->sl[i]);
-      free(ent->shadow_samp_mask_locs[i]);
-      free(ent->shadow_samp_add_locs[i]);
-      free(ent->ssbo_locs[i]);
-      free(ent->img_locs[i]);
    }
-   free(ent->attrib_locs);
+   vrend_free_program_locs(ent);
    free(ent);
 }
 
@@ -1704,7 +2803,7 @@ int vrend_create_surface(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   surf = CALLOC_STRUCT(vrend_surface);
+   surf = vrend_slab_alloc(ctx->sub->surface_slab);
    if (!surf)
       return ENOMEM;
 
@@ -1762,7 +2861,7 @@ int vrend_create_surface(struct vrend_context *ctx,
 
    ret_handle = vrend_renderer_object_insert(ctx, surf, sizeof(*surf), handle, VIRGL_OBJECT_SURFACE);
    if (ret_handle == 0) {
-      FREE(surf);
+      vrend_slab_free(surf);
       return ENOMEM;
    }
    return 0;
@@ -1961,7 +3060,7 @@ int vrend_create_sampler_view(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   view = CALLOC_STRUCT(vrend_sampler_view);
+   view = vrend_slab_alloc(ctx->sub->view_slab);
    if (!view)
       return ENOMEM;
 
@@ -2102,7 +3201,7 @@ int vrend_create_sampler_view(struct vrend_context *ctx,
 
    ret_handle = vrend_renderer_object_insert(ctx, view, sizeof(*view), handle, VIRGL_OBJECT_SAMPLER_VIEW);
    if (ret_handle == 0) {
-      FREE(view);
+      vrend_slab_free(view);
       return ENOMEM;
    }
    return 0;
@@ -3137,9 +4236,11 @@ static inline void vrend_fill_shader_key(struct vrend_context *ctx,
       key->num_prev_generic_and_patch_outputs = ctx->sub->shaders[prev_type]->sinfo.num_generic_and_patch_outputs;
       key->guest_sent_io_arrays = ctx->sub->shaders[prev_type]->sinfo.guest_sent_io_arrays;
 
+      key->num_prev_generic_and_patch_outputs = MIN2(key->num_prev_generic_and_patch_outputs,
+                                                     ARRAY_SIZE(key->prev_stage_generic_and_patch_outputs_layout));
       memcpy(key->prev_stage_generic_and_patch_outputs_layout,
              ctx->sub->shaders[prev_type]->sinfo.generic_outputs_layout,
-             64 * sizeof (struct vrend_layout_info));
+             key->num_prev_generic_and_patch_outputs * sizeof (struct vrend_layout_info));
       key->force_invariant_inputs = ctx->sub->shaders[prev_type]->sinfo.invariant_outputs;
    }
 
@@ -3180,20 +4281,6 @@ static inline void vrend_fill_shader_key(struct vrend_context *ctx,
    }
 }
 
-static inline int conv_shader_type(int type)
-{
-   switch (type) {
-   case PIPE_SHADER_VERTEX: return GL_VERTEX_SHADER;
-   case PIPE_SHADER_FRAGMENT: return GL_FRAGMENT_SHADER;
-   case PIPE_SHADER_GEOMETRY: return GL_GEOMETRY_SHADER;
-   case PIPE_SHADER_TESS_CTRL: return GL_TESS_CONTROL_SHADER;
-   case PIPE_SHADER_TESS_EVAL: return GL_TESS_EVALUATION_SHADER;
-   case PIPE_SHADER_COMPUTE: return GL_COMPUTE_SHADER;
-   default:
-      return 0;
-   };
-}
-
 static int vrend_shader_create(struct vrend_context *ctx,
                                struct vrend_shader *shader,
                                struct vrend_shader_key key)
@@ -3203,12 +4290,24 @@ static int vrend_shader_create(struct vrend_context *ctx,
    shader->compiled_fs_id = 0;
 
    if (shader->sel->tokens) {
-      bool ret = vrend_convert_shader(ctx, &ctx->shader_cfg, shader->sel->tokens,
-                                      shader->sel->req_local_mem, &key, &shader->sel->sinfo, &shader->glsl_strings);
+      bool ret = vrend_shader_cache_lookup(&ctx->shader_cfg, shader->sel->tokens,
+                                           shader->sel->req_local_mem, &key,
+                                           &shader->sel->sinfo, &shader->glsl_strings);
       if (!ret) {
-         report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, shader->sel->type);
-         glDeleteShader(shader->id);
-         return -1;
+         ret = vrend_convert_shader(ctx, &ctx->shader_cfg, shader->sel->tokens,
+                                    shader->sel->req_local_mem, &key, &shader->sel->sinfo, &shader->glsl_strings);
+         if (!ret) {
+            report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, shader->sel->type);
+            glDeleteShader(shader->id);
+            return -1;
+         }
+         vrend_shader_cache_store(&ctx->shader_cfg, shader->sel->tokens,
+                                  shader->sel->req_local_mem, &key,
+                                  &shader->sel->sinfo, &shader->glsl_strings);
+      } else {
+         VREND_DEBUG(dbg_shader_glsl, ctx, "GLSL (cached):");
+         VREND_DEBUG_EXT(dbg_shader_glsl, ctx, strarray_dump(&shader->glsl_strings));
+         VREND_DEBUG(dbg_shader_glsl, ctx, "\n");
       }
    } else if (!ctx->shader_cfg.use_gles && shader->sel->type != TGSI_PROCESSOR_TESS_CTRL) {
       report_context_error(ctx, VIRGL_ERROR_CTX_ILLEGAL_SHADER, shader->sel->type);
@@ -3217,6 +4316,7 @@ static int vrend_shader_create(struct vrend_context *ctx,
    }
 
    shader->key = key;
+   vrend_shader_set_variant_key(shader);
    if (1) {//shader->sel->type == PIPE_SHADER_FRAGMENT || shader->sel->type == PIPE_SHADER_GEOMETRY) {
       bool ret;
 
@@ -3230,51 +4330,89 @@ static int vrend_shader_create(struct vrend_context *ctx,
    return 0;
 }
 
+/* counts a new variant of sel, or a switch to one it had before */
+static void vrend_shader_stats_add(struct vrend_shader_selector *sel, bool new_variant)
+{
+   struct vrend_shader_stats *stats = &vrend_state.shader_stats;
+
+   if (!vrend_state.stats_enabled)
+      return;
+
+   pipe_mutex_lock(vrend_shader_stats_mutex);
+   if (!new_variant) {
+      stats->variant_switches++;
+   } else {
+      stats->variants++;
+      if (sel->num_shaders == 1)
+         stats->selectors++;
+      else if (sel->num_shaders == 2)
+         stats->multi_variant_selectors++;
+      stats->max_variants = MAX2(stats->max_variants, sel->num_shaders);
+   }
+   pipe_mutex_unlock(vrend_shader_stats_mutex);
+}
+
+void vrend_renderer_get_shader_stats(struct vrend_shader_stats *stats)
+{
+   pipe_mutex_lock(vrend_shader_stats_mutex);
+   *stats = vrend_state.shader_stats;
+   pipe_mutex_unlock(vrend_shader_stats_mutex);
+}
+
 static int vrend_shader_select(struct vrend_context *ctx,
                                struct vrend_shader_selector *sel,
                                bool *dirty)
 {
    struct vrend_shader_key key;
+   struct vrend_variant_key variant_key;
    struct vrend_shader *shader = NULL;
    int r;
 
    memset(&key, 0, sizeof(key));
    vrend_fill_shader_key(ctx, sel, &key);
+   variant_key.key = &key;
+   variant_key.hash = vrend_shader_key_hash(&key);
 
-   if (sel->current && !memcmp(&sel->current->key, &key, sizeof(key)))
+   if (sel->current && !variant_key_compare(&sel->current->variant_key, &variant_key))
       return 0;
 
-   if (sel->num_shaders > 1) {
-      struct vrend_shader *p = sel->current;
-      struct vrend_shader *c = p->next_variant;
-      while (c && memcmp(&c->key, &key, sizeof(key)) != 0) {
-         p = c;
-         c = c->next_variant;
-      }
-      if (c) {
-         p->next_variant = c->next_variant;
-         shader = c;
-      }
-   }
+   if (sel->variant_table)
+      shader = util_hash_table_get(sel->variant_table, &variant_key);
 
    if (!shader) {
-      shader = CALLOC_STRUCT(vrend_shader);
+      shader = vrend_slab_alloc(ctx->sub->shader_slab);
+      if (!shader)
+         return ENOMEM;
       shader->sel = sel;
       list_inithead(&shader->programs);
+      list_inithead(&shader->interp_variants);
       strarray_alloc(&shader->glsl_strings, SHADER_MAX_STRINGS);
 
       r = vrend_shader_create(ctx, shader, key);
       if (r) {
          sel->current = NULL;
-         FREE(shader);
+         vrend_slab_free(shader);
          return r;
       }
+
+      if (!sel->variant_table)
+         sel->variant_table = util_hash_table_create(variant_key_hash, variant_key_compare,
+                                                     variant_free);
+      if (sel->variant_table)
+         util_hash_table_set(sel->variant_table, &shader->variant_key, shader);
+
+      shader->next_variant = sel->variants;
+      sel->variants = shader;
       sel->num_shaders++;
-   }
+      vrend_shader_stats_add(sel, true);
+      if (sel->num_shaders >= 8 && util_is_power_of_two(sel->num_shaders))
+         VREND_DEBUG(dbg_shader_variants, ctx, "%s shader selector %p has %u variants\n",
+                     pipe_shader_to_prefix(sel->type), (void *)sel, sel->num_shaders);
+   } else
+      vrend_shader_stats_add(sel, false);
    if (dirty)
       *dirty = true;
 
-   shader->next_variant = sel->current;
    sel->current = shader;
    return 0;
 }
@@ -3317,7 +4455,7 @@ int vrend_create_shader(struct vrend_context *ctx,
                         const struct pipe_stream_output_info *so_info,
                         uint32_t req_local_mem,
                         const char *shd_text, uint32_t offlen, uint32_t num_tokens,
-                        uint32_t type, uint32_t pkt_length)
+                        uint32_t type, uint32_t pkt_length, bool binary)
 {
    struct vrend_shader_selector *sel = NULL;
    int ret_handle;
@@ -3328,6 +4466,9 @@ int vrend_create_shader(struct vrend_context *ctx,
    if (type > PIPE_SHADER_COMPUTE)
       return EINVAL;
 
+   if (binary && !vrend_state.use_tgsi_tokens)
+      return EINVAL;
+
    if (type == PIPE_SHADER_GEOMETRY &&
        !has_feature(feat_geometry_shader))
       return EINVAL;
@@ -3369,6 +4510,7 @@ int vrend_create_shader(struct vrend_context *ctx,
         }
         memcpy(sel->tmp_buf, shd_text, pkt_length * 4);
         sel->buf_offset = pkt_length * 4;
+        sel->tmp_buf_tokens = binary;
         ctx->sub->long_shader_in_progress_handle[type] = handle;
      } else
         finished = true;
@@ -3380,6 +4522,12 @@ int vrend_create_shader(struct vrend_context *ctx,
          goto error;
       }
 
+      if (binary != sel->tmp_buf_tokens) {
+         vrend_printf( "Got shader continuation in a different format %d\n", handle);
+         ret = EINVAL;
+         goto error;
+      }
+
       offlen &= ~VIRGL_OBJ_SHADER_OFFSET_CONT;
       if (offlen != sel->buf_offset) {
          vrend_printf( "Got mismatched shader continuation %d vs %d\n",
@@ -3412,7 +4560,29 @@ int vrend_create_shader(struct vrend_context *ctx,
       }
    }
 
-   if (finished) {
+   if (finished && binary) {
+      uint32_t size = sel->buf_offset ? sel->buf_offset : pkt_length * 4;
+
+      /* the tokens were built by the guest, so instead of parsing text
+       * only check that they are safe to walk before they are copied */
+      if (num_tokens > size / sizeof(struct tgsi_token) ||
+          !vrend_tgsi_validate((const struct tgsi_token *)shd_text, num_tokens, type)) {
+         vrend_printf( "Got invalid shader tokens %d\n", handle);
+         ret = EINVAL;
+         goto error;
+      }
+
+      VREND_DEBUG_EXT(dbg_shader_tgsi, ctx, tgsi_dump((const struct tgsi_token *)shd_text, 0));
+
+      if (vrend_finish_shader(ctx, sel, (const struct tgsi_token *)shd_text)) {
+         ret = EINVAL;
+         goto error;
+      }
+      free(sel->tmp_buf);
+      sel->tmp_buf = NULL;
+      ctx->sub->long_shader_in_progress_handle[type] = 0;
+   } else if (finished) {
+      struct vrend_arena *arena = vrend_arena_thread();
       struct tgsi_token *tokens;
 
       /* check for null termination */
@@ -3422,8 +4592,11 @@ int vrend_create_shader(struct vrend_context *ctx,
          goto error;
       }
 
-      tokens = calloc(num_tokens + 10, sizeof(struct tgsi_token));
+      /* the selector keeps its own copy of the tokens */
+      vrend_arena_begin(arena);
+      tokens = vrend_arena_calloc(arena, num_tokens + 10, sizeof(struct tgsi_token));
       if (!tokens) {
+         vrend_arena_end(arena);
          ret = ENOMEM;
          goto error;
       }
@@ -3431,20 +4604,20 @@ int vrend_create_shader(struct vrend_context *ctx,
       VREND_DEBUG(dbg_shader_tgsi, ctx, "shader\n%s\n", shd_text);
 
       if (!tgsi_text_translate((const char *)shd_text, tokens, num_tokens + 10)) {
-         free(tokens);
+         vrend_arena_end(arena);
          ret = EINVAL;
          goto error;
       }
 
       if (vrend_finish_shader(ctx, sel, tokens)) {
-         free(tokens);
+         vrend_arena_end(arena);
          ret = EINVAL;
          goto error;
       } else {
          free(sel->tmp_buf);
          sel->tmp_buf = NULL;
       }
-      free(tokens);
+      vrend_arena_end(arena);
       ctx->sub->long_shader_in_progress_handle[type] = 0;
    }
 
@@ -4033,7 +5206,8 @@ static void vrend_draw_bind_ssbo_shader(struct vrend_context *ctx, int shader_ty
                         ssbo->buffer_offset, ssbo->buffer_size);
       if (ctx->sub->prog->ssbo_locs[shader_type][i] != GL_INVALID_INDEX) {
          if (!vrend_state.use_gles)
-            glShaderStorageBlockBinding(ctx->sub->prog->id, ctx->sub->prog->ssbo_locs[shader_type][i], i);
+            glShaderStorageBlockBinding(vrend_program_stage_id(ctx->sub->prog, shader_type),
+                                        ctx->sub->prog->ssbo_locs[shader_type][i], i);
          else
             debug_printf("glShaderStorageBlockBinding not supported on gles \n");
       }
@@ -4135,6 +5309,7 @@ static void vrend_draw_bind_objects(struct vrend_context *ctx, bool new_program)
 {
    int next_ubo_id = 0, next_sampler_id = 0;
    for (int shader_type = PIPE_SHADER_VERTEX; shader_type <= ctx->sub->last_shader_idx; shader_type++) {
+      vrend_program_select_stage(ctx->sub->prog, shader_type);
       next_ubo_id = vrend_draw_bind_ubo_shader(ctx, shader_type, next_ubo_id);
       vrend_draw_bind_const_shader(ctx, shader_type, new_program);
       next_sampler_id = vrend_draw_bind_samplers_shader(ctx, shader_type,
@@ -4148,6 +5323,7 @@ static void vrend_draw_bind_objects(struct vrend_context *ctx, bool new_program)
    if (vrend_state.use_core_profile && ctx->sub->prog->fs_stipple_loc != -1) {
       glActiveTexture(GL_TEXTURE0 + next_sampler_id);
       glBindTexture(GL_TEXTURE_2D, ctx->pstipple_tex_id);
+      vrend_program_select_stage(ctx->sub->prog, PIPE_SHADER_FRAGMENT);
       glUniform1i(ctx->sub->prog->fs_stipple_loc, next_sampler_id);
    }
 }
@@ -4162,21 +5338,24 @@ void vrend_inject_tcs(struct vrend_context *ctx, int vertices_per_patch)
                                                                  &so_info,
                                                                  false, PIPE_SHADER_TESS_CTRL);
    struct vrend_shader *shader;
-   shader = CALLOC_STRUCT(vrend_shader);
+   shader = vrend_slab_alloc(ctx->sub->shader_slab);
    vrend_fill_shader_key(ctx, sel, &shader->key);
+   vrend_shader_set_variant_key(shader);
 
    shader->sel = sel;
    list_inithead(&shader->programs);
+   list_inithead(&shader->interp_variants);
    strarray_alloc(&shader->glsl_strings, SHADER_MAX_STRINGS);
 
    vrend_shader_create_passthrough_tcs(ctx, &ctx->shader_cfg,
                                        ctx->sub->shaders[PIPE_SHADER_VERTEX]->tokens,
-                                       &shader->key, vrend_state.tess_factors, &sel->sinfo,
+                                       &shader->key, ctx->sub->tess_factors, &sel->sinfo,
                                        &shader->glsl_strings, vertices_per_patch);
    // Need to add inject the selected shader to the shader selector and then the code below
    // can continue
    sel->tokens = NULL;
    sel->current = shader;
+   sel->variants = shader;
    ctx->sub->shaders[PIPE_SHADER_TESS_CTRL] = sel;
    ctx->sub->shaders[PIPE_SHADER_TESS_CTRL]->num_shaders = 1;
 
@@ -4184,10 +5363,93 @@ void vrend_inject_tcs(struct vrend_context *ctx, int vertices_per_patch)
    vrend_compile_shader(ctx, shader);
 }
 
-int vrend_draw_vbo(struct vrend_context *ctx,
-                   const struct pipe_draw_info *info,
-                   uint32_t cso, uint32_t indirect_handle,
-                   uint32_t indirect_draw_count_handle)
+static GLenum vrend_index_type(unsigned index_size)
+{
+   switch (index_size) {
+   case 1:
+      return GL_UNSIGNED_BYTE;
+   case 2:
+      return GL_UNSIGNED_SHORT;
+   case 4:
+   default:
+      return GL_UNSIGNED_INT;
+   }
+}
+
+/* Emit a run of plain draws that only differ in their ranges. Without
+ * multi draw support the ranges are drawn one by one, which still skips
+ * the validation vrend_draw_vbo would do for each of them.
+ */
+static void vrend_draw_ranges(struct vrend_context *ctx,
+                              const struct pipe_draw_info *info,
+                              const struct vrend_draw_range *draws,
+                              uint32_t num_draws)
+{
+   GLint first[VREND_MAX_DRAW_RANGES];
+   GLsizei count[VREND_MAX_DRAW_RANGES];
+   const GLvoid *indices[VREND_MAX_DRAW_RANGES];
+   GLint basevertex[VREND_MAX_DRAW_RANGES];
+   bool has_bias = false;
+   GLenum elsz;
+   uint32_t i;
+
+   if (!info->indexed) {
+      if (!has_feature(feat_multi_draw)) {
+         for (i = 0; i < num_draws; i++)
+            glDrawArrays(info->mode, draws[i].start, draws[i].count);
+         return;
+      }
+
+      for (i = 0; i < num_draws; i++) {
+         first[i] = draws[i].start;
+         count[i] = draws[i].count;
+      }
+      glMultiDrawArrays(info->mode, first, count, num_draws);
+      return;
+   }
+
+   elsz = vrend_index_type(ctx->sub->ib.index_size);
+   if (!has_feature(feat_multi_draw)) {
+      for (i = 0; i < num_draws; i++) {
+         bool has_range = draws[i].min_index != 0 ||
+                          draws[i].max_index != (unsigned)-1;
+         void *offset = (void *)(unsigned long)draws[i].index_offset;
+
+         if (draws[i].index_bias && has_range)
+            glDrawRangeElementsBaseVertex(info->mode, draws[i].min_index,
+                                          draws[i].max_index, draws[i].count,
+                                          elsz, offset, draws[i].index_bias);
+         else if (draws[i].index_bias)
+            glDrawElementsBaseVertex(info->mode, draws[i].count, elsz, offset,
+                                     draws[i].index_bias);
+         else if (has_range)
+            glDrawRangeElements(info->mode, draws[i].min_index, draws[i].max_index,
+                                draws[i].count, elsz, offset);
+         else
+            glDrawElements(info->mode, draws[i].count, elsz, offset);
+      }
+      return;
+   }
+
+   for (i = 0; i < num_draws; i++) {
+      count[i] = draws[i].count;
+      indices[i] = (const GLvoid *)(unsigned long)draws[i].index_offset;
+      basevertex[i] = draws[i].index_bias;
+      has_bias |= draws[i].index_bias != 0;
+   }
+   if (has_bias)
+      glMultiDrawElementsBaseVertex(info->mode, count, elsz, indices,
+                                    num_draws, basevertex);
+   else
+      glMultiDrawElements(info->mode, count, elsz, indices, num_draws);
+}
+
+static int vrend_draw_vbo_common(struct vrend_context *ctx,
+                                 const struct pipe_draw_info *info,
+                                 uint32_t cso, uint32_t indirect_handle,
+                                 uint32_t indirect_draw_count_handle,
+                                 const struct vrend_draw_range *draws,
+                                 uint32_t num_draws)
 {
    int i;
    bool new_program = false;
@@ -4246,7 +5508,7 @@ int vrend_draw_vbo(struct vrend_context *ctx,
    if (ctx->sub->shader_dirty || ctx->sub->swizzle_output_rgb_to_bgr) {
       struct vrend_linked_shader_program *prog;
       bool fs_dirty, vs_dirty, gs_dirty, tcs_dirty, tes_dirty;
-      bool dual_src = util_blend_state_is_dual(&ctx->sub->blend_state, 0);
+      bool dual_src;
       bool same_prog;
 
       ctx->sub->shader_dirty = false;
@@ -4281,6 +5543,7 @@ int vrend_draw_vbo(struct vrend_context *ctx,
          vrend_printf( "failure to compile shader variants: %s\n", ctx->debug_name);
          return 0;
       }
+      dual_src = vrend_program_dual_src(ctx, ctx->sub->shaders[PIPE_SHADER_FRAGMENT]->current);
       same_prog = true;
       if (ctx->sub->shaders[PIPE_SHADER_VERTEX]->current->id != (GLuint)ctx->sub->prog_ids[PIPE_SHADER_VERTEX])
          same_prog = false;
@@ -4336,6 +5599,12 @@ int vrend_draw_vbo(struct vrend_context *ctx,
             ctx->sub->sampler_views_dirty[stage] = ~0;
          }
 
+         /* the separable programs may have been changed by other pipelines */
+         if (prog->is_pipeline) {
+            vrend_pipeline_update_bindings(prog);
+            prog->viewport_neg_val = 0;
+         }
+
          prog->ref_context = ctx->sub;
       }
    }
@@ -4344,7 +5613,7 @@ int vrend_draw_vbo(struct vrend_context *ctx,
       return 0;
    }
 
-   vrend_use_program(ctx, ctx->sub->prog->id);
+   vrend_use_linked_program(ctx, ctx->sub->prog);
 
    vrend_draw_bind_objects(ctx, new_program);
 
@@ -4353,6 +5622,7 @@ int vrend_draw_vbo(struct vrend_context *ctx,
       return 0;
    }
    float viewport_neg_val = ctx->sub->viewport_is_negative ? -1.0 : 1.0;
+   vrend_program_select_stage(ctx->sub->prog, PIPE_SHADER_VERTEX);
    if (ctx->sub->prog->viewport_neg_val != viewport_neg_val) {
       glUniform1f(ctx->sub->prog->vs_ws_adjust_loc, viewport_neg_val);
       ctx->sub->prog->viewport_neg_val = viewport_neg_val;
@@ -4437,7 +5707,9 @@ int vrend_draw_vbo(struct vrend_context *ctx,
       glPatchParameteri(GL_PATCH_VERTICES, info->vertices_per_patch);
 
    /* set the vertex state up now on a delay */
-   if (!info->indexed) {
+   if (num_draws) {
+      vrend_draw_ranges(ctx, info, draws, num_draws);
+   } else if (!info->indexed) {
       GLenum mode = info->mode;
       int count = cso ? cso : info->count;
       int start = cso ? 0 : info->start;
@@ -4457,20 +5729,8 @@ int vrend_draw_vbo(struct vrend_context *ctx,
       else
          glDrawArraysInstancedARB(mode, start, count, info->instance_count);
    } else {
-      GLenum elsz;
+      GLenum elsz = vrend_index_type(ctx->sub->ib.index_size);
       GLenum mode = info->mode;
-      switch (ctx->sub->ib.index_size) {
-      case 1:
-         elsz = GL_UNSIGNED_BYTE;
-         break;
-      case 2:
-         elsz = GL_UNSIGNED_SHORT;
-         break;
-      case 4:
-      default:
-         elsz = GL_UNSIGNED_INT;
-         break;
-      }
 
       if (indirect_handle) {
          if (indirect_params_res)
@@ -4514,6 +5774,27 @@ int vrend_draw_vbo(struct vrend_context *ctx,
    return 0;
 }
 
+int vrend_draw_vbo(struct vrend_context *ctx,
+                   const struct pipe_draw_info *info,
+                   uint32_t cso, uint32_t indirect_handle,
+                   uint32_t indirect_draw_count_handle)
+{
+   return vrend_draw_vbo_common(ctx, info, cso, indirect_handle,
+                                indirect_draw_count_handle, NULL, 0);
+}
+
+int vrend_draw_vbo_ranges(struct vrend_context *ctx,
+                          const struct pipe_draw_info *info,
+                          const struct vrend_draw_range *draws,
+                          uint32_t num_draws)
+{
+   if (!num_draws || num_draws > VREND_MAX_DRAW_RANGES ||
+       info->instance_count > 1 || info->start_instance)
+      return EINVAL;
+
+   return vrend_draw_vbo_common(ctx, info, 0, 0, 0, draws, num_draws);
+}
+
 void vrend_launch_grid(struct vrend_context *ctx,
                        UNUSED uint32_t *block,
                        uint32_t *grid,
@@ -5663,6 +6944,148 @@ static void vrend_renderer_use_threaded_sync(void)
 }
 #endif
 
+static int thread_compile(void *arg)
+{
+   virgl_gl_context gl_context = arg;
+   struct vrend_compile_job *job;
+
+   vrend_clicbs->make_current(gl_context);
+
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   while (true) {
+      while (LIST_IS_EMPTY(&vrend_state.compile_queue) &&
+             !vrend_state.stop_compile_threads)
+         pipe_condvar_wait(vrend_state.compile_cond, vrend_state.compile_mutex);
+
+      /* queued jobs are drained before stopping, shaders wait on them */
+      if (LIST_IS_EMPTY(&vrend_state.compile_queue))
+         break;
+
+      job = LIST_ENTRY(struct vrend_compile_job, vrend_state.compile_queue.next, head);
+      list_del(&job->head);
+      pipe_mutex_unlock(vrend_state.compile_mutex);
+
+      if (job->id) {
+         glShaderSource(job->id, job->num_parts, job->parts, NULL);
+         glCompileShader(job->id);
+      }
+      if (job->program) {
+         glLinkProgram(job->program);
+         glGetProgramiv(job->program, GL_LINK_STATUS, job->link_status);
+      }
+      /* the result must be visible to the context that uses it */
+      glFinish();
+
+      pipe_mutex_lock(vrend_state.compile_mutex);
+      job->done = true;
+      pipe_condvar_broadcast(vrend_state.compile_done_cond);
+   }
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+
+   vrend_clicbs->make_current(0);
+   vrend_clicbs->destroy_gl_context(gl_context);
+   return 0;
+}
+
+static void vrend_free_compile_threads(void)
+{
+   int i;
+
+   vrend_state.async_compile = false;
+   if (!vrend_state.num_compile_threads)
+      return;
+
+   pipe_mutex_lock(vrend_state.compile_mutex);
+   vrend_state.stop_compile_threads = true;
+   pipe_condvar_broadcast(vrend_state.compile_cond);
+   pipe_mutex_unlock(vrend_state.compile_mutex);
+
+   for (i = 0; i < vrend_state.num_compile_threads; i++)
+      pipe_thread_wait(vrend_state.compile_threads[i]);
+   vrend_state.num_compile_threads = 0;
+
+   pipe_condvar_destroy(vrend_state.compile_cond);
+   pipe_condvar_destroy(vrend_state.compile_done_cond);
+   pipe_mutex_destroy(vrend_state.compile_mutex);
+}
+
+/* Copies between guest memory and the host of transfers larger than
+ * VREND_COPY_POOL_MIN MiB are split across VREND_COPY_THREADS threads,
+ * by default one less than there are cores, at most four.
+ */
+static void vrend_renderer_use_copy_pool(void)
+{
+   int num_threads;
+
+   if (getenv("VIRGL_DISABLE_MT"))
+      return;
+
+   num_threads = MIN2(util_cpu_caps.nr_cpus - 1, 4);
+   num_threads = debug_get_num_option("VREND_COPY_THREADS", num_threads);
+   vrend_copy_pool_init(num_threads,
+                        debug_get_num_option("VREND_COPY_POOL_MIN", 8) * 1024 * 1024);
+}
+
+/* With VREND_COMPILE_THREADS set, shader compiles and program links are
+ * handed to worker threads with shared contexts, so that the decode thread
+ * does not stall on the GLSL compiler and linker. The driver's own
+ * background compile is used instead if it has one. This is off by
+ * default: compile errors are then only reported when the shader is first
+ * linked.
+ */
+static void vrend_renderer_use_compile_threads(void)
+{
+   struct virgl_gl_ctx_param ctx_params;
+   int num_threads, i;
+
+   if (getenv("VIRGL_DISABLE_MT"))
+      return;
+
+   num_threads = debug_get_num_option("VREND_COMPILE_THREADS", 0);
+   if (num_threads <= 0)
+      return;
+
+   vrend_state.async_compile = true;
+   if (has_feature(feat_parallel_shader_compile))
+      return;
+
+   if (num_threads > VREND_MAX_COMPILE_THREADS)
+      num_threads = VREND_MAX_COMPILE_THREADS;
+
+   ctx_params.shared = true;
+   ctx_params.major_ver = vrend_state.gl_major_ver;
+   ctx_params.minor_ver = vrend_state.gl_minor_ver;
+
+   vrend_state.stop_compile_threads = false;
+   list_inithead(&vrend_state.compile_queue);
+   pipe_condvar_init(vrend_state.compile_cond);
+   pipe_condvar_init(vrend_state.compile_done_cond);
+   pipe_mutex_init(vrend_state.compile_mutex);
+
+   for (i = 0; i < num_threads; i++) {
+      vrend_state.compile_contexts[i] = vrend_clicbs->create_gl_context(0, &ctx_params);
+      if (vrend_state.compile_contexts[i] == NULL) {
+         vrend_printf( "failed to create compile opengl context\n");
+         break;
+      }
+
+      vrend_state.compile_threads[i] = pipe_thread_create(thread_compile,
+                                                          vrend_state.compile_contexts[i]);
+      if (!vrend_state.compile_threads[i]) {
+         vrend_clicbs->destroy_gl_context(vrend_state.compile_contexts[i]);
+         break;
+      }
+      vrend_state.num_compile_threads++;
+   }
+
+   if (!vrend_state.num_compile_threads) {
+      vrend_state.async_compile = false;
+      pipe_condvar_destroy(vrend_state.compile_cond);
+      pipe_condvar_destroy(vrend_state.compile_done_cond);
+      pipe_mutex_destroy(vrend_state.compile_mutex);
+   }
+}
+
 static void vrend_debug_cb(UNUSED GLenum source, GLenum type, UNUSED GLuint id,
                            UNUSED GLenum severity, UNUSED GLsizei length,
                            UNUSED const GLchar* message, UNUSED const void* userParam)
@@ -5685,6 +7108,11 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
       vrend_state.inited = true;
       vrend_object_init_resource_table();
       vrend_clicbs = cbs;
+
+      /* VREND_SLABS=false allocates every object on its own, for valgrind */
+      vrend_slab_init(debug_get_bool_option("VREND_SLABS", true));
+      vrend_state.fence_slab = vrend_slab_create(sizeof(struct vrend_fence), true);
+      vrend_state.resource_slab = vrend_slab_create(sizeof(struct vrend_texture), true);
    }
 
 #ifndef NDEBUG
@@ -5737,6 +7165,22 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
 
    glGetIntegerv(GL_MAX_DRAW_BUFFERS, (GLint *) &vrend_state.max_draw_buffers);
 
+   if (has_feature(feat_get_program_binary)) {
+      static const GLenum driver_strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+      uint64_t hash = VREND_SHADER_CACHE_HASH_SEED;
+      GLint num_formats = 0;
+
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+      vrend_state.features[feat_get_program_binary] = num_formats > 0;
+
+      for (uint32_t i = 0; i < ARRAY_SIZE(driver_strings); i++) {
+         const char *str = (const char *)glGetString(driver_strings[i]);
+         if (str)
+            hash = vrend_shader_cache_hash(hash, str, strlen(str) + 1);
+      }
+      vrend_state.program_cache_driver_hash = hash;
+   }
+
    if (!has_feature(feat_arb_robustness) &&
        !has_feature(feat_gles_khr_robustness)) {
       vrend_printf("WARNING: running without ARB/KHR robustness in place may crash\n");
@@ -5776,8 +7220,17 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
    vrend_clicbs->destroy_gl_context(gl_context);
    list_inithead(&vrend_state.fence_list);
    list_inithead(&vrend_state.fence_wait_list);
-   list_inithead(&vrend_state.waiting_query_list);
    list_inithead(&vrend_state.active_ctx_list);
+
+   /* Since GL 4.40 the interpolation of separable programs doesn't have to
+    * match, so vertex shaders need no patching when combined in pipelines.
+    */
+   vrend_state.use_separable_shaders = !gles && gl_ver >= 44 &&
+                                       has_feature(feat_separate_shader_objects) &&
+                                       debug_get_bool_option("VREND_SEPARABLE_SHADERS", true);
+
+   vrend_state.use_tgsi_tokens = debug_get_bool_option("VREND_TGSI_TOKENS", false);
+
    /* create 0 context */
    vrend_renderer_context_create_internal(0, strlen("HOST"), "HOST");
 
@@ -5785,6 +7238,36 @@ int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags)
    if (flags & VREND_USE_THREAD_SYNC) {
       vrend_renderer_use_threaded_sync();
    }
+   vrend_renderer_use_compile_threads();
+
+   vrend_shader_cache_init(debug_get_option("VREND_SHADER_CACHE_DIR", NULL),
+                           debug_get_num_option("VREND_SHADER_CACHE_SIZE", 64) * 1024 * 1024);
+
+   vrend_simd_init(debug_get_option("VREND_SIMD", NULL));
+   vrend_renderer_use_copy_pool();
+
+   vrend_state.stream_ring_size = debug_get_num_option("VREND_STREAM_RING_SIZE", 4) * 1024 * 1024;
+   vrend_state.upload_stage_min = debug_get_num_option("VREND_UPLOAD_STAGE_MIN", 4) * 1024;
+   vrend_state.upload_stage_max = debug_get_num_option("VREND_UPLOAD_STAGE_MAX", 256) * 1024;
+   vrend_state.stats_enabled = flags & VREND_USE_CMD_STATS;
+   memset(&vrend_state.upload_stats, 0, sizeof(vrend_state.upload_stats));
+   memset(&vrend_state.shader_stats, 0, sizeof(vrend_state.shader_stats));
+
+   pipe_mutex_init(vrend_state.readback_mutex);
+   list_inithead(&vrend_state.readback_list);
+   list_inithead(&vrend_state.readback_pool);
+   vrend_state.readback_pool_count = 0;
+   vrend_state.async_readback = flags & VREND_USE_ASYNC_READBACK;
+
+   vrend_decode_set_cmd_stats(flags & VREND_USE_CMD_STATS);
+   vrend_decode_set_state_filter(debug_get_bool_option("VREND_STATE_FILTER", true));
+   vrend_decode_set_draw_coalescing(debug_get_bool_option("VREND_COALESCE_DRAWS", true));
+
+   vrend_state.deferred_fence_id = 0;
+   vrend_state.defer_fences = false;
+   if (flags & VREND_USE_THREADED_DECODE)
+      vrend_state.defer_fences =
+         !vrend_decode_thread_start(debug_get_num_option("VREND_DECODE_THREADS", 1));
 
    return 0;
 }
@@ -5795,6 +7278,8 @@ vrend_renderer_fini(void)
    if (!vrend_state.inited)
       return;
 
+   vrend_decode_thread_stop();
+
    typedef  void (*destroy_callback)(void *);
    vrend_resource_set_destroy_callback((destroy_callback)vrend_renderer_resource_destroy);
 
@@ -5804,16 +7289,45 @@ vrend_renderer_fini(void)
       vrend_state.eventfd = -1;
    }
 
+   vrend_readback_discard();
+   pipe_mutex_destroy(vrend_state.readback_mutex);
+
    vrend_blitter_fini();
+   vrend_shader_cache_fini();
    vrend_decode_reset(false);
    vrend_object_fini_resource_table();
    vrend_decode_reset(true);
+   vrend_free_compile_threads();
+   vrend_copy_pool_fini();
 
-   vrend_state.current_ctx = NULL;
-   vrend_state.current_hw_ctx = NULL;
+   vrend_slab_destroy(vrend_state.fence_slab);
+   vrend_slab_destroy(vrend_state.resource_slab);
+   vrend_state.fence_slab = NULL;
+   vrend_state.resource_slab = NULL;
+   vrend_arena_fini(vrend_arena_thread());
+
+   vrend_tls.current_ctx = NULL;
+   vrend_tls.current_hw_ctx = NULL;
    vrend_state.inited = false;
 }
 
+static void vrend_stream_ring_destroy(struct vrend_stream_ring *ring)
+{
+   int i;
+
+   if (!ring)
+      return;
+
+   for (i = 0; i < VREND_STREAM_RING_SEGMENTS; i++) {
+      if (ring->fences[i])
+         glDeleteSync(ring->fences[i]);
+   }
+   /* deleting the buffer also unmaps it */
+   if (ring->id)
+      glDeleteBuffers(1, &ring->id);
+   free(ring);
+}
+
 static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
 {
    int i, j;
@@ -5856,6 +7370,7 @@ static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
       sub->prog->ref_context = NULL;
 
    vrend_free_programs(sub);
+   vrend_program_table_destroy(sub->program_table);
    for (i = 0; i < PIPE_SHADER_TYPES; i++) {
       free(sub->consts[i].consts);
       sub->consts[i].consts = NULL;
@@ -5877,6 +7392,14 @@ static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
    vrend_resource_reference((struct vrend_resource **)&sub->ib.buffer, NULL);
 
    vrend_object_fini_ctx_table(sub->object_hash);
+   vrend_stream_ring_destroy(sub->stream_ring);
+
+   /* anything still referenced keeps its pages until it is freed */
+   vrend_slab_destroy(sub->surface_slab);
+   vrend_slab_destroy(sub->view_slab);
+   vrend_slab_destroy(sub->so_target_slab);
+   vrend_slab_destroy(sub->query_slab);
+   vrend_slab_destroy(sub->shader_slab);
    vrend_clicbs->destroy_gl_context(sub->gl_context);
 
    list_del(&sub->head);
@@ -5886,12 +7409,12 @@ static void vrend_destroy_sub_context(struct vrend_sub_context *sub)
 
 bool vrend_destroy_context(struct vrend_context *ctx)
 {
-   bool switch_0 = (ctx == vrend_state.current_ctx);
-   struct vrend_context *cur = vrend_state.current_ctx;
+   bool switch_0 = (ctx == vrend_tls.current_ctx);
+   struct vrend_context *cur = vrend_tls.current_ctx;
    struct vrend_sub_context *sub, *tmp;
    if (switch_0) {
-      vrend_state.current_ctx = NULL;
-      vrend_state.current_hw_ctx = NULL;
+      vrend_tls.current_ctx = NULL;
+      vrend_tls.current_hw_ctx = NULL;
    }
 
    if (vrend_state.use_core_profile) {
@@ -5956,6 +7479,7 @@ struct vrend_context *vrend_create_context(int id, uint32_t nlen, const char *de
    grctx->shader_cfg.use_gles = vrend_state.use_gles;
    grctx->shader_cfg.use_core_profile = vrend_state.use_core_profile;
    grctx->shader_cfg.use_explicit_locations = vrend_state.use_explicit_locations;
+   grctx->shader_cfg.use_separable_shaders = vrend_state.use_separable_shaders;
    grctx->shader_cfg.max_draw_buffers = vrend_state.max_draw_buffers;
    grctx->shader_cfg.has_arrays_of_arrays = has_feature(feat_arrays_of_arrays);
    grctx->shader_cfg.has_gpu_shader5 = has_feature(feat_gpu_shader5);
@@ -5963,6 +7487,11 @@ struct vrend_context *vrend_create_context(int id, uint32_t nlen, const char *de
    grctx->shader_cfg.has_conservative_depth = has_feature(feat_conservative_depth);
 
    vrend_renderer_create_sub_ctx(grctx, 0);
+   if (!grctx->sub0) {
+      vrend_object_fini_ctx_table(grctx->res_hash);
+      FREE(grctx);
+      return NULL;
+   }
    vrend_renderer_set_sub_ctx(grctx, 0);
 
    vrender_get_glsl_version(&grctx->shader_cfg.glsl_version);
@@ -6004,6 +7533,7 @@ void vrend_renderer_resource_detach_iov(int res_handle,
    if (!res) {
       return;
    }
+   vrend_readback_flush_resource(res);
    if (iov_p)
       *iov_p = res->iov;
    if (num_iovs_p)
@@ -6236,7 +7766,7 @@ static int vrend_renderer_resource_allocate_texture(struct vrend_resource *gr,
 
    if (internalformat == 0) {
       vrend_printf("unknown format is %d\n", pr->format);
-      FREE(gt);
+      vrend_slab_free(gt);
       return EINVAL;
    }
 
@@ -6248,8 +7778,8 @@ static int vrend_renderer_resource_allocate_texture(struct vrend_resource *gr,
          glEGLImageTargetTexture2DOES(gr->target, (GLeglImageOES) image_oes);
       } else {
          vrend_printf( "missing GL_OES_EGL_image_external extension\n");
-	 FREE(gr);
          glBindTexture(gr->target, 0);
+	 vrend_slab_free(gr);
 	 return EINVAL;
       }
    } else if (pr->nr_samples > 0) {
@@ -6357,7 +7887,7 @@ int vrend_renderer_resource_create(struct vrend_renderer_resource_create_args *a
    if (ret)
       return EINVAL;
 
-   gr = (struct vrend_resource *)CALLOC_STRUCT(vrend_texture);
+   gr = vrend_slab_alloc(vrend_state.resource_slab);
    if (!gr)
       return ENOMEM;
 
@@ -6376,7 +7906,7 @@ int vrend_renderer_resource_create(struct vrend_renderer_resource_create_args *a
       gr->storage = VREND_RESOURCE_STORAGE_GUEST_ELSE_SYSTEM;
       gr->ptr = malloc(args->width);
       if (!gr->ptr) {
-         FREE(gr);
+         vrend_slab_free(gr);
          return ENOMEM;
       }
    } else if (args->bind == VIRGL_BIND_STAGING) {
@@ -6461,7 +7991,7 @@ void vrend_renderer_resource_destroy(struct vrend_resource *res)
       gbm_bo_destroy(res->gbm_bo);
 #endif
 
-   free(res);
+   vrend_slab_free(res);
 }
 
 static void vrend_destroy_resource_object(void *obj_ptr)
@@ -6481,6 +8011,9 @@ void vrend_renderer_resource_unref(uint32_t res_handle)
    if (!res)
       return;
 
+   /* the backing is released together with the handle */
+   vrend_readback_flush_resource(res);
+
    /* find in all contexts and detach also */
 
    /* remove from any contexts */
@@ -6504,15 +8037,7 @@ static void iov_buffer_upload(void *cookie, uint32_t doff, void *src, int len)
 
 static void vrend_scale_depth(void *ptr, int size, float scale_val)
 {
-   GLuint *ival = ptr;
-   const GLfloat myscale = 1.0f / 0xffffff;
-   int i;
-   for (i = 0; i < size / 4; i++) {
-      GLuint value = ival[i];
-      GLfloat d = ((float)(value >> 8) * myscale) * scale_val;
-      d = CLAMP(d, 0.0F, 1.0F);
-      ival[i] = (int)(d / myscale) << 8;
-   }
+   vrend_copy_scale_depth(ptr, ptr, size / 4, scale_val);
 }
 
 static void read_transfer_data(struct iovec *iov,
@@ -6539,6 +8064,12 @@ static void read_transfer_data(struct iovec *iov,
       if (invert) {
          for (d = 0; d < box->depth; d++) {
             uint32_t myoffset = offset + d * src_layer_stride;
+            if (num_iovs == 1 &&
+                myoffset + (uint64_t)(bh - 1) * src_stride + bwx <= iov[0].iov_len) {
+               vrend_copy_flip(data + d * (bh * bwx), bwx,
+                               (char *)iov[0].iov_base + myoffset, src_stride, bwx, bh);
+               continue;
+            }
             for (h = bh - 1; h >= 0; h--) {
                void *ptr = data + (h * bwx) + d * (bh * bwx);
                vrend_read_from_iovec(iov, num_iovs, myoffset, ptr, bwx);
@@ -6582,6 +8113,12 @@ static void write_transfer_data(struct pipe_resource *res,
    } else if (invert) {
       for (d = 0; d < box->depth; d++) {
          uint32_t myoffset = offset + d * stride * u_minify(res->height0, level);
+         if (num_iovs == 1 &&
+             myoffset + (uint64_t)(bh - 1) * stride + bwx <= iov[0].iov_len) {
+            vrend_copy_flip((char *)iov[0].iov_base + myoffset, stride,
+                            data + d * (bh * bwx), bwx, bwx, bh);
+            continue;
+         }
          for (h = bh - 1; h >= 0; h--) {
             void *ptr = data + (h * bwx) + d * (bh * bwx);
             vrend_write_to_iovec(iov, num_iovs, myoffset, ptr, bwx);
@@ -6600,6 +8137,153 @@ static void write_transfer_data(struct pipe_resource *res,
    }
 }
 
+/* Rows of a transfer that are contiguous in one iovec and can be handed to
+ * GL directly. A row that straddles two iovecs gets a run of its own with
+ * a NULL ptr and goes through a bounce buffer.
+ */
+struct vrend_iov_run {
+   char *ptr;
+   uint64_t offset;
+   uint32_t layer;
+   uint32_t row;
+   uint32_t num_rows;
+};
+
+/* Short iovecs split a transfer into many small GL calls and bounce most of
+ * its rows, below this many rows per run a single temporary is cheaper.
+ */
+#define VREND_IOV_RUN_MIN_ROWS 4
+
+static struct vrend_iov_run *vrend_iov_runs(const struct iovec *iov, int num_iovs,
+                                            uint64_t offset, uint32_t row_size,
+                                            uint32_t stride, uint32_t rows,
+                                            uint32_t layer_stride, uint32_t layers,
+                                            uint32_t *num_runs)
+{
+   struct vrend_iov_run *runs, *last = NULL;
+   uint32_t max_runs = MAX2(rows * layers / VREND_IOV_RUN_MIN_ROWS, 1);
+   uint64_t seg_start = 0;
+   uint32_t l, r, n = 0;
+   int i = 0;
+
+   runs = malloc(max_runs * sizeof(*runs));
+   if (!runs)
+      return NULL;
+
+   for (l = 0; l < layers; l++) {
+      for (r = 0; r < rows; r++) {
+         uint64_t off = offset + (uint64_t)l * layer_stride + (uint64_t)r * stride;
+         char *ptr = NULL;
+
+         if (off < seg_start) {
+            i = 0;
+            seg_start = 0;
+         }
+         while (i < num_iovs && off >= seg_start + iov[i].iov_len) {
+            seg_start += iov[i].iov_len;
+            i++;
+         }
+         if (i == num_iovs)
+            goto fail;
+
+         if (off + row_size <= seg_start + iov[i].iov_len)
+            ptr = (char *)iov[i].iov_base + (off - seg_start);
+
+         if (ptr && last && last->ptr && last->layer == l &&
+             last->ptr + (uint64_t)last->num_rows * stride == ptr) {
+            last->num_rows++;
+            continue;
+         }
+
+         if (n == max_runs)
+            goto fail;
+         last = &runs[n++];
+         last->ptr = ptr;
+         last->offset = off;
+         last->layer = l;
+         last->row = r;
+         last->num_rows = 1;
+      }
+   }
+
+   *num_runs = n;
+   return runs;
+
+fail:
+   free(runs);
+   return NULL;
+}
+
+static bool vrend_iov_runs_supported(struct vrend_resource *res)
+{
+   switch (res->target) {
+   case GL_TEXTURE_2D:
+   case GL_TEXTURE_RECTANGLE_NV:
+   case GL_TEXTURE_3D:
+   case GL_TEXTURE_2D_ARRAY:
+   case GL_TEXTURE_CUBE_MAP:
+   case GL_TEXTURE_CUBE_MAP_ARRAY:
+      return true;
+   default:
+      return false;
+   }
+}
+
+static uint32_t vrend_iov_run_layers(struct vrend_resource *res,
+                                     const struct vrend_transfer_info *info)
+{
+   /* a cube map transfer covers the single face in box->z */
+   if (res->target == GL_TEXTURE_CUBE_MAP)
+      return 1;
+   return info->box->depth;
+}
+
+static void vrend_tex_sub_image_rows(struct vrend_resource *res, uint32_t level,
+                                     int x, int y, int z, int width, int height,
+                                     GLenum glformat, GLenum gltype, const void *data)
+{
+   if (res->target == GL_TEXTURE_CUBE_MAP)
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + z, level, x, y, width, height,
+                      glformat, gltype, data);
+   else if (res->target == GL_TEXTURE_3D || res->target == GL_TEXTURE_2D_ARRAY ||
+            res->target == GL_TEXTURE_CUBE_MAP_ARRAY)
+      glTexSubImage3D(res->target, level, x, y, z, width, height, 1,
+                      glformat, gltype, data);
+   else
+      glTexSubImage2D(res->target, level, x, y, width, height, glformat, gltype, data);
+}
+
+/* expects the texture bound and GL_UNPACK_ROW_LENGTH set to the stride */
+static int vrend_upload_iov_runs(struct vrend_resource *res,
+                                 const struct vrend_transfer_info *info,
+                                 const struct iovec *iov, int num_iovs,
+                                 const struct vrend_iov_run *runs, uint32_t num_runs,
+                                 uint32_t row_size, GLenum glformat, GLenum gltype)
+{
+   char *row = NULL;
+   uint32_t i;
+
+   for (i = 0; i < num_runs; i++) {
+      const char *data = runs[i].ptr;
+
+      if (!data) {
+         if (!row) {
+            row = vrend_arena_alloc(vrend_arena_thread(), row_size);
+            if (!row)
+               return ENOMEM;
+         }
+         vrend_read_from_iovec(iov, num_iovs, runs[i].offset, row, row_size);
+         data = row;
+      }
+      vrend_tex_sub_image_rows(res, info->level, info->box->x,
+                               info->box->y + runs[i].row,
+                               info->box->z + runs[i].layer,
+                               info->box->width, runs[i].num_rows,
+                               glformat, gltype, data);
+   }
+   return 0;
+}
+
 static bool check_transfer_bounds(struct vrend_resource *res,
                                   const struct vrend_transfer_info *info)
 {
@@ -6738,6 +8422,133 @@ static bool check_iov_bounds(struct vrend_resource *res,
    return true;
 }
 
+static struct vrend_stream_ring *vrend_stream_ring_create(uint32_t size)
+{
+   const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+   struct vrend_stream_ring *ring = CALLOC_STRUCT(vrend_stream_ring);
+
+   if (!ring)
+      return NULL;
+
+   ring->segment_size = size / VREND_STREAM_RING_SEGMENTS;
+
+   glGenBuffers(1, &ring->id);
+   glBindBuffer(GL_COPY_READ_BUFFER, ring->id);
+   glBufferStorage(GL_COPY_READ_BUFFER, size, NULL, flags);
+   ring->map = glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags);
+   glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+   if (!ring->map) {
+      vrend_printf("failed to map the buffer upload ring, using the map path\n");
+      glDeleteBuffers(1, &ring->id);
+      ring->id = 0;
+   }
+   return ring;
+}
+
+/* Returns space for size bytes in the ring and its offset, or NULL if the
+ * upload is larger than a segment. */
+static uint8_t *vrend_stream_ring_alloc(struct vrend_stream_ring *ring,
+                                        uint32_t size, uint32_t *offset)
+{
+   GLsync fence;
+
+   if (size > ring->segment_size)
+      return NULL;
+
+   if (ring->segment_offset + size > ring->segment_size) {
+      ring->fences[ring->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      ring->segment = (ring->segment + 1) % VREND_STREAM_RING_SEGMENTS;
+      ring->segment_offset = 0;
+
+      fence = ring->fences[ring->segment];
+      if (fence) {
+         GLenum status;
+         do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+         } while (status == GL_TIMEOUT_EXPIRED);
+         glDeleteSync(fence);
+         ring->fences[ring->segment] = NULL;
+      }
+   }
+
+   *offset = ring->segment * ring->segment_size + ring->segment_offset;
+   ring->segment_offset += align(size, 16);
+   return ring->map + *offset;
+}
+
+/* Returns space for size bytes in the ring of the sub context of ctx,
+ * or NULL if the ring can not be used for this upload. */
+static uint8_t *vrend_stream_ring_get(struct vrend_context *ctx, uint32_t size,
+                                      uint32_t *offset)
+{
+   struct vrend_sub_context *sub;
+
+   if (!ctx || !vrend_state.stream_ring_size || !has_feature(feat_arb_buffer_storage))
+      return NULL;
+
+   /* the fences protecting the ring belong to the current GL context */
+   if (vrend_tls.current_hw_ctx != ctx || ctx->ctx_switch_pending)
+      return NULL;
+
+   sub = ctx->sub;
+   if (!sub->stream_ring) {
+      sub->stream_ring = vrend_stream_ring_create(vrend_state.stream_ring_size);
+      if (!sub->stream_ring)
+         return NULL;
+   }
+   if (!sub->stream_ring->id)
+      return NULL;
+
+   return vrend_stream_ring_alloc(sub->stream_ring, size, offset);
+}
+
+static bool vrend_stream_ring_upload(struct vrend_context *ctx,
+                                     struct vrend_resource *res,
+                                     const struct iovec *iov, int num_iovs,
+                                     const struct vrend_transfer_info *info)
+{
+   uint32_t offset;
+   uint8_t *ptr;
+
+   ptr = vrend_stream_ring_get(ctx, info->box->width, &offset);
+   if (!ptr)
+      return false;
+
+   vrend_read_from_iovec(iov, num_iovs, info->offset, (char *)ptr, info->box->width);
+
+   glBindBuffer(GL_COPY_READ_BUFFER, ctx->sub->stream_ring->id);
+   glBindBuffer(GL_COPY_WRITE_BUFFER, res->id);
+   glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                       offset, info->box->x, info->box->width);
+   glBindBuffer(GL_COPY_READ_BUFFER, 0);
+   glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+   return true;
+}
+
+static void vrend_upload_stats_add(bool staged, uint32_t size)
+{
+   if (!vrend_state.stats_enabled)
+      return;
+
+   pipe_mutex_lock(vrend_upload_stats_mutex);
+   if (staged) {
+      vrend_state.upload_stats.staged_count++;
+      vrend_state.upload_stats.staged_bytes += size;
+   } else {
+      vrend_state.upload_stats.direct_count++;
+      vrend_state.upload_stats.direct_bytes += size;
+   }
+   pipe_mutex_unlock(vrend_upload_stats_mutex);
+}
+
+void vrend_renderer_get_upload_stats(struct vrend_upload_stats *stats)
+{
+   pipe_mutex_lock(vrend_upload_stats_mutex);
+   *stats = vrend_state.upload_stats;
+   pipe_mutex_unlock(vrend_upload_stats_mutex);
+}
+
 static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
                                              struct vrend_resource *res,
                                              struct iovec *iov, int num_iovs,
@@ -6765,6 +8576,9 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
       d.box = info->box;
       d.target = res->target;
 
+      if (vrend_stream_ring_upload(ctx, res, iov, num_iovs, info))
+         return 0;
+
       if (!info->synchronized)
          map_flags |= GL_MAP_UNSYNCHRONIZED_BIT;
 
@@ -6788,8 +8602,14 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
       bool invert = false;
       float depth_scale;
       GLuint send_size = 0;
+      uint32_t upload_size;
       uint32_t stride = info->stride;
       uint32_t layer_stride = info->layer_stride;
+      uint8_t *staged = NULL;
+      uint32_t stage_offset;
+      bool scatter;
+      struct vrend_iov_run *runs = NULL;
+      uint32_t num_runs = 0;
 
       if (ctx)
          vrend_use_program(ctx, 0);
@@ -6808,16 +8628,52 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
          need_temp = true;
       }
 
+      /* only split iovecs keep the rows from being uploaded in place */
+      scatter = num_iovs > 1 && !compressed && !res->y_0_top &&
+                vrend_iov_runs_supported(res);
+
       if (vrend_state.use_core_profile == true && (res->y_0_top || (res->base.format == (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM))) {
          need_temp = true;
+         scatter = false;
          if (res->y_0_top)
             invert = true;
       }
 
-      if (need_temp) {
-         send_size = util_format_get_nblocks(res->base.format, info->box->width,
-                                             info->box->height) * elsize * info->box->depth;
-         data = malloc(send_size);
+      upload_size = util_format_get_nblocks(res->base.format, info->box->width,
+                                            info->box->height) * elsize * info->box->depth;
+
+      /* Copy the data into the staging ring and let the driver source it
+       * from there, so it doesn't have to copy it before returning. Small
+       * uploads are cheaper to hand over directly, and big ones would
+       * stall on the ring. The glDrawPixels path below takes no buffer,
+       * and depth values that get scaled in place must not be read back
+       * from the write only ring mapping.
+       */
+      if (upload_size >= vrend_state.upload_stage_min &&
+          upload_size <= vrend_state.upload_stage_max &&
+          (vrend_state.use_core_profile || !res->y_0_top) &&
+          res->base.format != (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM)
+         staged = vrend_stream_ring_get(ctx, upload_size, &stage_offset);
+      vrend_upload_stats_add(staged != NULL, upload_size);
+
+      if (staged) {
+         need_temp = true;
+         send_size = upload_size;
+         read_transfer_data(iov, num_iovs, (char *)staged, res->base.format, info->offset,
+                            stride, layer_stride, info->box, invert);
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ctx->sub->stream_ring->id);
+         data = (void *)(uintptr_t)stage_offset;
+      } else if (scatter &&
+                 (runs = vrend_iov_runs(iov, num_iovs, info->offset,
+                                        info->box->width * elsize, stride,
+                                        info->box->height, layer_stride,
+                                        vrend_iov_run_layers(res, info), &num_runs))) {
+         /* upload straight from the guest iovecs instead of gathering them */
+         need_temp = false;
+         data = NULL;
+      } else if (need_temp) {
+         send_size = upload_size;
+         data = vrend_arena_alloc(vrend_arena_thread(), send_size);
          if (!data)
             return ENOMEM;
          read_transfer_data(iov, num_iovs, data, res->base.format, info->offset,
@@ -6929,7 +8785,13 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
             else
                vrend_scale_depth(data, send_size, depth_scale);
          }
-         if (res->target == GL_TEXTURE_CUBE_MAP) {
+         if (runs) {
+            int ret = vrend_upload_iov_runs(res, info, iov, num_iovs, runs, num_runs,
+                                            info->box->width * elsize, glformat, gltype);
+            if (ret)
+               vrend_printf("failed to upload %d rows of resource %d\n",
+                            info->box->height, res->handle);
+         } else if (res->target == GL_TEXTURE_CUBE_MAP) {
             GLenum ctarget = GL_TEXTURE_CUBE_MAP_POSITIVE_X + info->box->z;
             if (compressed) {
                glCompressedTexSubImage2D(ctarget, info->level, x, y,
@@ -6987,8 +8849,9 @@ static int vrend_renderer_transfer_write_iov(struct vrend_context *ctx,
 
       glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-      if (need_temp)
-         free(data);
+      if (staged)
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      free(runs);
    }
    return 0;
 }
@@ -7005,6 +8868,225 @@ static uint32_t vrend_get_texture_depth(struct vrend_resource *res, uint32_t lev
    return depth;
 }
 
+static bool vrend_readback_can_defer(struct vrend_resource *res,
+                                     const struct iovec *iov)
+{
+   /* only the attached backing outlives the transfer call */
+   return vrend_state.async_readback && res->iov && iov == res->iov;
+}
+
+#define VREND_READBACK_POOL_SIZE 8
+/* bigger pack buffers are not worth keeping around */
+#define VREND_READBACK_POOL_MAX_PBO (32 * 1024 * 1024)
+
+/* prefers a pooled buffer that is large enough, else one to grow */
+static struct vrend_readback *vrend_readback_pool_get(uint32_t size)
+{
+   struct vrend_readback *rb, *found = NULL;
+   GLuint pbo_id;
+   uint32_t pbo_size;
+
+   pipe_mutex_lock(vrend_state.readback_mutex);
+   LIST_FOR_EACH_ENTRY(rb, &vrend_state.readback_pool, head) {
+      if (!found || (found->pbo_size < size && rb->pbo_size > found->pbo_size) ||
+          (rb->pbo_size >= size && rb->pbo_size < found->pbo_size))
+         found = rb;
+   }
+   if (found) {
+      list_del(&found->head);
+      vrend_state.readback_pool_count--;
+   }
+   pipe_mutex_unlock(vrend_state.readback_mutex);
+
+   if (!found)
+      return NULL;
+
+   pbo_id = found->pbo_id;
+   pbo_size = found->pbo_size;
+   memset(found, 0, sizeof(*found));
+   found->pbo_id = pbo_id;
+   found->pbo_size = pbo_size;
+   return found;
+}
+
+/* returns a readback with its pack buffer bound to read size bytes into */
+static struct vrend_readback *vrend_readback_begin(uint32_t size)
+{
+   struct vrend_readback *rb;
+
+   rb = vrend_readback_pool_get(size);
+   if (!rb) {
+      rb = CALLOC_STRUCT(vrend_readback);
+      if (!rb)
+         return NULL;
+      glGenBuffers(1, &rb->pbo_id);
+   }
+
+   rb->size = size;
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo_id);
+   if (rb->pbo_size < size) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+      rb->pbo_size = size;
+   }
+   return rb;
+}
+
+static void vrend_readback_free(struct vrend_readback *rb)
+{
+   glDeleteBuffers(1, &rb->pbo_id);
+   free(rb);
+}
+
+static void vrend_readback_destroy(struct vrend_readback *rb)
+{
+   bool pooled = false;
+
+   if (rb->syncobj)
+      glDeleteSync(rb->syncobj);
+   if (rb->res)
+      p_atomic_dec(&rb->res->num_readbacks);
+   vrend_resource_reference(&rb->res, NULL);
+
+   pipe_mutex_lock(vrend_state.readback_mutex);
+   if (vrend_state.readback_pool_count < VREND_READBACK_POOL_SIZE &&
+       rb->pbo_size <= VREND_READBACK_POOL_MAX_PBO) {
+      list_add(&rb->head, &vrend_state.readback_pool);
+      vrend_state.readback_pool_count++;
+      pooled = true;
+   }
+   pipe_mutex_unlock(vrend_state.readback_mutex);
+
+   if (!pooled)
+      vrend_readback_free(rb);
+}
+
+static void vrend_readback_queue(struct vrend_readback *rb,
+                                 struct vrend_resource *res,
+                                 uint32_t data_offset,
+                                 const struct vrend_transfer_info *info,
+                                 bool invert)
+{
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   rb->syncobj = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   glFlush();
+
+   rb->data_offset = data_offset;
+   rb->box = *info->box;
+   rb->level = info->level;
+   rb->stride = info->stride;
+   rb->offset = info->offset;
+   rb->invert = invert;
+   vrend_resource_reference(&rb->res, res);
+   p_atomic_inc(&res->num_readbacks);
+
+   pipe_mutex_lock(vrend_state.readback_mutex);
+   rb->seq = ++vrend_state.readback_seq;
+   list_addtail(&rb->head, &vrend_state.readback_list);
+   pipe_mutex_unlock(vrend_state.readback_mutex);
+}
+
+static void vrend_readback_complete(struct vrend_readback *rb)
+{
+   struct vrend_resource *res = rb->res;
+   char *data;
+
+   if (rb->syncobj) {
+      GLenum status;
+      do {
+         status = glClientWaitSync(rb->syncobj, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+      } while (status == GL_TIMEOUT_EXPIRED);
+   }
+
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo_id);
+   data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rb->size, GL_MAP_READ_BIT);
+   if (!data) {
+      vrend_printf("unable to map readback buffer\n");
+   } else {
+      if (res->iov)
+         write_transfer_data(&res->base, res->iov, res->num_iovs,
+                             data + rb->data_offset, rb->stride, &rb->box,
+                             rb->level, rb->offset, rb->invert);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   vrend_readback_destroy(rb);
+}
+
+static void vrend_readback_complete_list(struct list_head *list)
+{
+   struct vrend_readback *rb, *tmp;
+
+   LIST_FOR_EACH_ENTRY_SAFE(rb, tmp, list, head) {
+      list_del(&rb->head);
+      vrend_readback_complete(rb);
+   }
+}
+
+/* copy out everything that was read back before the fence with seq */
+static void vrend_readback_retire(uint32_t seq)
+{
+   struct vrend_readback *rb, *tmp;
+   struct list_head done;
+
+   list_inithead(&done);
+
+   pipe_mutex_lock(vrend_state.readback_mutex);
+   LIST_FOR_EACH_ENTRY_SAFE(rb, tmp, &vrend_state.readback_list, head) {
+      if ((int32_t)(seq - rb->seq) <= 0)
+         break;
+      list_del(&rb->head);
+      list_addtail(&rb->head, &done);
+   }
+   pipe_mutex_unlock(vrend_state.readback_mutex);
+
+   if (LIST_IS_EMPTY(&done))
+      return;
+
+   vrend_renderer_force_ctx_0();
+   vrend_readback_complete_list(&done);
+}
+
+/* the iovecs of res are about to be read, replaced or freed */
+static void vrend_readback_flush_resource(struct vrend_resource *res)
+{
+   struct vrend_readback *rb, *tmp;
+   struct list_head done;
+
+   if (!p_atomic_read(&res->num_readbacks))
+      return;
+
+   list_inithead(&done);
+
+   pipe_mutex_lock(vrend_state.readback_mutex);
+   LIST_FOR_EACH_ENTRY_SAFE(rb, tmp, &vrend_state.readback_list, head) {
+      if (rb->res != res)
+         continue;
+      list_del(&rb->head);
+      list_addtail(&rb->head, &done);
+   }
+   pipe_mutex_unlock(vrend_state.readback_mutex);
+
+   vrend_readback_complete_list(&done);
+}
+
+static void vrend_readback_discard(void)
+{
+   struct vrend_readback *rb, *tmp;
+
+   LIST_FOR_EACH_ENTRY_SAFE(rb, tmp, &vrend_state.readback_list, head) {
+      list_del(&rb->head);
+      vrend_readback_destroy(rb);
+   }
+
+   LIST_FOR_EACH_ENTRY_SAFE(rb, tmp, &vrend_state.readback_pool, head) {
+      list_del(&rb->head);
+      vrend_readback_free(rb);
+   }
+   vrend_state.readback_pool_count = 0;
+}
+
 static int vrend_transfer_send_getteximage(struct vrend_resource *res,
                                            struct iovec *iov, int num_iovs,
                                            const struct vrend_transfer_info *info)
@@ -7016,6 +9098,7 @@ static int vrend_transfer_send_getteximage(struct vrend_resource *res,
    int compressed = util_format_is_compressed(res->base.format);
    GLenum target;
    uint32_t send_offset = 0;
+   struct vrend_readback *rb = NULL;
    format = tex_conv_table[res->base.format].glformat;
    type = tex_conv_table[res->base.format].gltype;
 
@@ -7029,9 +9112,18 @@ static int vrend_transfer_send_getteximage(struct vrend_resource *res,
       send_offset = util_format_get_nblocks(res->base.format, u_minify(res->base.width0, info->level), u_minify(res->base.height0, info->level)) * util_format_get_blocksize(res->base.format) * info->box->z;
    }
 
-   data = malloc(tex_size);
-   if (!data)
-      return ENOMEM;
+   if (vrend_readback_can_defer(res, iov)) {
+      rb = vrend_readback_begin(tex_size);
+      if (!rb)
+         return ENOMEM;
+      data = NULL;
+   } else {
+      /* an older deferred readback must not land on top of this one */
+      vrend_readback_flush_resource(res);
+      data = vrend_arena_alloc(vrend_arena_thread(), tex_size);
+      if (!data)
+         return ENOMEM;
+   }
 
    switch (elsize) {
    case 1:
@@ -7075,10 +9167,13 @@ static int vrend_transfer_send_getteximage(struct vrend_resource *res,
 
    glPixelStorei(GL_PACK_ALIGNMENT, 4);
 
-   write_transfer_data(&res->base, iov, num_iovs, data + send_offset,
-                       info->stride, info->box, info->level, info->offset,
-                       false);
-   free(data);
+   if (rb) {
+      vrend_readback_queue(rb, res, send_offset, info, false);
+   } else {
+      write_transfer_data(&res->base, iov, num_iovs, data + send_offset,
+                          info->stride, info->box, info->level, info->offset,
+                          false);
+   }
    glBindTexture(res->target, 0);
    return 0;
 }
@@ -7096,6 +9191,36 @@ static void do_readpixels(GLint x, GLint y,
       glReadPixels(x, y, width, height, format, type, data);
 }
 
+/* expects GL_PACK_ROW_LENGTH set to the stride */
+static int vrend_readpixels_iov_runs(const struct vrend_transfer_info *info, GLint y,
+                                     const struct iovec *iov, int num_iovs,
+                                     const struct vrend_iov_run *runs, uint32_t num_runs,
+                                     uint32_t row_size, uint32_t stride,
+                                     GLenum format, GLenum type)
+{
+   char *row = NULL;
+   uint32_t i;
+
+   for (i = 0; i < num_runs; i++) {
+      if (runs[i].ptr) {
+         do_readpixels(info->box->x, y + runs[i].row, info->box->width,
+                       runs[i].num_rows, format, type,
+                       (runs[i].num_rows - 1) * stride + row_size, runs[i].ptr);
+         continue;
+      }
+
+      if (!row) {
+         row = vrend_arena_alloc(vrend_arena_thread(), row_size);
+         if (!row)
+            return ENOMEM;
+      }
+      do_readpixels(info->box->x, y + runs[i].row, info->box->width, 1,
+                    format, type, row_size, row);
+      vrend_write_to_iovec(iov, num_iovs, runs[i].offset, row, row_size);
+   }
+   return 0;
+}
+
 static int vrend_transfer_send_readpixels(struct vrend_resource *res,
                                           struct iovec *iov, int num_iovs,
                                           const struct vrend_transfer_info *info)
@@ -7113,6 +9238,12 @@ static int vrend_transfer_send_readpixels(struct vrend_resource *res,
    float depth_scale;
    int row_stride = info->stride / elsize;
    GLint old_fbo;
+   struct vrend_readback *rb = NULL;
+   struct vrend_iov_run *runs = NULL;
+   uint32_t num_runs = 0;
+   uint32_t stride = info->stride;
+   bool defer;
+   int ret = 0;
 
    glUseProgram(0);
 
@@ -7126,14 +9257,39 @@ static int vrend_transfer_send_readpixels(struct vrend_resource *res,
    if (actually_invert && !has_feature(feat_mesa_invert))
       separate_invert = true;
 
-   if (num_iovs > 1 || separate_invert)
-      need_temp = 1;
+   if (!stride)
+      stride = util_format_get_nblocksx(res->base.format, u_minify(res->base.width0, info->level)) * elsize;
+
+   /* depth values read on core profiles are scaled on the CPU */
+   defer = vrend_readback_can_defer(res, iov) &&
+           (res->base.format != (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM ||
+            !vrend_state.use_core_profile);
 
-   if (need_temp) {
+   /* an older deferred readback must not land on top of this one */
+   if (!defer)
+      vrend_readback_flush_resource(res);
+
+   if (defer) {
+      send_size = util_format_get_nblocks(res->base.format, info->box->width, info->box->height) * info->box->depth * util_format_get_blocksize(res->base.format);
+      rb = vrend_readback_begin(send_size);
+      if (!rb)
+         return ENOMEM;
+      need_temp = 1;
+      data = NULL;
+   } else if (num_iovs > 1 && !actually_invert && info->box->depth == 1 &&
+              (res->base.format != (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM ||
+               !vrend_state.use_core_profile) &&
+              (runs = vrend_iov_runs(iov, num_iovs, info->offset, info->box->width * elsize,
+                                     stride, info->box->height, 0, 1, &num_runs))) {
+      /* read straight into the guest iovecs instead of scattering a copy */
+      data = NULL;
+      row_stride = stride / elsize;
+   } else if (num_iovs > 1 || separate_invert) {
+      need_temp = 1;
       send_size = util_format_get_nblocks(res->base.format, info->box->width, info->box->height) * info->box->depth * util_format_get_blocksize(res->base.format);
-      data = malloc(send_size);
+      data = vrend_arena_alloc(vrend_arena_thread(), send_size);
       if (!data) {
-         vrend_printf("malloc failed %d\n", send_size);
+         vrend_printf("failed to allocate %d bytes for the readback\n", send_size);
          return ENOMEM;
       }
    } else {
@@ -7227,7 +9383,11 @@ static int vrend_transfer_send_readpixels(struct vrend_resource *res,
       }
    }
 
-   do_readpixels(info->box->x, y1, info->box->width, info->box->height, format, type, send_size, data);
+   if (runs)
+      ret = vrend_readpixels_iov_runs(info, y1, iov, num_iovs, runs, num_runs,
+                                      info->box->width * elsize, stride, format, type);
+   else
+      do_readpixels(info->box->x, y1, info->box->width, info->box->height, format, type, send_size, data);
 
    if (res->base.format == (enum pipe_format)VIRGL_FORMAT_Z24X8_UNORM) {
       if (!vrend_state.use_core_profile)
@@ -7240,16 +9400,18 @@ static int vrend_transfer_send_readpixels(struct vrend_resource *res,
    if (!need_temp && row_stride)
       glPixelStorei(GL_PACK_ROW_LENGTH, 0);
    glPixelStorei(GL_PACK_ALIGNMENT, 4);
-   if (need_temp) {
+   if (rb) {
+      vrend_readback_queue(rb, res, 0, info, separate_invert);
+   } else if (need_temp) {
       write_transfer_data(&res->base, iov, num_iovs, data,
                           info->stride, info->box, info->level, info->offset,
                           separate_invert);
-      free(data);
    }
+   free(runs);
 
    glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
 
-   return 0;
+   return ret;
 }
 
 static int vrend_transfer_send_readonly(struct vrend_resource *res,
@@ -7342,6 +9504,7 @@ int vrend_renderer_transfer_iov(const struct vrend_transfer_info *info,
    struct vrend_context *ctx;
    struct iovec *iov;
    int num_iovs;
+   int ret;
 
    if (!info->box)
       return EINVAL;
@@ -7393,9 +9556,16 @@ int vrend_renderer_transfer_iov(const struct vrend_transfer_info *info,
 
    switch (transfer_mode) {
    case VIRGL_TRANSFER_TO_HOST:
-      return vrend_renderer_transfer_write_iov(ctx, res, iov, num_iovs, info);
+      vrend_readback_flush_resource(res);
+      vrend_arena_begin(vrend_arena_thread());
+      ret = vrend_renderer_transfer_write_iov(ctx, res, iov, num_iovs, info);
+      vrend_arena_end(vrend_arena_thread());
+      return ret;
    case VIRGL_TRANSFER_FROM_HOST:
-      return vrend_renderer_transfer_send_iov(res, iov, num_iovs, info);
+      vrend_arena_begin(vrend_arena_thread());
+      ret = vrend_renderer_transfer_send_iov(res, iov, num_iovs, info);
+      vrend_arena_end(vrend_arena_thread());
+      return ret;
 
    default:
       assert(0);
@@ -7406,6 +9576,7 @@ int vrend_transfer_inline_write(struct vrend_context *ctx,
                                 struct vrend_transfer_info *info)
 {
    struct vrend_resource *res;
+   int ret;
 
    res = vrend_renderer_ctx_res_lookup(ctx, info->handle);
    if (!res) {
@@ -7423,8 +9594,12 @@ int vrend_transfer_inline_write(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   return vrend_renderer_transfer_write_iov(ctx, res, info->iovec, info->iovec_cnt, info);
-
+   /* the staging buffer of this write is released when it is done, not
+    * with the rest of the command buffer */
+   vrend_arena_begin(vrend_arena_thread());
+   ret = vrend_renderer_transfer_write_iov(ctx, res, info->iovec, info->iovec_cnt, info);
+   vrend_arena_end(vrend_arena_thread());
+   return ret;
 }
 
 int vrend_renderer_copy_transfer3d(struct vrend_context *ctx,
@@ -7432,6 +9607,7 @@ int vrend_renderer_copy_transfer3d(struct vrend_context *ctx,
                                    uint32_t src_handle)
 {
    struct vrend_resource *src_res, *dst_res;
+   int ret;
 
    src_res = vrend_renderer_ctx_res_lookup(ctx, src_handle);
    dst_res = vrend_renderer_ctx_res_lookup(ctx, info->handle);
@@ -7461,8 +9637,13 @@ int vrend_renderer_copy_transfer3d(struct vrend_context *ctx,
       return EINVAL;
    }
 
-  return vrend_renderer_transfer_write_iov(ctx, dst_res, src_res->iov,
+   /* the source iovecs may still be waiting for a readback */
+   vrend_readback_flush_resource(src_res);
+   vrend_arena_begin(vrend_arena_thread());
+   ret = vrend_renderer_transfer_write_iov(ctx, dst_res, src_res->iov,
                                            src_res->num_iovs, info);
+   vrend_arena_end(vrend_arena_thread());
+   return ret;
 }
 
 void vrend_set_stencil_ref(struct vrend_context *ctx,
@@ -7572,14 +9753,14 @@ void vrend_set_min_samples(struct vrend_context *ctx, unsigned min_samples)
       glMinSampleShading(min_sample_shading);
 }
 
-void vrend_set_tess_state(UNUSED struct vrend_context *ctx, const float tess_factors[6])
+void vrend_set_tess_state(struct vrend_context *ctx, const float tess_factors[6])
 {
    if (has_feature(feat_tessellation)) {
       if (!vrend_state.use_gles) {
          glPatchParameterfv(GL_PATCH_DEFAULT_OUTER_LEVEL, tess_factors);
          glPatchParameterfv(GL_PATCH_DEFAULT_INNER_LEVEL, &tess_factors[4]);
       } else {
-         memcpy(vrend_state.tess_factors, tess_factors, 6 * sizeof (float));
+         memcpy(ctx->sub->tess_factors, tess_factors, 6 * sizeof (float));
       }
    }
 }
@@ -8137,11 +10318,14 @@ static void vrend_renderer_blit_int(struct vrend_context *ctx,
 
    if (use_gl) {
       VREND_DEBUG(dbg_blit, ctx, "BLIT_INT: use GL fallback\n");
+      /* the blitter context can only be current on one thread */
+      pipe_mutex_lock(vrend_blit_mutex);
       vrend_renderer_blit_gl(ctx, src_res, dst_res, blitter_views, info,
                              has_feature(feat_texture_srgb_decode),
                              has_feature(feat_srgb_write_control),
                              skip_dest_swizzle);
       vrend_clicbs->make_current(ctx->sub->gl_context);
+      pipe_mutex_unlock(vrend_blit_mutex);
       goto cleanup;
    }
 
@@ -8192,7 +10376,7 @@ static void vrend_renderer_blit_int(struct vrend_context *ctx,
       args.target = src_res->base.target;
       args.last_level = src_res->base.last_level;
       args.array_size = src_res->base.array_size;
-      intermediate_copy = (struct vrend_resource *)CALLOC_STRUCT(vrend_texture);
+      intermediate_copy = vrend_slab_alloc(vrend_state.resource_slab);
       vrend_renderer_resource_copy_args(&args, intermediate_copy);
       vrend_renderer_resource_allocate_texture(intermediate_copy, NULL);
 
@@ -8367,22 +10551,53 @@ void vrend_renderer_blit(struct vrend_context *ctx,
       vrend_pause_render_condition(ctx, false);
 }
 
-int vrend_renderer_create_fence(int client_fence_id, uint32_t ctx_id)
+/* creates the sync object for the commands submitted in the context
+ * current on this thread, without making it visible to the fence check */
+struct vrend_fence *vrend_renderer_fence_sync(int client_fence_id, uint32_t ctx_id)
 {
    struct vrend_fence *fence;
 
-   fence = malloc(sizeof(struct vrend_fence));
+   fence = vrend_slab_alloc(vrend_state.fence_slab);
    if (!fence)
-      return ENOMEM;
+      return NULL;
 
    fence->ctx_id = ctx_id;
    fence->fence_id = client_fence_id;
    fence->syncobj = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
    glFlush();
+   pipe_mutex_lock(vrend_state.readback_mutex);
+   fence->seq = ++vrend_state.readback_seq;
+   pipe_mutex_unlock(vrend_state.readback_mutex);
 
-   if (fence->syncobj == NULL)
-      goto fail;
+   if (fence->syncobj == NULL) {
+      vrend_printf( "failed to create fence sync object\n");
+      vrend_slab_free(fence);
+      return NULL;
+   }
+   return fence;
+}
+
+/* orders the commands of the current context before the contexts that
+ * wait for the result */
+GLsync vrend_renderer_sync_signal(void)
+{
+   GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   glFlush();
+   return sync;
+}
+
+void vrend_renderer_sync_wait(GLsync sync)
+{
+   glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
+}
+
+void vrend_renderer_sync_delete(GLsync sync)
+{
+   glDeleteSync(sync);
+}
 
+void vrend_renderer_fence_submit(struct vrend_fence *fence)
+{
    if (vrend_state.sync_thread) {
       pipe_mutex_lock(vrend_state.fence_mutex);
       list_addtail(&fence->fences, &vrend_state.fence_wait_list);
@@ -8390,19 +10605,25 @@ int vrend_renderer_create_fence(int client_fence_id, uint32_t ctx_id)
       pipe_mutex_unlock(vrend_state.fence_mutex);
    } else
       list_addtail(&fence->fences, &vrend_state.fence_list);
-   return 0;
+}
+
+int vrend_renderer_create_fence(int client_fence_id, uint32_t ctx_id)
+{
+   struct vrend_fence *fence;
+
+   fence = vrend_renderer_fence_sync(client_fence_id, ctx_id);
+   if (!fence)
+      return ENOMEM;
 
- fail:
-   vrend_printf( "failed to create fence sync object\n");
-   free(fence);
-   return ENOMEM;
+   vrend_renderer_fence_submit(fence);
+   return 0;
 }
 
 static void free_fence_locked(struct vrend_fence *fence)
 {
    list_del(&fence->fences);
    glDeleteSync(fence->syncobj);
-   free(fence);
+   vrend_slab_free(fence);
 }
 
 static void flush_eventfd(int fd)
@@ -8414,12 +10635,12 @@ static void flush_eventfd(int fd)
     } while ((len == -1 && errno == EINTR) || len == sizeof(value));
 }
 
-static void vrend_renderer_check_queries(void);
 
 void vrend_renderer_check_fences(void)
 {
    struct vrend_fence *fence, *stor;
    uint32_t latest_id = 0;
+   uint32_t latest_seq = 0;
    GLenum glret;
 
    if (!vrend_state.inited)
@@ -8431,6 +10652,7 @@ void vrend_renderer_check_fences(void)
       LIST_FOR_EACH_ENTRY_SAFE(fence, stor, &vrend_state.fence_list, fences) {
          if (fence->fence_id > latest_id)
             latest_id = fence->fence_id;
+         latest_seq = fence->seq;
          free_fence_locked(fence);
       }
       pipe_mutex_unlock(vrend_state.fence_mutex);
@@ -8441,6 +10663,7 @@ void vrend_renderer_check_fences(void)
          glret = glClientWaitSync(fence->syncobj, 0, 0);
          if (glret == GL_ALREADY_SIGNALED){
             latest_id = fence->fence_id;
+            latest_seq = fence->seq;
             free_fence_locked(fence);
          }
          /* don't bother checking any subsequent ones */
@@ -8453,11 +10676,47 @@ void vrend_renderer_check_fences(void)
    if (latest_id == 0)
       return;
 
+   if (vrend_state.async_readback)
+      vrend_readback_retire(latest_seq);
+
    vrend_renderer_check_queries();
 
+   if (vrend_state.defer_fences) {
+      pipe_mutex_lock(vrend_fence_deliver_mutex);
+      vrend_state.deferred_fence_id = latest_id;
+      pipe_mutex_unlock(vrend_fence_deliver_mutex);
+
+#ifdef HAVE_EVENTFD
+      /* have the caller poll again, see vrend_renderer_get_poll_fd */
+      if (vrend_state.eventfd != -1) {
+         uint64_t value = 1;
+         ssize_t n = write_full(vrend_state.eventfd, &value, sizeof(value));
+         if (n != sizeof(value))
+            perror("failed to write to eventfd\n");
+      }
+#endif
+      return;
+   }
+
    vrend_clicbs->write_fence(latest_id);
 }
 
+/* Reports the fences retired on the decode threads, from the thread that
+ * calls in, so write_fence is never called from a decode thread.
+ */
+void vrend_renderer_deliver_fences(void)
+{
+   uint32_t fence_id;
+
+   pipe_mutex_lock(vrend_fence_deliver_mutex);
+   fence_id = vrend_state.deferred_fence_id;
+   vrend_state.deferred_fence_id = 0;
+   pipe_mutex_unlock(vrend_fence_deliver_mutex);
+
+   if (fence_id)
+      vrend_clicbs->write_fence(fence_id);
+}
+
 static bool vrend_get_one_query_result(GLuint query_id, bool use_64, uint64_t *result)
 {
    GLuint ready;
@@ -8482,11 +10741,11 @@ static bool vrend_get_one_query_result(GLuint query_id, bool use_64, uint64_t *r
 static inline void
 vrend_update_oq_samples_multiplier(struct vrend_context *ctx)
 {
-   if (!vrend_state.current_ctx->sub->fake_occlusion_query_samples_passed_multiplier) {
+   if (!vrend_tls.current_ctx->sub->fake_occlusion_query_samples_passed_multiplier) {
       uint32_t multiplier = 0;
       bool tweaked = vrend_get_tweak_is_active_with_params(vrend_get_context_tweaks(ctx),
                                                            virgl_tweak_gles_tf3_samples_passes_multiplier, &multiplier);
-      vrend_state.current_ctx->sub->fake_occlusion_query_samples_passed_multiplier =
+      vrend_tls.current_ctx->sub->fake_occlusion_query_samples_passed_multiplier =
             tweaked ? multiplier: fake_occlusion_query_samples_passed_default;
    }
 }
@@ -8507,8 +10766,8 @@ static bool vrend_check_query(struct vrend_query *query)
     * blow the number up so that the client doesn't think it was just one pixel
     * and discards an object that might be bigger */
    if (query->fake_samples_passed) {
-      vrend_update_oq_samples_multiplier(vrend_state.current_ctx);
-      state.result *=  vrend_state.current_ctx->sub->fake_occlusion_query_samples_passed_multiplier;
+      vrend_update_oq_samples_multiplier(vrend_tls.current_ctx);
+      state.result *=  vrend_tls.current_ctx->sub->fake_occlusion_query_samples_passed_multiplier;
    }
 
    state.query_state = VIRGL_QUERY_STATE_DONE;
@@ -8523,11 +10782,12 @@ static bool vrend_check_query(struct vrend_query *query)
    return true;
 }
 
-static void vrend_renderer_check_queries(void)
+void vrend_renderer_check_queries(void)
 {
+   struct list_head *waiting = vrend_waiting_query_list();
    struct vrend_query *query, *stor;
 
-   LIST_FOR_EACH_ENTRY_SAFE(query, stor, &vrend_state.waiting_query_list, waiting_queries) {
+   LIST_FOR_EACH_ENTRY_SAFE(query, stor, waiting, waiting_queries) {
       vrend_hw_switch_context(vrend_lookup_renderer_ctx(query->ctx_id), true);
       if (vrend_check_query(query))
          list_delinit(&query->waiting_queries);
@@ -8539,7 +10799,7 @@ bool vrend_hw_switch_context(struct vrend_context *ctx, bool now)
    if (!ctx)
       return false;
 
-   if (ctx == vrend_state.current_ctx && ctx->ctx_switch_pending == false)
+   if (ctx == vrend_tls.current_ctx && ctx->ctx_switch_pending == false)
       return true;
 
    if (ctx->ctx_id != 0 && ctx->in_error) {
@@ -8550,7 +10810,7 @@ bool vrend_hw_switch_context(struct vrend_context *ctx, bool now)
    if (now == true) {
       vrend_finish_context_switch(ctx);
    }
-   vrend_state.current_ctx = ctx;
+   vrend_tls.current_ctx = ctx;
    return true;
 }
 
@@ -8560,10 +10820,10 @@ static void vrend_finish_context_switch(struct vrend_context *ctx)
       return;
    ctx->ctx_switch_pending = false;
 
-   if (vrend_state.current_hw_ctx == ctx)
+   if (vrend_tls.current_hw_ctx == ctx)
       return;
 
-   vrend_state.current_hw_ctx = ctx;
+   vrend_tls.current_hw_ctx = ctx;
 
    vrend_clicbs->make_current(ctx->sub->gl_context);
 }
@@ -8608,7 +10868,7 @@ int vrend_create_query(struct vrend_context *ctx, uint32_t handle,
       return EINVAL;
    }
 
-   q = CALLOC_STRUCT(vrend_query);
+   q = vrend_slab_alloc(ctx->sub->query_slab);
    if (!q)
       return ENOMEM;
 
@@ -8669,7 +10929,7 @@ int vrend_create_query(struct vrend_context *ctx, uint32_t handle,
    ret_handle = vrend_renderer_object_insert(ctx, q, sizeof(struct vrend_query), handle,
                                              VIRGL_OBJECT_QUERY);
    if (!ret_handle) {
-      FREE(q);
+      vrend_slab_free(q);
       return ENOMEM;
    }
    return 0;
@@ -8680,7 +10940,7 @@ static void vrend_destroy_query(struct vrend_query *query)
    vrend_resource_reference(&query->res, NULL);
    list_del(&query->waiting_queries);
    glDeleteQueries(1, &query->id);
-   free(query);
+   vrend_slab_free(query);
 }
 
 static void vrend_destroy_query_object(void *obj_ptr)
@@ -8755,7 +11015,7 @@ void vrend_get_query_result(struct vrend_context *ctx, uint32_t handle,
    if (ret) {
       list_delinit(&q->waiting_queries);
    } else if (LIST_IS_EMPTY(&q->waiting_queries)) {
-      list_addtail(&q->waiting_queries, &vrend_state.waiting_query_list);
+      list_addtail(&q->waiting_queries, vrend_waiting_query_list());
    }
 }
 
@@ -8937,7 +11197,7 @@ int vrend_create_so_target(struct vrend_context *ctx,
       return EINVAL;
    }
 
-   target = CALLOC_STRUCT(vrend_so_target);
+   target = vrend_slab_alloc(ctx->sub->so_target_slab);
    if (!target)
       return ENOMEM;
 
@@ -8951,7 +11211,7 @@ int vrend_create_so_target(struct vrend_context *ctx,
    ret_handle = vrend_renderer_object_insert(ctx, target, sizeof(*target), handle,
                                              VIRGL_OBJECT_STREAMOUT_TARGET);
    if (ret_handle == 0) {
-      FREE(target);
+      vrend_slab_free(target);
       return ENOMEM;
    }
    return 0;
@@ -9514,6 +11774,9 @@ static void vrend_renderer_fill_caps_v2(int gl_ver, int gles_ver,  union virgl_c
    caps->v2.capability_bits |= VIRGL_CAP_INDIRECT_INPUT_ADDR;
 
    caps->v2.capability_bits |= VIRGL_CAP_COPY_TRANSFER;
+
+   if (vrend_state.use_tgsi_tokens)
+      caps->v2.capability_bits_v2 |= VIRGL_CAP_V2_TGSI_TOKENS;
 }
 
 void vrend_renderer_fill_caps(uint32_t set, UNUSED uint32_t version,
@@ -9572,7 +11835,6 @@ void *vrend_renderer_get_cursor_contents(uint32_t res_handle, uint32_t *width, u
    int blsize;
    char *data, *data2;
    int size;
-   uint h;
 
    res = vrend_resource_lookup(res_handle, 0);
    if (!res)
@@ -9632,12 +11894,8 @@ void *vrend_renderer_get_cursor_contents(uint32_t res_handle, uint32_t *width, u
       glGetTexImage(res->target, 0, format, type, data);
    }
 
-   for (h = 0; h < res->base.height0; h++) {
-      uint32_t doff = (res->base.height0 - h - 1) * res->base.width0 * blsize;
-      uint32_t soff = h * res->base.width0 * blsize;
-
-      memcpy(data2 + doff, data + soff, res->base.width0 * blsize);
-   }
+   vrend_copy_flip(data2, res->base.width0 * blsize, data, res->base.width0 * blsize,
+                   res->base.width0 * blsize, res->base.height0);
    free(data);
    glBindTexture(res->target, 0);
    return data2;
@@ -9647,11 +11905,33 @@ void *vrend_renderer_get_cursor_contents(uint32_t res_handle, uint32_t *width, u
 void vrend_renderer_force_ctx_0(void)
 {
    struct vrend_context *ctx0 = vrend_lookup_renderer_ctx(0);
-   vrend_state.current_ctx = NULL;
-   vrend_state.current_hw_ctx = NULL;
+   vrend_tls.current_ctx = NULL;
+   vrend_tls.current_hw_ctx = NULL;
    vrend_hw_switch_context(ctx0, true);
 }
 
+/* unbind the GL context so that another thread can make it current */
+void vrend_renderer_release_current(void)
+{
+   vrend_tls.current_ctx = NULL;
+   vrend_tls.current_hw_ctx = NULL;
+   vrend_clicbs->make_current(NULL);
+}
+
+/* called by a decode thread before it exits, the queries it was waiting
+ * on are left to be picked up by the next vrend_get_query_result */
+void vrend_renderer_thread_fini(void)
+{
+   struct vrend_query *query, *stor;
+
+   if (!vrend_tls.waiting_query_list.next)
+      return;
+
+   LIST_FOR_EACH_ENTRY_SAFE(query, stor, &vrend_tls.waiting_query_list, waiting_queries)
+      list_delinit(&query->waiting_queries);
+   vrend_renderer_release_current();
+}
+
 void vrend_renderer_get_rect(int res_handle, struct iovec *iov, unsigned int num_iovs,
                              uint32_t offset, int x, int y, int width, int height)
 {
@@ -9810,12 +12090,23 @@ void vrend_renderer_create_sub_ctx(struct vrend_context *ctx, int sub_ctx_id)
    if (!sub)
       return;
 
+   sub->program_table = vrend_program_table_create();
+   if (!sub->program_table) {
+      report_context_error(ctx, VIRGL_ERROR_CTX_UNKNOWN, sub_ctx_id);
+      free(sub);
+      return;
+   }
+
    ctx_params.shared = (ctx->ctx_id == 0 && sub_ctx_id == 0) ? false : true;
    ctx_params.major_ver = vrend_state.gl_major_ver;
    ctx_params.minor_ver = vrend_state.gl_minor_ver;
    sub->gl_context = vrend_clicbs->create_gl_context(0, &ctx_params);
    vrend_clicbs->make_current(sub->gl_context);
 
+   /* let the driver pick the number of compiler threads */
+   if (vrend_state.async_compile && has_feature(feat_parallel_shader_compile))
+      glMaxShaderCompilerThreadsKHR(0xffffffff);
+
    /* enable if vrend_renderer_init function has done it as well */
    if (has_feature(feat_debug_cb)) {
       glDebugMessageCallback(vrend_debug_cb, NULL);
@@ -9843,6 +12134,12 @@ void vrend_renderer_create_sub_ctx(struct vrend_context *ctx, int sub_ctx_id)
 
    sub->object_hash = vrend_object_init_ctx_table();
 
+   sub->surface_slab = vrend_slab_create(sizeof(struct vrend_surface), false);
+   sub->view_slab = vrend_slab_create(sizeof(struct vrend_sampler_view), false);
+   sub->so_target_slab = vrend_slab_create(sizeof(struct vrend_so_target), false);
+   sub->query_slab = vrend_slab_create(sizeof(struct vrend_query), false);
+   sub->shader_slab = vrend_slab_create(sizeof(struct vrend_shader), false);
+
    ctx->sub = sub;
    list_add(&sub->head, &ctx->sub_ctxs);
    if (sub_ctx_id == 0)
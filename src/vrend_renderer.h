@@ -85,6 +85,8 @@ struct vrend_resource {
    uint32_t num_iovs;
    uint64_t mipmap_offsets[VR_MAX_TEXTURE_2D_LEVELS];
    void *gbm_bo, *egl_image;
+   /* readbacks into iov still waiting for their fence */
+   int num_readbacks;
 };
 
 #define VIRGL_TEXTURE_NEED_SWIZZLE        (1 << 0)
@@ -110,6 +112,9 @@ struct vrend_if_cbs {
 };
 
 #define VREND_USE_THREAD_SYNC 1
+#define VREND_USE_THREADED_DECODE 2
+#define VREND_USE_CMD_STATS 4
+#define VREND_USE_ASYNC_READBACK 8
 
 int vrend_renderer_init(struct vrend_if_cbs *cbs, uint32_t flags);
 
@@ -126,7 +131,7 @@ int vrend_create_shader(struct vrend_context *ctx,
                         const struct pipe_stream_output_info *stream_output,
                         uint32_t req_local_mem,
                         const char *shd_text, uint32_t offlen, uint32_t num_tokens,
-                        uint32_t type, uint32_t pkt_length);
+                        uint32_t type, uint32_t pkt_length, bool binary);
 
 void vrend_bind_shader(struct vrend_context *ctx,
                        uint32_t type,
@@ -143,6 +148,26 @@ int vrend_draw_vbo(struct vrend_context *ctx,
                    const struct pipe_draw_info *info,
                    uint32_t cso, uint32_t indirect_handle, uint32_t indirect_draw_count_handle);
 
+#define VREND_MAX_DRAW_RANGES 64
+
+/* one draw of a run merged by the decoder, index_offset is the index
+ * buffer offset that was set for it */
+struct vrend_draw_range {
+   uint32_t start;
+   uint32_t count;
+   int32_t index_bias;
+   uint32_t index_offset;
+   /* the indices the draw uses, 0 and ~0 when unknown */
+   uint32_t min_index;
+   uint32_t max_index;
+};
+
+/* draw the ranges with the mode, index and restart settings of info */
+int vrend_draw_vbo_ranges(struct vrend_context *ctx,
+                          const struct pipe_draw_info *info,
+                          const struct vrend_draw_range *draws,
+                          uint32_t num_draws);
+
 void vrend_set_framebuffer_state(struct vrend_context *ctx,
                                  uint32_t nr_cbufs, uint32_t surf_handle[PIPE_MAX_COLOR_BUFS],
                                  uint32_t zsurf_handle);
@@ -319,11 +344,73 @@ void vrend_set_tess_state(struct vrend_context *ctx, const float tess_factors[6]
 void vrend_renderer_fini(void);
 
 int vrend_decode_block(uint32_t ctx_id, uint32_t *block, int ndw);
+
+#define VREND_CMD_STATS_BUCKETS 32
+
+/* matches struct virgl_renderer_cmd_stats */
+struct vrend_cmd_stats {
+   const char *name;
+   uint64_t count;
+   uint64_t total_ns;
+   uint64_t max_ns;
+   uint64_t buckets[VREND_CMD_STATS_BUCKETS];
+   uint64_t elided;
+};
+
+/* matches struct virgl_renderer_upload_stats */
+struct vrend_upload_stats {
+   uint64_t staged_count;
+   uint64_t staged_bytes;
+   uint64_t direct_count;
+   uint64_t direct_bytes;
+};
+
+void vrend_renderer_get_upload_stats(struct vrend_upload_stats *stats);
+
+/* matches struct virgl_renderer_shader_stats */
+struct vrend_shader_stats {
+   uint64_t selectors;
+   uint64_t variants;
+   uint64_t multi_variant_selectors;
+   uint64_t max_variants;
+   uint64_t variant_switches;
+};
+
+void vrend_renderer_get_shader_stats(struct vrend_shader_stats *stats);
+
+void vrend_decode_set_cmd_stats(bool enable);
+void vrend_decode_set_state_filter(bool enable);
+void vrend_decode_set_draw_coalescing(bool enable);
+int vrend_decode_get_cmd_stats(uint32_t ctx_id, uint32_t cmd, struct vrend_cmd_stats *stats);
+
+int vrend_decode_thread_start(int num_threads);
+void vrend_decode_thread_stop(void);
+bool vrend_decode_thread_running(void);
+int vrend_decode_queue_block(uint32_t ctx_id, const uint32_t *block, int ndw);
+int vrend_decode_queue_fence(int client_fence_id, uint32_t ctx_id);
+int vrend_decode_queue_transfer(const struct vrend_transfer_info *info,
+                                int transfer_mode);
+int vrend_decode_queue_ctx_resource(uint32_t ctx_id, uint32_t res_handle,
+                                    bool attach);
+void vrend_decode_thread_forget_resource(uint32_t res_handle);
+void vrend_decode_thread_forget_ctx(uint32_t ctx_id);
+void vrend_decode_queue_poll(void);
+void vrend_decode_thread_acquire(void);
+void vrend_decode_thread_release(void);
 struct vrend_context *vrend_lookup_renderer_ctx(uint32_t ctx_id);
 
+struct vrend_fence;
+
 int vrend_renderer_create_fence(int client_fence_id, uint32_t ctx_id);
+struct vrend_fence *vrend_renderer_fence_sync(int client_fence_id, uint32_t ctx_id);
+GLsync vrend_renderer_sync_signal(void);
+void vrend_renderer_sync_wait(GLsync sync);
+void vrend_renderer_sync_delete(GLsync sync);
+void vrend_renderer_fence_submit(struct vrend_fence *fence);
 
 void vrend_renderer_check_fences(void);
+void vrend_renderer_deliver_fences(void);
+void vrend_renderer_check_queries(void);
 
 bool vrend_hw_switch_context(struct vrend_context *ctx, bool now);
 uint32_t vrend_renderer_object_insert(struct vrend_context *ctx, void *data,
@@ -380,6 +467,8 @@ vrend_resource_reference(struct vrend_resource **ptr, struct vrend_resource *tex
 }
 
 void vrend_renderer_force_ctx_0(void);
+void vrend_renderer_release_current(void);
+void vrend_renderer_thread_fini(void);
 
 void vrend_renderer_get_rect(int resource_id, struct iovec *iov, unsigned int num_iovs,
                              uint32_t offset, int x, int y, int width, int height);
@@ -35,10 +35,13 @@
 #include "vrend_debug.h"
 
 #include "vrend_strbuf.h"
+#include "vrend_arena.h"
 
 /* start convert of tgsi to glsl */
 
 #define INTERP_PREFIX "                           "
+/* identifies the placeholder in front of an output */
+#define INTERP_TAG(semantic, sid) ((((semantic) + 1) << 8) | ((sid) & 0xff))
 #define INVARI_PREFIX "invariant"
 
 #define SHADER_REQ_NONE 0
@@ -147,13 +150,15 @@ struct dump_ctx {
    struct tgsi_shader_info info;
    int prog_type;
    int size;
-   struct vrend_strbuf glsl_main;
+   struct vrend_rope glsl_main;
    int indent_level;
-   struct vrend_strbuf glsl_hdr;
+   struct vrend_rope glsl_hdr;
    struct vrend_strbuf glsl_ver_ext;
    uint instno;
 
    struct vrend_strbuf src_bufs[4];
+   /* scratch memory for the duration of the translation */
+   struct vrend_arena *arena;
 
    uint32_t num_interps;
    uint32_t num_inputs;
@@ -176,6 +181,7 @@ struct dump_ctx {
    uint32_t generic_outputs_emitted_mask;
 
    uint32_t num_temp_ranges;
+   uint32_t temp_ranges_size;
    struct vrend_temp_range *temp_ranges;
 
    struct vrend_shader_sampler samplers[32];
@@ -564,15 +570,14 @@ static void emit_indent(struct dump_ctx *ctx)
       int indent_level = MIN2(ctx->indent_level, 15);
       char buf[16];
       memset(buf, '\t', indent_level);
-      buf[indent_level] = '\0';
-      strbuf_append(&ctx->glsl_main, buf);
+      rope_append_buffer(&ctx->glsl_main, buf, indent_level);
    }
 }
 
 static void emit_buf(struct dump_ctx *ctx, const char *buf)
 {
    emit_indent(ctx);
-   strbuf_append(&ctx->glsl_main, buf);
+   rope_append(&ctx->glsl_main, buf);
 }
 
 static void indent_buf(struct dump_ctx *ctx)
@@ -583,7 +588,7 @@ static void indent_buf(struct dump_ctx *ctx)
 static void outdent_buf(struct dump_ctx *ctx)
 {
    if (ctx->indent_level <= 0) {
-      strbuf_set_error(&ctx->glsl_main);
+      rope_set_error(&ctx->glsl_main);
       return;
    }
    ctx->indent_level--;
@@ -591,7 +596,7 @@ static void outdent_buf(struct dump_ctx *ctx)
 
 static void set_buf_error(struct dump_ctx *ctx)
 {
-   strbuf_set_error(&ctx->glsl_main);
+   rope_set_error(&ctx->glsl_main);
 }
 
 __attribute__((format(printf, 2, 3)))
@@ -600,18 +605,18 @@ static void emit_buff(struct dump_ctx *ctx, const char *fmt, ...)
    va_list va;
    va_start(va, fmt);
    emit_indent(ctx);
-   strbuf_vappendf(&ctx->glsl_main, fmt, va);
+   rope_vappendf(&ctx->glsl_main, fmt, va);
    va_end(va);
 }
 
 static void emit_hdr(struct dump_ctx *ctx, const char *buf)
 {
-   strbuf_append(&ctx->glsl_hdr, buf);
+   rope_append(&ctx->glsl_hdr, buf);
 }
 
 static void set_hdr_error(struct dump_ctx *ctx)
 {
-   strbuf_set_error(&ctx->glsl_hdr);
+   rope_set_error(&ctx->glsl_hdr);
 }
 
 __attribute__((format(printf, 2, 3)))
@@ -619,10 +624,17 @@ static void emit_hdrf(struct dump_ctx *ctx, const char *fmt, ...)
 {
    va_list va;
    va_start(va, fmt);
-   strbuf_vappendf(&ctx->glsl_hdr, fmt, va);
+   rope_vappendf(&ctx->glsl_hdr, fmt, va);
    va_end(va);
 }
 
+/* leaves room for the interpolation qualifier of an output, it is only
+ * known once the shader is linked with a fragment shader */
+static void emit_interp_placeholder(struct dump_ctx *ctx, int semantic, int sid)
+{
+   rope_add_placeholder(&ctx->glsl_hdr, strlen(INTERP_PREFIX), INTERP_TAG(semantic, sid));
+}
+
 static void emit_ver_ext(struct dump_ctx *ctx, const char *buf)
 {
    strbuf_append(&ctx->glsl_ver_ext, buf);
@@ -642,9 +654,18 @@ static bool allocate_temp_range(struct dump_ctx *ctx, int first, int last,
 {
    int idx = ctx->num_temp_ranges;
 
-   ctx->temp_ranges = realloc(ctx->temp_ranges, sizeof(struct vrend_temp_range) * (idx + 1));
-   if (!ctx->temp_ranges)
-      return false;
+   if (ctx->num_temp_ranges == ctx->temp_ranges_size) {
+      uint32_t new_size = MAX2(ctx->temp_ranges_size * 2, 16);
+      struct vrend_temp_range *ranges;
+
+      ranges = vrend_arena_alloc(ctx->arena, sizeof(struct vrend_temp_range) * new_size);
+      if (!ranges)
+         return false;
+      if (ctx->temp_ranges)
+         memcpy(ranges, ctx->temp_ranges, sizeof(struct vrend_temp_range) * idx);
+      ctx->temp_ranges = ranges;
+      ctx->temp_ranges_size = new_size;
+   }
 
    ctx->temp_ranges[idx].first = first;
    ctx->temp_ranges[idx].last = last;
@@ -4162,7 +4183,8 @@ get_source_info(struct dump_ctx *ctx,
    return true;
 }
 
-static bool rewrite_1d_image_coordinate(struct vrend_strbuf *src, const struct tgsi_full_instruction *inst)
+static bool rewrite_1d_image_coordinate(struct dump_ctx *ctx, struct vrend_strbuf *src,
+                                        const struct tgsi_full_instruction *inst)
 {
    if (inst->Src[0].Register.File == TGSI_FILE_IMAGE &&
        (inst->Memory.Texture == TGSI_TEXTURE_1D ||
@@ -4170,17 +4192,15 @@ static bool rewrite_1d_image_coordinate(struct vrend_strbuf *src, const struct t
 
       /* duplicate src */
       size_t len = strbuf_get_len(src);
-      char *buf = malloc(len);
+      char *buf = vrend_arena_alloc(ctx->arena, len + 1);
       if (!buf)
          return false;
-      strncpy(buf, src->buf, len);
+      memcpy(buf, src->buf, len + 1);
 
       if (inst->Memory.Texture == TGSI_TEXTURE_1D)
          strbuf_fmt(src, "vec2(vec4(%s).x, 0)", buf);
       else if (inst->Memory.Texture == TGSI_TEXTURE_1D_ARRAY)
          strbuf_fmt(src, "vec3(%s.xy, 0).xzy", buf);
-
-      free(buf);
    }
    return true;
 }
@@ -5136,7 +5156,7 @@ iter_instruction(struct tgsi_iterate_context *iter,
    }
    case TGSI_OPCODE_STORE:
       if (ctx->cfg->use_gles) {
-         if (!rewrite_1d_image_coordinate(ctx->src_bufs + 1, inst))
+         if (!rewrite_1d_image_coordinate(ctx, ctx->src_bufs + 1, inst))
             return false;
          srcs[1] = ctx->src_bufs[1].buf;
       }
@@ -5144,7 +5164,7 @@ iter_instruction(struct tgsi_iterate_context *iter,
       break;
    case TGSI_OPCODE_LOAD:
       if (ctx->cfg->use_gles) {
-         if (!rewrite_1d_image_coordinate(ctx->src_bufs + 1, inst))
+         if (!rewrite_1d_image_coordinate(ctx, ctx->src_bufs + 1, inst))
             return false;
          srcs[1] = ctx->src_bufs[1].buf;
       }
@@ -5161,7 +5181,7 @@ iter_instruction(struct tgsi_iterate_context *iter,
    case TGSI_OPCODE_ATOMIMIN:
    case TGSI_OPCODE_ATOMIMAX:
       if (ctx->cfg->use_gles) {
-         if (!rewrite_1d_image_coordinate(ctx->src_bufs + 1, inst))
+         if (!rewrite_1d_image_coordinate(ctx, ctx->src_bufs + 1, inst))
             return false;
          srcs[1] = ctx->src_bufs[1].buf;
       }
@@ -5189,7 +5209,7 @@ iter_instruction(struct tgsi_iterate_context *iter,
       emit_buff(ctx, "%s = clamp(%s, 0.0, 1.0);\n", dsts[0], dsts[0]);
    }
 
-   if (strbuf_get_error(&ctx->glsl_main))
+   if (rope_get_error(&ctx->glsl_main))
        return false;
    return true;
 }
@@ -5827,8 +5847,8 @@ static void emit_ios_indirect_generics_input(struct dump_ctx *ctx, const char *p
 
 static void
 emit_ios_generic(struct dump_ctx *ctx, enum io_type iot,  const char *prefix,
-                 const struct vrend_shader_io *io, const char *inout,
-                 const char *postfix)
+                 bool interp_placeholder, const struct vrend_shader_io *io,
+                 const char *inout, const char *postfix)
 {
    const char type[4][6] = {"float", " vec2", " vec3", " vec4"};
    const char *t = " vec4";
@@ -5849,7 +5869,8 @@ emit_ios_generic(struct dump_ctx *ctx, enum io_type iot,  const char *prefix,
 
    if (io->first == io->last) {
       emit_hdr(ctx, layout);
-      /* ugly leave spaces to patch interp in later */
+      if (interp_placeholder)
+         emit_interp_placeholder(ctx, io->name, io->sid);
       emit_hdrf(ctx, "%s%s%s  %s %s %s%s;\n",
                 prefix,
                 io->precise ? "precise " : "",
@@ -5879,6 +5900,8 @@ emit_ios_generic(struct dump_ctx *ctx, enum io_type iot,  const char *prefix,
 
          emit_hdrf(ctx, "%s %s {\n", inout, blockname);
          emit_hdr(ctx, layout);
+         if (interp_placeholder)
+            emit_interp_placeholder(ctx, io->name, io->sid);
          emit_hdrf(ctx, "%s%s%s     %s %s[%d]; \n} %s;\n",
                    prefix,
                    io->precise ? "precise " : "",
@@ -5889,6 +5912,8 @@ emit_ios_generic(struct dump_ctx *ctx, enum io_type iot,  const char *prefix,
                    blockvarame);
       } else {
          emit_hdr(ctx, layout);
+         if (interp_placeholder)
+            emit_interp_placeholder(ctx, io->name, io->sid);
          emit_hdrf(ctx, "%s%s%s       %s %s %s%s[%d];\n",
                    prefix,
                    io->precise ? "precise " : "",
@@ -5918,13 +5943,12 @@ emit_ios_generic_outputs(struct dump_ctx *ctx,
          if (!can_emit_generic(&ctx->outputs[i]))
             continue;
 
-         const char *prefix = "";
+         bool interp_placeholder = false;
          if (ctx->outputs[i].name == TGSI_SEMANTIC_GENERIC ||
              ctx->outputs[i].name == TGSI_SEMANTIC_COLOR ||
              ctx->outputs[i].name == TGSI_SEMANTIC_BCOLOR) {
             ctx->num_interps++;
-            /* ugly leave spaces to patch interp in later */
-            prefix = INTERP_PREFIX;
+            interp_placeholder = true;
          }
 
          if (ctx->outputs[i].name == TGSI_SEMANTIC_COLOR)
@@ -5937,7 +5961,7 @@ emit_ios_generic_outputs(struct dump_ctx *ctx,
             ctx->front_back_color_emitted_flags[ctx->outputs[i].sid] |= BACK_COLOR_EMITTED;
          }
 
-         emit_ios_generic(ctx, io_out, prefix, &ctx->outputs[i],
+         emit_ios_generic(ctx, io_out, "", interp_placeholder, &ctx->outputs[i],
                           ctx->outputs[i].fbfetch_used ? "inout" : "out", "");
       } else if (ctx->outputs[i].invariant || ctx->outputs[i].precise) {
          emit_hdrf(ctx, "%s%s;\n",
@@ -5980,6 +6004,17 @@ can_emit_generic_default(UNUSED const struct vrend_shader_io *io)
    return true;
 }
 
+/* A separable program has to redeclare the built-in output block it
+ * writes, for GLSL 1.50 and later. Vertex shaders that feed a geometry
+ * or tessellation stage are always linked together with it.
+ */
+static bool vs_redeclare_pervertex(const struct dump_ctx *ctx)
+{
+   return ctx->cfg->use_separable_shaders &&
+          !ctx->key->gs_present && !ctx->key->tes_present &&
+          ctx->glsl_ver_required >= 150;
+}
+
 static void emit_ios_vs(struct dump_ctx *ctx)
 {
    uint32_t i;
@@ -6013,11 +6048,13 @@ static void emit_ios_vs(struct dump_ctx *ctx)
          bcolor_emitted = ctx->front_back_color_emitted_flags[ctx->outputs[i].sid] & BACK_COLOR_EMITTED;
 
          if (fcolor_emitted && !bcolor_emitted) {
-            emit_hdrf(ctx, "%sout vec4 ex_bc%d;\n", INTERP_PREFIX, ctx->outputs[i].sid);
+            emit_interp_placeholder(ctx, TGSI_SEMANTIC_BCOLOR, ctx->outputs[i].sid);
+            emit_hdrf(ctx, "out vec4 ex_bc%d;\n", ctx->outputs[i].sid);
             ctx->front_back_color_emitted_flags[ctx->outputs[i].sid] |= BACK_COLOR_EMITTED;
          }
          if (bcolor_emitted && !fcolor_emitted) {
-            emit_hdrf(ctx, "%sout vec4 ex_c%d;\n", INTERP_PREFIX, ctx->outputs[i].sid);
+            emit_interp_placeholder(ctx, TGSI_SEMANTIC_COLOR, ctx->outputs[i].sid);
+            emit_hdrf(ctx, "out vec4 ex_c%d;\n", ctx->outputs[i].sid);
             ctx->front_back_color_emitted_flags[ctx->outputs[i].sid] |= FRONT_COLOR_EMITTED;
          }
       }
@@ -6046,13 +6083,16 @@ static void emit_ios_vs(struct dump_ctx *ctx)
       if (ctx->key->clip_plane_enable) {
          emit_hdr(ctx, "uniform vec4 clipp[8];\n");
       }
-      if (ctx->key->gs_present || ctx->key->tes_present) {
+      if (ctx->key->gs_present || ctx->key->tes_present)
          ctx->vs_has_pervertex = true;
+      if (ctx->vs_has_pervertex || vs_redeclare_pervertex(ctx)) {
          emit_hdrf(ctx, "out gl_PerVertex {\n vec4 gl_Position;\n float gl_PointSize;\n%s%s};\n", clip_buf, cull_buf);
       } else {
          emit_hdrf(ctx, "%s%s", clip_buf, cull_buf);
       }
       emit_hdr(ctx, "vec4 clip_dist_temp[2];\n");
+   } else if (vs_redeclare_pervertex(ctx)) {
+      emit_hdr(ctx, "out gl_PerVertex {\n vec4 gl_Position;\n float gl_PointSize;\n};\n");
    }
 }
 
@@ -6107,7 +6147,7 @@ static void emit_ios_fs(struct dump_ctx *ctx)
 
          char prefixes[64];
          snprintf(prefixes, sizeof(prefixes), "%s %s", prefix, auxprefix);
-         emit_ios_generic(ctx, io_in, prefixes, &ctx->inputs[i], "in", "");
+         emit_ios_generic(ctx, io_in, prefixes, false, &ctx->inputs[i], "in", "");
       }
 
       if (ctx->cfg->use_gles && !ctx->key->winsys_adjust_y_emitted &&
@@ -6142,7 +6182,7 @@ static void emit_ios_fs(struct dump_ctx *ctx)
       for (i = 0; i < ctx->num_outputs; i++) {
 
          if (!ctx->outputs[i].glsl_predefined_no_emit) {
-            emit_ios_generic(ctx, io_out, "", &ctx->outputs[i],
+            emit_ios_generic(ctx, io_out, "", false, &ctx->outputs[i],
                               ctx->outputs[i].fbfetch_used ? "inout" : "out", "");
 
          } else if (ctx->outputs[i].invariant || ctx->outputs[i].precise) {
@@ -6198,7 +6238,7 @@ static void emit_ios_geom(struct dump_ctx *ctx)
       if (!ctx->inputs[i].glsl_predefined_no_emit) {
          char postfix[64];
          snprintf(postfix, sizeof(postfix), "[%d]", gs_input_prim_to_size(ctx->gs_in_prim));
-         emit_ios_generic(ctx, io_in, "", &ctx->inputs[i], "in", postfix);
+         emit_ios_generic(ctx, io_in, "", false, &ctx->inputs[i], "in", postfix);
       }
    }
 
@@ -6207,16 +6247,15 @@ static void emit_ios_geom(struct dump_ctx *ctx)
          if (!ctx->outputs[i].stream)
             continue;
 
-         const char *prefix = "";
+         emit_hdrf(ctx, "layout (stream = %d) ", ctx->outputs[i].stream);
          if (ctx->outputs[i].name == TGSI_SEMANTIC_GENERIC ||
              ctx->outputs[i].name == TGSI_SEMANTIC_COLOR ||
              ctx->outputs[i].name == TGSI_SEMANTIC_BCOLOR) {
             ctx->num_interps++;
-            /* ugly leave spaces to patch interp in later */
-            prefix = INTERP_PREFIX;
+            emit_interp_placeholder(ctx, ctx->outputs[i].name, ctx->outputs[i].sid);
          }
 
-         emit_hdrf(ctx, "layout (stream = %d) %s%s%sout vec4 %s;\n", ctx->outputs[i].stream, prefix,
+         emit_hdrf(ctx, "%s%sout vec4 %s;\n",
                    ctx->outputs[i].precise ? "precise " : "",
                    ctx->outputs[i].invariant ? "invariant " : "",
                    ctx->outputs[i].glsl_name);
@@ -6274,7 +6313,7 @@ static void emit_ios_tcs(struct dump_ctx *ctx)
          if (ctx->inputs[i].name == TGSI_SEMANTIC_PATCH)
             emit_ios_patch(ctx, "",  &ctx->inputs[i], "in", ctx->inputs[i].last - ctx->inputs[i].first + 1);
          else
-            emit_ios_generic(ctx, io_in, "", &ctx->inputs[i], "in", "[]");
+            emit_ios_generic(ctx, io_in, "", false, &ctx->inputs[i], "in", "[]");
       }
    }
 
@@ -6292,7 +6331,7 @@ static void emit_ios_tcs(struct dump_ctx *ctx)
             emit_ios_patch(ctx, "patch", &ctx->outputs[i], "out",
                            ctx->outputs[i].last - ctx->outputs[i].first + 1);
          } else
-            emit_ios_generic(ctx, io_out, "", &ctx->outputs[i], "out", "[]");
+            emit_ios_generic(ctx, io_out, "", false, &ctx->outputs[i], "out", "[]");
       } else if (ctx->outputs[i].invariant || ctx->outputs[i].precise) {
          emit_hdrf(ctx, "%s%s;\n",
                    ctx->outputs[i].precise ? "precise " :
@@ -6338,7 +6377,7 @@ static void emit_ios_tes(struct dump_ctx *ctx)
             emit_ios_patch(ctx, "patch", &ctx->inputs[i], "in",
                            ctx->inputs[i].last - ctx->inputs[i].first + 1);
          else
-            emit_ios_generic(ctx, io_in, "", &ctx->inputs[i], "in", "[]");
+            emit_ios_generic(ctx, io_in, "", false, &ctx->inputs[i], "in", "[]");
       }
    }
 
@@ -6424,10 +6463,12 @@ static void emit_ios(struct dump_ctx *ctx)
       for (int i = 0; i < 31; ++i) {
          uint32_t mask = 1 << i;
          bool expecting = ctx->generic_outputs_expected_mask & mask;
-         if (expecting & !(ctx->generic_outputs_emitted_mask & mask))
-            emit_hdrf(ctx, "                              out vec4 %s_g%dA0_f%s;\n",
+         if (expecting & !(ctx->generic_outputs_emitted_mask & mask)) {
+            emit_interp_placeholder(ctx, TGSI_SEMANTIC_GENERIC, i);
+            emit_hdrf(ctx, "   out vec4 %s_g%dA0_f%s;\n",
                       get_stage_output_name_prefix(ctx->prog_type), i,
                       ctx->prog_type == TGSI_PROCESSOR_TESS_CTRL ? "[]" : "");
+         }
       }
    }
 
@@ -6602,13 +6643,10 @@ static void fill_sinfo(struct dump_ctx *ctx, struct vrend_shader_info *sinfo)
 
 static bool allocate_strbuffers(struct dump_ctx* ctx)
 {
-   if (!strbuf_alloc(&ctx->glsl_main, 4096))
+   if (!rope_init(&ctx->glsl_main, 4096))
       return false;
 
-   if (strbuf_get_error(&ctx->glsl_main))
-      return false;
-
-   if (!strbuf_alloc(&ctx->glsl_hdr, 1024))
+   if (!rope_init(&ctx->glsl_hdr, 1024))
       return false;
 
    if (!strbuf_alloc(&ctx->glsl_ver_ext, 1024))
@@ -6617,15 +6655,22 @@ static bool allocate_strbuffers(struct dump_ctx* ctx)
    return true;
 }
 
-static void set_strbuffers(struct vrend_context *rctx, struct dump_ctx* ctx,
+/* hands the segments over as they are, the version and extensions stay a
+ * single string so they can still be appended to */
+static bool set_strbuffers(struct vrend_context *rctx, struct dump_ctx* ctx,
                            struct vrend_strarray *shader)
 {
-   strarray_addstrbuf(shader, &ctx->glsl_ver_ext);
-   strarray_addstrbuf(shader, &ctx->glsl_hdr);
-   strarray_addstrbuf(shader, &ctx->glsl_main);
+   if (!strarray_reserve(shader, shader->num_strings + 1 +
+                         ctx->glsl_hdr.num_segs + ctx->glsl_main.num_segs) ||
+       !strarray_addstrbuf(shader, &ctx->glsl_ver_ext))
+      return false;
+   memset(&ctx->glsl_ver_ext, 0, sizeof(ctx->glsl_ver_ext));
+   rope_move_to_strarray(&ctx->glsl_hdr, shader);
+   rope_move_to_strarray(&ctx->glsl_main, shader);
    VREND_DEBUG(dbg_shader_glsl, rctx, "GLSL:");
    VREND_DEBUG_EXT(dbg_shader_glsl, rctx, strarray_dump(shader));
    VREND_DEBUG(dbg_shader_glsl, rctx, "\n");
+   return true;
 }
 
 bool vrend_convert_shader(struct vrend_context *rctx,
@@ -6649,6 +6694,9 @@ bool vrend_convert_shader(struct vrend_context *rctx,
    if (bret == false)
       return false;
 
+   ctx.arena = vrend_arena_thread();
+   vrend_arena_begin(ctx.arena);
+
    ctx.num_inputs = 0;
 
    ctx.iter.prolog = prolog;
@@ -6698,58 +6746,67 @@ bool vrend_convert_shader(struct vrend_context *rctx,
    if (!allocate_strbuffers(&ctx))
       goto fail;
 
+   /* operand strings rarely outgrow this, if they do they move to the heap */
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.src_bufs); ++i) {
+      char *buf = vrend_arena_alloc(ctx.arena, 256);
+      if (!buf)
+         goto fail;
+      strbuf_init_external(ctx.src_bufs + i, buf, 256);
+   }
+
    bret = tgsi_iterate_shader(tokens, &ctx.iter);
    if (bret == false)
       goto fail;
 
    for (size_t i = 0; i < ARRAY_SIZE(ctx.src_bufs); ++i)
       strbuf_free(ctx.src_bufs + i);
+   memset(ctx.src_bufs, 0, sizeof(ctx.src_bufs));
 
    emit_header(&ctx);
    emit_ios(&ctx);
 
-   if (strbuf_get_error(&ctx.glsl_hdr))
+   if (rope_get_error(&ctx.glsl_hdr) || rope_get_error(&ctx.glsl_main))
       goto fail;
 
    bret = fill_interpolants(&ctx, sinfo);
    if (bret == false)
       goto fail;
 
-   free(ctx.temp_ranges);
-
+   if (!set_strbuffers(rctx, &ctx, shader))
+      goto fail;
    fill_sinfo(&ctx, sinfo);
-   set_strbuffers(rctx, &ctx, shader);
 
+   vrend_arena_end(ctx.arena);
    return true;
  fail:
-   strbuf_free(&ctx.glsl_main);
-   strbuf_free(&ctx.glsl_hdr);
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.src_bufs); ++i)
+      strbuf_free(ctx.src_bufs + i);
+   rope_free(&ctx.glsl_main);
+   rope_free(&ctx.glsl_hdr);
    strbuf_free(&ctx.glsl_ver_ext);
    free(ctx.so_names);
-   free(ctx.temp_ranges);
+   vrend_arena_end(ctx.arena);
    return false;
 }
 
-static void replace_interp(struct vrend_strarray *program,
-                           const char *var_name,
+/* the placeholders are segments of their own, so they are overwritten in
+ * place without looking at the text around them */
+static void replace_interp(struct vrend_strarray *program, uint32_t tag,
                            const char *pstring, const char *auxstring)
 {
-   int mylen = strlen(INTERP_PREFIX) + strlen("out float ");
+   size_t plen = strlen(pstring);
+   size_t alen = strlen(auxstring);
 
-   char *ptr = program->strings[SHADER_STRING_HDR].buf;
-   do {
-      char *p = strstr(ptr, var_name);
-      if (!p)
-         break;
-
-      ptr = p - mylen;
+   for (int i = 0; i < program->num_strings; i++) {
+      struct vrend_strbuf *sb = &program->strings[i];
 
-      memset(ptr, ' ', strlen(INTERP_PREFIX));
-      memcpy(ptr, pstring, strlen(pstring));
-      memcpy(ptr + strlen(pstring), auxstring, strlen(auxstring));
+      if (sb->tag != tag || plen + alen > sb->size)
+         continue;
 
-      ptr = p + strlen(var_name);
-   } while (1);
+      memset(sb->buf, ' ', sb->size);
+      memcpy(sb->buf, pstring, plen);
+      memcpy(sb->buf + plen, auxstring, alen);
+   }
 }
 
 static const char *gpu_shader5_string = "#extension GL_ARB_gpu_shader5 : require\n";
@@ -6773,11 +6830,10 @@ bool vrend_patch_vertex_shader_interpolants(struct vrend_context *rctx,
                                             struct vrend_strarray *prog_strings,
                                             struct vrend_shader_info *vs_info,
                                             struct vrend_shader_info *fs_info,
-                                            const char *oprefix, bool flatshade)
+                                            bool flatshade)
 {
    int i;
    const char *pstring, *auxstring;
-   char glsl_name[64];
    if (!vs_info || !fs_info)
       return true;
 
@@ -6802,25 +6858,18 @@ bool vrend_patch_vertex_shader_interpolants(struct vrend_context *rctx,
       switch (fs_info->interpinfo[i].semantic_name) {
       case TGSI_SEMANTIC_COLOR:
       case TGSI_SEMANTIC_BCOLOR:
-         /* color is a bit trickier */
-         if (fs_info->glsl_ver < 140) {
-            if (fs_info->interpinfo[i].semantic_index == 1) {
-               replace_interp(prog_strings, "gl_FrontSecondaryColor", pstring, auxstring);
-               replace_interp(prog_strings, "gl_BackSecondaryColor", pstring, auxstring);
-            } else {
-               replace_interp(prog_strings, "gl_FrontColor", pstring, auxstring);
-               replace_interp(prog_strings, "gl_BackColor", pstring, auxstring);
-            }
-         } else {
-            snprintf(glsl_name, 64, "ex_c%d", fs_info->interpinfo[i].semantic_index);
-            replace_interp(prog_strings, glsl_name, pstring, auxstring);
-            snprintf(glsl_name, 64, "ex_bc%d", fs_info->interpinfo[i].semantic_index);
-            replace_interp(prog_strings, glsl_name, pstring, auxstring);
-         }
+         /* the front and the back color take the same qualifier */
+         replace_interp(prog_strings,
+                        INTERP_TAG(TGSI_SEMANTIC_COLOR, fs_info->interpinfo[i].semantic_index),
+                        pstring, auxstring);
+         replace_interp(prog_strings,
+                        INTERP_TAG(TGSI_SEMANTIC_BCOLOR, fs_info->interpinfo[i].semantic_index),
+                        pstring, auxstring);
          break;
       case TGSI_SEMANTIC_GENERIC:
-         snprintf(glsl_name, 64, "%s_g%d", oprefix, fs_info->interpinfo[i].semantic_index);
-         replace_interp(prog_strings, glsl_name, pstring, auxstring);
+         replace_interp(prog_strings,
+                        INTERP_TAG(TGSI_SEMANTIC_GENERIC, fs_info->interpinfo[i].semantic_index),
+                        pstring, auxstring);
          break;
       default:
          vrend_printf("unhandled semantic: %x\n", fs_info->interpinfo[i].semantic_name);
@@ -6972,11 +7021,13 @@ bool vrend_shader_create_passthrough_tcs(struct vrend_context *rctx,
    ctx.prog_type = TGSI_PROCESSOR_TESS_CTRL;
    ctx.cfg = cfg;
    ctx.key = key;
+   ctx.arena = vrend_arena_thread();
    ctx.iter.iterate_declaration = iter_vs_declaration;
    ctx.ssbo_array_base = 0xffffffff;
    ctx.ssbo_atomic_array_base = 0xffffffff;
    ctx.has_sample_input = false;
 
+   vrend_arena_begin(ctx.arena);
    if (!allocate_strbuffers(&ctx))
       goto fail;
 
@@ -7029,14 +7080,17 @@ bool vrend_shader_create_passthrough_tcs(struct vrend_context *rctx,
 
    emit_buf(&ctx, "}\n");
 
+   if (rope_get_error(&ctx.glsl_hdr) || rope_get_error(&ctx.glsl_main) ||
+       !set_strbuffers(rctx, &ctx, shader))
+      goto fail;
    fill_sinfo(&ctx, sinfo);
-   set_strbuffers(rctx, &ctx, shader);
+   vrend_arena_end(ctx.arena);
    return true;
 fail:
-   strbuf_free(&ctx.glsl_main);
-   strbuf_free(&ctx.glsl_hdr);
+   rope_free(&ctx.glsl_main);
+   rope_free(&ctx.glsl_hdr);
    strbuf_free(&ctx.glsl_ver_ext);
    free(ctx.so_names);
-   free(ctx.temp_ranges);
+   vrend_arena_end(ctx.arena);
    return false;
 }
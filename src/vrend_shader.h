@@ -113,9 +113,6 @@ struct vrend_shader_key {
    enum pipe_logicop fs_logicop_func;
    uint8_t surface_component_bits[PIPE_MAX_COLOR_BUFS];
 
-   uint32_t num_prev_generic_and_patch_outputs;
-   struct vrend_layout_info prev_stage_generic_and_patch_outputs_layout[64];
-
    uint8_t prev_stage_num_clip_out;
    uint8_t prev_stage_num_cull_out;
    float alpha_ref_val;
@@ -127,8 +124,19 @@ struct vrend_shader_key {
    uint32_t generic_outputs_expected_mask;
    uint8_t fs_swizzle_output_rgb_to_bgr;
    uint64_t force_invariant_inputs;
+
+   /* must stay last, only the used part of the layout is compared */
+   uint32_t num_prev_generic_and_patch_outputs;
+   struct vrend_layout_info prev_stage_generic_and_patch_outputs_layout[64];
 };
 
+/* number of significant bytes of a key that was cleared before being filled */
+static inline size_t vrend_shader_key_size(const struct vrend_shader_key *key)
+{
+   return offsetof(struct vrend_shader_key, prev_stage_generic_and_patch_outputs_layout) +
+          key->num_prev_generic_and_patch_outputs * sizeof(struct vrend_layout_info);
+}
+
 struct vrend_shader_cfg {
    int glsl_version;
    int max_draw_buffers;
@@ -139,13 +147,19 @@ struct vrend_shader_cfg {
    bool has_gpu_shader5;
    bool has_es31_compat;
    bool has_conservative_depth;
+   /* vertex shaders not followed by other vertex stages are linked on
+    * their own into program pipelines */
+   bool use_separable_shaders;
 };
 
 struct vrend_context;
 
+/* The source is passed around as a list of strings: the version and
+ * extensions come first, the rest follows in as many strings as the
+ * translation produced. Arrays start out with room for this many.
+ */
 #define SHADER_MAX_STRINGS 3
 #define SHADER_STRING_VER_EXT 0
-#define SHADER_STRING_HDR 1
 
 
 bool vrend_patch_vertex_shader_interpolants(struct vrend_context *rctx,
@@ -153,7 +167,7 @@ bool vrend_patch_vertex_shader_interpolants(struct vrend_context *rctx,
                                             struct vrend_strarray *shader,
                                             struct vrend_shader_info *vs_info,
                                             struct vrend_shader_info *fs_info,
-                                            const char *oprefix, bool flatshade);
+                                            bool flatshade);
 
 bool vrend_convert_shader(struct  vrend_context *rctx,
                           struct vrend_shader_cfg *cfg,
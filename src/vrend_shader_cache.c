@@ -0,0 +1,928 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_DL_ITERATE_PHDR
+#include <link.h>
+#endif
+
+#include "util/u_memory.h"
+#include "util/u_math.h"
+#include "util/u_double_list.h"
+#include "util/u_hash_table.h"
+#include "tgsi/tgsi_parse.h"
+#include "os/os_thread.h"
+
+#include "vrend_shader_cache.h"
+#include "vrend_debug.h"
+
+/* bump this whenever the layout of the key or of the cached data changes */
+#define CACHE_FILE_VERSION 4
+#define CACHE_FILE_SUFFIX ".vsc"
+
+static const char cache_file_magic[4] = { 'V', 'S', 'C', 'F' };
+
+/* first word of every key, so the different kinds of entries never alias */
+enum cache_entry_type {
+   CACHE_ENTRY_SHADER = 1,
+   CACHE_ENTRY_PROGRAM = 2,
+};
+
+struct cache_file_header {
+   char magic[4];
+   uint32_t version;
+   uint64_t build_id;
+   uint64_t key_size;
+   uint64_t data_size;
+};
+
+/* fixed part of the key, the TGSI tokens follow it */
+struct cache_key_header {
+   uint32_t type;
+   uint32_t num_tokens;
+   uint32_t req_local_mem;
+   struct vrend_shader_cfg cfg;
+   struct vrend_shader_key key;
+   struct pipe_stream_output_info so_info;
+};
+
+struct cache_entry {
+   struct list_head head;
+   uint64_t hash;
+   uint64_t size;
+};
+
+static struct {
+   bool enabled;
+   char *dir;
+   /* entries written by a different build of the translator are stale */
+   uint64_t build_id;
+   /* most recently used entries first */
+   struct list_head lru;
+   struct util_hash_table *entries;
+   struct vrend_shader_cache_stats stats;
+} cache;
+
+/* lookups and stores can come from several decode threads */
+pipe_static_mutex(cache_mutex);
+
+uint64_t vrend_shader_cache_hash(uint64_t hash, const void *data, size_t size)
+{
+   const uint8_t *p = data;
+
+   /* 64 bit FNV-1a */
+   for (size_t i = 0; i < size; i++) {
+      hash ^= p[i];
+      hash *= 0x100000001b3ull;
+   }
+   return hash;
+}
+
+static unsigned hash_func(void *key)
+{
+   uint64_t hash = *(uint64_t *)key;
+   return (unsigned)(hash ^ (hash >> 32));
+}
+
+static int compare(void *key1, void *key2)
+{
+   return *(uint64_t *)key1 != *(uint64_t *)key2;
+}
+
+void vrend_cache_blob_write(struct vrend_cache_blob *blob, const void *data, size_t size)
+{
+   if (blob->error || !size)
+      return;
+
+   if (blob->size + size > blob->alloc_size) {
+      size_t new_size = MAX2(blob->alloc_size * 2, blob->size + size);
+      uint8_t *new_data = realloc(blob->data, new_size);
+      if (!new_data) {
+         blob->error = true;
+         return;
+      }
+      blob->data = new_data;
+      blob->alloc_size = new_size;
+   }
+   memcpy(blob->data + blob->size, data, size);
+   blob->size += size;
+}
+
+void vrend_cache_blob_write_u32(struct vrend_cache_blob *blob, uint32_t value)
+{
+   vrend_cache_blob_write(blob, &value, sizeof(value));
+}
+
+const void *vrend_cache_reader_read(struct vrend_cache_reader *reader, size_t size)
+{
+   const void *ptr;
+
+   if (reader->error || size > reader->size - reader->offset) {
+      reader->error = true;
+      return NULL;
+   }
+   ptr = reader->data + reader->offset;
+   reader->offset += size;
+   return ptr;
+}
+
+uint32_t vrend_cache_reader_read_u32(struct vrend_cache_reader *reader)
+{
+   uint32_t value = 0;
+   const void *ptr = vrend_cache_reader_read(reader, sizeof(value));
+   if (ptr)
+      memcpy(&value, ptr, sizeof(value));
+   return value;
+}
+
+static void *reader_dup(struct vrend_cache_reader *reader, size_t size)
+{
+   const void *ptr;
+   void *copy;
+
+   if (!size)
+      return NULL;
+
+   ptr = vrend_cache_reader_read(reader, size);
+   if (!ptr)
+      return NULL;
+
+   copy = malloc(size);
+   if (!copy) {
+      reader->error = true;
+      return NULL;
+   }
+   memcpy(copy, ptr, size);
+   return copy;
+}
+
+static bool build_key(struct vrend_cache_blob *blob,
+                      const struct vrend_shader_cfg *cfg,
+                      const struct tgsi_token *tokens,
+                      uint32_t req_local_mem,
+                      const struct vrend_shader_key *key,
+                      const struct pipe_stream_output_info *so_info)
+{
+   struct cache_key_header hdr;
+
+   /* the structures are hashed as raw bytes, keep the padding stable */
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.type = CACHE_ENTRY_SHADER;
+   hdr.num_tokens = tgsi_num_tokens(tokens);
+   hdr.req_local_mem = req_local_mem;
+   memcpy(&hdr.cfg, cfg, sizeof(hdr.cfg));
+   memcpy(&hdr.key, key, vrend_shader_key_size(key));
+   memcpy(&hdr.so_info, so_info, sizeof(hdr.so_info));
+
+   vrend_cache_blob_write(blob, &hdr, sizeof(hdr));
+   vrend_cache_blob_write(blob, tokens, hdr.num_tokens * sizeof(struct tgsi_token));
+   return !blob->error;
+}
+
+#ifdef HAVE_DL_ITERATE_PHDR
+struct build_id_search {
+   uintptr_t addr;
+   uint64_t hash;
+};
+
+static bool phdr_info_contains(struct dl_phdr_info *info, uintptr_t addr)
+{
+   for (int i = 0; i < info->dlpi_phnum; i++) {
+      const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+      uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+
+      if (phdr->p_type == PT_LOAD && addr >= start && addr - start < phdr->p_memsz)
+         return true;
+   }
+   return false;
+}
+
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+   struct build_id_search *search = data;
+   (void)size;
+
+   if (!phdr_info_contains(info, search->addr))
+      return 0;
+
+   for (int i = 0; i < info->dlpi_phnum; i++) {
+      const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+      const uint8_t *note, *end;
+
+      if (phdr->p_type != PT_NOTE)
+         continue;
+
+      note = (const uint8_t *)(info->dlpi_addr + phdr->p_vaddr);
+      end = note + phdr->p_memsz;
+      while (note + sizeof(ElfW(Nhdr)) <= end) {
+         const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+         const uint8_t *name = note + sizeof(*nhdr);
+         const uint8_t *desc = name + align(nhdr->n_namesz, 4);
+
+         if (desc + nhdr->n_descsz > end)
+            break;
+         if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+             !memcmp(name, "GNU", 4)) {
+            search->hash = vrend_shader_cache_hash(search->hash, desc, nhdr->n_descsz);
+            return 1;
+         }
+         note = desc + align(nhdr->n_descsz, 4);
+      }
+   }
+   return 1;
+}
+#endif
+
+/* The GNU build id of the module the translator lives in changes with
+ * every rebuild, the package version is the fallback when there is none.
+ */
+static uint64_t cache_compute_build_id(void)
+{
+   uint64_t hash = vrend_shader_cache_hash(VREND_SHADER_CACHE_HASH_SEED,
+                                           PACKAGE_VERSION, strlen(PACKAGE_VERSION));
+#ifdef HAVE_DL_ITERATE_PHDR
+   struct build_id_search search = {
+      .addr = (uintptr_t)cache_compute_build_id,
+      .hash = hash,
+   };
+
+   dl_iterate_phdr(find_build_id, &search);
+   hash = search.hash;
+#endif
+   return hash;
+}
+
+static bool cache_header_valid(const struct cache_file_header *hdr)
+{
+   return !memcmp(hdr->magic, cache_file_magic, sizeof(hdr->magic)) &&
+          hdr->version == CACHE_FILE_VERSION &&
+          hdr->build_id == cache.build_id;
+}
+
+static void cache_file_name(char *name, size_t size, uint64_t hash)
+{
+   snprintf(name, size, "%s/%016" PRIx64 CACHE_FILE_SUFFIX, cache.dir, hash);
+}
+
+static void cache_remove_entry(struct cache_entry *entry)
+{
+   char name[PATH_MAX];
+
+   cache_file_name(name, sizeof(name), entry->hash);
+   unlink(name);
+
+   cache.stats.size -= MIN2(entry->size, cache.stats.size);
+   list_del(&entry->head);
+   util_hash_table_remove(cache.entries, &entry->hash);
+}
+
+static void cache_remove(uint64_t hash)
+{
+   struct cache_entry *entry = util_hash_table_get(cache.entries, &hash);
+   char name[PATH_MAX];
+
+   if (entry) {
+      cache_remove_entry(entry);
+      return;
+   }
+
+   cache_file_name(name, sizeof(name), hash);
+   unlink(name);
+}
+
+static void cache_evict(void)
+{
+   while (cache.stats.size > cache.stats.max_size && !LIST_IS_EMPTY(&cache.lru)) {
+      struct cache_entry *entry = LIST_ENTRY(struct cache_entry, cache.lru.prev, head);
+      cache_remove_entry(entry);
+      cache.stats.evictions++;
+   }
+}
+
+static struct cache_entry *cache_add_entry(uint64_t hash, uint64_t size)
+{
+   struct cache_entry *entry = util_hash_table_get(cache.entries, &hash);
+
+   if (entry) {
+      cache.stats.size -= MIN2(entry->size, cache.stats.size);
+      list_del(&entry->head);
+   } else {
+      entry = CALLOC_STRUCT(cache_entry);
+      if (!entry)
+         return NULL;
+      entry->hash = hash;
+      if (util_hash_table_set(cache.entries, &entry->hash, entry) != PIPE_OK) {
+         FREE(entry);
+         return NULL;
+      }
+   }
+
+   entry->size = size;
+   cache.stats.size += size;
+   list_add(&entry->head, &cache.lru);
+   return entry;
+}
+
+static bool cache_read_file(uint64_t hash, const struct vrend_cache_blob *key,
+                            struct vrend_cache_blob *data)
+{
+   struct cache_file_header hdr;
+   char name[PATH_MAX];
+   uint8_t *file_key = NULL;
+   bool ret = false;
+   int fd;
+
+   cache_file_name(name, sizeof(name), hash);
+   fd = open(name, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+
+   if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+       !cache_header_valid(&hdr) ||
+       hdr.key_size != key->size ||
+       hdr.data_size > cache.stats.max_size)
+      goto out;
+
+   /* guard against hash collisions by comparing the complete key */
+   file_key = malloc(key->size);
+   if (!file_key || read(fd, file_key, key->size) != (ssize_t)key->size ||
+       memcmp(file_key, key->data, key->size))
+      goto out;
+
+   data->data = malloc(hdr.data_size);
+   if (!data->data)
+      goto out;
+   data->size = data->alloc_size = hdr.data_size;
+   if (read(fd, data->data, hdr.data_size) != (ssize_t)hdr.data_size) {
+      free(data->data);
+      data->data = NULL;
+      goto out;
+   }
+
+   /* the modification time is used for the LRU order between runs */
+   futimens(fd, NULL);
+   ret = true;
+out:
+   free(file_key);
+   close(fd);
+   return ret;
+}
+
+static bool cache_write_file(uint64_t hash, const struct vrend_cache_blob *key,
+                             const struct vrend_cache_blob *data)
+{
+   struct cache_file_header hdr;
+   char name[PATH_MAX], tmp_name[PATH_MAX + 16];
+   bool ret;
+   int fd;
+
+   cache_file_name(name, sizeof(name), hash);
+   snprintf(tmp_name, sizeof(tmp_name), "%s.%d.tmp", name, (int)getpid());
+
+   fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      return false;
+
+   memcpy(hdr.magic, cache_file_magic, sizeof(hdr.magic));
+   hdr.version = CACHE_FILE_VERSION;
+   hdr.build_id = cache.build_id;
+   hdr.key_size = key->size;
+   hdr.data_size = data->size;
+
+   ret = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+         write(fd, key->data, key->size) == (ssize_t)key->size &&
+         write(fd, data->data, data->size) == (ssize_t)data->size;
+   close(fd);
+
+   /* rename so that concurrent readers never see partial files */
+   if (!ret || rename(tmp_name, name)) {
+      unlink(tmp_name);
+      return false;
+   }
+   return true;
+}
+
+static bool mkdir_recursive(const char *path)
+{
+   char *copy, *p;
+   bool ret = true;
+
+   copy = strdup(path);
+   if (!copy)
+      return false;
+
+   for (p = copy + 1; ; p++) {
+      if (*p != '/' && *p != '\0')
+         continue;
+
+      char c = *p;
+      *p = '\0';
+      if (mkdir(copy, 0755) && errno != EEXIST) {
+         ret = false;
+         break;
+      }
+      *p = c;
+      if (c == '\0')
+         break;
+   }
+   free(copy);
+   return ret;
+}
+
+struct scanned_entry {
+   uint64_t hash;
+   uint64_t size;
+   time_t mtime;
+};
+
+static int scanned_entry_compare(const void *a, const void *b)
+{
+   const struct scanned_entry *ea = a, *eb = b;
+   return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/* files from other builds or of another layout are never going to hit */
+static bool cache_file_stale(const char *name)
+{
+   struct cache_file_header hdr;
+   bool stale;
+   int fd;
+
+   fd = open(name, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+   stale = read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || !cache_header_valid(&hdr);
+   close(fd);
+   return stale;
+}
+
+static void cache_scan_dir(void)
+{
+   struct scanned_entry *scanned = NULL;
+   unsigned num_scanned = 0, num_alloced = 0;
+   struct dirent *dent;
+   DIR *dir;
+
+   dir = opendir(cache.dir);
+   if (!dir)
+      return;
+
+   while ((dent = readdir(dir))) {
+      char name[PATH_MAX], *end;
+      struct stat st;
+      uint64_t hash;
+
+      hash = strtoull(dent->d_name, &end, 16);
+      if (end != dent->d_name + 16 || strcmp(end, CACHE_FILE_SUFFIX))
+         continue;
+
+      snprintf(name, sizeof(name), "%s/%s", cache.dir, dent->d_name);
+      if (stat(name, &st) || !S_ISREG(st.st_mode))
+         continue;
+
+      if (cache_file_stale(name)) {
+         unlink(name);
+         continue;
+      }
+
+      if (num_scanned == num_alloced) {
+         unsigned new_alloc = MAX2(num_alloced * 2, 64);
+         struct scanned_entry *new_scanned = realloc(scanned, new_alloc * sizeof(*scanned));
+         if (!new_scanned)
+            break;
+         scanned = new_scanned;
+         num_alloced = new_alloc;
+      }
+      scanned[num_scanned].hash = hash;
+      scanned[num_scanned].size = st.st_size;
+      scanned[num_scanned].mtime = st.st_mtime;
+      num_scanned++;
+   }
+   closedir(dir);
+
+   /* oldest first, so the most recently used entry ends up in front */
+   if (num_scanned)
+      qsort(scanned, num_scanned, sizeof(*scanned), scanned_entry_compare);
+   for (unsigned i = 0; i < num_scanned; i++)
+      cache_add_entry(scanned[i].hash, scanned[i].size);
+   free(scanned);
+
+   cache_evict();
+}
+
+static bool cache_init(const char *dir, uint64_t max_size)
+{
+   if (cache.enabled)
+      return true;
+
+   if (!dir || !*dir || !max_size)
+      return false;
+
+   if (!mkdir_recursive(dir)) {
+      vrend_printf("shader cache: unable to create %s\n", dir);
+      return false;
+   }
+
+   cache.dir = strdup(dir);
+   if (!cache.dir)
+      return false;
+
+   cache.entries = util_hash_table_create(hash_func, compare, free);
+   if (!cache.entries) {
+      free(cache.dir);
+      cache.dir = NULL;
+      return false;
+   }
+
+   list_inithead(&cache.lru);
+   memset(&cache.stats, 0, sizeof(cache.stats));
+   cache.stats.max_size = max_size;
+   cache.build_id = cache_compute_build_id();
+   cache.enabled = true;
+
+   cache_scan_dir();
+   return true;
+}
+
+/* The cache is used from the decode threads of all contexts, the state
+ * including enabled is only touched with cache_mutex held.
+ */
+bool vrend_shader_cache_init(const char *dir, uint64_t max_size)
+{
+   bool ret;
+
+   pipe_mutex_lock(cache_mutex);
+   ret = cache_init(dir, max_size);
+   pipe_mutex_unlock(cache_mutex);
+   return ret;
+}
+
+void vrend_shader_cache_fini(void)
+{
+   pipe_mutex_lock(cache_mutex);
+   if (cache.enabled) {
+      util_hash_table_destroy(cache.entries);
+      cache.entries = NULL;
+      free(cache.dir);
+      cache.dir = NULL;
+      cache.enabled = false;
+   }
+   pipe_mutex_unlock(cache_mutex);
+}
+
+bool vrend_shader_cache_enabled(void)
+{
+   bool enabled;
+
+   pipe_mutex_lock(cache_mutex);
+   enabled = cache.enabled;
+   pipe_mutex_unlock(cache_mutex);
+   return enabled;
+}
+
+void vrend_shader_cache_get_stats(struct vrend_shader_cache_stats *stats)
+{
+   pipe_mutex_lock(cache_mutex);
+   *stats = cache.stats;
+   pipe_mutex_unlock(cache_mutex);
+}
+
+static bool deserialize_shader(struct vrend_cache_reader *reader,
+                               struct vrend_shader_info *sinfo,
+                               struct vrend_strarray *shader)
+{
+   struct vrend_shader_info info;
+   struct vrend_array *sampler_arrays = NULL, *image_arrays = NULL;
+   struct vrend_interp_info *interpinfo = NULL;
+   char **so_names = NULL;
+   uint32_t num_strings;
+   const void *ptr;
+
+   ptr = vrend_cache_reader_read(reader, sizeof(info));
+   if (!ptr)
+      return false;
+   memcpy(&info, ptr, sizeof(info));
+
+   sampler_arrays = reader_dup(reader, info.num_sampler_arrays * sizeof(struct vrend_array));
+   image_arrays = reader_dup(reader, info.num_image_arrays * sizeof(struct vrend_array));
+   if (vrend_cache_reader_read_u32(reader))
+      interpinfo = reader_dup(reader, info.num_interps * sizeof(struct vrend_interp_info));
+
+   if (vrend_cache_reader_read_u32(reader) && info.so_info.num_outputs) {
+      so_names = calloc(info.so_info.num_outputs, sizeof(char *));
+      if (!so_names)
+         reader->error = true;
+      for (unsigned i = 0; so_names && i < info.so_info.num_outputs; i++) {
+         uint32_t len = vrend_cache_reader_read_u32(reader);
+         if (len == UINT32_MAX)
+            continue;
+         ptr = vrend_cache_reader_read(reader, len);
+         so_names[i] = ptr ? strndup(ptr, len) : NULL;
+         if (!so_names[i])
+            reader->error = true;
+      }
+   }
+
+   /* every string takes at least its length and tag */
+   num_strings = vrend_cache_reader_read_u32(reader);
+   if (reader->error ||
+       num_strings > (reader->size - reader->offset) / 8)
+      goto fail;
+
+   for (unsigned i = 0; i < num_strings; i++) {
+      struct vrend_strbuf sb;
+      uint32_t len = vrend_cache_reader_read_u32(reader);
+      uint32_t tag = vrend_cache_reader_read_u32(reader);
+
+      ptr = vrend_cache_reader_read(reader, len);
+      if (!ptr || memchr(ptr, '\0', len) || !strbuf_alloc(&sb, len + 1))
+         goto fail_strings;
+      strbuf_append_buffer(&sb, ptr, len);
+      sb.tag = tag;
+      if (!strarray_addstrbuf(shader, &sb)) {
+         strbuf_free(&sb);
+         goto fail_strings;
+      }
+   }
+
+   /* Replace the data exactly like fill_sinfo and fill_interpolants do. */
+   if (sinfo->so_names) {
+      for (unsigned i = 0; i < sinfo->so_info.num_outputs; ++i)
+         free(sinfo->so_names[i]);
+      free(sinfo->so_names);
+   }
+   free(sinfo->sampler_arrays);
+   free(sinfo->image_arrays);
+   if (interpinfo) {
+      free(sinfo->interpinfo);
+      info.interpinfo = interpinfo;
+   } else {
+      info.interpinfo = sinfo->interpinfo;
+   }
+   info.sampler_arrays = sampler_arrays;
+   info.image_arrays = image_arrays;
+   info.so_names = so_names;
+   info.so_info = sinfo->so_info;
+   info.invariant_outputs |= sinfo->invariant_outputs;
+   *sinfo = info;
+   return true;
+
+fail_strings:
+   while (shader->num_strings)
+      strbuf_free(&shader->strings[--shader->num_strings]);
+fail:
+   if (so_names) {
+      for (unsigned i = 0; i < info.so_info.num_outputs; i++)
+         free(so_names[i]);
+      free(so_names);
+   }
+   free(interpinfo);
+   free(image_arrays);
+   free(sampler_arrays);
+   return false;
+}
+
+static void serialize_shader(struct vrend_cache_blob *blob,
+                             const struct vrend_shader_info *sinfo,
+                             const struct vrend_strarray *shader)
+{
+   struct vrend_shader_info info = *sinfo;
+
+   info.sampler_arrays = NULL;
+   info.image_arrays = NULL;
+   info.interpinfo = NULL;
+   info.so_names = NULL;
+   vrend_cache_blob_write(blob, &info, sizeof(info));
+
+   vrend_cache_blob_write(blob, sinfo->sampler_arrays, sinfo->num_sampler_arrays * sizeof(struct vrend_array));
+   vrend_cache_blob_write(blob, sinfo->image_arrays, sinfo->num_image_arrays * sizeof(struct vrend_array));
+
+   vrend_cache_blob_write_u32(blob, sinfo->interpinfo != NULL);
+   if (sinfo->interpinfo)
+      vrend_cache_blob_write(blob, sinfo->interpinfo, sinfo->num_interps * sizeof(struct vrend_interp_info));
+
+   vrend_cache_blob_write_u32(blob, sinfo->so_names != NULL);
+   if (sinfo->so_names) {
+      for (unsigned i = 0; i < sinfo->so_info.num_outputs; i++) {
+         if (!sinfo->so_names[i]) {
+            vrend_cache_blob_write_u32(blob, UINT32_MAX);
+            continue;
+         }
+         vrend_cache_blob_write_u32(blob, strlen(sinfo->so_names[i]));
+         vrend_cache_blob_write(blob, sinfo->so_names[i], strlen(sinfo->so_names[i]));
+      }
+   }
+
+   vrend_cache_blob_write_u32(blob, shader->num_strings);
+   for (int i = 0; i < shader->num_strings; i++) {
+      vrend_cache_blob_write_u32(blob, shader->strings[i].size);
+      vrend_cache_blob_write_u32(blob, shader->strings[i].tag);
+      vrend_cache_blob_write(blob, shader->strings[i].buf, shader->strings[i].size);
+   }
+}
+
+static uint64_t cache_key_hash(const struct vrend_cache_blob *key)
+{
+   return vrend_shader_cache_hash(VREND_SHADER_CACHE_HASH_SEED, key->data, key->size);
+}
+
+static bool cache_get(const struct vrend_cache_blob *key, struct vrend_cache_blob *data)
+{
+   uint64_t hash = cache_key_hash(key);
+
+   /* Other instances may share the directory, so try the file even if we
+    * don't know about it yet. */
+   if (!cache_read_file(hash, key, data))
+      return false;
+
+   cache_add_entry(hash, sizeof(struct cache_file_header) + key->size + data->size);
+   cache_evict();
+   return true;
+}
+
+static bool cache_put(const struct vrend_cache_blob *key, const struct vrend_cache_blob *data)
+{
+   uint64_t hash, size;
+
+   size = sizeof(struct cache_file_header) + key->size + data->size;
+   if (size > cache.stats.max_size)
+      return false;
+
+   hash = cache_key_hash(key);
+   if (!cache_write_file(hash, key, data))
+      return false;
+
+   cache_add_entry(hash, size);
+   cache_evict();
+   return true;
+}
+
+bool vrend_shader_cache_lookup(const struct vrend_shader_cfg *cfg,
+                               const struct tgsi_token *tokens,
+                               uint32_t req_local_mem,
+                               const struct vrend_shader_key *key,
+                               struct vrend_shader_info *sinfo,
+                               struct vrend_strarray *shader)
+{
+   struct vrend_cache_blob key_blob = {0}, data_blob = {0};
+   struct vrend_cache_reader reader;
+   bool ret = false;
+
+   if (!vrend_shader_cache_enabled())
+      return false;
+
+   if (!build_key(&key_blob, cfg, tokens, req_local_mem, key, &sinfo->so_info))
+      goto out;
+
+   pipe_mutex_lock(cache_mutex);
+   ret = cache.enabled && cache_get(&key_blob, &data_blob);
+   pipe_mutex_unlock(cache_mutex);
+   if (!ret)
+      goto out;
+
+   reader.data = data_blob.data;
+   reader.size = data_blob.size;
+   reader.offset = 0;
+   reader.error = false;
+   ret = deserialize_shader(&reader, sinfo, shader);
+
+   /* corrupt or truncated, don't bother with it again */
+   pipe_mutex_lock(cache_mutex);
+   if (!ret && cache.enabled)
+      cache_remove(cache_key_hash(&key_blob));
+   pipe_mutex_unlock(cache_mutex);
+out:
+   pipe_mutex_lock(cache_mutex);
+   if (ret)
+      cache.stats.hits++;
+   else
+      cache.stats.misses++;
+   pipe_mutex_unlock(cache_mutex);
+   free(key_blob.data);
+   free(data_blob.data);
+   return ret;
+}
+
+void vrend_shader_cache_store(const struct vrend_shader_cfg *cfg,
+                              const struct tgsi_token *tokens,
+                              uint32_t req_local_mem,
+                              const struct vrend_shader_key *key,
+                              const struct vrend_shader_info *sinfo,
+                              const struct vrend_strarray *shader)
+{
+   struct vrend_cache_blob key_blob = {0}, data_blob = {0};
+
+   if (!vrend_shader_cache_enabled())
+      return;
+
+   if (!build_key(&key_blob, cfg, tokens, req_local_mem, key, &sinfo->so_info))
+      goto out;
+
+   serialize_shader(&data_blob, sinfo, shader);
+   if (data_blob.error)
+      goto out;
+
+   pipe_mutex_lock(cache_mutex);
+   if (cache.enabled && cache_put(&key_blob, &data_blob))
+      cache.stats.stores++;
+   pipe_mutex_unlock(cache_mutex);
+out:
+   free(key_blob.data);
+   free(data_blob.data);
+}
+
+static bool build_program_key(struct vrend_cache_blob *blob,
+                              const struct vrend_cache_blob *key)
+{
+   vrend_cache_blob_write_u32(blob, CACHE_ENTRY_PROGRAM);
+   vrend_cache_blob_write(blob, key->data, key->size);
+   return !blob->error && !key->error;
+}
+
+bool vrend_program_cache_lookup(const struct vrend_cache_blob *key,
+                                struct vrend_cache_blob *data)
+{
+   struct vrend_cache_blob key_blob = {0};
+   bool ret = false;
+
+   pipe_mutex_lock(cache_mutex);
+   if (!cache.enabled) {
+      pipe_mutex_unlock(cache_mutex);
+      return false;
+   }
+
+   if (build_program_key(&key_blob, key))
+      ret = cache_get(&key_blob, data);
+
+   if (ret)
+      cache.stats.program_hits++;
+   else
+      cache.stats.program_misses++;
+   pipe_mutex_unlock(cache_mutex);
+   free(key_blob.data);
+   return ret;
+}
+
+void vrend_program_cache_store(const struct vrend_cache_blob *key,
+                               const struct vrend_cache_blob *data)
+{
+   struct vrend_cache_blob key_blob = {0};
+
+   if (data->error)
+      return;
+
+   pipe_mutex_lock(cache_mutex);
+   if (cache.enabled && build_program_key(&key_blob, key) && cache_put(&key_blob, data))
+      cache.stats.program_stores++;
+   pipe_mutex_unlock(cache_mutex);
+   free(key_blob.data);
+}
+
+void vrend_program_cache_reject(const struct vrend_cache_blob *key)
+{
+   struct vrend_cache_blob key_blob = {0};
+
+   pipe_mutex_lock(cache_mutex);
+   if (cache.enabled) {
+      if (build_program_key(&key_blob, key))
+         cache_remove(cache_key_hash(&key_blob));
+      cache.stats.program_rejects++;
+   }
+   pipe_mutex_unlock(cache_mutex);
+   free(key_blob.data);
+}
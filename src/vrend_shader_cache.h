@@ -0,0 +1,115 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef VREND_SHADER_CACHE_H
+#define VREND_SHADER_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vrend_shader.h"
+
+/* Persistent on-disk cache of TGSI -> GLSL translations.
+ *
+ * Entries are keyed on the TGSI tokens together with the shader key and
+ * the shader config, and store the emitted GLSL strings plus the filled
+ * in vrend_shader_info, so a hit can skip vrend_convert_shader entirely.
+ * The same directory also holds linked program binaries, whose key and
+ * data are opaque to the cache.
+ * The cache is disabled unless a directory is given, and is kept below
+ * max_size bytes by evicting the least recently used entries.
+ */
+
+#define VREND_SHADER_CACHE_HASH_SEED 0xcbf29ce484222325ull
+
+struct vrend_shader_cache_stats {
+   uint64_t hits;
+   uint64_t misses;
+   uint64_t stores;
+   uint64_t program_hits;
+   uint64_t program_misses;
+   uint64_t program_stores;
+   uint64_t program_rejects;
+   uint64_t evictions;
+   uint64_t size;
+   uint64_t max_size;
+};
+
+/* growable buffer used to build keys and entries */
+struct vrend_cache_blob {
+   uint8_t *data;
+   size_t size;
+   size_t alloc_size;
+   bool error;
+};
+
+struct vrend_cache_reader {
+   const uint8_t *data;
+   size_t size;
+   size_t offset;
+   bool error;
+};
+
+void vrend_cache_blob_write(struct vrend_cache_blob *blob, const void *data, size_t size);
+
+void vrend_cache_blob_write_u32(struct vrend_cache_blob *blob, uint32_t value);
+
+const void *vrend_cache_reader_read(struct vrend_cache_reader *reader, size_t size);
+
+uint32_t vrend_cache_reader_read_u32(struct vrend_cache_reader *reader);
+
+uint64_t vrend_shader_cache_hash(uint64_t hash, const void *data, size_t size);
+
+bool vrend_shader_cache_init(const char *dir, uint64_t max_size);
+
+void vrend_shader_cache_fini(void);
+
+bool vrend_shader_cache_enabled(void);
+
+bool vrend_shader_cache_lookup(const struct vrend_shader_cfg *cfg,
+                               const struct tgsi_token *tokens,
+                               uint32_t req_local_mem,
+                               const struct vrend_shader_key *key,
+                               struct vrend_shader_info *sinfo,
+                               struct vrend_strarray *shader);
+
+void vrend_shader_cache_store(const struct vrend_shader_cfg *cfg,
+                              const struct tgsi_token *tokens,
+                              uint32_t req_local_mem,
+                              const struct vrend_shader_key *key,
+                              const struct vrend_shader_info *sinfo,
+                              const struct vrend_strarray *shader);
+
+bool vrend_program_cache_lookup(const struct vrend_cache_blob *key,
+                                struct vrend_cache_blob *data);
+
+void vrend_program_cache_store(const struct vrend_cache_blob *key,
+                               const struct vrend_cache_blob *data);
+
+/* drop an entry the driver refused to load */
+void vrend_program_cache_reject(const struct vrend_cache_blob *key);
+
+void vrend_shader_cache_get_stats(struct vrend_shader_cache_stats *stats);
+
+#endif
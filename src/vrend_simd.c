@@ -0,0 +1,304 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include "pipe/p_config.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+
+#include "vrend_simd.h"
+
+#if (defined(PIPE_ARCH_X86) || defined(PIPE_ARCH_X86_64)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define VREND_SIMD_X86
+#include <immintrin.h>
+#define TARGET(t) __attribute__((target(t)))
+#endif
+
+#if defined(PIPE_ARCH_AARCH64) && defined(__ARM_NEON)
+#define VREND_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/* Copies at least this large bypass the cache with streaming stores, they
+ * would evict more useful data than they could ever hit themselves.
+ */
+#define VREND_SIMD_STREAM_MIN (256 * 1024)
+
+#define DEPTH_UNIT (1.0f / 0xffffff)
+
+static void copy_c(void *dst, const void *src, size_t size)
+{
+   memcpy(dst, src, size);
+}
+
+static void copy_flip_c(uint8_t *dst, uint32_t dst_stride,
+                        const uint8_t *src, uint32_t src_stride,
+                        uint32_t row_size, uint32_t rows)
+{
+   uint32_t i;
+
+   for (i = 0; i < rows; i++)
+      memcpy(dst + (uint64_t)(rows - i - 1) * dst_stride,
+             src + (uint64_t)i * src_stride, row_size);
+}
+
+static void copy_scale_depth_c(uint32_t *dst, const uint32_t *src,
+                               size_t count, float scale)
+{
+   size_t i;
+
+   for (i = 0; i < count; i++) {
+      float d = ((float)(src[i] >> 8) * DEPTH_UNIT) * scale;
+      d = CLAMP(d, 0.0f, 1.0f);
+      dst[i] = (uint32_t)(int)(d / DEPTH_UNIT) << 8;
+   }
+}
+
+static const struct vrend_simd_kernels kernels_c = {
+   "scalar", copy_c, copy_flip_c, copy_scale_depth_c
+};
+
+#ifdef VREND_SIMD_X86
+
+TARGET("sse2")
+static void stream_sse2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+   size_t head = MIN2((16 - ((uintptr_t)dst & 15)) & 15, size);
+
+   memcpy(dst, src, head);
+   dst += head;
+   src += head;
+   size -= head;
+
+   for (; size >= 64; size -= 64, dst += 64, src += 64) {
+      __m128i a = _mm_loadu_si128((const __m128i *)src);
+      __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+      __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+      __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+      _mm_stream_si128((__m128i *)dst, a);
+      _mm_stream_si128((__m128i *)(dst + 16), b);
+      _mm_stream_si128((__m128i *)(dst + 32), c);
+      _mm_stream_si128((__m128i *)(dst + 48), d);
+   }
+   memcpy(dst, src, size);
+}
+
+TARGET("sse2")
+static void copy_sse2(void *dst, const void *src, size_t size)
+{
+   if (size < VREND_SIMD_STREAM_MIN) {
+      memcpy(dst, src, size);
+      return;
+   }
+   stream_sse2(dst, src, size);
+   _mm_sfence();
+}
+
+TARGET("sse2")
+static void copy_flip_sse2(uint8_t *dst, uint32_t dst_stride,
+                           const uint8_t *src, uint32_t src_stride,
+                           uint32_t row_size, uint32_t rows)
+{
+   uint32_t i;
+
+   if ((uint64_t)row_size * rows < VREND_SIMD_STREAM_MIN) {
+      copy_flip_c(dst, dst_stride, src, src_stride, row_size, rows);
+      return;
+   }
+   for (i = 0; i < rows; i++)
+      stream_sse2(dst + (uint64_t)(rows - i - 1) * dst_stride,
+                  src + (uint64_t)i * src_stride, row_size);
+   _mm_sfence();
+}
+
+TARGET("sse2")
+static void copy_scale_depth_sse2(uint32_t *dst, const uint32_t *src,
+                                  size_t count, float scale)
+{
+   const __m128 unit = _mm_set1_ps(DEPTH_UNIT);
+   const __m128 vscale = _mm_set1_ps(scale);
+   const __m128 zero = _mm_setzero_ps();
+   const __m128 one = _mm_set1_ps(1.0f);
+   size_t i;
+
+   for (i = 0; i + 4 <= count; i += 4) {
+      __m128i v = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + i)), 8);
+      __m128 d = _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), unit), vscale);
+      d = _mm_min_ps(_mm_max_ps(d, zero), one);
+      v = _mm_slli_epi32(_mm_cvttps_epi32(_mm_div_ps(d, unit)), 8);
+      _mm_storeu_si128((__m128i *)(dst + i), v);
+   }
+   copy_scale_depth_c(dst + i, src + i, count - i, scale);
+}
+
+static const struct vrend_simd_kernels kernels_sse2 = {
+   "sse2", copy_sse2, copy_flip_sse2, copy_scale_depth_sse2
+};
+
+TARGET("avx2")
+static void stream_avx2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+   size_t head = MIN2((32 - ((uintptr_t)dst & 31)) & 31, size);
+
+   memcpy(dst, src, head);
+   dst += head;
+   src += head;
+   size -= head;
+
+   for (; size >= 128; size -= 128, dst += 128, src += 128) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)src);
+      __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+      __m256i c = _mm256_loadu_si256((const __m256i *)(src + 64));
+      __m256i d = _mm256_loadu_si256((const __m256i *)(src + 96));
+      _mm256_stream_si256((__m256i *)dst, a);
+      _mm256_stream_si256((__m256i *)(dst + 32), b);
+      _mm256_stream_si256((__m256i *)(dst + 64), c);
+      _mm256_stream_si256((__m256i *)(dst + 96), d);
+   }
+   memcpy(dst, src, size);
+}
+
+TARGET("avx2")
+static void copy_avx2(void *dst, const void *src, size_t size)
+{
+   if (size < VREND_SIMD_STREAM_MIN) {
+      memcpy(dst, src, size);
+      return;
+   }
+   stream_avx2(dst, src, size);
+   _mm_sfence();
+}
+
+TARGET("avx2")
+static void copy_flip_avx2(uint8_t *dst, uint32_t dst_stride,
+                           const uint8_t *src, uint32_t src_stride,
+                           uint32_t row_size, uint32_t rows)
+{
+   uint32_t i;
+
+   if ((uint64_t)row_size * rows < VREND_SIMD_STREAM_MIN) {
+      copy_flip_c(dst, dst_stride, src, src_stride, row_size, rows);
+      return;
+   }
+   for (i = 0; i < rows; i++)
+      stream_avx2(dst + (uint64_t)(rows - i - 1) * dst_stride,
+                  src + (uint64_t)i * src_stride, row_size);
+   _mm_sfence();
+}
+
+TARGET("avx2")
+static void copy_scale_depth_avx2(uint32_t *dst, const uint32_t *src,
+                                  size_t count, float scale)
+{
+   const __m256 unit = _mm256_set1_ps(DEPTH_UNIT);
+   const __m256 vscale = _mm256_set1_ps(scale);
+   const __m256 zero = _mm256_setzero_ps();
+   const __m256 one = _mm256_set1_ps(1.0f);
+   size_t i;
+
+   for (i = 0; i + 8 <= count; i += 8) {
+      __m256i v = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + i)), 8);
+      __m256 d = _mm256_mul_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), unit), vscale);
+      d = _mm256_min_ps(_mm256_max_ps(d, zero), one);
+      v = _mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_div_ps(d, unit)), 8);
+      _mm256_storeu_si256((__m256i *)(dst + i), v);
+   }
+   copy_scale_depth_c(dst + i, src + i, count - i, scale);
+}
+
+static const struct vrend_simd_kernels kernels_avx2 = {
+   "avx2", copy_avx2, copy_flip_avx2, copy_scale_depth_avx2
+};
+
+#endif
+
+#ifdef VREND_SIMD_NEON
+
+static void copy_scale_depth_neon(uint32_t *dst, const uint32_t *src,
+                                  size_t count, float scale)
+{
+   const float32x4_t unit = vdupq_n_f32(DEPTH_UNIT);
+   const float32x4_t vscale = vdupq_n_f32(scale);
+   const float32x4_t zero = vdupq_n_f32(0.0f);
+   const float32x4_t one = vdupq_n_f32(1.0f);
+   size_t i;
+
+   for (i = 0; i + 4 <= count; i += 4) {
+      uint32x4_t v = vshrq_n_u32(vld1q_u32(src + i), 8);
+      float32x4_t d = vmulq_f32(vmulq_f32(vcvtq_f32_u32(v), unit), vscale);
+      d = vminq_f32(vmaxq_f32(d, zero), one);
+      v = vreinterpretq_u32_s32(vcvtq_s32_f32(vdivq_f32(d, unit)));
+      vst1q_u32(dst + i, vshlq_n_u32(v, 8));
+   }
+   copy_scale_depth_c(dst + i, src + i, count - i, scale);
+}
+
+/* NEON is always there on aarch64, and the libc copies already use it */
+static const struct vrend_simd_kernels kernels_neon = {
+   "neon", copy_c, copy_flip_c, copy_scale_depth_neon
+};
+
+#endif
+
+static const struct vrend_simd_kernels *available[3] = { &kernels_c };
+static unsigned num_available = 1;
+static const struct vrend_simd_kernels *current = &kernels_c;
+
+void vrend_simd_init(const char *name)
+{
+   unsigned i;
+
+   util_cpu_detect();
+
+   num_available = 1;
+#ifdef VREND_SIMD_X86
+   if (util_cpu_caps.has_sse2)
+      available[num_available++] = &kernels_sse2;
+   if (util_cpu_caps.has_avx2)
+      available[num_available++] = &kernels_avx2;
+#endif
+#ifdef VREND_SIMD_NEON
+   available[num_available++] = &kernels_neon;
+#endif
+
+   current = available[num_available - 1];
+   for (i = 0; name && i < num_available; i++) {
+      if (!strcmp(available[i]->name, name))
+         current = available[i];
+   }
+}
+
+const struct vrend_simd_kernels *const *vrend_simd_get_kernels(unsigned *count)
+{
+   *count = num_available;
+   return available;
+}
+
+const struct vrend_simd_kernels *vrend_simd_current(void)
+{
+   return current;
+}
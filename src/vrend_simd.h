@@ -0,0 +1,77 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef VREND_SIMD_H
+#define VREND_SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* CPU kernels for the bulk copies and pixel fix ups around transfers.
+ * vrend_simd_init picks the widest set the host CPU supports, the
+ * scalar set is used until then.
+ */
+struct vrend_simd_kernels {
+   const char *name;
+   /* copy into memory the host CPU is not going to read soon */
+   void (*copy)(void *dst, const void *src, size_t size);
+   /* copy rows, the first row of src ends up as the last one of dst */
+   void (*copy_flip)(uint8_t *dst, uint32_t dst_stride,
+                     const uint8_t *src, uint32_t src_stride,
+                     uint32_t row_size, uint32_t rows);
+   /* rescale the 24 bit depth values in the high bits of each word,
+    * dst may be src */
+   void (*copy_scale_depth)(uint32_t *dst, const uint32_t *src,
+                            size_t count, float scale);
+};
+
+/* uses the set called name if it is given and supported */
+void vrend_simd_init(const char *name);
+
+/* the sets supported on this CPU, starting with the scalar one */
+const struct vrend_simd_kernels *const *vrend_simd_get_kernels(unsigned *count);
+
+const struct vrend_simd_kernels *vrend_simd_current(void);
+
+static inline void vrend_copy(void *dst, const void *src, size_t size)
+{
+   vrend_simd_current()->copy(dst, src, size);
+}
+
+static inline void vrend_copy_flip(void *dst, uint32_t dst_stride,
+                                   const void *src, uint32_t src_stride,
+                                   uint32_t row_size, uint32_t rows)
+{
+   vrend_simd_current()->copy_flip(dst, dst_stride, src, src_stride, row_size, rows);
+}
+
+static inline void vrend_copy_scale_depth(uint32_t *dst, const uint32_t *src,
+                                          size_t count, float scale)
+{
+   vrend_simd_current()->copy_scale_depth(dst, src, count, scale);
+}
+
+#endif
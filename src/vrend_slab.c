@@ -0,0 +1,286 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "os/os_thread.h"
+#include "util/u_double_list.h"
+#include "util/u_math.h"
+
+#include "vrend_slab.h"
+
+#define VREND_SLAB_PAGE_SIZE 4096
+#define VREND_SLAB_MIN_OBJECTS 8
+
+/* in front of every object, keeps the object 16 byte aligned */
+struct vrend_slab_elem {
+   struct vrend_slab *slab;
+   struct vrend_slab_elem *next_free;
+};
+
+struct vrend_slab_page {
+   struct vrend_slab_page *next;
+   uint64_t pad;
+};
+
+struct vrend_slab {
+   struct list_head head;
+   size_t elem_size;
+   size_t obj_size;
+   unsigned objects_per_page;
+   bool thread_safe;
+   /* slabs are disabled, every object is a separate heap allocation */
+   bool passthrough;
+   pipe_mutex mutex;
+
+   struct vrend_slab_page *pages;
+   struct vrend_slab_elem *free_list;
+   /* destroyed while objects were still alive */
+   bool orphaned;
+
+   uint64_t allocs;
+   uint64_t page_allocs;
+   uint64_t live;
+};
+
+pipe_static_mutex(vrend_slab_mutex);
+
+static struct {
+   bool enabled;
+   uint64_t start_ns;
+   /* all slabs that still have pages */
+   struct list_head slabs;
+   /* counters of the slabs that are gone */
+   struct vrend_slab_stats retired;
+} slabs;
+
+static uint64_t vrend_slab_time_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void vrend_slab_init(bool enabled)
+{
+   pipe_mutex_lock(vrend_slab_mutex);
+   if (!slabs.slabs.next)
+      list_inithead(&slabs.slabs);
+   slabs.enabled = enabled;
+   slabs.start_ns = vrend_slab_time_ns();
+   memset(&slabs.retired, 0, sizeof(slabs.retired));
+   pipe_mutex_unlock(vrend_slab_mutex);
+}
+
+struct vrend_slab *vrend_slab_create(size_t size, bool thread_safe)
+{
+   struct vrend_slab *slab;
+
+   slab = calloc(1, sizeof(*slab));
+   if (!slab)
+      return NULL;
+
+   slab->passthrough = !slabs.enabled;
+   slab->obj_size = size;
+   slab->elem_size = align(sizeof(struct vrend_slab_elem) + size, 16);
+   slab->objects_per_page = MAX2(VREND_SLAB_MIN_OBJECTS,
+                                 (VREND_SLAB_PAGE_SIZE - sizeof(struct vrend_slab_page)) /
+                                 slab->elem_size);
+   slab->thread_safe = thread_safe;
+   if (thread_safe)
+      pipe_mutex_init(slab->mutex);
+
+   pipe_mutex_lock(vrend_slab_mutex);
+   list_addtail(&slab->head, &slabs.slabs);
+   pipe_mutex_unlock(vrend_slab_mutex);
+   return slab;
+}
+
+static void vrend_slab_release(struct vrend_slab *slab)
+{
+   struct vrend_slab_page *page, *next;
+
+   pipe_mutex_lock(vrend_slab_mutex);
+   list_del(&slab->head);
+   slabs.retired.allocs += slab->allocs;
+   slabs.retired.page_allocs += slab->page_allocs;
+   pipe_mutex_unlock(vrend_slab_mutex);
+
+   for (page = slab->pages; page; page = next) {
+      next = page->next;
+      free(page);
+   }
+
+   if (slab->thread_safe)
+      pipe_mutex_destroy(slab->mutex);
+   free(slab);
+}
+
+void vrend_slab_destroy(struct vrend_slab *slab)
+{
+   bool release;
+
+   if (!slab)
+      return;
+
+   if (slab->thread_safe)
+      pipe_mutex_lock(slab->mutex);
+   slab->orphaned = true;
+   release = !slab->live;
+   if (slab->thread_safe)
+      pipe_mutex_unlock(slab->mutex);
+
+   if (release)
+      vrend_slab_release(slab);
+}
+
+static bool vrend_slab_add_page(struct vrend_slab *slab)
+{
+   struct vrend_slab_page *page;
+   uint8_t *elems;
+   unsigned i;
+
+   page = malloc(sizeof(*page) + slab->objects_per_page * slab->elem_size);
+   if (!page)
+      return false;
+
+   page->next = slab->pages;
+   slab->pages = page;
+   slab->page_allocs++;
+
+   elems = (uint8_t *)(page + 1);
+   for (i = slab->objects_per_page; i-- > 0;) {
+      struct vrend_slab_elem *elem = (struct vrend_slab_elem *)(elems + i * slab->elem_size);
+      elem->slab = slab;
+      elem->next_free = slab->free_list;
+      slab->free_list = elem;
+   }
+   return true;
+}
+
+void *vrend_slab_alloc(struct vrend_slab *slab)
+{
+   struct vrend_slab_elem *elem;
+
+   if (!slab)
+      return NULL;
+
+   if (slab->passthrough) {
+      elem = calloc(1, sizeof(*elem) + slab->obj_size);
+      if (!elem)
+         return NULL;
+      elem->slab = slab;
+      if (slab->thread_safe)
+         pipe_mutex_lock(slab->mutex);
+      slab->allocs++;
+      slab->page_allocs++;
+      slab->live++;
+      if (slab->thread_safe)
+         pipe_mutex_unlock(slab->mutex);
+      return elem + 1;
+   }
+
+   if (slab->thread_safe)
+      pipe_mutex_lock(slab->mutex);
+
+   if (!slab->free_list && !vrend_slab_add_page(slab)) {
+      if (slab->thread_safe)
+         pipe_mutex_unlock(slab->mutex);
+      return NULL;
+   }
+
+   elem = slab->free_list;
+   slab->free_list = elem->next_free;
+   slab->allocs++;
+   slab->live++;
+
+   if (slab->thread_safe)
+      pipe_mutex_unlock(slab->mutex);
+
+   elem->next_free = NULL;
+   memset(elem + 1, 0, slab->obj_size);
+   return elem + 1;
+}
+
+void vrend_slab_free(void *ptr)
+{
+   struct vrend_slab_elem *elem;
+   struct vrend_slab *slab;
+   bool release;
+
+   if (!ptr)
+      return;
+
+   elem = (struct vrend_slab_elem *)ptr - 1;
+   slab = elem->slab;
+
+   if (slab->thread_safe)
+      pipe_mutex_lock(slab->mutex);
+   if (slab->passthrough) {
+      free(elem);
+   } else {
+      elem->next_free = slab->free_list;
+      slab->free_list = elem;
+   }
+   slab->live--;
+   release = slab->orphaned && !slab->live;
+   if (slab->thread_safe)
+      pipe_mutex_unlock(slab->mutex);
+
+   if (release)
+      vrend_slab_release(slab);
+}
+
+/* The counters of thread safe slabs are read under their locks. Slabs
+ * that are not thread safe belong to a decode thread, so the caller has
+ * to stop those, see vrend_decode_thread_acquire.
+ */
+void vrend_slab_get_stats(struct vrend_slab_stats *stats)
+{
+   struct vrend_slab *slab;
+
+   pipe_mutex_lock(vrend_slab_mutex);
+   *stats = slabs.retired;
+   if (slabs.slabs.next) {
+      LIST_FOR_EACH_ENTRY(slab, &slabs.slabs, head) {
+         if (slab->thread_safe)
+            pipe_mutex_lock(slab->mutex);
+         stats->allocs += slab->allocs;
+         stats->page_allocs += slab->page_allocs;
+         stats->live += slab->live;
+         if (slab->thread_safe)
+            pipe_mutex_unlock(slab->mutex);
+      }
+   }
+   stats->elapsed_ns = vrend_slab_time_ns() - slabs.start_ns;
+   pipe_mutex_unlock(vrend_slab_mutex);
+}
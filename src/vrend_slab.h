@@ -0,0 +1,70 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef VREND_SLAB_H
+#define VREND_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Allocators for small objects of one type that are created and
+ * destroyed at guest frame rates.
+ *
+ * Objects are carved from pages of a few KiB and recycled through a free
+ * list, so most allocations do not go to the heap. Each object records its
+ * slab, so it can be freed without knowing where it came from. Destroying
+ * a slab releases all its pages at once; if objects are still alive the
+ * pages are released when the last of them is freed.
+ *
+ * Slabs created without thread_safe must only be used from one thread at
+ * a time. With slabs disabled every object is allocated on its own, which
+ * keeps tools like valgrind useful.
+ */
+
+struct vrend_slab;
+
+/* matches struct virgl_renderer_alloc_stats */
+struct vrend_slab_stats {
+   uint64_t allocs;
+   uint64_t page_allocs;
+   uint64_t live;
+   uint64_t elapsed_ns;
+};
+
+void vrend_slab_init(bool enabled);
+
+struct vrend_slab *vrend_slab_create(size_t size, bool thread_safe);
+
+void vrend_slab_destroy(struct vrend_slab *slab);
+
+/* returns zeroed memory, or NULL if slab is NULL or out of memory */
+void *vrend_slab_alloc(struct vrend_slab *slab);
+
+void vrend_slab_free(void *ptr);
+
+void vrend_slab_get_stats(struct vrend_slab_stats *stats);
+
+#endif
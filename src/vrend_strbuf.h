@@ -27,8 +27,10 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "util/u_math.h"
 
 #include "vrend_debug.h"
@@ -42,6 +44,10 @@ struct vrend_strbuf {
    /* size of string stored without terminating NULL */
    size_t size;
    bool error_state;
+   /* buf is not owned by the strbuf, it is moved to the heap on growth */
+   bool external;
+   /* non zero for placeholders that are filled in after the translation */
+   uint32_t tag;
 };
 
 static inline void strbuf_set_error(struct vrend_strbuf *sb)
@@ -61,7 +67,8 @@ static inline size_t strbuf_get_len(struct vrend_strbuf *sb)
 
 static inline void strbuf_free(struct vrend_strbuf *sb)
 {
-   free(sb->buf);
+   if (!sb->external)
+      free(sb->buf);
 }
 
 static inline bool strbuf_alloc(struct vrend_strbuf *sb, int initial_size)
@@ -72,26 +79,49 @@ static inline bool strbuf_alloc(struct vrend_strbuf *sb, int initial_size)
    sb->alloc_size = initial_size;
    sb->buf[0] = 0;
    sb->error_state = false;
+   sb->external = false;
+   sb->tag = 0;
    sb->size = 0;
    return true;
 }
 
+/* use storage owned by the caller, e.g. scratch memory */
+static inline void strbuf_init_external(struct vrend_strbuf *sb, char *buf, size_t size)
+{
+   sb->buf = buf;
+   sb->alloc_size = size;
+   sb->buf[0] = 0;
+   sb->error_state = false;
+   sb->external = true;
+   sb->tag = 0;
+   sb->size = 0;
+}
+
 /* this might need tuning */
 #define STRBUF_MIN_MALLOC 1024
 
 static inline bool strbuf_grow(struct vrend_strbuf *sb, int len)
 {
    if (sb->size + len + 1 > sb->alloc_size) {
-      /* Reallocate to the larger size of current alloc + min realloc,
-       * or the resulting string size if larger.
+      /* Grow geometrically so that appending stays linear overall, by at
+       * least the min realloc, or to the resulting string size if larger.
        */
-      size_t new_size = MAX2(sb->size + len + 1, sb->alloc_size + STRBUF_MIN_MALLOC);
-      char *new = realloc(sb->buf, new_size);
+      size_t new_size = MAX2(sb->size + len + 1,
+                             MAX2(sb->alloc_size * 2, sb->alloc_size + STRBUF_MIN_MALLOC));
+      char *new;
+
+      if (sb->external) {
+         new = malloc(new_size);
+         if (new)
+            memcpy(new, sb->buf, sb->size + 1);
+      } else
+         new = realloc(sb->buf, new_size);
       if (!new) {
          strbuf_set_error(sb);
          return false;
       }
       sb->buf = new;
+      sb->external = false;
       sb->alloc_size = new_size;
    }
    return true;
@@ -175,10 +205,24 @@ static inline bool strarray_alloc(struct vrend_strarray *sa, int init_alloc)
    return true;
 }
 
+static inline bool strarray_reserve(struct vrend_strarray *sa, int num_strings)
+{
+   struct vrend_strbuf *strings;
+
+   if (num_strings <= sa->num_alloced_strings)
+      return true;
+   strings = realloc(sa->strings, num_strings * sizeof(struct vrend_strbuf));
+   if (!strings)
+      return false;
+   sa->strings = strings;
+   sa->num_alloced_strings = num_strings;
+   return true;
+}
+
 static inline bool strarray_addstrbuf(struct vrend_strarray *sa, struct vrend_strbuf *sb)
 {
-   assert(sa->num_strings < sa->num_alloced_strings);
-   if (sa->num_strings >= sa->num_alloced_strings)
+   if (sa->num_strings >= sa->num_alloced_strings &&
+       !strarray_reserve(sa, MAX2(sa->num_alloced_strings * 2, 4)))
       return false;
    sa->strings[sa->num_strings] = *sb;
    sa->num_strings++;
@@ -200,17 +244,238 @@ static inline void strarray_dump(struct vrend_strarray *sa)
       vrend_printf("%s", sa->strings[i].buf);
 }
 
+/* lines may continue from one string into the next */
 static inline void strarray_dump_with_line_numbers(struct vrend_strarray *sa)
 {
    int lineno = 1;
+   bool line_start = true;
+
    for (int i = 0; i < sa->num_strings; i++) {
-      char *saveptr;
-      char *line = strtok_r(sa->strings[i].buf, "\n", &saveptr);
-      while (line) {
-         vrend_printf("%4d: %s\n", lineno++, line);
-         line = strtok_r(NULL, "\n", &saveptr);
+      const char *str = sa->strings[i].buf;
+
+      while (*str) {
+         const char *nl = strchr(str, '\n');
+         int len = nl ? nl - str + 1 : (int)strlen(str);
+
+         if (line_start)
+            vrend_printf("%4d: ", lineno++);
+         vrend_printf("%.*s", len, str);
+         line_start = nl != NULL;
+         str += len;
+      }
+   }
+   if (!line_start)
+      vrend_printf("\n");
+}
+
+/* Shader source built as a list of segments that are handed to
+ * glShaderSource as separate strings, so text that was written once is
+ * never copied again. Segments are carved out of chunks that double in
+ * size, the first segment of a chunk owns it and the others are external
+ * strbufs pointing into it. Placeholders get a segment of their own with
+ * a non zero tag, so they can be overwritten in place after the
+ * translation without searching the text.
+ */
+#define ROPE_INLINE_SEGS 16
+#define ROPE_MAX_CHUNK (64 * 1024)
+
+struct vrend_rope {
+   struct vrend_strbuf *segs;
+   int num_segs;
+   int alloc_segs;
+   size_t chunk_size;
+   bool error_state;
+   struct vrend_strbuf inline_segs[ROPE_INLINE_SEGS];
+};
+
+static inline void rope_set_error(struct vrend_rope *rope)
+{
+   rope->error_state = true;
+}
+
+static inline bool rope_get_error(struct vrend_rope *rope)
+{
+   return rope->error_state;
+}
+
+static inline struct vrend_strbuf *rope_tail(struct vrend_rope *rope)
+{
+   return &rope->segs[rope->num_segs - 1];
+}
+
+static inline struct vrend_strbuf *rope_add_seg(struct vrend_rope *rope)
+{
+   if (rope->num_segs == rope->alloc_segs) {
+      int alloc_segs = rope->alloc_segs * 2;
+      struct vrend_strbuf *segs;
+
+      if (rope->segs == rope->inline_segs) {
+         segs = malloc(alloc_segs * sizeof(struct vrend_strbuf));
+         if (segs)
+            memcpy(segs, rope->segs, rope->num_segs * sizeof(struct vrend_strbuf));
+      } else
+         segs = realloc(rope->segs, alloc_segs * sizeof(struct vrend_strbuf));
+      if (!segs) {
+         rope_set_error(rope);
+         return NULL;
       }
+      rope->segs = segs;
+      rope->alloc_segs = alloc_segs;
    }
+   return &rope->segs[rope->num_segs++];
+}
+
+/* starts a segment at the end of the tail, in the space it does not use */
+static inline bool rope_split(struct vrend_rope *rope, size_t size)
+{
+   struct vrend_strbuf *tail = rope_tail(rope);
+   char *buf = tail->buf + tail->size + 1;
+   size_t avail = tail->alloc_size - tail->size - 1;
+   struct vrend_strbuf *sb;
+
+   assert(avail >= size);
+   sb = rope_add_seg(rope);
+   if (!sb)
+      return false;
+   rope_tail(rope)[-1].alloc_size -= avail;
+   strbuf_init_external(sb, buf, avail);
+   return true;
+}
+
+static inline bool rope_add_chunk(struct vrend_rope *rope, size_t min_size)
+{
+   size_t size = MAX2(rope->chunk_size, min_size);
+   struct vrend_strbuf *sb = rope_add_seg(rope);
+
+   if (!sb)
+      return false;
+   if (!strbuf_alloc(sb, size)) {
+      rope->num_segs--;
+      rope_set_error(rope);
+      return false;
+   }
+   rope->chunk_size = MIN2(size * 2, ROPE_MAX_CHUNK);
+   return true;
+}
+
+static inline bool rope_init(struct vrend_rope *rope, size_t initial_size)
+{
+   rope->segs = rope->inline_segs;
+   rope->num_segs = 0;
+   rope->alloc_segs = ROPE_INLINE_SEGS;
+   rope->chunk_size = initial_size;
+   rope->error_state = false;
+   return rope_add_chunk(rope, initial_size);
+}
+
+static inline void rope_free(struct vrend_rope *rope)
+{
+   for (int i = 0; i < rope->num_segs; i++)
+      strbuf_free(&rope->segs[i]);
+   if (rope->segs != rope->inline_segs)
+      free(rope->segs);
+   rope->segs = rope->inline_segs;
+   rope->num_segs = 0;
+}
+
+static inline void rope_append_buffer(struct vrend_rope *rope, const char *data, size_t len)
+{
+   struct vrend_strbuf *tail;
+
+   assert(!memchr(data, '\0', len));
+   if (rope_get_error(rope))
+      return;
+   tail = rope_tail(rope);
+   if (tail->size + len + 1 > tail->alloc_size) {
+      if (!rope_add_chunk(rope, len + 1))
+         return;
+      tail = rope_tail(rope);
+   }
+   memcpy(tail->buf + tail->size, data, len);
+   tail->size += len;
+   tail->buf[tail->size] = '\0';
+}
+
+static inline void rope_append(struct vrend_rope *rope, const char *str)
+{
+   rope_append_buffer(rope, str, strlen(str));
+}
+
+/* formats straight into the tail, only text that does not fit into the
+ * current chunk is formatted a second time */
+static inline void rope_vappendf(struct vrend_rope *rope, const char *fmt, va_list ap)
+{
+   struct vrend_strbuf *tail;
+   size_t avail;
+   va_list cp;
+   int len;
+
+   if (rope_get_error(rope))
+      return;
+   tail = rope_tail(rope);
+   avail = tail->alloc_size - tail->size;
+
+   va_copy(cp, ap);
+   len = vsnprintf(tail->buf + tail->size, avail, fmt, ap);
+   if (len < 0) {
+      tail->buf[tail->size] = '\0';
+      rope_set_error(rope);
+   } else if ((size_t)len >= avail) {
+      tail->buf[tail->size] = '\0';
+      if (rope_add_chunk(rope, len + 1)) {
+         tail = rope_tail(rope);
+         vsnprintf(tail->buf, tail->alloc_size, fmt, cp);
+         tail->size = len;
+      }
+   } else
+      tail->size += len;
+   va_end(cp);
+}
+
+__attribute__((format(printf, 2, 3)))
+static inline void rope_appendf(struct vrend_rope *rope, const char *fmt, ...)
+{
+   va_list va;
+   va_start(va, fmt);
+   rope_vappendf(rope, fmt, va);
+   va_end(va);
+}
+
+/* adds len spaces in a segment of their own, followed by a new tail */
+static inline void rope_add_placeholder(struct vrend_rope *rope, size_t len, uint32_t tag)
+{
+   struct vrend_strbuf *tail;
+
+   assert(tag);
+   if (rope_get_error(rope))
+      return;
+   tail = rope_tail(rope);
+   if (tail->size + len + 3 > tail->alloc_size &&
+       !rope_add_chunk(rope, len + 3))
+      return;
+   if (!rope_split(rope, len + 2))
+      return;
+
+   tail = rope_tail(rope);
+   memset(tail->buf, ' ', len);
+   tail->buf[len] = '\0';
+   tail->size = len;
+   tail->tag = tag;
+   rope_split(rope, 1);
+}
+
+/* moves the segments to the end of sa, the rope is empty afterwards */
+static inline bool rope_move_to_strarray(struct vrend_rope *rope, struct vrend_strarray *sa)
+{
+   if (rope_get_error(rope) ||
+       !strarray_reserve(sa, sa->num_strings + rope->num_segs))
+      return false;
+   memcpy(sa->strings + sa->num_strings, rope->segs,
+          rope->num_segs * sizeof(struct vrend_strbuf));
+   sa->num_strings += rope->num_segs;
+   rope->num_segs = 0;
+   rope_free(rope);
+   return true;
 }
 
 
@@ -0,0 +1,304 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include "pipe/p_defines.h"
+#include "tgsi/tgsi_info.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_sanity.h"
+
+#include "vrend_tgsi_validate.h"
+
+struct validate_ctx {
+   const struct tgsi_token *tokens;
+   uint32_t pos;
+   uint32_t end;
+};
+
+static const unsigned shader_processor[PIPE_SHADER_TYPES] = {
+   [PIPE_SHADER_VERTEX] = TGSI_PROCESSOR_VERTEX,
+   [PIPE_SHADER_FRAGMENT] = TGSI_PROCESSOR_FRAGMENT,
+   [PIPE_SHADER_GEOMETRY] = TGSI_PROCESSOR_GEOMETRY,
+   [PIPE_SHADER_TESS_CTRL] = TGSI_PROCESSOR_TESS_CTRL,
+   [PIPE_SHADER_TESS_EVAL] = TGSI_PROCESSOR_TESS_EVAL,
+   [PIPE_SHADER_COMPUTE] = TGSI_PROCESSOR_COMPUTE,
+};
+
+static bool next_token(struct validate_ctx *ctx, void *token)
+{
+   if (ctx->pos >= ctx->end)
+      return false;
+   memcpy(token, &ctx->tokens[ctx->pos++], sizeof(struct tgsi_token));
+   return true;
+}
+
+static bool validate_declaration(struct validate_ctx *ctx)
+{
+   struct tgsi_declaration decl;
+   struct tgsi_declaration_range range;
+   uint32_t start = ctx->pos;
+   uint32_t token;
+
+   if (!next_token(ctx, &decl) || !next_token(ctx, &range))
+      return false;
+
+   if (decl.File >= TGSI_FILE_COUNT || range.First > range.Last)
+      return false;
+   if (decl.File == TGSI_FILE_MEMORY && decl.MemType >= TGSI_MEMORY_TYPE_COUNT)
+      return false;
+
+   if (decl.Dimension && !next_token(ctx, &token))
+      return false;
+
+   if (decl.Interpolate) {
+      struct tgsi_declaration_interp interp;
+
+      if (!next_token(ctx, &interp))
+         return false;
+      if (interp.Interpolate >= TGSI_INTERPOLATE_COUNT ||
+          interp.Location >= TGSI_INTERPOLATE_LOC_COUNT)
+         return false;
+   }
+
+   if (decl.Semantic) {
+      struct tgsi_declaration_semantic semantic;
+
+      if (!next_token(ctx, &semantic))
+         return false;
+      if (semantic.Name >= TGSI_SEMANTIC_COUNT)
+         return false;
+   }
+
+   if (decl.File == TGSI_FILE_IMAGE) {
+      struct tgsi_declaration_image image;
+
+      if (!next_token(ctx, &image))
+         return false;
+      if (image.Resource >= TGSI_TEXTURE_COUNT)
+         return false;
+   }
+
+   if (decl.File == TGSI_FILE_SAMPLER_VIEW) {
+      struct tgsi_declaration_sampler_view view;
+
+      if (!next_token(ctx, &view))
+         return false;
+      if (view.Resource >= TGSI_TEXTURE_COUNT ||
+          view.ReturnTypeX >= TGSI_RETURN_TYPE_COUNT ||
+          view.ReturnTypeY >= TGSI_RETURN_TYPE_COUNT ||
+          view.ReturnTypeZ >= TGSI_RETURN_TYPE_COUNT ||
+          view.ReturnTypeW >= TGSI_RETURN_TYPE_COUNT)
+         return false;
+   }
+
+   if (decl.Array && !next_token(ctx, &token))
+      return false;
+
+   return decl.NrTokens == ctx->pos - start;
+}
+
+static bool validate_immediate(struct validate_ctx *ctx)
+{
+   struct tgsi_immediate imm;
+   uint32_t token;
+
+   if (!next_token(ctx, &imm))
+      return false;
+
+   if (imm.DataType > TGSI_IMM_FLOAT64)
+      return false;
+   if (imm.NrTokens < 2 || imm.NrTokens - 1 > 4)
+      return false;
+
+   for (unsigned i = 0; i < imm.NrTokens - 1u; i++) {
+      if (!next_token(ctx, &token))
+         return false;
+   }
+   return true;
+}
+
+static bool validate_register(struct validate_ctx *ctx, unsigned file,
+                              bool indirect, bool dimension)
+{
+   struct tgsi_ind_register ind;
+   struct tgsi_dimension dim;
+
+   if (file >= TGSI_FILE_COUNT)
+      return false;
+
+   if (indirect) {
+      if (!next_token(ctx, &ind) || ind.File >= TGSI_FILE_COUNT)
+         return false;
+   }
+
+   if (dimension) {
+      /* tgsi_parse only handles one extra dimension */
+      if (!next_token(ctx, &dim) || dim.Dimension)
+         return false;
+      if (dim.Indirect) {
+         if (!next_token(ctx, &ind) || ind.File >= TGSI_FILE_COUNT)
+            return false;
+      }
+   }
+   return true;
+}
+
+static bool validate_instruction(struct validate_ctx *ctx)
+{
+   const struct tgsi_opcode_info *info;
+   struct tgsi_instruction inst;
+   uint32_t start = ctx->pos;
+   uint32_t token;
+
+   if (!next_token(ctx, &inst))
+      return false;
+
+   /* removed opcodes have no mnemonic and could never be sent as text */
+   info = tgsi_get_opcode_info(inst.Opcode);
+   if (!info || !info->mnemonic || !info->mnemonic[0])
+      return false;
+   if (inst.NumDstRegs != info->num_dst || inst.NumSrcRegs != info->num_src)
+      return false;
+   if (info->is_tex && !inst.Texture)
+      return false;
+
+   if (inst.Label && !next_token(ctx, &token))
+      return false;
+
+   if (inst.Texture) {
+      struct tgsi_instruction_texture texture;
+      struct tgsi_texture_offset offset;
+
+      if (!next_token(ctx, &texture))
+         return false;
+      if (texture.Texture >= TGSI_TEXTURE_COUNT ||
+          texture.NumOffsets > TGSI_FULL_MAX_TEX_OFFSETS)
+         return false;
+
+      for (unsigned i = 0; i < texture.NumOffsets; i++) {
+         if (!next_token(ctx, &offset) || offset.File >= TGSI_FILE_COUNT)
+            return false;
+      }
+   }
+
+   if (inst.Memory) {
+      struct tgsi_instruction_memory memory;
+
+      if (!next_token(ctx, &memory) || memory.Texture >= TGSI_TEXTURE_COUNT)
+         return false;
+   }
+
+   for (unsigned i = 0; i < inst.NumDstRegs; i++) {
+      struct tgsi_dst_register dst;
+
+      if (!next_token(ctx, &dst) ||
+          !validate_register(ctx, dst.File, dst.Indirect, dst.Dimension))
+         return false;
+   }
+
+   for (unsigned i = 0; i < inst.NumSrcRegs; i++) {
+      struct tgsi_src_register src;
+
+      if (!next_token(ctx, &src) ||
+          !validate_register(ctx, src.File, src.Indirect, src.Dimension))
+         return false;
+   }
+
+   /* tgsi_build does not count the instruction token itself */
+   return inst.NrTokens == ctx->pos - start - 1;
+}
+
+static bool validate_property(struct validate_ctx *ctx)
+{
+   struct tgsi_property prop;
+   uint32_t token;
+
+   if (!next_token(ctx, &prop))
+      return false;
+
+   if (prop.PropertyName >= TGSI_PROPERTY_COUNT)
+      return false;
+   if (prop.NrTokens < 1 || prop.NrTokens - 1 > 8)
+      return false;
+
+   for (unsigned i = 0; i < prop.NrTokens - 1u; i++) {
+      if (!next_token(ctx, &token))
+         return false;
+   }
+   return true;
+}
+
+bool vrend_tgsi_validate(const struct tgsi_token *tokens, uint32_t num_tokens,
+                         uint32_t shader_type)
+{
+   struct validate_ctx ctx;
+   struct tgsi_header header;
+   struct tgsi_processor processor;
+
+   if (shader_type >= PIPE_SHADER_TYPES || num_tokens < 2)
+      return false;
+
+   memcpy(&header, &tokens[0], sizeof(header));
+   memcpy(&processor, &tokens[1], sizeof(processor));
+
+   if (header.HeaderSize < 2 ||
+       (uint64_t)header.HeaderSize + header.BodySize > num_tokens)
+      return false;
+   if (processor.Processor != shader_processor[shader_type])
+      return false;
+
+   ctx.tokens = tokens;
+   ctx.pos = header.HeaderSize;
+   ctx.end = header.HeaderSize + header.BodySize;
+
+   while (ctx.pos < ctx.end) {
+      struct tgsi_token token;
+      bool ret;
+
+      memcpy(&token, &tokens[ctx.pos], sizeof(token));
+      switch (token.Type) {
+      case TGSI_TOKEN_TYPE_DECLARATION:
+         ret = validate_declaration(&ctx);
+         break;
+      case TGSI_TOKEN_TYPE_IMMEDIATE:
+         ret = validate_immediate(&ctx);
+         break;
+      case TGSI_TOKEN_TYPE_INSTRUCTION:
+         ret = validate_instruction(&ctx);
+         break;
+      case TGSI_TOKEN_TYPE_PROPERTY:
+         ret = validate_property(&ctx);
+         break;
+      default:
+         ret = false;
+      }
+      if (!ret)
+         return false;
+   }
+
+   /* the same checks tgsi_text_translate finishes with */
+   return tgsi_sanity_check(tokens);
+}
@@ -0,0 +1,46 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef VREND_TGSI_VALIDATE_H
+#define VREND_TGSI_VALIDATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pipe/p_shader_tokens.h"
+
+/* Check shader tokens sent by the guest in binary form.
+ *
+ * The tokens must be walkable by tgsi_parse without reading past
+ * num_tokens, and may only contain what tgsi_text_translate could have
+ * produced for a shader of the given PIPE_SHADER_x type: known opcodes
+ * with their fixed operand counts, and register files, semantics,
+ * properties and texture targets in range. Like for text shaders,
+ * tgsi_sanity_check has to pass as well.
+ */
+bool vrend_tgsi_validate(const struct tgsi_token *tokens, uint32_t num_tokens,
+                         uint32_t shader_type);
+
+#endif
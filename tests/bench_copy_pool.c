@@ -0,0 +1,112 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Measures how fast a large transfer moves between a linear buffer and a
+ * guest style iovec, made of 2 MiB segments, for an increasing number of
+ * copy threads, and checks the copied bytes. Throughput is in GB/s.
+ *
+ * usage: bench_copy_pool [iterations] [size in MiB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "vrend_copy_pool.h"
+#include "vrend_iov.h"
+#include "vrend_simd.h"
+#include "bench_util.h"
+
+#define SEGMENT_SIZE (2 * 1024 * 1024)
+
+int main(int argc, char **argv)
+{
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 10;
+   size_t size = (argc > 2 ? atoi(argv[2]) : 64) * 1024 * 1024;
+   int max_threads, num_threads, num_iovs, i;
+   struct iovec *iovs;
+   uint8_t *buf, *guest, *check;
+   unsigned it;
+   double start, read_ns, write_ns;
+   int failed = 0;
+
+   vrend_simd_init(NULL);
+   max_threads = MIN2(util_cpu_caps.nr_cpus, VREND_COPY_POOL_MAX_THREADS);
+
+   num_iovs = (size + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+   iovs = calloc(num_iovs, sizeof(*iovs));
+   buf = malloc(size);
+   guest = malloc(size);
+   check = malloc(size);
+   if (!iovs || !buf || !guest || !check)
+      return EXIT_FAILURE;
+
+   /* hand the segments out in reverse, guest pages are rarely in order */
+   for (i = 0; i < num_iovs; i++) {
+      size_t offset = (size_t)(num_iovs - 1 - i) * SEGMENT_SIZE;
+      iovs[i].iov_base = guest + offset;
+      iovs[i].iov_len = MIN2(SEGMENT_SIZE, size - offset);
+   }
+   for (i = 0; i < (int)(size / 4); i++)
+      ((uint32_t *)buf)[i] = i * 2654435761u;
+   memset(guest, 0, size);
+
+   printf("%-8s %12s %12s\n", "threads", "write GB/s", "read GB/s");
+
+   for (num_threads = 0; num_threads < max_threads; num_threads++) {
+      vrend_copy_pool_init(num_threads, 0);
+
+      start = now_ns();
+      for (it = 0; it < iterations; it++)
+         vrend_write_to_iovec(iovs, num_iovs, 0, (const char *)buf, size);
+      write_ns = now_ns() - start;
+
+      memset(check, 0, size);
+      start = now_ns();
+      for (it = 0; it < iterations; it++)
+         vrend_read_from_iovec(iovs, num_iovs, 0, (char *)check, size);
+      read_ns = now_ns() - start;
+
+      printf("%-8d %12.2f %12.2f\n", num_threads + 1,
+             gbps(size, iterations, write_ns), gbps(size, iterations, read_ns));
+
+      vrend_copy_pool_fini();
+
+      if (memcmp(check, buf, size)) {
+         fprintf(stderr, "copy with %d threads corrupted the data\n",
+                 num_threads + 1);
+         failed = 1;
+         break;
+      }
+   }
+
+   free(iovs);
+   free(buf);
+   free(guest);
+   free(check);
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
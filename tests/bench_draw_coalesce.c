@@ -0,0 +1,272 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Measures how long the host takes to decode and execute a command
+ * buffer of small draws with nothing in between, the case where the
+ * decoder merges the draws into multi draw calls, with merging turned
+ * on and off through VREND_COALESCE_DRAWS.
+ *
+ * usage: bench_draw_coalesce [draws per submit] [submits]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <virglrenderer.h>
+
+#include "virgl_hw.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_state.h"
+#include "testvirgl_encode.h"
+#include "virgl_protocol.h"
+#include "bench_util.h"
+
+#define BENCH_WIDTH 256
+#define BENCH_HEIGHT 256
+
+struct vertex {
+   float position[4];
+};
+
+static void wait_fence(uint32_t fence_id)
+{
+   virgl_renderer_create_fence(fence_id, 1);
+   while (testvirgl_get_last_fence() < fence_id) {
+      virgl_renderer_poll();
+      nanosleep((struct timespec[]){{0, 10000}}, NULL);
+   }
+}
+
+static void setup_pipeline(struct virgl_context *ctx, struct virgl_resource *fb,
+                           struct virgl_resource *vbo, struct virgl_resource *ibo,
+                           unsigned num_draws)
+{
+   static const char *vs_text =
+      "VERT\n"
+      "DCL IN[0]\n"
+      "DCL OUT[0], POSITION\n"
+      "  0: MOV OUT[0], IN[0]\n"
+      "  1: END\n";
+   static const char *fs_text =
+      "FRAG\n"
+      "DCL OUT[0], COLOR\n"
+      "IMM[0] FLT32 { 1.0, 0.0, 0.0, 1.0 }\n"
+      "  0: MOV OUT[0], IMM[0]\n"
+      "  1: END\n";
+   struct pipe_framebuffer_state fb_state;
+   struct pipe_vertex_element ve;
+   struct pipe_vertex_buffer vbuf;
+   struct pipe_shader_state shader;
+   struct pipe_blend_state blend;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_rasterizer_state rs;
+   struct pipe_viewport_state vp;
+   struct virgl_surface surf;
+   struct virgl_box box;
+   struct vertex *verts;
+   uint16_t *indices;
+   uint32_t handle = 10;
+   unsigned i;
+
+   testvirgl_create_backed_simple_2d_res(fb, 1, BENCH_WIDTH, BENCH_HEIGHT);
+   virgl_renderer_ctx_attach_resource(ctx->ctx_id, fb->handle);
+
+   memset(&surf, 0, sizeof(surf));
+   surf.base.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+   surf.handle = handle++;
+   surf.base.texture = &fb->base;
+   virgl_encoder_create_surface(ctx, surf.handle, fb, &surf.base);
+   fb_state.nr_cbufs = 1;
+   fb_state.zsbuf = NULL;
+   fb_state.cbufs[0] = &surf.base;
+   virgl_encoder_set_framebuffer_state(ctx, &fb_state);
+
+   memset(&ve, 0, sizeof(ve));
+   ve.src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   virgl_encoder_create_vertex_elements(ctx, handle, 1, &ve);
+   virgl_encode_bind_object(ctx, handle++, VIRGL_OBJECT_VERTEX_ELEMENTS);
+
+   /* one small triangle per draw, and indices that walk through them */
+   verts = calloc(num_draws * 3, sizeof(*verts));
+   indices = calloc(num_draws * 3, sizeof(*indices));
+   for (i = 0; i < num_draws * 3; i++) {
+      float x = (float)(i / 3 % 64) / 32.0f - 1.0f;
+      float y = (float)(i / 3 / 64 % 64) / 32.0f - 1.0f;
+      verts[i].position[0] = x + (i % 3 == 1 ? 0.03f : 0.0f);
+      verts[i].position[1] = y + (i % 3 == 2 ? 0.03f : 0.0f);
+      verts[i].position[3] = 1.0f;
+      indices[i] = i % 3;
+   }
+
+   testvirgl_create_backed_simple_buffer(vbo, 2, num_draws * 3 * sizeof(*verts),
+                                         PIPE_BIND_VERTEX_BUFFER);
+   virgl_renderer_ctx_attach_resource(ctx->ctx_id, vbo->handle);
+   memcpy(vbo->iovs[0].iov_base, verts, num_draws * 3 * sizeof(*verts));
+   box.x = box.y = box.z = 0;
+   box.w = num_draws * 3 * sizeof(*verts);
+   box.h = box.d = 1;
+   virgl_renderer_transfer_write_iov(vbo->handle, ctx->ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+
+   testvirgl_create_backed_simple_buffer(ibo, 3, num_draws * 3 * sizeof(*indices),
+                                         PIPE_BIND_INDEX_BUFFER);
+   virgl_renderer_ctx_attach_resource(ctx->ctx_id, ibo->handle);
+   memcpy(ibo->iovs[0].iov_base, indices, num_draws * 3 * sizeof(*indices));
+   box.w = num_draws * 3 * sizeof(*indices);
+   virgl_renderer_transfer_write_iov(ibo->handle, ctx->ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+   free(verts);
+   free(indices);
+
+   vbuf.stride = sizeof(struct vertex);
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = &vbo->base;
+   virgl_encoder_set_vertex_buffers(ctx, 1, &vbuf);
+
+   memset(&shader, 0, sizeof(shader));
+   virgl_encode_shader_state(ctx, handle, PIPE_SHADER_VERTEX, &shader, vs_text);
+   virgl_encode_bind_shader(ctx, handle++, PIPE_SHADER_VERTEX);
+   virgl_encode_shader_state(ctx, handle, PIPE_SHADER_FRAGMENT, &shader, fs_text);
+   virgl_encode_bind_shader(ctx, handle++, PIPE_SHADER_FRAGMENT);
+
+   memset(&blend, 0, sizeof(blend));
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   virgl_encode_blend_state(ctx, handle, &blend);
+   virgl_encode_bind_object(ctx, handle++, VIRGL_OBJECT_BLEND);
+
+   memset(&dsa, 0, sizeof(dsa));
+   virgl_encode_dsa_state(ctx, handle, &dsa);
+   virgl_encode_bind_object(ctx, handle++, VIRGL_OBJECT_DSA);
+
+   memset(&rs, 0, sizeof(rs));
+   rs.cull_face = PIPE_FACE_NONE;
+   rs.half_pixel_center = 1;
+   rs.bottom_edge_rule = 1;
+   rs.depth_clip = 1;
+   virgl_encode_rasterizer_state(ctx, handle, &rs);
+   virgl_encode_bind_object(ctx, handle++, VIRGL_OBJECT_RASTERIZER);
+
+   vp.scale[0] = BENCH_WIDTH / 2.0f;
+   vp.scale[1] = BENCH_HEIGHT / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = BENCH_WIDTH / 2.0f;
+   vp.translate[1] = BENCH_HEIGHT / 2.0f;
+   vp.translate[2] = 0.5f;
+   virgl_encoder_set_viewport_states(ctx, 0, 1, &vp);
+
+   ctx->flush(ctx);
+}
+
+/* encode num_draws draws the way a guest driver does, indexed draws set
+ * the index buffer offset before each one */
+static void encode_draws(struct virgl_context *ctx, struct virgl_resource *ibo,
+                         unsigned num_draws, bool indexed)
+{
+   struct pipe_draw_info info;
+   struct pipe_index_buffer ib;
+   unsigned i;
+
+   memset(&info, 0, sizeof(info));
+   info.mode = PIPE_PRIM_TRIANGLES;
+   info.count = 3;
+   info.indexed = indexed;
+   info.max_index = ~0u;
+
+   ib.index_size = 2;
+   ib.buffer = &ibo->base;
+   ib.user_buffer = NULL;
+
+   for (i = 0; i < num_draws; i++) {
+      if (indexed) {
+         ib.offset = i * 3 * sizeof(uint16_t);
+         info.index_bias = i * 3;
+         virgl_encoder_set_index_buffer(ctx, &ib);
+      } else {
+         info.start = i * 3;
+      }
+      virgl_encoder_draw_vbo(ctx, &info);
+   }
+}
+
+static double run(bool coalesce, bool indexed, unsigned num_draws, unsigned num_submits)
+{
+   struct virgl_context ctx;
+   struct virgl_resource fb, vbo, ibo;
+   uint32_t *cmds;
+   unsigned ndw, i;
+   double start, elapsed;
+
+   setenv("VREND_COALESCE_DRAWS", coalesce ? "true" : "false", 1);
+   if (testvirgl_init_ctx_cmdbuf(&ctx))
+      exit(1);
+
+   setup_pipeline(&ctx, &fb, &vbo, &ibo, num_draws);
+
+   /* encode once and keep a copy, so only the host side is measured */
+   encode_draws(&ctx, &ibo, num_draws, indexed);
+   ndw = ctx.cbuf->cdw;
+   cmds = malloc(ndw * 4);
+   memcpy(cmds, ctx.cbuf->buf, ndw * 4);
+   ctx.cbuf->cdw = 0;
+
+   testvirgl_reset_fence();
+   virgl_renderer_submit_cmd(cmds, ctx.ctx_id, ndw);
+   wait_fence(1);
+
+   start = now_ns();
+   for (i = 0; i < num_submits; i++)
+      virgl_renderer_submit_cmd(cmds, ctx.ctx_id, ndw);
+   wait_fence(2);
+   elapsed = now_ns() - start;
+
+   free(cmds);
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, fb.handle);
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, vbo.handle);
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, ibo.handle);
+   testvirgl_destroy_backed_res(&ibo);
+   testvirgl_destroy_backed_res(&vbo);
+   testvirgl_destroy_backed_res(&fb);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+
+   return elapsed / ((double)num_draws * num_submits);
+}
+
+int main(int argc, char **argv)
+{
+   unsigned num_draws = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+   unsigned num_submits = argc > 2 ? strtoul(argv[2], NULL, 0) : 100;
+   int indexed;
+
+   /* a set index buffer and a draw take 17 dwords, keep one submit */
+   if (!num_draws || !num_submits || num_draws * 17 > VIRGL_MAX_CMDBUF_DWORDS)
+      return 1;
+
+   printf("%8s %14s %14s\n", "", "separate ns", "merged ns");
+   for (indexed = 0; indexed < 2; indexed++) {
+      double separate = run(false, indexed, num_draws, num_submits);
+      double merged = run(true, indexed, num_draws, num_submits);
+      printf("%8s %14.1f %14.1f\n", indexed ? "indexed" : "arrays", separate, merged);
+   }
+   return 0;
+}
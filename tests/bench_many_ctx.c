@@ -0,0 +1,89 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Measures the cost of creating, submitting to and destroying contexts
+ * when a few thousand of them with sparse ids have been alive, the case
+ * the context lookup has to stay fast for.
+ *
+ * usage: bench_many_ctx [contexts] [contexts alive at once]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <virglrenderer.h>
+
+#include "testvirgl.h"
+#include "bench_util.h"
+
+/* context 1 is the one created by testvirgl_init_single_ctx */
+static uint32_t ctx_id(unsigned i)
+{
+   return i * 97 + 2;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned num_ctx = argc > 1 ? strtoul(argv[1], NULL, 0) : 4096;
+   unsigned batch = argc > 2 ? strtoul(argv[2], NULL, 0) : 128;
+   double create_ns = 0, submit_ns = 0, destroy_ns = 0, start;
+   uint32_t cmd = 0;
+   unsigned i, j;
+
+   if (!num_ctx || !batch)
+      return 1;
+
+   if (testvirgl_init_single_ctx())
+      return 1;
+
+   for (i = 0; i < num_ctx; i += batch) {
+      unsigned end = i + batch < num_ctx ? i + batch : num_ctx;
+
+      start = now_ns();
+      for (j = i; j < end; j++) {
+         if (virgl_renderer_context_create(ctx_id(j), strlen("bench"), "bench"))
+            return 1;
+      }
+      create_ns += now_ns() - start;
+
+      start = now_ns();
+      for (j = i; j < end; j++)
+         virgl_renderer_submit_cmd(&cmd, ctx_id(j), 0);
+      submit_ns += now_ns() - start;
+
+      start = now_ns();
+      for (j = i; j < end; j++)
+         virgl_renderer_context_destroy(ctx_id(j));
+      destroy_ns += now_ns() - start;
+   }
+
+   printf("%u contexts, %u alive at once\n", num_ctx, batch);
+   printf("%10s %10s %10s\n", "create us", "submit us", "destroy us");
+   printf("%10.1f %10.2f %10.1f\n", create_ns / 1000.0 / num_ctx,
+          submit_ns / 1000.0 / num_ctx, destroy_ns / 1000.0 / num_ctx);
+
+   testvirgl_fini_single_ctx();
+   return 0;
+}
@@ -0,0 +1,195 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Compares the handle indexed object tables against the util_hash_table
+ * with one wrapper allocation per object they replaced, for the patterns
+ * a guest produces: filling a context with objects, looking them up while
+ * drawing, churning through new handles and tearing everything down.
+ * Numbers are millions of operations per second.
+ *
+ * usage: bench_object_table [objects] [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "util/u_hash_table.h"
+#include "util/u_memory.h"
+#include "util/u_pointer.h"
+
+#include "vrend_object.h"
+#include "bench_util.h"
+
+static double mops(unsigned ops, double ns)
+{
+   return ops * 1e3 / ns;
+}
+
+/* the previous implementation */
+struct hash_object {
+   enum virgl_object_type type;
+   uint32_t handle;
+   void *data;
+};
+
+static unsigned hash_func(void *key)
+{
+   return (unsigned)(pointer_to_intptr(key) & 0xffffffff);
+}
+
+static int compare(void *key1, void *key2)
+{
+   return key1 < key2 ? -1 : key1 > key2 ? 1 : 0;
+}
+
+static void free_hash_object(void *value)
+{
+   FREE(value);
+}
+
+static void hash_insert(struct util_hash_table *hash, uint32_t handle, void *data)
+{
+   struct hash_object *obj = CALLOC_STRUCT(hash_object);
+
+   obj->handle = handle;
+   obj->data = data;
+   obj->type = VIRGL_OBJECT_SURFACE;
+   util_hash_table_set(hash, intptr_to_pointer(handle), obj);
+}
+
+static void *hash_lookup(struct util_hash_table *hash, uint32_t handle)
+{
+   struct hash_object *obj = util_hash_table_get(hash, intptr_to_pointer(handle));
+
+   if (!obj || obj->type != VIRGL_OBJECT_SURFACE)
+      return NULL;
+   return obj->data;
+}
+
+static void *handle_data(uint32_t handle)
+{
+   return intptr_to_pointer((intptr_t)handle * 16 + 16);
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+   *state = *state * 1664525u + 1013904223u;
+   return *state >> 8;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned num_objects = argc > 1 ? atoi(argv[1]) : 4096;
+   unsigned num_lookups = argc > 2 ? atoi(argv[2]) : 10000000;
+   struct util_hash_table *hash;
+   struct vrend_object_table *table;
+   uint32_t rnd, h;
+   unsigned i;
+   double start, insert_ns[2], lookup_ns[2], churn_ns[2], destroy_ns[2];
+   int failed = 0;
+
+   if (!num_objects)
+      return EXIT_FAILURE;
+
+   /* util_hash_table */
+   hash = util_hash_table_create(hash_func, compare, free_hash_object);
+   start = now_ns();
+   for (h = 1; h <= num_objects; h++)
+      hash_insert(hash, h, handle_data(h));
+   insert_ns[0] = now_ns() - start;
+
+   rnd = 1;
+   start = now_ns();
+   for (i = 0; i < num_lookups; i++) {
+      h = next_random(&rnd) % num_objects + 1;
+      if (hash_lookup(hash, h) != handle_data(h))
+         failed = 1;
+   }
+   lookup_ns[0] = now_ns() - start;
+
+   /* handles keep growing, objects live for about num_objects creations */
+   start = now_ns();
+   for (h = num_objects + 1; h <= num_objects * 5; h++) {
+      hash_insert(hash, h, handle_data(h));
+      util_hash_table_remove(hash, intptr_to_pointer(h - num_objects));
+   }
+   churn_ns[0] = now_ns() - start;
+
+   start = now_ns();
+   util_hash_table_destroy(hash);
+   destroy_ns[0] = now_ns() - start;
+
+   /* vrend_object_table */
+   table = vrend_object_init_ctx_table();
+   start = now_ns();
+   for (h = 1; h <= num_objects; h++)
+      vrend_object_insert_nofree(table, handle_data(h), 0, h,
+                                 VIRGL_OBJECT_SURFACE, false);
+   insert_ns[1] = now_ns() - start;
+
+   rnd = 1;
+   start = now_ns();
+   for (i = 0; i < num_lookups; i++) {
+      h = next_random(&rnd) % num_objects + 1;
+      if (vrend_object_lookup(table, h, VIRGL_OBJECT_SURFACE) != handle_data(h))
+         failed = 1;
+   }
+   lookup_ns[1] = now_ns() - start;
+
+   start = now_ns();
+   for (h = num_objects + 1; h <= num_objects * 5; h++) {
+      vrend_object_insert_nofree(table, handle_data(h), 0, h,
+                                 VIRGL_OBJECT_SURFACE, false);
+      vrend_object_remove(table, h - num_objects, VIRGL_OBJECT_SURFACE);
+   }
+   churn_ns[1] = now_ns() - start;
+
+   for (h = 1; h <= num_objects * 4; h++) {
+      if (vrend_object_lookup(table, h, VIRGL_OBJECT_SURFACE))
+         failed = 1;
+   }
+   for (h = num_objects * 4 + 1; h <= num_objects * 5; h++) {
+      if (vrend_object_lookup(table, h, VIRGL_OBJECT_SURFACE) != handle_data(h) ||
+          vrend_object_lookup(table, h, VIRGL_OBJECT_SHADER))
+         failed = 1;
+   }
+
+   start = now_ns();
+   vrend_object_fini_ctx_table(table);
+   destroy_ns[1] = now_ns() - start;
+
+   printf("%-12s %10s %10s %10s %10s\n", "table", "insert", "lookup",
+          "churn", "destroy");
+   for (i = 0; i < 2; i++)
+      printf("%-12s %10.2f %10.2f %10.2f %10.2f\n",
+             i ? "object table" : "hash table",
+             mops(num_objects, insert_ns[i]), mops(num_lookups, lookup_ns[i]),
+             mops(num_objects * 4 * 2, churn_ns[i]), mops(num_objects, destroy_ns[i]));
+
+   if (failed)
+      fprintf(stderr, "object table returned wrong objects\n");
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
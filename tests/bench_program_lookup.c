@@ -0,0 +1,141 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Measures the cost of finding a linked program by its shader ids, for
+ * the program table and for the list walk it replaced, as the number of
+ * linked programs in a sub context grows.
+ *
+ * usage: bench_program_lookup [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util/u_double_list.h"
+#include "vrend_program_table.h"
+#include "bench_util.h"
+
+struct bench_program {
+   struct list_head head;
+   struct vrend_program_key key;
+};
+
+static struct bench_program *list_lookup(struct list_head *programs,
+                                         const struct vrend_program_key *key)
+{
+   struct bench_program *ent;
+   LIST_FOR_EACH_ENTRY(ent, programs, head) {
+      if (!memcmp(&ent->key, key, sizeof(*key)))
+         return ent;
+   }
+   return NULL;
+}
+
+/* pattern 0 repeats one program, 1 cycles over three, 2 is random */
+static void make_sequence(unsigned *seq, unsigned num_lookups,
+                          unsigned num_programs, int pattern)
+{
+   unsigned i;
+
+   for (i = 0; i < num_lookups; i++) {
+      switch (pattern) {
+      case 0:
+         seq[i] = num_programs - 1;
+         break;
+      case 1:
+         seq[i] = num_programs - 1 - (i % 3) % num_programs;
+         break;
+      default:
+         seq[i] = rand() % num_programs;
+         break;
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   static const char *pattern_names[] = { "same", "cycle3", "random" };
+   static const unsigned sizes[] = { 1, 8, 64, 512, 4096, 16384 };
+   unsigned num_lookups = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+   unsigned *seq = malloc(num_lookups * sizeof(*seq));
+   unsigned s, i;
+   int pattern;
+
+   if (!seq || !num_lookups)
+      return 1;
+
+   srand(1);
+   printf("%8s %8s %12s %12s\n", "programs", "pattern", "table ns", "list ns");
+
+   for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      unsigned num_programs = sizes[s];
+      struct bench_program *progs = calloc(num_programs, sizeof(*progs));
+      struct vrend_program_table *table = vrend_program_table_create();
+      struct list_head programs;
+
+      if (!progs || !table)
+         return 1;
+
+      list_inithead(&programs);
+      for (i = 0; i < num_programs; i++) {
+         /* shader ids as a guest allocates them, a few programs per vs */
+         progs[i].key.ids[PIPE_SHADER_VERTEX] = 1 + i / 4;
+         progs[i].key.ids[PIPE_SHADER_FRAGMENT] = 1 + num_programs + i;
+         list_addtail(&progs[i].head, &programs);
+         vrend_program_table_insert(table, &progs[i].key, &progs[i]);
+      }
+
+      for (pattern = 0; pattern < 3; pattern++) {
+         uintptr_t check = 0;
+         double start, table_ns, list_ns;
+
+         make_sequence(seq, num_lookups, num_programs, pattern);
+
+         start = now_ns();
+         for (i = 0; i < num_lookups; i++)
+            check += (uintptr_t)vrend_program_table_lookup(table, &progs[seq[i]].key);
+         table_ns = (now_ns() - start) / num_lookups;
+
+         start = now_ns();
+         for (i = 0; i < num_lookups; i++)
+            check -= (uintptr_t)list_lookup(&programs, &progs[seq[i]].key);
+         list_ns = (now_ns() - start) / num_lookups;
+
+         if (check) {
+            fprintf(stderr, "lookup mismatch\n");
+            return 1;
+         }
+         printf("%8u %8s %12.1f %12.1f\n", num_programs, pattern_names[pattern],
+                table_ns, list_ns);
+      }
+
+      vrend_program_table_destroy(table);
+      free(progs);
+   }
+
+   free(seq);
+   return 0;
+}
@@ -0,0 +1,464 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Measures the TGSI to GLSL translator on its own, without a GL context.
+ * Every shader of the corpus is converted with a set of host
+ * configurations (desktop GL and GLES) and with the shader key variants
+ * the renderer produces for it, and the vertex shaders are then patched
+ * against the fragment shaders like when a program gets linked.
+ * Reports microseconds and shaders per second, the bytes of GLSL emitted
+ * and the number of heap allocations per shader.
+ *
+ * The built in corpus can be replaced by files holding TGSI text, for
+ * example shaders dumped with VREND_DEBUG=tgsi.
+ *
+ * usage: bench_shader_translate [iterations] [shader.tgsi ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipe/p_defines.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_text.h"
+#include "util/u_memory.h"
+
+#include "vrend_shader.h"
+#include "large_shader.h"
+#include "shader_corpus.h"
+#include "bench_util.h"
+
+#define MAX_TOKENS (64 * 1024)
+
+#ifdef __GLIBC__
+/* count the allocations made by the translator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static bool count_allocs;
+static uint64_t num_allocs;
+
+void *malloc(size_t size)
+{
+   num_allocs += count_allocs;
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+   num_allocs += count_allocs;
+   return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+   num_allocs += count_allocs;
+   return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT 1
+#else
+static bool count_allocs;
+static uint64_t num_allocs;
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+struct bench_cfg {
+   const char *name;
+   struct vrend_shader_cfg cfg;
+};
+
+static const struct bench_cfg bench_cfgs[] = {
+   { "GL 3.3 core", { .glsl_version = 330, .max_draw_buffers = 8,
+                      .use_core_profile = true, .use_explicit_locations = true } },
+   { "GL 4.3 core", { .glsl_version = 430, .max_draw_buffers = 8,
+                      .use_core_profile = true, .use_explicit_locations = true,
+                      .has_arrays_of_arrays = true, .has_gpu_shader5 = true,
+                      .has_conservative_depth = true } },
+   { "GLES 3.0", { .glsl_version = 300, .max_draw_buffers = 4,
+                   .use_gles = true, .use_explicit_locations = true } },
+   { "GLES 3.1", { .glsl_version = 310, .max_draw_buffers = 8,
+                   .use_gles = true, .use_explicit_locations = true,
+                   .has_es31_compat = true } },
+};
+
+enum key_variant {
+   KEY_DEFAULT,
+   KEY_FLATSHADE,
+   KEY_ALPHA_TEST,
+   KEY_TWO_SIDE,
+   KEY_CLIP_PLANES,
+   KEY_COUNT,
+};
+
+static bool key_applies(enum key_variant variant, uint32_t type)
+{
+   switch (variant) {
+   case KEY_DEFAULT:
+      return true;
+   case KEY_FLATSHADE:
+   case KEY_ALPHA_TEST:
+   case KEY_TWO_SIDE:
+      return type == PIPE_SHADER_FRAGMENT;
+   case KEY_CLIP_PLANES:
+      return type == PIPE_SHADER_VERTEX || type == PIPE_SHADER_GEOMETRY;
+   default:
+      return false;
+   }
+}
+
+static void fill_key(struct vrend_shader_key *key, enum key_variant variant)
+{
+   memset(key, 0, sizeof(*key));
+   switch (variant) {
+   case KEY_FLATSHADE:
+      key->flatshade = true;
+      break;
+   case KEY_ALPHA_TEST:
+      key->add_alpha_test = true;
+      key->alpha_test = PIPE_FUNC_LESS;
+      key->alpha_ref_val = 0.5f;
+      break;
+   case KEY_TWO_SIDE:
+      key->color_two_side = true;
+      break;
+   case KEY_CLIP_PLANES:
+      key->clip_plane_enable = 0x3f;
+      break;
+   default:
+      break;
+   }
+}
+
+struct bench_shader {
+   const char *name;
+   struct tgsi_token *tokens;
+   uint32_t type;
+};
+
+struct bench_result {
+   unsigned shaders;
+   double ns;
+   uint64_t glsl_bytes;
+   uint64_t allocs;
+};
+
+static char *read_file(const char *path)
+{
+   FILE *f = fopen(path, "rb");
+   char *text;
+   long size;
+
+   if (!f)
+      return NULL;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   text = calloc(1, size + 1);
+   if (text && fread(text, 1, size, f) != (size_t)size) {
+      free(text);
+      text = NULL;
+   }
+   fclose(f);
+   return text;
+}
+
+static uint32_t shader_type(const struct tgsi_token *tokens)
+{
+   struct tgsi_parse_context parse;
+
+   tgsi_parse_init(&parse, tokens);
+   switch (parse.FullHeader.Processor.Processor) {
+   case TGSI_PROCESSOR_VERTEX: return PIPE_SHADER_VERTEX;
+   case TGSI_PROCESSOR_FRAGMENT: return PIPE_SHADER_FRAGMENT;
+   case TGSI_PROCESSOR_GEOMETRY: return PIPE_SHADER_GEOMETRY;
+   case TGSI_PROCESSOR_TESS_CTRL: return PIPE_SHADER_TESS_CTRL;
+   case TGSI_PROCESSOR_TESS_EVAL: return PIPE_SHADER_TESS_EVAL;
+   default: return PIPE_SHADER_COMPUTE;
+   }
+}
+
+static bool add_shader(struct bench_shader *shaders, unsigned *num_shaders,
+                       const char *name, const char *text)
+{
+   struct tgsi_token *tokens = CALLOC(MAX_TOKENS, sizeof(struct tgsi_token));
+   struct bench_shader *shader = &shaders[*num_shaders];
+
+   if (!tokens)
+      return false;
+   if (!tgsi_text_translate(text, tokens, MAX_TOKENS)) {
+      fprintf(stderr, "%s: failed to parse\n", name);
+      FREE(tokens);
+      return false;
+   }
+   shader->name = name;
+   shader->tokens = tokens;
+   shader->type = shader_type(tokens);
+   (*num_shaders)++;
+   return true;
+}
+
+static void free_sinfo(struct vrend_shader_info *sinfo)
+{
+   free(sinfo->sampler_arrays);
+   free(sinfo->image_arrays);
+   free(sinfo->interpinfo);
+   if (sinfo->so_names) {
+      for (unsigned i = 0; i < sinfo->so_info.num_outputs; i++)
+         free(sinfo->so_names[i]);
+      free(sinfo->so_names);
+   }
+}
+
+/* one translation like vrend_shader_select does it, the strings are
+ * kept in sa when it is not NULL */
+static bool convert(const struct bench_shader *shader, struct vrend_shader_cfg *cfg,
+                    struct vrend_shader_key *key, struct vrend_shader_info *sinfo,
+                    struct vrend_strarray *sa, struct bench_result *res)
+{
+   struct vrend_strarray strings;
+   double start;
+   bool ret;
+
+   memset(sinfo, 0, sizeof(*sinfo));
+
+   count_allocs = true;
+   start = now_ns();
+   ret = strarray_alloc(&strings, SHADER_MAX_STRINGS) &&
+         vrend_convert_shader(NULL, cfg, shader->tokens, 0, key, sinfo, &strings);
+   res->ns += now_ns() - start;
+   count_allocs = false;
+
+   if (!ret) {
+      strarray_free(&strings, true);
+      free_sinfo(sinfo);
+      return false;
+   }
+
+   for (int i = 0; i < strings.num_strings; i++)
+      res->glsl_bytes += strings.strings[i].size;
+   res->shaders++;
+
+   if (sa)
+      *sa = strings;
+   else
+      strarray_free(&strings, true);
+   return true;
+}
+
+static void print_result(const char *name, const char *variants,
+                         const struct bench_result *res)
+{
+   if (!res->shaders)
+      return;
+   printf("  %-24.24s %-10s %10.2f %10.0f", name, variants,
+          res->ns / res->shaders / 1e3, res->shaders * 1e9 / res->ns);
+   if (res->glsl_bytes)
+      printf(" %9.0f", (double)res->glsl_bytes / res->shaders);
+   else
+      printf(" %9s", "-");
+   if (HAVE_ALLOC_COUNT)
+      printf(" %9.1f\n", (double)res->allocs / res->shaders);
+   else
+      printf(" %9s\n", "n/a");
+}
+
+static bool bench_cfg(const struct bench_cfg *bcfg, const struct bench_shader *shaders,
+                      unsigned num_shaders, unsigned iterations)
+{
+   struct vrend_shader_cfg cfg = bcfg->cfg;
+   struct vrend_shader_key key;
+   struct vrend_shader_info sinfo;
+   struct bench_result total = {0};
+   bool ok = true;
+
+   printf("%s\n", bcfg->name);
+
+   for (unsigned s = 0; s < num_shaders; s++) {
+      struct bench_result res = {0};
+      char variants[16];
+      unsigned num_variants = 0;
+
+      for (unsigned v = 0; v < KEY_COUNT; v++) {
+         if (!key_applies(v, shaders[s].type))
+            continue;
+         fill_key(&key, v);
+         num_variants++;
+
+         for (unsigned i = 0; i < iterations; i++) {
+            uint64_t allocs = num_allocs;
+
+            if (!convert(&shaders[s], &cfg, &key, &sinfo, NULL, &res)) {
+               fprintf(stderr, "%s: %s failed to translate\n", bcfg->name,
+                       shaders[s].name);
+               ok = false;
+               break;
+            }
+            res.allocs += num_allocs - allocs;
+            free_sinfo(&sinfo);
+         }
+      }
+
+      snprintf(variants, sizeof(variants), "%u keys", num_variants);
+      print_result(shaders[s].name, variants, &res);
+      total.shaders += res.shaders;
+      total.ns += res.ns;
+      total.glsl_bytes += res.glsl_bytes;
+      total.allocs += res.allocs;
+   }
+   print_result("all shaders", "", &total);
+   return ok;
+}
+
+/* vrend_patch_vertex_shader_interpolants for every pair of vertex and
+ * fragment shader, the placeholders are overwritten in place so patching
+ * the same strings again does the same work */
+static bool bench_link(const struct bench_cfg *bcfg, const struct bench_shader *shaders,
+                       unsigned num_shaders, unsigned iterations)
+{
+   struct vrend_shader_cfg cfg = bcfg->cfg;
+   struct vrend_shader_key key;
+   struct bench_result res = {0};
+   bool ok = true;
+
+   fill_key(&key, KEY_DEFAULT);
+
+   for (unsigned v = 0; v < num_shaders && ok; v++) {
+      struct vrend_shader_info vs_info;
+      struct vrend_strarray vs_strings;
+      struct bench_result vs_res = {0};
+
+      if (shaders[v].type != PIPE_SHADER_VERTEX)
+         continue;
+      if (!convert(&shaders[v], &cfg, &key, &vs_info, &vs_strings, &vs_res))
+         return false;
+
+      for (unsigned f = 0; f < num_shaders && ok; f++) {
+         struct vrend_shader_info fs_info;
+         struct bench_result fs_res = {0};
+         double start;
+
+         if (shaders[f].type != PIPE_SHADER_FRAGMENT)
+            continue;
+         if (!convert(&shaders[f], &cfg, &key, &fs_info, NULL, &fs_res)) {
+            ok = false;
+            break;
+         }
+
+         for (unsigned flat = 0; flat < 2; flat++) {
+            uint64_t allocs = num_allocs;
+
+            count_allocs = true;
+            start = now_ns();
+            for (unsigned i = 0; i < iterations; i++) {
+               if (!vrend_patch_vertex_shader_interpolants(NULL, &cfg, &vs_strings,
+                                                           &vs_info, &fs_info, flat)) {
+                  ok = false;
+                  break;
+               }
+            }
+            res.ns += now_ns() - start;
+            count_allocs = false;
+            res.allocs += num_allocs - allocs;
+            res.shaders += iterations;
+         }
+         free_sinfo(&fs_info);
+      }
+
+      strarray_free(&vs_strings, true);
+      free_sinfo(&vs_info);
+   }
+
+   print_result("vs/fs interpolants", "per pair", &res);
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 100;
+   struct bench_shader *shaders;
+   char **texts = NULL;
+   unsigned num_shaders = 0;
+   bool ok = true;
+
+   if (!iterations)
+      return EXIT_FAILURE;
+
+   shaders = CALLOC(MAX2(argc, ARRAY_SIZE(shader_corpus) + 1), sizeof(*shaders));
+   if (!shaders)
+      return EXIT_FAILURE;
+
+   if (argc > 2) {
+      texts = CALLOC(argc, sizeof(char *));
+      if (!texts)
+         return EXIT_FAILURE;
+      for (int i = 2; i < argc; i++) {
+         texts[i] = read_file(argv[i]);
+         if (!texts[i]) {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            ok = false;
+            continue;
+         }
+         ok &= add_shader(shaders, &num_shaders, argv[i], texts[i]);
+      }
+   } else {
+      for (unsigned i = 0; i < ARRAY_SIZE(shader_corpus); i++)
+         ok &= add_shader(shaders, &num_shaders, shader_corpus[i].name,
+                          shader_corpus[i].text);
+      ok &= add_shader(shaders, &num_shaders, "large fs", large_frag);
+   }
+
+   /* warm up the caches and the allocator */
+   for (unsigned i = 0; i < num_shaders; i++) {
+      struct vrend_shader_cfg cfg = bench_cfgs[0].cfg;
+      struct vrend_shader_key key;
+      struct vrend_shader_info sinfo;
+      struct bench_result res = {0};
+
+      fill_key(&key, KEY_DEFAULT);
+      if (convert(&shaders[i], &cfg, &key, &sinfo, NULL, &res))
+         free_sinfo(&sinfo);
+   }
+
+   printf("  %-24s %-10s %10s %10s %9s %9s\n", "shader", "variants", "us",
+          "shaders/s", "GLSL B", "allocs");
+
+   for (unsigned c = 0; c < ARRAY_SIZE(bench_cfgs); c++) {
+      ok &= bench_cfg(&bench_cfgs[c], shaders, num_shaders, iterations);
+      ok &= bench_link(&bench_cfgs[c], shaders, num_shaders, iterations);
+   }
+
+   for (unsigned i = 0; i < num_shaders; i++)
+      FREE(shaders[i].tokens);
+   FREE(shaders);
+   if (texts) {
+      for (int i = 2; i < argc; i++)
+         free(texts[i]);
+      FREE(texts);
+   }
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
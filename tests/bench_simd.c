@@ -0,0 +1,117 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Compares the CPU kernels used around transfers, the scalar set against
+ * every SIMD set the host supports, and checks that they all produce the
+ * same bytes. Throughput is in GB/s of source data.
+ *
+ * usage: bench_simd [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vrend_simd.h"
+#include "bench_util.h"
+
+#define FRAME_WIDTH 1920
+#define FRAME_HEIGHT 1080
+
+int main(int argc, char **argv)
+{
+   static const size_t copy_sizes[] = { 4096, 1024 * 1024, 32 * 1024 * 1024 };
+   const struct vrend_simd_kernels *const *kernels;
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 20;
+   size_t frame_size = FRAME_WIDTH * FRAME_HEIGHT * 4;
+   size_t max_size = copy_sizes[2];
+   uint8_t *src, *dst, *ref;
+   unsigned num_kernels, k, s, i;
+   double start;
+   int failed = 0;
+
+   vrend_simd_init(NULL);
+   kernels = vrend_simd_get_kernels(&num_kernels);
+
+   src = malloc(max_size);
+   dst = malloc(max_size);
+   ref = malloc(max_size);
+   if (!src || !dst || !ref)
+      return EXIT_FAILURE;
+
+   for (i = 0; i < max_size / 4; i++)
+      ((uint32_t *)src)[i] = i * 2654435761u;
+
+   printf("%-8s %-20s %10s\n", "kernels", "operation", "GB/s");
+
+   for (k = 0; k < num_kernels; k++) {
+      const struct vrend_simd_kernels *kern = kernels[k];
+
+      for (s = 0; s < sizeof(copy_sizes) / sizeof(copy_sizes[0]); s++) {
+         char name[32];
+
+         start = now_ns();
+         for (i = 0; i < iterations; i++)
+            kern->copy(dst, src, copy_sizes[s]);
+         snprintf(name, sizeof(name), "copy %zu KiB", copy_sizes[s] / 1024);
+         printf("%-8s %-20s %10.2f\n", kern->name, name,
+                gbps(copy_sizes[s], iterations, now_ns() - start));
+         if (memcmp(dst, src, copy_sizes[s]))
+            failed = 1;
+      }
+
+      start = now_ns();
+      for (i = 0; i < iterations; i++)
+         kern->copy_flip(dst, FRAME_WIDTH * 4, src, FRAME_WIDTH * 4,
+                         FRAME_WIDTH * 4, FRAME_HEIGHT);
+      printf("%-8s %-20s %10.2f\n", kern->name, "flip 1080p",
+             gbps(frame_size, iterations, now_ns() - start));
+      kernels[0]->copy_flip(ref, FRAME_WIDTH * 4, src, FRAME_WIDTH * 4,
+                            FRAME_WIDTH * 4, FRAME_HEIGHT);
+      if (memcmp(dst, ref, frame_size))
+         failed = 1;
+
+      start = now_ns();
+      for (i = 0; i < iterations; i++)
+         kern->copy_scale_depth((uint32_t *)dst, (const uint32_t *)src,
+                                frame_size / 4, 256.0f);
+      printf("%-8s %-20s %10.2f\n", kern->name, "depth scale 1080p",
+             gbps(frame_size, iterations, now_ns() - start));
+      kernels[0]->copy_scale_depth((uint32_t *)ref, (const uint32_t *)src,
+                                   frame_size / 4, 256.0f);
+      if (memcmp(dst, ref, frame_size))
+         failed = 1;
+
+      if (failed) {
+         fprintf(stderr, "%s kernels differ from the scalar ones\n", kern->name);
+         break;
+      }
+   }
+
+   free(src);
+   free(dst);
+   free(ref);
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
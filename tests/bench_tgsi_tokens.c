@@ -0,0 +1,172 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/* Compares how long the host takes to take in a shader sent as TGSI text,
+ * which has to be parsed by tgsi_text_translate, against the same shader
+ * sent as binary tokens, which only have to pass vrend_tgsi_validate.
+ * Both include tgsi_sanity_check. Numbers are microseconds per shader.
+ *
+ * The built in corpus can be replaced by files holding TGSI text, for
+ * example shaders dumped with VREND_DEBUG=tgsi.
+ *
+ * usage: bench_tgsi_tokens [iterations] [shader.tgsi ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipe/p_defines.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_text.h"
+#include "util/u_memory.h"
+
+#include "vrend_tgsi_validate.h"
+#include "large_shader.h"
+#include "shader_corpus.h"
+#include "bench_util.h"
+
+#define MAX_TOKENS (64 * 1024)
+
+static char *read_file(const char *path)
+{
+   FILE *f = fopen(path, "rb");
+   char *text;
+   long size;
+
+   if (!f)
+      return NULL;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   text = calloc(1, size + 1);
+   if (text && fread(text, 1, size, f) != (size_t)size) {
+      free(text);
+      text = NULL;
+   }
+   fclose(f);
+   return text;
+}
+
+static uint32_t shader_type(const struct tgsi_token *tokens)
+{
+   struct tgsi_parse_context parse;
+
+   tgsi_parse_init(&parse, tokens);
+   switch (parse.FullHeader.Processor.Processor) {
+   case TGSI_PROCESSOR_VERTEX: return PIPE_SHADER_VERTEX;
+   case TGSI_PROCESSOR_FRAGMENT: return PIPE_SHADER_FRAGMENT;
+   case TGSI_PROCESSOR_GEOMETRY: return PIPE_SHADER_GEOMETRY;
+   case TGSI_PROCESSOR_TESS_CTRL: return PIPE_SHADER_TESS_CTRL;
+   case TGSI_PROCESSOR_TESS_EVAL: return PIPE_SHADER_TESS_EVAL;
+   default: return PIPE_SHADER_COMPUTE;
+   }
+}
+
+/* returns false if the shader does not translate */
+static bool bench_shader(const char *name, const char *text, unsigned iterations,
+                         struct tgsi_token *tokens, struct tgsi_token *binary,
+                         double *text_total, double *binary_total)
+{
+   unsigned num_tokens, text_size = strlen(text) + 1;
+   uint32_t type;
+   double start, text_ns, binary_ns;
+
+   /* what the guest would send */
+   if (!tgsi_text_translate(text, binary, MAX_TOKENS)) {
+      fprintf(stderr, "%s: failed to translate\n", name);
+      return false;
+   }
+   num_tokens = tgsi_num_tokens(binary);
+   type = shader_type(binary);
+
+   start = now_ns();
+   for (unsigned i = 0; i < iterations; i++) {
+      if (!tgsi_text_translate(text, tokens, MAX_TOKENS))
+         return false;
+   }
+   text_ns = (now_ns() - start) / iterations;
+
+   start = now_ns();
+   for (unsigned i = 0; i < iterations; i++) {
+      if (!vrend_tgsi_validate(binary, num_tokens, type)) {
+         fprintf(stderr, "%s: binary tokens rejected\n", name);
+         return false;
+      }
+   }
+   binary_ns = (now_ns() - start) / iterations;
+
+   printf("%-24.24s %8u %8u %10.2f %10.2f %8.1fx\n", name, text_size,
+          num_tokens * 4, text_ns / 1e3, binary_ns / 1e3, text_ns / binary_ns);
+
+   *text_total += text_ns;
+   *binary_total += binary_ns;
+   return true;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 200;
+   struct tgsi_token *tokens = CALLOC(MAX_TOKENS, sizeof(struct tgsi_token));
+   struct tgsi_token *binary = CALLOC(MAX_TOKENS, sizeof(struct tgsi_token));
+   double text_total = 0, binary_total = 0;
+   bool ok = true;
+
+   if (!tokens || !binary || !iterations)
+      return EXIT_FAILURE;
+
+   printf("%-24s %8s %8s %10s %10s %9s\n", "shader", "text B", "tokens B",
+          "text us", "binary us", "speedup");
+
+   if (argc > 2) {
+      for (int i = 2; i < argc; i++) {
+         char *text = read_file(argv[i]);
+
+         if (!text) {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            ok = false;
+            continue;
+         }
+         ok &= bench_shader(argv[i], text, iterations, tokens, binary,
+                            &text_total, &binary_total);
+         free(text);
+      }
+   } else {
+      for (unsigned i = 0; i < ARRAY_SIZE(shader_corpus); i++)
+         ok &= bench_shader(shader_corpus[i].name, shader_corpus[i].text,
+                            iterations, tokens, binary, &text_total, &binary_total);
+      ok &= bench_shader("large fs", large_frag, iterations, tokens, binary,
+                         &text_total, &binary_total);
+   }
+
+   if (binary_total > 0)
+      printf("%-24s %8s %8s %10.2f %10.2f %8.1fx\n", "total", "", "",
+             text_total / 1e3, binary_total / 1e3, text_total / binary_total);
+
+   FREE(tokens);
+   FREE(binary);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
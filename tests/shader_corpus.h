@@ -0,0 +1,188 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef SHADER_CORPUS_H
+#define SHADER_CORPUS_H
+
+/* TGSI shaders for the benchmarks, modelled on what the guest driver
+ * emits for typical applications: fixed function emulation, texturing
+ * with alpha test, uniform buffer loops and point sprite expansion.
+ * tests/large_shader.h adds a big shader from a real application.
+ */
+
+struct corpus_shader {
+   const char *name;
+   const char *text;
+};
+
+static const struct corpus_shader shader_corpus[] = {
+   { "passthrough vs",
+     "VERT\n"
+     "DCL IN[0]\n"
+     "DCL IN[1]\n"
+     "DCL OUT[0], POSITION\n"
+     "DCL OUT[1], GENERIC[0]\n"
+     "  0: MOV OUT[0], IN[0]\n"
+     "  1: MOV OUT[1], IN[1]\n"
+     "  2: END\n" },
+   { "transform vs",
+     "VERT\n"
+     "DCL IN[0]\n"
+     "DCL IN[1]\n"
+     "DCL IN[2]\n"
+     "DCL OUT[0], POSITION\n"
+     "DCL OUT[1], GENERIC[0]\n"
+     "DCL OUT[2], GENERIC[1]\n"
+     "DCL CONST[0..7]\n"
+     "DCL TEMP[0..1]\n"
+     "IMM[0] FLT32 {1.0, 0.0, 0.5, 2.0}\n"
+     "  0: MUL TEMP[0], IN[0].xxxx, CONST[0]\n"
+     "  1: MAD TEMP[0], IN[0].yyyy, CONST[1], TEMP[0]\n"
+     "  2: MAD TEMP[0], IN[0].zzzz, CONST[2], TEMP[0]\n"
+     "  3: MAD OUT[0], IN[0].wwww, CONST[3], TEMP[0]\n"
+     "  4: MUL TEMP[1], IN[1].xxxx, CONST[4]\n"
+     "  5: MAD TEMP[1], IN[1].yyyy, CONST[5], TEMP[1]\n"
+     "  6: MAD TEMP[1], IN[1].zzzz, CONST[6], TEMP[1]\n"
+     "  7: DP3 TEMP[1].x, TEMP[1], TEMP[1]\n"
+     "  8: RSQ TEMP[1].x, TEMP[1].xxxx\n"
+     "  9: MUL OUT[2], IN[1], TEMP[1].xxxx\n"
+     " 10: MAD OUT[1], IN[2], IMM[0].zzzz, IMM[0].zzzz\n"
+     " 11: END\n" },
+   { "lit vs",
+     "VERT\n"
+     "DCL IN[0]\n"
+     "DCL IN[1]\n"
+     "DCL IN[2]\n"
+     "DCL OUT[0], POSITION\n"
+     "DCL OUT[1], COLOR\n"
+     "DCL OUT[2], GENERIC[0]\n"
+     "DCL CONST[0..11]\n"
+     "DCL TEMP[0..3]\n"
+     "IMM[0] FLT32 {0.0, 1.0, 16.0, 0.5}\n"
+     "  0: MUL TEMP[0], IN[0].xxxx, CONST[0]\n"
+     "  1: MAD TEMP[0], IN[0].yyyy, CONST[1], TEMP[0]\n"
+     "  2: MAD TEMP[0], IN[0].zzzz, CONST[2], TEMP[0]\n"
+     "  3: MAD OUT[0], IN[0].wwww, CONST[3], TEMP[0]\n"
+     "  4: DP3 TEMP[1].x, IN[1], CONST[8]\n"
+     "  5: MAX TEMP[1].x, TEMP[1].xxxx, IMM[0].xxxx\n"
+     "  6: DP3 TEMP[1].y, IN[1], CONST[9]\n"
+     "  7: MAX TEMP[1].y, TEMP[1].yyyy, IMM[0].xxxx\n"
+     "  8: POW TEMP[1].y, TEMP[1].yyyy, IMM[0].zzzz\n"
+     "  9: MUL TEMP[2], CONST[10], TEMP[1].xxxx\n"
+     " 10: MAD TEMP[2], CONST[11], TEMP[1].yyyy, TEMP[2]\n"
+     " 11: MIN TEMP[3], TEMP[2], IMM[0].yyyy\n"
+     " 12: MOV OUT[1], TEMP[3]\n"
+     " 13: MOV OUT[2], IN[2]\n"
+     " 14: END\n" },
+   { "textured fs",
+     "FRAG\n"
+     "DCL IN[0], GENERIC[0], PERSPECTIVE\n"
+     "DCL IN[1], GENERIC[1], PERSPECTIVE\n"
+     "DCL OUT[0], COLOR\n"
+     "DCL SAMP[0]\n"
+     "DCL SAMP[1]\n"
+     "DCL SVIEW[0], 2D, FLOAT\n"
+     "DCL SVIEW[1], 2D, FLOAT\n"
+     "DCL CONST[0]\n"
+     "DCL TEMP[0..2]\n"
+     "IMM[0] FLT32 {0.0, 1.0, 0.5, 0.25}\n"
+     "  0: TEX TEMP[0], IN[0], SAMP[0], 2D\n"
+     "  1: TEX TEMP[1], IN[0], SAMP[1], 2D\n"
+     "  2: DP3 TEMP[2].x, IN[1], CONST[0]\n"
+     "  3: MAX TEMP[2].x, TEMP[2].xxxx, IMM[0].xxxx\n"
+     "  4: MUL TEMP[0], TEMP[0], TEMP[2].xxxx\n"
+     "  5: MAD OUT[0], TEMP[1], IMM[0].wwww, TEMP[0]\n"
+     "  6: END\n" },
+   { "alpha test fs",
+     "FRAG\n"
+     "DCL IN[0], COLOR, COLOR\n"
+     "DCL IN[1], GENERIC[0], PERSPECTIVE\n"
+     "DCL OUT[0], COLOR\n"
+     "DCL SAMP[0]\n"
+     "DCL SVIEW[0], 2D, FLOAT\n"
+     "DCL TEMP[0..1]\n"
+     "IMM[0] FLT32 {0.5, 0.0, 1.0, 0.0}\n"
+     "  0: TEX TEMP[0], IN[1], SAMP[0], 2D\n"
+     "  1: MUL TEMP[0], TEMP[0], IN[0]\n"
+     "  2: ADD TEMP[1].x, TEMP[0].wwww, -IMM[0].xxxx\n"
+     "  3: KILL_IF TEMP[1].xxxx\n"
+     "  4: MOV OUT[0], TEMP[0]\n"
+     "  5: END\n" },
+   { "ubo loop fs",
+     "FRAG\n"
+     "DCL IN[0], GENERIC[0], PERSPECTIVE\n"
+     "DCL OUT[0], COLOR\n"
+     "DCL CONST[0]\n"
+     "DCL CONST[1][0..15]\n"
+     "DCL TEMP[0..2]\n"
+     "DCL ADDR[0]\n"
+     "IMM[0] UINT32 {0, 1, 8, 0}\n"
+     "IMM[1] FLT32 {0.0, 1.0, 0.0, 0.0}\n"
+     "  0: MOV TEMP[0], IMM[1].xxxx\n"
+     "  1: MOV TEMP[1].x, IMM[0].xxxx\n"
+     "  2: BGNLOOP\n"
+     "  3: USGE TEMP[2].x, TEMP[1].xxxx, IMM[0].zzzz\n"
+     "  4: UIF TEMP[2].xxxx\n"
+     "  5: BRK\n"
+     "  6: ENDIF\n"
+     "  7: UARL ADDR[0].x, TEMP[1].xxxx\n"
+     "  8: MAD TEMP[0], CONST[1][ADDR[0].x], IN[0].xxxx, TEMP[0]\n"
+     "  9: UADD TEMP[1].x, TEMP[1].xxxx, IMM[0].yyyy\n"
+     " 10: ENDLOOP\n"
+     " 11: MUL OUT[0], TEMP[0], CONST[0]\n"
+     " 12: END\n" },
+   { "point sprite gs",
+     "GEOM\n"
+     "PROPERTY GS_INPUT_PRIMITIVE POINTS\n"
+     "PROPERTY GS_OUTPUT_PRIMITIVE TRIANGLE_STRIP\n"
+     "PROPERTY GS_MAX_OUTPUT_VERTICES 4\n"
+     "PROPERTY GS_INVOCATIONS 1\n"
+     "DCL IN[][0], POSITION\n"
+     "DCL IN[][1], GENERIC[0]\n"
+     "DCL OUT[0], POSITION\n"
+     "DCL OUT[1], GENERIC[0]\n"
+     "DCL CONST[0]\n"
+     "DCL TEMP[0]\n"
+     "IMM[0] FLT32 {-1.0, 1.0, 0.0, 0.0}\n"
+     "IMM[1] INT32 {0, 0, 0, 0}\n"
+     "  0: MAD TEMP[0], CONST[0], IMM[0].xxzz, IN[0][0]\n"
+     "  1: MOV OUT[0], TEMP[0]\n"
+     "  2: MOV OUT[1], IN[0][1]\n"
+     "  3: EMIT IMM[1].xxxx\n"
+     "  4: MAD TEMP[0], CONST[0], IMM[0].yxzz, IN[0][0]\n"
+     "  5: MOV OUT[0], TEMP[0]\n"
+     "  6: MOV OUT[1], IN[0][1]\n"
+     "  7: EMIT IMM[1].xxxx\n"
+     "  8: MAD TEMP[0], CONST[0], IMM[0].xyzz, IN[0][0]\n"
+     "  9: MOV OUT[0], TEMP[0]\n"
+     " 10: MOV OUT[1], IN[0][1]\n"
+     " 11: EMIT IMM[1].xxxx\n"
+     " 12: MAD TEMP[0], CONST[0], IMM[0].yyzz, IN[0][0]\n"
+     " 13: MOV OUT[0], TEMP[0]\n"
+     " 14: MOV OUT[1], IN[0][1]\n"
+     " 15: EMIT IMM[1].xxxx\n"
+     " 16: END\n" },
+};
+
+#endif
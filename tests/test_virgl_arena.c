@@ -0,0 +1,237 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/vrend_arena.h"
+
+/* Test the scratch arena used for per command buffer temporaries */
+
+START_TEST(arena_alloc_aligned)
+{
+   struct vrend_arena arena;
+   char *a, *b;
+
+   vrend_arena_init(&arena);
+   vrend_arena_begin(&arena);
+   a = vrend_arena_alloc(&arena, 3);
+   b = vrend_arena_alloc(&arena, 0);
+   ck_assert_ptr_ne(a, NULL);
+   ck_assert_ptr_ne(b, NULL);
+   ck_assert_ptr_ne(a, b);
+   ck_assert_int_eq((uintptr_t)a % 16, 0);
+   ck_assert_int_eq((uintptr_t)b % 16, 0);
+   memset(a, 0xff, 3);
+
+   b = vrend_arena_calloc(&arena, 100, 4);
+   for (int i = 0; i < 400; i++)
+      ck_assert_int_eq(b[i], 0);
+   ck_assert_ptr_eq(vrend_arena_calloc(&arena, SIZE_MAX / 2, 4), NULL);
+   vrend_arena_end(&arena);
+   vrend_arena_fini(&arena);
+}
+END_TEST
+
+START_TEST(arena_reuse)
+{
+   struct vrend_arena arena;
+   uint64_t block_allocs;
+   void *first;
+
+   vrend_arena_init(&arena);
+
+   /* the first scope grows through several blocks */
+   vrend_arena_begin(&arena);
+   for (int i = 0; i < 64; i++)
+      memset(vrend_arena_alloc(&arena, 16 * 1024), i, 16 * 1024);
+   vrend_arena_end(&arena);
+   block_allocs = arena.num_block_allocs;
+   ck_assert_int_gt(block_allocs, 1);
+
+   /* afterwards the same work does not touch the heap */
+   for (int n = 0; n < 4; n++) {
+      void *ptr;
+
+      vrend_arena_begin(&arena);
+      ptr = vrend_arena_alloc(&arena, 16 * 1024);
+      for (int i = 1; i < 64; i++)
+         memset(vrend_arena_alloc(&arena, 16 * 1024), i, 16 * 1024);
+      vrend_arena_end(&arena);
+
+      if (n == 0)
+         first = ptr;
+      ck_assert_ptr_eq(ptr, first);
+      ck_assert_int_eq(arena.num_block_allocs, block_allocs);
+   }
+   vrend_arena_fini(&arena);
+}
+END_TEST
+
+START_TEST(arena_nested)
+{
+   struct vrend_arena arena;
+   char *outer, *inner;
+
+   vrend_arena_init(&arena);
+   vrend_arena_begin(&arena);
+   outer = vrend_arena_alloc(&arena, 32);
+   strcpy(outer, "outer");
+
+   /* the end of an inner scope must not release outer allocations */
+   vrend_arena_begin(&arena);
+   inner = vrend_arena_alloc(&arena, 32);
+   ck_assert_ptr_ne(inner, outer);
+   vrend_arena_end(&arena);
+
+   inner = vrend_arena_alloc(&arena, 32);
+   ck_assert_ptr_ne(inner, outer);
+   ck_assert_str_eq(outer, "outer");
+   vrend_arena_end(&arena);
+
+   ck_assert_int_eq(arena.depth, 0);
+   ck_assert_int_eq(arena.total, 0);
+   vrend_arena_fini(&arena);
+}
+END_TEST
+
+/* a command buffer full of transfers, each with its own scope around a
+ * staging buffer, must not hold more than one of them at a time */
+START_TEST(arena_nested_release)
+{
+   struct vrend_arena arena;
+   const size_t size = 3 * VREND_ARENA_MIN_BLOCK;
+   char *outer;
+
+   vrend_arena_init(&arena);
+   vrend_arena_begin(&arena);
+   outer = vrend_arena_alloc(&arena, 32);
+   strcpy(outer, "outer");
+
+   for (int i = 0; i < 256; i++) {
+      vrend_arena_begin(&arena);
+      memset(vrend_arena_alloc(&arena, size), i, size);
+      vrend_arena_end(&arena);
+      ck_assert_int_eq(arena.total, 32);
+   }
+   ck_assert_str_eq(outer, "outer");
+   ck_assert_int_eq(arena.high_water, 32 + size);
+   vrend_arena_end(&arena);
+
+   /* what is kept afterwards fits one transfer without a new block */
+   vrend_arena_begin(&arena);
+   vrend_arena_alloc(&arena, 32);
+   arena.num_block_allocs = 0;
+   for (int i = 0; i < 16; i++) {
+      vrend_arena_begin(&arena);
+      ck_assert_ptr_ne(vrend_arena_alloc(&arena, size), NULL);
+      vrend_arena_end(&arena);
+   }
+   ck_assert_int_eq(arena.num_block_allocs, 0);
+   vrend_arena_end(&arena);
+   vrend_arena_fini(&arena);
+}
+END_TEST
+
+START_TEST(arena_large_not_kept)
+{
+   struct vrend_arena arena;
+
+   vrend_arena_init(&arena);
+   vrend_arena_begin(&arena);
+   ck_assert_ptr_ne(vrend_arena_alloc(&arena, 2 * VREND_ARENA_MAX_KEEP), NULL);
+   vrend_arena_end(&arena);
+
+   /* the oversized block is returned to the heap, but what is kept
+    * still covers everything up to the limit */
+   ck_assert_int_eq(arena.num_block_allocs, 2);
+   vrend_arena_begin(&arena);
+   ck_assert_ptr_ne(vrend_arena_alloc(&arena, VREND_ARENA_MAX_KEEP), NULL);
+   vrend_arena_end(&arena);
+   ck_assert_int_eq(arena.num_block_allocs, 2);
+   vrend_arena_fini(&arena);
+   ck_assert_ptr_eq(arena.blocks, NULL);
+}
+END_TEST
+
+static void *arena_thread(void *arg)
+{
+   struct vrend_arena *arena = vrend_arena_thread();
+
+   (void)arg;
+   vrend_arena_begin(arena);
+   vrend_arena_alloc(arena, 2 * VREND_ARENA_MIN_BLOCK);
+   vrend_arena_end(arena);
+   return arena->blocks;
+}
+
+/* a thread that exits without vrend_arena_fini must not leak its blocks,
+ * which the valgrind run of the tests checks */
+START_TEST(arena_thread_exit)
+{
+   pthread_t thread;
+   void *blocks = NULL;
+
+   ck_assert_int_eq(pthread_create(&thread, NULL, arena_thread, NULL), 0);
+   ck_assert_int_eq(pthread_join(thread, &blocks), 0);
+   ck_assert_ptr_ne(blocks, NULL);
+   ck_assert_ptr_ne(vrend_arena_thread()->blocks, blocks);
+}
+END_TEST
+
+static Suite *init_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("vrend_arena");
+  tc_core = tcase_create("arena");
+
+  suite_add_tcase(s, tc_core);
+
+  tcase_add_test(tc_core, arena_alloc_aligned);
+  tcase_add_test(tc_core, arena_reuse);
+  tcase_add_test(tc_core, arena_nested);
+  tcase_add_test(tc_core, arena_nested_release);
+  tcase_add_test(tc_core, arena_large_not_kept);
+  tcase_add_test(tc_core, arena_thread_exit);
+  return s;
+}
+
+int main(void)
+{
+   Suite *s;
+   SRunner *sr;
+   int number_failed;
+
+   s = init_suite();
+   sr = srunner_create(s);
+
+   srunner_run_all(sr, CK_NORMAL);
+   number_failed = srunner_ntests_failed(sr);
+   srunner_free(sr);
+   return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
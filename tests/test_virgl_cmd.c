@@ -32,6 +32,8 @@
 #include "testvirgl_encode.h"
 #include "virgl_protocol.h"
 #include "util/u_memory.h"
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_text.h"
 
 #include "large_shader.h"
 /* test creating objects with same ID causes context err */
@@ -1014,6 +1016,465 @@ START_TEST(virgl_test_large_shader)
 }
 END_TEST
 
+/* send the same large shader as binary tokens */
+START_TEST(virgl_test_large_shader_tokens)
+{
+   int ret;
+   struct virgl_context ctx;
+   struct virgl_resource res;
+   struct virgl_resource vbo;
+   struct virgl_surface surf;
+   struct pipe_framebuffer_state fb_state;
+   struct pipe_vertex_element ve[2];
+   struct pipe_vertex_buffer vbuf;
+   struct tgsi_token tokens[8192];
+   int ve_handle, vs_handle, fs_handle;
+   int ctx_handle = 1;
+   union pipe_color_union color;
+   struct virgl_box box;
+   int tw = 300, th = 300;
+
+   setenv("VREND_TGSI_TOKENS", "true", 1);
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   ret = tgsi_text_translate(large_frag, tokens, ARRAY_SIZE(tokens));
+   ck_assert_int_eq(ret, true);
+
+   ret = testvirgl_create_backed_simple_2d_res(&res, 1, tw, th);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+   memset(&surf, 0, sizeof(surf));
+   surf.base.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+   surf.handle = ctx_handle++;
+   surf.base.texture = &res.base;
+   virgl_encoder_create_surface(&ctx, surf.handle, &res, &surf.base);
+
+   fb_state.nr_cbufs = 1;
+   fb_state.zsbuf = NULL;
+   fb_state.cbufs[0] = &surf.base;
+   virgl_encoder_set_framebuffer_state(&ctx, &fb_state);
+
+   /* clear buffer to green */
+   color.f[0] = 0.0;
+   color.f[1] = 1.0;
+   color.f[2] = 0.0;
+   color.f[3] = 1.0;
+   virgl_encode_clear(&ctx, PIPE_CLEAR_COLOR0, &color, 0.0, 0);
+
+   ve_handle = ctx_handle++;
+   memset(ve, 0, sizeof(ve));
+   ve[0].src_offset = Offset(struct vertex, position);
+   ve[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   ve[1].src_offset = Offset(struct vertex, color);
+   ve[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   virgl_encoder_create_vertex_elements(&ctx, ve_handle, 2, ve);
+   virgl_encode_bind_object(&ctx, ve_handle, VIRGL_OBJECT_VERTEX_ELEMENTS);
+
+   ret = testvirgl_create_backed_simple_buffer(&vbo, 2, sizeof(vertices), PIPE_BIND_VERTEX_BUFFER);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, vbo.handle);
+
+   box.x = 0;
+   box.y = 0;
+   box.z = 0;
+   box.w = sizeof(vertices);
+   box.h = 1;
+   box.d = 1;
+   virgl_encoder_inline_write(&ctx, &vbo, 0, 0, (struct pipe_box *)&box, &vertices, box.w, 0);
+
+   vbuf.stride = sizeof(struct vertex);
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = &vbo.base;
+   virgl_encoder_set_vertex_buffers(&ctx, 1, &vbuf);
+
+   {
+      struct pipe_shader_state vs;
+      const char *text =
+         "VERT\n"
+         "DCL IN[0]\n"
+         "DCL IN[1]\n"
+         "DCL OUT[0], POSITION\n"
+         "DCL OUT[1], COLOR\n"
+         "  0: MOV OUT[1], IN[1]\n"
+         "  1: MOV OUT[0], IN[0]\n"
+         "  2: END\n";
+      memset(&vs, 0, sizeof(vs));
+      vs_handle = ctx_handle++;
+      virgl_encode_shader_state(&ctx, vs_handle, PIPE_SHADER_VERTEX,
+                                &vs, text);
+      virgl_encode_bind_shader(&ctx, vs_handle, PIPE_SHADER_VERTEX);
+   }
+
+   /* the fragment shader is sent as binary tokens */
+   {
+      struct pipe_shader_state fs;
+
+      memset(&fs, 0, sizeof(fs));
+      fs.tokens = tokens;
+      fs_handle = ctx_handle++;
+      virgl_encode_shader_state_tokens(&ctx, fs_handle, PIPE_SHADER_FRAGMENT, &fs);
+      virgl_encode_bind_shader(&ctx, fs_handle, PIPE_SHADER_FRAGMENT);
+   }
+
+   {
+      struct pipe_blend_state blend;
+      int blend_handle = ctx_handle++;
+      memset(&blend, 0, sizeof(blend));
+      blend.rt[0].colormask = PIPE_MASK_RGBA;
+      virgl_encode_blend_state(&ctx, blend_handle, &blend);
+      virgl_encode_bind_object(&ctx, blend_handle, VIRGL_OBJECT_BLEND);
+   }
+
+   {
+      struct pipe_rasterizer_state rasterizer;
+      int rs_handle = ctx_handle++;
+      memset(&rasterizer, 0, sizeof(rasterizer));
+      rasterizer.cull_face = PIPE_FACE_NONE;
+      rasterizer.half_pixel_center = 1;
+      rasterizer.bottom_edge_rule = 1;
+      rasterizer.depth_clip = 1;
+      virgl_encode_rasterizer_state(&ctx, rs_handle, &rasterizer);
+      virgl_encode_bind_object(&ctx, rs_handle, VIRGL_OBJECT_RASTERIZER);
+   }
+
+   {
+      struct pipe_viewport_state vp;
+      vp.scale[0] = tw / 2.0f;
+      vp.scale[1] = th / 2.0f;
+      vp.scale[2] = 0.5f;
+      vp.translate[0] = tw / 2.0f;
+      vp.translate[1] = th / 2.0f;
+      vp.translate[2] = 0.5f;
+      virgl_encoder_set_viewport_states(&ctx, 0, 1, &vp);
+   }
+
+   /* the draw is dropped if the shader object was not created or the
+    * context is in error */
+   {
+      struct pipe_draw_info info;
+      memset(&info, 0, sizeof(info));
+      info.count = 3;
+      info.mode = PIPE_PRIM_TRIANGLES;
+      virgl_encoder_draw_vbo(&ctx, &info);
+   }
+
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   box.x = 0;
+   box.y = 0;
+   box.z = 0;
+   box.w = tw;
+   box.h = th;
+   box.d = 1;
+   ret = virgl_renderer_transfer_read_iov(res.handle, ctx.ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+   ck_assert_int_eq(ret, 0);
+
+   {
+      int w, h;
+      bool all_cleared = true;
+      uint32_t *ptr = res.iovs[0].iov_base;
+      for (h = 0; h < th; h++) {
+         for (w = 0; w < tw; w++) {
+            if (ptr[h * tw + w] != 0xff00ff00)
+               all_cleared = false;
+         }
+      }
+      ck_assert_int_eq(all_cleared, false);
+   }
+
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, vbo.handle);
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+
+   testvirgl_destroy_backed_res(&vbo);
+   testvirgl_destroy_backed_res(&res);
+
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+   unsetenv("VREND_TGSI_TOKENS");
+}
+END_TEST
+
+static bool has_tgsi_tokens_cap(void)
+{
+   uint32_t max_ver, max_size;
+   struct virgl_caps_v2 *caps;
+   bool ret;
+
+   virgl_renderer_get_cap_set(2, &max_ver, &max_size);
+   ck_assert_int_ge(max_size, sizeof(struct virgl_caps_v2));
+   caps = calloc(1, max_size);
+   virgl_renderer_fill_caps(2, 0, caps);
+   ret = caps->capability_bits_v2 & VIRGL_CAP_V2_TGSI_TOKENS;
+   free(caps);
+   return ret;
+}
+
+/* binary tokens use wire values that are not reserved upstream, so the
+ * host must not offer them unless it is asked to */
+START_TEST(virgl_test_shader_tokens_opt_in)
+{
+   struct virgl_context ctx;
+   int ret;
+
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+   ck_assert_int_eq(has_tgsi_tokens_cap(), false);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+
+   setenv("VREND_TGSI_TOKENS", "true", 1);
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+   ck_assert_int_eq(has_tgsi_tokens_cap(), true);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+   unsetenv("VREND_TGSI_TOKENS");
+}
+END_TEST
+
+/* every shader object gets its first variant when it is created */
+START_TEST(virgl_test_shader_stats)
+{
+   struct virgl_renderer_shader_stats stats;
+   struct virgl_context ctx;
+   struct pipe_shader_state shader;
+   int ret;
+
+   context_flags |= VIRGL_RENDERER_CMD_STATS;
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   context_flags &= ~VIRGL_RENDERER_CMD_STATS;
+   ck_assert_int_eq(ret, 0);
+
+   memset(&shader, 0, sizeof(shader));
+   virgl_encode_shader_state(&ctx, 1, PIPE_SHADER_VERTEX, &shader,
+                             "VERT\n"
+                             "DCL IN[0]\n"
+                             "DCL OUT[0], POSITION\n"
+                             "  0: MOV OUT[0], IN[0]\n"
+                             "  1: END\n");
+   memset(&shader, 0, sizeof(shader));
+   virgl_encode_shader_state(&ctx, 2, PIPE_SHADER_FRAGMENT, &shader,
+                             "FRAG\n"
+                             "DCL OUT[0], COLOR\n"
+                             "IMM[0] FLT32 { 1.0, 0.0, 0.0, 1.0 }\n"
+                             "  0: MOV OUT[0], IMM[0]\n"
+                             "  1: END\n");
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   virgl_renderer_get_shader_stats(&stats);
+   ck_assert_int_eq(stats.selectors, 2);
+   ck_assert_int_eq(stats.variants, 2);
+   ck_assert_int_eq(stats.multi_variant_selectors, 0);
+   ck_assert_int_eq(stats.max_variants, 1);
+
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+END_TEST
+
+/* Renders COALESCE_TRIS triangles of different colors with one draw each,
+ * the first half as array draws and the second half as indexed draws that
+ * set the index buffer offset before each draw, as a guest driver does.
+ * Odd indexed draws reach their triangle through the index bias instead.
+ */
+#define COALESCE_TRIS 16
+#define COALESCE_SIZE 64
+
+static void render_draw_run(bool coalesce, uint32_t *pixels)
+{
+   static const char *vs_text =
+      "VERT\n"
+      "DCL IN[0]\n"
+      "DCL IN[1]\n"
+      "DCL OUT[0], POSITION\n"
+      "DCL OUT[1], COLOR\n"
+      "  0: MOV OUT[1], IN[1]\n"
+      "  1: MOV OUT[0], IN[0]\n"
+      "  2: END\n";
+   static const char *fs_text =
+      "FRAG\n"
+      "DCL IN[0], COLOR, LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "  0: MOV OUT[0], IN[0]\n"
+      "  1: END\n";
+   struct virgl_context ctx;
+   struct virgl_resource res, vbo, ibo;
+   struct virgl_surface surf;
+   struct pipe_framebuffer_state fb_state;
+   struct pipe_vertex_element ve[2];
+   struct pipe_vertex_buffer vbuf;
+   struct pipe_shader_state shader;
+   struct pipe_blend_state blend;
+   struct pipe_rasterizer_state rasterizer;
+   struct pipe_viewport_state vp;
+   struct pipe_draw_info info;
+   struct pipe_index_buffer ib;
+   struct vertex verts[COALESCE_TRIS * 3];
+   uint16_t indices[COALESCE_TRIS * 3];
+   union pipe_color_union color;
+   struct virgl_box box;
+   int ctx_handle = 1;
+   int ret, i;
+
+   setenv("VREND_COALESCE_DRAWS", coalesce ? "true" : "false", 1);
+   ret = testvirgl_init_ctx_cmdbuf(&ctx);
+   ck_assert_int_eq(ret, 0);
+
+   ret = testvirgl_create_backed_simple_2d_res(&res, 1, COALESCE_SIZE, COALESCE_SIZE);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+   /* one triangle per cell of a 4x4 grid */
+   memset(verts, 0, sizeof(verts));
+   for (i = 0; i < COALESCE_TRIS * 3; i++) {
+      int tri = i / 3;
+      float x = (tri % 4) / 2.0f - 1.0f;
+      float y = (tri / 4) / 2.0f - 1.0f;
+
+      verts[i].position[0] = x + (i % 3 == 1 ? 0.5f : 0.0f);
+      verts[i].position[1] = y + (i % 3 == 2 ? 0.5f : 0.0f);
+      verts[i].position[3] = 1.0f;
+      verts[i].color[0] = tri / (float)COALESCE_TRIS;
+      verts[i].color[1] = 1.0f - tri / (float)COALESCE_TRIS;
+      verts[i].color[2] = tri & 1;
+      verts[i].color[3] = 1.0f;
+      indices[i] = i;
+   }
+
+   ret = testvirgl_create_backed_simple_buffer(&vbo, 2, sizeof(verts), PIPE_BIND_VERTEX_BUFFER);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, vbo.handle);
+   memcpy(vbo.iovs[0].iov_base, verts, sizeof(verts));
+   box.x = box.y = box.z = 0;
+   box.w = sizeof(verts);
+   box.h = box.d = 1;
+   ret = virgl_renderer_transfer_write_iov(vbo.handle, ctx.ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+   ck_assert_int_eq(ret, 0);
+
+   ret = testvirgl_create_backed_simple_buffer(&ibo, 3, sizeof(indices), PIPE_BIND_INDEX_BUFFER);
+   ck_assert_int_eq(ret, 0);
+   virgl_renderer_ctx_attach_resource(ctx.ctx_id, ibo.handle);
+   memcpy(ibo.iovs[0].iov_base, indices, sizeof(indices));
+   box.w = sizeof(indices);
+   ret = virgl_renderer_transfer_write_iov(ibo.handle, ctx.ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+   ck_assert_int_eq(ret, 0);
+
+   memset(&surf, 0, sizeof(surf));
+   surf.base.format = PIPE_FORMAT_B8G8R8X8_UNORM;
+   surf.handle = ctx_handle++;
+   surf.base.texture = &res.base;
+   virgl_encoder_create_surface(&ctx, surf.handle, &res, &surf.base);
+   fb_state.nr_cbufs = 1;
+   fb_state.zsbuf = NULL;
+   fb_state.cbufs[0] = &surf.base;
+   virgl_encoder_set_framebuffer_state(&ctx, &fb_state);
+
+   memset(&color, 0, sizeof(color));
+   virgl_encode_clear(&ctx, PIPE_CLEAR_COLOR0, &color, 0.0, 0);
+
+   memset(ve, 0, sizeof(ve));
+   ve[0].src_offset = Offset(struct vertex, position);
+   ve[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   ve[1].src_offset = Offset(struct vertex, color);
+   ve[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   virgl_encoder_create_vertex_elements(&ctx, ctx_handle, 2, ve);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_VERTEX_ELEMENTS);
+
+   vbuf.stride = sizeof(struct vertex);
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = &vbo.base;
+   virgl_encoder_set_vertex_buffers(&ctx, 1, &vbuf);
+
+   memset(&shader, 0, sizeof(shader));
+   virgl_encode_shader_state(&ctx, ctx_handle, PIPE_SHADER_VERTEX, &shader, vs_text);
+   virgl_encode_bind_shader(&ctx, ctx_handle++, PIPE_SHADER_VERTEX);
+   memset(&shader, 0, sizeof(shader));
+   virgl_encode_shader_state(&ctx, ctx_handle, PIPE_SHADER_FRAGMENT, &shader, fs_text);
+   virgl_encode_bind_shader(&ctx, ctx_handle++, PIPE_SHADER_FRAGMENT);
+
+   memset(&blend, 0, sizeof(blend));
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   virgl_encode_blend_state(&ctx, ctx_handle, &blend);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_BLEND);
+
+   memset(&rasterizer, 0, sizeof(rasterizer));
+   rasterizer.cull_face = PIPE_FACE_NONE;
+   rasterizer.half_pixel_center = 1;
+   rasterizer.bottom_edge_rule = 1;
+   rasterizer.depth_clip = 1;
+   virgl_encode_rasterizer_state(&ctx, ctx_handle, &rasterizer);
+   virgl_encode_bind_object(&ctx, ctx_handle++, VIRGL_OBJECT_RASTERIZER);
+
+   vp.scale[0] = vp.translate[0] = COALESCE_SIZE / 2.0f;
+   vp.scale[1] = vp.translate[1] = COALESCE_SIZE / 2.0f;
+   vp.scale[2] = vp.translate[2] = 0.5f;
+   virgl_encoder_set_viewport_states(&ctx, 0, 1, &vp);
+
+   memset(&info, 0, sizeof(info));
+   info.mode = PIPE_PRIM_TRIANGLES;
+   info.count = 3;
+   for (i = 0; i < COALESCE_TRIS / 2; i++) {
+      info.start = i * 3;
+      virgl_encoder_draw_vbo(&ctx, &info);
+   }
+
+   ib.index_size = 2;
+   ib.buffer = &ibo.base;
+   ib.user_buffer = NULL;
+   info.start = 0;
+   info.indexed = 1;
+   info.max_index = ~0u;
+   for (i = COALESCE_TRIS / 2; i < COALESCE_TRIS; i++) {
+      ib.offset = (i & ~1) * 3 * sizeof(uint16_t);
+      info.index_bias = (i & 1) * 3;
+      /* the last draws give the range of the indices they read */
+      if (i >= COALESCE_TRIS * 3 / 4) {
+         info.min_index = (i & ~1) * 3;
+         info.max_index = info.min_index + 2;
+      }
+      virgl_encoder_set_index_buffer(&ctx, &ib);
+      virgl_encoder_draw_vbo(&ctx, &info);
+   }
+
+   ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+   ck_assert_int_eq(ret, 0);
+
+   box.w = COALESCE_SIZE;
+   box.h = COALESCE_SIZE;
+   ret = virgl_renderer_transfer_read_iov(res.handle, ctx.ctx_id, 0, 0, 0, &box, 0, NULL, 0);
+   ck_assert_int_eq(ret, 0);
+   memcpy(pixels, res.iovs[0].iov_base, COALESCE_SIZE * COALESCE_SIZE * 4);
+
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, ibo.handle);
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, vbo.handle);
+   virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+   testvirgl_destroy_backed_res(&ibo);
+   testvirgl_destroy_backed_res(&vbo);
+   testvirgl_destroy_backed_res(&res);
+   testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+
+/* merging draws into multi draws must not change what is rendered */
+START_TEST(virgl_test_render_coalesced_draws)
+{
+   static uint32_t separate[COALESCE_SIZE * COALESCE_SIZE];
+   static uint32_t merged[COALESCE_SIZE * COALESCE_SIZE];
+   int i, drawn = 0;
+
+   render_draw_run(false, separate);
+   render_draw_run(true, merged);
+   unsetenv("VREND_COALESCE_DRAWS");
+
+   for (i = 0; i < COALESCE_SIZE * COALESCE_SIZE; i++) {
+      if (separate[i] & 0xffffff)
+         drawn++;
+   }
+   /* the triangles cover half of the framebuffer */
+   ck_assert_int_ge(drawn, COALESCE_SIZE * COALESCE_SIZE / 4);
+   ck_assert_int_eq(memcmp(separate, merged, sizeof(separate)), 0);
+}
+END_TEST
+
 static Suite *virgl_init_suite(void)
 {
   Suite *s;
@@ -1025,9 +1486,13 @@ static Suite *virgl_init_suite(void)
   tcase_add_test(tc_core, virgl_test_blit_simple);
   tcase_add_test(tc_core, virgl_test_overlap_obj_id);
   tcase_add_test(tc_core, virgl_test_large_shader);
+  tcase_add_test(tc_core, virgl_test_large_shader_tokens);
+  tcase_add_test(tc_core, virgl_test_shader_tokens_opt_in);
+  tcase_add_test(tc_core, virgl_test_shader_stats);
   tcase_add_test(tc_core, virgl_test_render_simple);
   tcase_add_test(tc_core, virgl_test_render_geom_simple);
   tcase_add_test(tc_core, virgl_test_render_xfb);
+  tcase_add_test(tc_core, virgl_test_render_coalesced_draws);
 
   suite_add_tcase(s, tc_core);
   return s;
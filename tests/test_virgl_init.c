@@ -28,13 +28,16 @@
  */
 
 #include <check.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <unistd.h>
 #include <virglrenderer.h>
 #include <gbm.h>
 #include <sys/uio.h>
 #include "testvirgl.h"
 #include "virgl_hw.h"
+#include "virgl_protocol.h"
 struct myinfo_struct {
   uint32_t test;
 };
@@ -95,6 +98,240 @@ START_TEST(virgl_init_egl_create_ctx)
 }
 END_TEST
 
+/* create and destroy a few thousand contexts with sparse ids in batches,
+ * submitting to each one while it is alive */
+#define MANY_CTX_TOTAL 4096
+#define MANY_CTX_BATCH 128
+
+START_TEST(virgl_init_egl_create_many_ctx)
+{
+  uint32_t cmd = 0;
+  int ret, i, j;
+
+  test_cbs.version = 1;
+  ret = virgl_renderer_init(&mystruct, context_flags, &test_cbs);
+  ck_assert_int_eq(ret, 0);
+
+  for (i = 0; i < MANY_CTX_TOTAL; i += MANY_CTX_BATCH) {
+    for (j = i; j < i + MANY_CTX_BATCH; j++) {
+      ret = virgl_renderer_context_create(j * 97 + 1, strlen("test1"), "test1");
+      ck_assert_int_eq(ret, 0);
+    }
+
+    for (j = i; j < i + MANY_CTX_BATCH; j++) {
+      ret = virgl_renderer_submit_cmd(&cmd, j * 97 + 1, 0);
+      ck_assert_int_eq(ret, 0);
+    }
+
+    for (j = i; j < i + MANY_CTX_BATCH; j++)
+      virgl_renderer_context_destroy(j * 97 + 1);
+  }
+
+  /* destroyed contexts are gone */
+  ret = virgl_renderer_submit_cmd(&cmd, 97 + 1, 0);
+  ck_assert_int_eq(ret, EINVAL);
+
+  virgl_renderer_cleanup(&mystruct);
+}
+END_TEST
+
+START_TEST(virgl_init_egl_cmd_stats)
+{
+  struct virgl_renderer_cmd_stats stats;
+  uint32_t cmd = VIRGL_CMD0(VIRGL_CCMD_END_TRANSFERS, 0, 0);
+  int ret;
+
+  test_cbs.version = 1;
+  ret = virgl_renderer_init(&mystruct, context_flags | VIRGL_RENDERER_CMD_STATS, &test_cbs);
+  ck_assert_int_eq(ret, 0);
+  ret = virgl_renderer_context_create(1, strlen("test1"), "test1");
+  ck_assert_int_eq(ret, 0);
+
+  ret = virgl_renderer_submit_cmd(&cmd, 1, 1);
+  ck_assert_int_eq(ret, 0);
+  ret = virgl_renderer_submit_cmd(&cmd, 1, 1);
+  ck_assert_int_eq(ret, 0);
+
+  ret = virgl_renderer_get_cmd_stats(1, VIRGL_CCMD_END_TRANSFERS, &stats);
+  ck_assert_int_eq(ret, 0);
+  ck_assert_int_eq(stats.count, 2);
+  ck_assert_str_eq(stats.name, "END_TRANSFERS");
+
+  ret = virgl_renderer_get_cmd_stats(1, VIRGL_CCMD_CLEAR, &stats);
+  ck_assert_int_eq(ret, 0);
+  ck_assert_int_eq(stats.count, 0);
+
+  ret = virgl_renderer_get_cmd_stats(1, VIRGL_MAX_COMMANDS, &stats);
+  ck_assert_int_eq(ret, EINVAL);
+
+  /* the totals keep the commands of destroyed contexts */
+  virgl_renderer_context_destroy(1);
+  ret = virgl_renderer_get_cmd_stats(1, VIRGL_CCMD_END_TRANSFERS, &stats);
+  ck_assert_int_eq(ret, EINVAL);
+  ret = virgl_renderer_get_cmd_stats(0, VIRGL_CCMD_END_TRANSFERS, &stats);
+  ck_assert_int_eq(ret, 0);
+  ck_assert_int_eq(stats.count, 2);
+
+  virgl_renderer_cleanup(&mystruct);
+}
+END_TEST
+
+START_TEST(virgl_init_egl_state_filter)
+{
+  struct virgl_renderer_cmd_stats stats;
+  uint32_t cmd[VIRGL_SET_BLEND_COLOR_SIZE + 1];
+  int ret;
+
+  test_cbs.version = 1;
+  ret = virgl_renderer_init(&mystruct, context_flags | VIRGL_RENDERER_CMD_STATS, &test_cbs);
+  ck_assert_int_eq(ret, 0);
+  ret = virgl_renderer_context_create(1, strlen("test1"), "test1");
+  ck_assert_int_eq(ret, 0);
+
+  memset(cmd, 0, sizeof(cmd));
+  cmd[0] = VIRGL_CMD0(VIRGL_CCMD_SET_BLEND_COLOR, 0, VIRGL_SET_BLEND_COLOR_SIZE);
+  ret = virgl_renderer_submit_cmd(cmd, 1, VIRGL_SET_BLEND_COLOR_SIZE + 1);
+  ck_assert_int_eq(ret, 0);
+  ret = virgl_renderer_submit_cmd(cmd, 1, VIRGL_SET_BLEND_COLOR_SIZE + 1);
+  ck_assert_int_eq(ret, 0);
+  cmd[VIRGL_SET_BLEND_COLOR(0)] = 0x3f800000;
+  ret = virgl_renderer_submit_cmd(cmd, 1, VIRGL_SET_BLEND_COLOR_SIZE + 1);
+  ck_assert_int_eq(ret, 0);
+
+  /* only the repeated color is dropped */
+  ret = virgl_renderer_get_cmd_stats(1, VIRGL_CCMD_SET_BLEND_COLOR, &stats);
+  ck_assert_int_eq(ret, 0);
+  ck_assert_int_eq(stats.count, 2);
+  ck_assert_int_eq(stats.elided, 1);
+
+  virgl_renderer_context_destroy(1);
+  virgl_renderer_cleanup(&mystruct);
+}
+END_TEST
+
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_ITERATIONS 64
+
+/* one context per thread, each iteration makes a resource, moves data
+ * into it and drops it again, returns the number of failed calls */
+static void *concurrent_api_thread(void *arg)
+{
+  uint32_t ctx_id = (uintptr_t)arg;
+  uint32_t cmd = VIRGL_CMD0(VIRGL_CCMD_END_TRANSFERS, 0, 0);
+  uintptr_t failed = 0;
+  int i;
+
+  if (virgl_renderer_context_create(ctx_id, strlen("test1"), "test1"))
+    return (void *)(uintptr_t)CONCURRENT_ITERATIONS;
+
+  for (i = 0; i < CONCURRENT_ITERATIONS; i++) {
+    struct virgl_renderer_resource_create_args args;
+    struct virgl_renderer_resource_info info;
+    struct virgl_box box = { 0, 0, 0, 256, 1, 1 };
+    struct iovec iov, *iov_p;
+    int num_iovs;
+    uint32_t handle = ctx_id * 1000 + i + 1;
+
+    testvirgl_init_simple_buffer_sized(&args, handle, 256);
+    if (virgl_renderer_resource_create(&args, NULL, 0)) {
+      failed++;
+      continue;
+    }
+
+    iov.iov_len = 256;
+    iov.iov_base = calloc(1, iov.iov_len);
+    failed += virgl_renderer_resource_attach_iov(handle, &iov, 1) != 0;
+    virgl_renderer_ctx_attach_resource(ctx_id, handle);
+
+    failed += virgl_renderer_transfer_write_iov(handle, ctx_id, 0, 0, 0, &box,
+                                                0, NULL, 0) != 0;
+    failed += virgl_renderer_submit_cmd(&cmd, ctx_id, 1) != 0;
+    failed += virgl_renderer_resource_get_info(handle, &info) != 0;
+
+    virgl_renderer_ctx_detach_resource(ctx_id, handle);
+    virgl_renderer_resource_detach_iov(handle, &iov_p, &num_iovs);
+    virgl_renderer_resource_unref(handle);
+    free(iov.iov_base);
+  }
+
+  virgl_renderer_context_destroy(ctx_id);
+  return (void *)failed;
+}
+
+/* with threaded decode calls may come from several threads at once */
+START_TEST(virgl_init_egl_threaded_decode_concurrent)
+{
+  pthread_t threads[CONCURRENT_THREADS];
+  int ret, i;
+
+  setenv("VREND_DECODE_THREADS", "2", 1);
+  test_cbs.version = 1;
+  ret = virgl_renderer_init(&mystruct, context_flags | VIRGL_RENDERER_THREADED_DECODE,
+                            &test_cbs);
+  ck_assert_int_eq(ret, 0);
+
+  for (i = 0; i < CONCURRENT_THREADS; i++) {
+    ret = pthread_create(&threads[i], NULL, concurrent_api_thread,
+                         (void *)(uintptr_t)(i + 1));
+    ck_assert_int_eq(ret, 0);
+  }
+
+  for (i = 0; i < CONCURRENT_THREADS; i++) {
+    void *failed;
+
+    ck_assert_int_eq(pthread_join(threads[i], &failed), 0);
+    ck_assert_int_eq((uintptr_t)failed, 0);
+  }
+
+  virgl_renderer_cleanup(&mystruct);
+  unsetenv("VREND_DECODE_THREADS");
+}
+END_TEST
+
+static pthread_t fence_caller;
+static uint32_t fence_seen;
+static bool fence_on_caller;
+
+static void threaded_write_fence(void *cookie, uint32_t fence)
+{
+  fence_seen = fence;
+  fence_on_caller = pthread_equal(pthread_self(), fence_caller);
+}
+
+/* fences retire on a decode thread but are reported to the caller */
+START_TEST(virgl_init_egl_threaded_decode_fences)
+{
+  uint32_t cmd = VIRGL_CMD0(VIRGL_CCMD_END_TRANSFERS, 0, 0);
+  int ret, i;
+
+  test_cbs.version = 1;
+  test_cbs.write_fence = threaded_write_fence;
+  ret = virgl_renderer_init(&mystruct, context_flags | VIRGL_RENDERER_THREADED_DECODE,
+                            &test_cbs);
+  ck_assert_int_eq(ret, 0);
+  ret = virgl_renderer_context_create(1, strlen("test1"), "test1");
+  ck_assert_int_eq(ret, 0);
+
+  fence_caller = pthread_self();
+  fence_seen = 0;
+  ret = virgl_renderer_submit_cmd(&cmd, 1, 1);
+  ck_assert_int_eq(ret, 0);
+  ret = virgl_renderer_create_fence(1, 1);
+  ck_assert_int_eq(ret, 0);
+
+  for (i = 0; i < 1000 && fence_seen != 1; i++) {
+    virgl_renderer_poll();
+    usleep(1000);
+  }
+  ck_assert_int_eq(fence_seen, 1);
+  ck_assert(fence_on_caller);
+
+  virgl_renderer_context_destroy(1);
+  virgl_renderer_cleanup(&mystruct);
+  test_cbs.write_fence = NULL;
+}
+END_TEST
+
 START_TEST(virgl_init_egl_create_ctx_0)
 {
   int ret;
@@ -452,13 +689,16 @@ static Suite *virgl_init_suite(void)
 
   s = suite_create("virgl_init");
   tc_core = tcase_create("init");
-
   tcase_add_test(tc_core, virgl_init_no_cbs);
   tcase_add_test(tc_core, virgl_init_no_cookie);
   tcase_add_test(tc_core, virgl_init_cbs_wrong_ver);
   tcase_add_test(tc_core, virgl_init_egl);
   tcase_add_test(tc_core, virgl_init_egl_create_ctx);
   tcase_add_test(tc_core, virgl_init_egl_create_ctx_0);
+  tcase_add_test(tc_core, virgl_init_egl_cmd_stats);
+  tcase_add_test(tc_core, virgl_init_egl_state_filter);
+  tcase_add_test(tc_core, virgl_init_egl_threaded_decode_concurrent);
+  tcase_add_test(tc_core, virgl_init_egl_threaded_decode_fences);
   tcase_add_test(tc_core, virgl_init_egl_destroy_ctx_illegal);
   tcase_add_test(tc_core, virgl_init_egl_create_ctx_leak);
   tcase_add_test(tc_core, virgl_init_egl_create_ctx_reset);
@@ -470,6 +710,12 @@ static Suite *virgl_init_suite(void)
 
   suite_add_tcase(s, tc_core);
 
+  /* creates a few thousand GL contexts, give it the time for that */
+  tc_core = tcase_create("init_many_ctx");
+  tcase_set_timeout(tc_core, 60);
+  tcase_add_test(tc_core, virgl_init_egl_create_many_ctx);
+  suite_add_tcase(s, tc_core);
+
   tc_core = tcase_create("init_std");
   tcase_add_checked_fixture(tc_core, testvirgl_init_single_ctx_nr, testvirgl_fini_single_ctx);
   tcase_add_test(tc_core, virgl_init_egl_create_ctx_create_bind_res);
@@ -0,0 +1,419 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include "../src/vrend_shader_cache.h"
+
+/* Test the on-disk GLSL translation cache */
+
+static char cache_dir[64];
+
+static void cache_setup(void)
+{
+   strcpy(cache_dir, "/tmp/virgl-shader-cache-XXXXXX");
+   ck_assert_ptr_ne(mkdtemp(cache_dir), NULL);
+}
+
+static void cache_teardown(void)
+{
+   struct dirent *dent;
+   char name[PATH_MAX];
+   DIR *dir;
+
+   vrend_shader_cache_fini();
+
+   dir = opendir(cache_dir);
+   while (dir && (dent = readdir(dir))) {
+      if (dent->d_name[0] == '.')
+         continue;
+      snprintf(name, sizeof(name), "%s/%s", cache_dir, dent->d_name);
+      unlink(name);
+   }
+   if (dir)
+      closedir(dir);
+   rmdir(cache_dir);
+}
+
+static void fill_tokens(struct tgsi_token *tokens, int seed)
+{
+   struct tgsi_header hdr = { .HeaderSize = 2, .BodySize = 6 };
+
+   memcpy(&tokens[0], &hdr, sizeof(hdr));
+   for (int i = 1; i < 8; i++)
+      memset(&tokens[i], seed + i, sizeof(tokens[i]));
+}
+
+static void fill_strings(struct vrend_strarray *sa, const char *main)
+{
+   struct vrend_strbuf sb;
+
+   strarray_alloc(sa, SHADER_MAX_STRINGS);
+   strbuf_alloc(&sb, 64);
+   strbuf_append(&sb, "#version 140\n");
+   strarray_addstrbuf(sa, &sb);
+   strbuf_alloc(&sb, 64);
+   strbuf_append(&sb, "in vec4 in_0;\n");
+   strarray_addstrbuf(sa, &sb);
+   strbuf_alloc(&sb, 64);
+   strbuf_append(&sb, main);
+   strarray_addstrbuf(sa, &sb);
+}
+
+static void free_sinfo(struct vrend_shader_info *sinfo)
+{
+   free(sinfo->sampler_arrays);
+   free(sinfo->image_arrays);
+   free(sinfo->interpinfo);
+   if (sinfo->so_names) {
+      for (unsigned i = 0; i < sinfo->so_info.num_outputs; i++)
+         free(sinfo->so_names[i]);
+      free(sinfo->so_names);
+   }
+}
+
+START_TEST(shader_cache_disabled)
+{
+   struct vrend_shader_cfg cfg = {0};
+   struct vrend_shader_key key = {0};
+   struct vrend_shader_info sinfo = {0};
+   struct vrend_strarray sa;
+   struct tgsi_token tokens[8];
+
+   ck_assert_int_eq(vrend_shader_cache_init(NULL, 1024 * 1024), false);
+   ck_assert_int_eq(vrend_shader_cache_enabled(), false);
+
+   fill_tokens(tokens, 0);
+   strarray_alloc(&sa, SHADER_MAX_STRINGS);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), false);
+   strarray_free(&sa, true);
+}
+END_TEST
+
+START_TEST(shader_cache_roundtrip)
+{
+   struct vrend_shader_cfg cfg = { .glsl_version = 140, .max_draw_buffers = 8 };
+   struct vrend_shader_key key = { .flatshade = true };
+   struct vrend_shader_info sinfo = {0}, cached = {0};
+   struct vrend_shader_cache_stats stats;
+   struct vrend_strarray sa, cached_sa;
+   struct tgsi_token tokens[8];
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+
+   fill_tokens(tokens, 1);
+   fill_strings(&sa, "void main() {}\n");
+   sa.strings[1].tag = 0x601;
+   sinfo.num_inputs = 3;
+   sinfo.samplers_used_mask = 0x5;
+   sinfo.num_sampler_arrays = 1;
+   sinfo.sampler_arrays = calloc(1, sizeof(struct vrend_array));
+   sinfo.sampler_arrays[0].first = 0;
+   sinfo.sampler_arrays[0].array_size = 3;
+   sinfo.num_interps = 2;
+   sinfo.interpinfo = calloc(2, sizeof(struct vrend_interp_info));
+   sinfo.interpinfo[1].semantic_index = 7;
+   sinfo.so_info.num_outputs = 2;
+   sinfo.so_names = calloc(2, sizeof(char *));
+   sinfo.so_names[0] = strdup("tfout0");
+   sinfo.so_names[1] = strdup("tfout1");
+
+   strarray_alloc(&cached_sa, SHADER_MAX_STRINGS);
+   cached.so_info = sinfo.so_info;
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &cached, &cached_sa), false);
+
+   vrend_shader_cache_store(&cfg, tokens, 0, &key, &sinfo, &sa);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &cached, &cached_sa), true);
+
+   ck_assert_int_eq(cached_sa.num_strings, 3);
+   for (int i = 0; i < 3; i++) {
+      ck_assert_str_eq(cached_sa.strings[i].buf, sa.strings[i].buf);
+      ck_assert_int_eq(cached_sa.strings[i].size, sa.strings[i].size);
+      ck_assert_int_eq(cached_sa.strings[i].tag, sa.strings[i].tag);
+   }
+   ck_assert_int_eq(cached.num_inputs, 3);
+   ck_assert_int_eq(cached.samplers_used_mask, 0x5);
+   ck_assert_int_eq(cached.num_sampler_arrays, 1);
+   ck_assert_int_eq(cached.sampler_arrays[0].array_size, 3);
+   ck_assert_int_eq(cached.interpinfo[1].semantic_index, 7);
+   ck_assert_str_eq(cached.so_names[1], "tfout1");
+
+   vrend_shader_cache_get_stats(&stats);
+   ck_assert_int_eq(stats.hits, 1);
+   ck_assert_int_eq(stats.misses, 1);
+   ck_assert_int_eq(stats.stores, 1);
+
+   strarray_free(&cached_sa, true);
+   strarray_free(&sa, true);
+   free_sinfo(&cached);
+   free_sinfo(&sinfo);
+}
+END_TEST
+
+START_TEST(shader_cache_key_mismatch)
+{
+   struct vrend_shader_cfg cfg = { .glsl_version = 140 };
+   struct vrend_shader_key key = {0};
+   struct vrend_shader_info sinfo = {0};
+   struct vrend_strarray sa;
+   struct tgsi_token tokens[8];
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+
+   fill_tokens(tokens, 1);
+   fill_strings(&sa, "void main() {}\n");
+   vrend_shader_cache_store(&cfg, tokens, 0, &key, &sinfo, &sa);
+   strarray_free(&sa, true);
+
+   strarray_alloc(&sa, SHADER_MAX_STRINGS);
+   key.color_two_side = true;
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), false);
+   key.color_two_side = false;
+   cfg.use_gles = true;
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), false);
+   cfg.use_gles = false;
+   fill_tokens(tokens, 2);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), false);
+   ck_assert_int_eq(sa.num_strings, 0);
+   strarray_free(&sa, true);
+}
+END_TEST
+
+START_TEST(shader_cache_persistent)
+{
+   struct vrend_shader_cfg cfg = { .glsl_version = 300, .use_gles = true };
+   struct vrend_shader_key key = {0};
+   struct vrend_shader_info sinfo = {0};
+   struct vrend_shader_cache_stats stats;
+   struct vrend_strarray sa;
+   struct tgsi_token tokens[8];
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+   fill_tokens(tokens, 3);
+   fill_strings(&sa, "void main() { gl_Position = in_0; }\n");
+   vrend_shader_cache_store(&cfg, tokens, 0, &key, &sinfo, &sa);
+   strarray_free(&sa, true);
+   vrend_shader_cache_fini();
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+   vrend_shader_cache_get_stats(&stats);
+   ck_assert_int_gt(stats.size, 0);
+
+   strarray_alloc(&sa, SHADER_MAX_STRINGS);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), true);
+   ck_assert_str_eq(sa.strings[2].buf, "void main() { gl_Position = in_0; }\n");
+   strarray_free(&sa, true);
+   free_sinfo(&sinfo);
+}
+END_TEST
+
+/* pretend every file in the cache was written by another build */
+static void corrupt_build_ids(void)
+{
+   struct dirent *dent;
+   char name[PATH_MAX];
+   DIR *dir;
+
+   dir = opendir(cache_dir);
+   ck_assert_ptr_ne(dir, NULL);
+   while ((dent = readdir(dir))) {
+      uint8_t byte;
+      int fd;
+
+      if (dent->d_name[0] == '.')
+         continue;
+      snprintf(name, sizeof(name), "%s/%s", cache_dir, dent->d_name);
+      fd = open(name, O_RDWR);
+      ck_assert_int_ge(fd, 0);
+      /* the build id follows the magic and the version */
+      ck_assert_int_eq(pread(fd, &byte, 1, 8), 1);
+      byte ^= 0xff;
+      ck_assert_int_eq(pwrite(fd, &byte, 1, 8), 1);
+      close(fd);
+   }
+   closedir(dir);
+}
+
+static unsigned count_files(void)
+{
+   struct dirent *dent;
+   unsigned count = 0;
+   DIR *dir;
+
+   dir = opendir(cache_dir);
+   ck_assert_ptr_ne(dir, NULL);
+   while ((dent = readdir(dir)))
+      count += dent->d_name[0] != '.';
+   closedir(dir);
+   return count;
+}
+
+START_TEST(shader_cache_stale_build)
+{
+   struct vrend_shader_cfg cfg = { .glsl_version = 140 };
+   struct vrend_shader_key key = {0};
+   struct vrend_shader_info sinfo = {0};
+   struct vrend_shader_cache_stats stats;
+   struct vrend_strarray sa;
+   struct tgsi_token tokens[8];
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+   fill_tokens(tokens, 4);
+   fill_strings(&sa, "void main() { gl_Position = in_0; }\n");
+   vrend_shader_cache_store(&cfg, tokens, 0, &key, &sinfo, &sa);
+   strarray_free(&sa, true);
+   vrend_shader_cache_fini();
+   ck_assert_int_eq(count_files(), 1);
+
+   corrupt_build_ids();
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+   vrend_shader_cache_get_stats(&stats);
+   ck_assert_int_eq(stats.size, 0);
+   ck_assert_int_eq(count_files(), 0);
+
+   strarray_alloc(&sa, SHADER_MAX_STRINGS);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), false);
+   strarray_free(&sa, true);
+}
+END_TEST
+
+START_TEST(shader_cache_eviction)
+{
+   struct vrend_shader_cfg cfg = { .glsl_version = 140 };
+   struct vrend_shader_key key = {0};
+   struct vrend_shader_info sinfo = {0};
+   struct vrend_shader_cache_stats stats;
+   struct vrend_strarray sa;
+   struct tgsi_token tokens[8];
+   char main[2048];
+
+   /* room for a couple of entries only */
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 3 * sizeof(main) +
+                                            2 * sizeof(struct vrend_shader_info)), true);
+
+   memset(main, 'x', sizeof(main) - 1);
+   main[sizeof(main) - 1] = 0;
+   for (int i = 0; i < 8; i++) {
+      fill_tokens(tokens, i);
+      fill_strings(&sa, main);
+      vrend_shader_cache_store(&cfg, tokens, 0, &key, &sinfo, &sa);
+      strarray_free(&sa, true);
+
+      vrend_shader_cache_get_stats(&stats);
+      ck_assert_uint_le(stats.size, stats.max_size);
+   }
+   ck_assert_int_gt(stats.evictions, 0);
+
+   /* the most recent entry survives, the oldest one is gone */
+   strarray_alloc(&sa, SHADER_MAX_STRINGS);
+   fill_tokens(tokens, 7);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), true);
+   strarray_free(&sa, true);
+
+   strarray_alloc(&sa, SHADER_MAX_STRINGS);
+   fill_tokens(tokens, 0);
+   ck_assert_int_eq(vrend_shader_cache_lookup(&cfg, tokens, 0, &key, &sinfo, &sa), false);
+   strarray_free(&sa, true);
+   free_sinfo(&sinfo);
+}
+END_TEST
+
+START_TEST(shader_cache_program_blob)
+{
+   struct vrend_cache_blob key = {0}, data = {0}, cached = {0};
+   struct vrend_shader_cache_stats stats;
+   uint32_t binary[64];
+
+   ck_assert_int_eq(vrend_shader_cache_init(cache_dir, 1024 * 1024), true);
+
+   for (int i = 0; i < 64; i++)
+      binary[i] = i * 3;
+   vrend_cache_blob_write_u32(&key, 42);
+   vrend_cache_blob_write(&data, binary, sizeof(binary));
+
+   ck_assert_int_eq(vrend_program_cache_lookup(&key, &cached), false);
+   vrend_program_cache_store(&key, &data);
+   ck_assert_int_eq(vrend_program_cache_lookup(&key, &cached), true);
+   ck_assert_int_eq(cached.size, sizeof(binary));
+   ck_assert_int_eq(memcmp(cached.data, binary, sizeof(binary)), 0);
+   free(cached.data);
+   memset(&cached, 0, sizeof(cached));
+
+   /* a rejected binary must not be returned again */
+   vrend_program_cache_reject(&key);
+   ck_assert_int_eq(vrend_program_cache_lookup(&key, &cached), false);
+
+   vrend_shader_cache_get_stats(&stats);
+   ck_assert_int_eq(stats.program_hits, 1);
+   ck_assert_int_eq(stats.program_misses, 2);
+   ck_assert_int_eq(stats.program_stores, 1);
+   ck_assert_int_eq(stats.program_rejects, 1);
+   ck_assert_int_eq(stats.hits, 0);
+
+   free(key.data);
+   free(data.data);
+}
+END_TEST
+
+static Suite *init_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("vrend_shader_cache");
+  tc_core = tcase_create("shader_cache");
+  tcase_add_checked_fixture(tc_core, cache_setup, cache_teardown);
+
+  suite_add_tcase(s, tc_core);
+
+  tcase_add_test(tc_core, shader_cache_disabled);
+  tcase_add_test(tc_core, shader_cache_roundtrip);
+  tcase_add_test(tc_core, shader_cache_key_mismatch);
+  tcase_add_test(tc_core, shader_cache_persistent);
+  tcase_add_test(tc_core, shader_cache_stale_build);
+  tcase_add_test(tc_core, shader_cache_eviction);
+  tcase_add_test(tc_core, shader_cache_program_blob);
+  return s;
+}
+
+int main(void)
+{
+   Suite *s;
+   SRunner *sr;
+   int number_failed;
+
+   s = init_suite();
+   sr = srunner_create(s);
+
+   srunner_run_all(sr, CK_NORMAL);
+   number_failed = srunner_ntests_failed(sr);
+   srunner_free(sr);
+   return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,179 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/vrend_slab.h"
+
+/* Test the slab allocators used for renderer objects */
+
+struct test_object {
+   uint64_t a;
+   uint32_t b[13];
+};
+
+static void slab_setup(void)
+{
+   vrend_slab_init(true);
+}
+
+static void slab_setup_disabled(void)
+{
+   vrend_slab_init(false);
+}
+
+START_TEST(slab_alloc_reuse)
+{
+   struct vrend_slab *slab = vrend_slab_create(sizeof(struct test_object), false);
+   struct test_object *objs[100];
+   struct test_object *obj;
+   struct vrend_slab_stats stats;
+   unsigned i;
+
+   ck_assert_ptr_ne(slab, NULL);
+
+   for (i = 0; i < 100; i++) {
+      objs[i] = vrend_slab_alloc(slab);
+      ck_assert_ptr_ne(objs[i], NULL);
+      ck_assert_int_eq((uintptr_t)objs[i] & 15, 0);
+      ck_assert_int_eq(objs[i]->a, 0);
+      memset(objs[i], 0xff, sizeof(*objs[i]));
+   }
+
+   vrend_slab_get_stats(&stats);
+   ck_assert_int_eq(stats.allocs, 100);
+   ck_assert_int_eq(stats.live, 100);
+   ck_assert_int_lt(stats.page_allocs, 10);
+
+   /* freed objects come back zeroed without new pages */
+   vrend_slab_free(objs[42]);
+   obj = vrend_slab_alloc(slab);
+   ck_assert_ptr_eq(obj, objs[42]);
+   ck_assert_int_eq(obj->a, 0);
+   ck_assert_int_eq(obj->b[12], 0);
+
+   vrend_slab_get_stats(&stats);
+   ck_assert_int_eq(stats.allocs, 101);
+
+   for (i = 0; i < 100; i++)
+      vrend_slab_free(objs[i]);
+   vrend_slab_destroy(slab);
+
+   vrend_slab_get_stats(&stats);
+   ck_assert_int_eq(stats.allocs, 101);
+   ck_assert_int_eq(stats.live, 0);
+}
+END_TEST
+
+START_TEST(slab_destroy_with_live_objects)
+{
+   struct vrend_slab *slab = vrend_slab_create(sizeof(struct test_object), true);
+   struct test_object *obj;
+   struct vrend_slab_stats stats;
+
+   obj = vrend_slab_alloc(slab);
+   ck_assert_ptr_ne(obj, NULL);
+
+   /* the object stays usable until it is freed */
+   vrend_slab_destroy(slab);
+   obj->a = 1;
+
+   vrend_slab_get_stats(&stats);
+   ck_assert_int_eq(stats.live, 1);
+
+   vrend_slab_free(obj);
+   vrend_slab_get_stats(&stats);
+   ck_assert_int_eq(stats.live, 0);
+   ck_assert_int_eq(stats.allocs, 1);
+}
+END_TEST
+
+START_TEST(slab_disabled)
+{
+   struct vrend_slab *slab = vrend_slab_create(sizeof(struct test_object), false);
+   struct test_object *obj1, *obj2;
+   struct vrend_slab_stats stats;
+
+   obj1 = vrend_slab_alloc(slab);
+   obj2 = vrend_slab_alloc(slab);
+   ck_assert_ptr_ne(obj1, NULL);
+   ck_assert_ptr_ne(obj2, NULL);
+
+   vrend_slab_get_stats(&stats);
+   ck_assert_int_eq(stats.allocs, 2);
+   ck_assert_int_eq(stats.page_allocs, 2);
+
+   vrend_slab_free(obj1);
+   vrend_slab_destroy(slab);
+   vrend_slab_free(obj2);
+}
+END_TEST
+
+START_TEST(slab_null)
+{
+   ck_assert_ptr_eq(vrend_slab_alloc(NULL), NULL);
+   vrend_slab_free(NULL);
+   vrend_slab_destroy(NULL);
+}
+END_TEST
+
+static Suite *init_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+  TCase *tc_disabled;
+
+  s = suite_create("vrend_slab");
+  tc_core = tcase_create("slab");
+  tcase_add_checked_fixture(tc_core, slab_setup, NULL);
+  suite_add_tcase(s, tc_core);
+
+  tcase_add_test(tc_core, slab_alloc_reuse);
+  tcase_add_test(tc_core, slab_destroy_with_live_objects);
+  tcase_add_test(tc_core, slab_null);
+
+  tc_disabled = tcase_create("slab_disabled");
+  tcase_add_checked_fixture(tc_disabled, slab_setup_disabled, NULL);
+  suite_add_tcase(s, tc_disabled);
+
+  tcase_add_test(tc_disabled, slab_disabled);
+  return s;
+}
+
+int main(void)
+{
+   Suite *s;
+   SRunner *sr;
+   int number_failed;
+
+   s = init_suite();
+   sr = srunner_create(s);
+
+   srunner_run_all(sr, CK_NORMAL);
+   number_failed = srunner_ntests_failed(sr);
+   srunner_free(sr);
+   return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -183,6 +183,94 @@ START_TEST(strbuf_test_appendf_str)
 }
 END_TEST
 
+START_TEST(strbuf_test_external)
+{
+   struct vrend_strbuf sb;
+   char storage[8];
+   strbuf_init_external(&sb, storage, sizeof(storage));
+   strbuf_append(&sb, "hello");
+   ck_assert_ptr_eq(sb.buf, storage);
+   strbuf_appendf(&sb, "%s", " world");
+   ck_assert_ptr_ne(sb.buf, storage);
+   ck_assert_str_eq(sb.buf, "hello world");
+   ck_assert_int_eq(sb.external, false);
+   strbuf_free(&sb);
+}
+END_TEST
+
+static void rope_concat(struct vrend_strarray *sa, char *out)
+{
+   out[0] = 0;
+   for (int i = 0; i < sa->num_strings; i++)
+      strcat(out, sa->strings[i].buf);
+}
+
+START_TEST(rope_test_chunks)
+{
+   struct vrend_rope rope;
+   struct vrend_strarray sa;
+   char expected[4096] = "", result[4096];
+   char *first;
+
+   ck_assert_int_eq(rope_init(&rope, 64), true);
+   first = rope.segs[0].buf;
+   for (int i = 0; i < 100; i++) {
+      char line[32];
+      snprintf(line, sizeof(line), "line %d;\n", i);
+      strcat(expected, line);
+      if (i & 1)
+         rope_appendf(&rope, "line %d;\n", i);
+      else
+         rope_append(&rope, line);
+   }
+   ck_assert_int_eq(rope_get_error(&rope), false);
+   ck_assert_int_gt(rope.num_segs, 1);
+   /* text is never moved to a new chunk once written */
+   ck_assert_ptr_eq(rope.segs[0].buf, first);
+   /* chunks grow geometrically */
+   ck_assert_int_ge(rope.segs[rope.num_segs - 1].alloc_size, 2 * rope.segs[1].alloc_size);
+
+   ck_assert_int_eq(strarray_alloc(&sa, 1), true);
+   ck_assert_int_eq(rope_move_to_strarray(&rope, &sa), true);
+   ck_assert_int_eq(rope.num_segs, 0);
+   rope_concat(&sa, result);
+   ck_assert_str_eq(result, expected);
+   strarray_free(&sa, true);
+}
+END_TEST
+
+START_TEST(rope_test_placeholder)
+{
+   struct vrend_rope rope;
+   struct vrend_strarray sa;
+   char result[256];
+   int patched = 0;
+
+   ck_assert_int_eq(rope_init(&rope, 32), true);
+   rope_append(&rope, "layout(location = 0)\n");
+   rope_add_placeholder(&rope, 8, 1);
+   rope_append(&rope, "out vec4 a;\n");
+   rope_add_placeholder(&rope, 8, 2);
+   rope_appendf(&rope, "out vec4 %s;\n", "b");
+   ck_assert_int_eq(rope_get_error(&rope), false);
+
+   ck_assert_int_eq(strarray_alloc(&sa, 1), true);
+   ck_assert_int_eq(rope_move_to_strarray(&rope, &sa), true);
+   for (int i = 0; i < sa.num_strings; i++) {
+      if (sa.strings[i].tag == 2) {
+         ck_assert_int_eq(sa.strings[i].size, 8);
+         memcpy(sa.strings[i].buf, "flat", 4);
+         patched++;
+      }
+   }
+   ck_assert_int_eq(patched, 1);
+   rope_concat(&sa, result);
+   ck_assert_str_eq(result, "layout(location = 0)\n        out vec4 a;\n"
+                            "flat    out vec4 b;\n");
+   strarray_free(&sa, true);
+}
+END_TEST
+
 static Suite *init_suite(void)
 {
   Suite *s;
@@ -202,6 +290,9 @@ static Suite *init_suite(void)
   tcase_add_test(tc_core, strbuf_test_boundary2);
   tcase_add_test(tc_core, strbuf_test_appendf);
   tcase_add_test(tc_core, strbuf_test_appendf_str);
+  tcase_add_test(tc_core, strbuf_test_external);
+  tcase_add_test(tc_core, rope_test_chunks);
+  tcase_add_test(tc_core, rope_test_placeholder);
   return s;
 }
 
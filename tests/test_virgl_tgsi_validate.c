@@ -0,0 +1,218 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pipe/p_defines.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_text.h"
+#include "util/u_memory.h"
+#include "../src/vrend_tgsi_validate.h"
+#include "large_shader.h"
+
+/* Test the checks done on shaders sent as binary tokens */
+
+static const char *vs_text =
+   "VERT\n"
+   "DCL IN[0]\n"
+   "DCL IN[1]\n"
+   "DCL OUT[0], POSITION\n"
+   "DCL OUT[1], GENERIC[0]\n"
+   "DCL CONST[0..3]\n"
+   "DCL TEMP[0]\n"
+   "IMM[0] FLT32 {1.0, 0.0, 0.5, 2.0}\n"
+   "  0: MUL TEMP[0], IN[0].xxxx, CONST[0]\n"
+   "  1: MAD TEMP[0], IN[0].yyyy, CONST[1], TEMP[0]\n"
+   "  2: MAD OUT[0], IN[0].zzzz, CONST[2], TEMP[0]\n"
+   "  3: MOV OUT[1], IN[1]\n"
+   "  4: END\n";
+
+static const char *fs_tex_text =
+   "FRAG\n"
+   "DCL IN[0], GENERIC[0], PERSPECTIVE\n"
+   "DCL OUT[0], COLOR\n"
+   "DCL SAMP[0]\n"
+   "DCL SVIEW[0], 2D, FLOAT\n"
+   "DCL TEMP[0]\n"
+   "  0: TEX TEMP[0], IN[0], SAMP[0], 2D\n"
+   "  1: MOV OUT[0], TEMP[0]\n"
+   "  2: END\n";
+
+static struct tgsi_token tokens[8192];
+
+static unsigned translate(const char *text)
+{
+   ck_assert_int_eq(tgsi_text_translate(text, tokens, ARRAY_SIZE(tokens)), true);
+   return tgsi_num_tokens(tokens);
+}
+
+/* index of the first instruction token */
+static unsigned first_instruction(unsigned num_tokens)
+{
+   struct tgsi_parse_context parse;
+   unsigned pos;
+
+   tgsi_parse_init(&parse, tokens);
+   while (!tgsi_parse_end_of_tokens(&parse)) {
+      pos = parse.Position;
+      tgsi_parse_token(&parse);
+      if (parse.FullToken.Token.Type == TGSI_TOKEN_TYPE_INSTRUCTION)
+         return pos;
+   }
+   ck_assert(0);
+   return num_tokens;
+}
+
+START_TEST(tgsi_validate_translated)
+{
+   unsigned n;
+
+   n = translate(vs_text);
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_VERTEX), true);
+
+   n = translate(fs_tex_text);
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_FRAGMENT), true);
+
+   n = translate(large_frag);
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_FRAGMENT), true);
+}
+END_TEST
+
+START_TEST(tgsi_validate_header)
+{
+   unsigned n = translate(vs_text);
+
+   /* the tokens must match the shader type and fit the sent size */
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_FRAGMENT), false);
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_TYPES), false);
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n - 1, PIPE_SHADER_VERTEX), false);
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, 1, PIPE_SHADER_VERTEX), false);
+
+   /* a header claiming more tokens than were sent */
+   ((struct tgsi_header *)tokens)->BodySize += 1;
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_VERTEX), false);
+}
+END_TEST
+
+START_TEST(tgsi_validate_instruction)
+{
+   unsigned n = translate(vs_text);
+   unsigned pos = first_instruction(n);
+   struct tgsi_instruction *inst = (struct tgsi_instruction *)&tokens[pos];
+   struct tgsi_instruction saved = *inst;
+
+   ck_assert_int_eq(inst->Opcode, TGSI_OPCODE_MUL);
+
+   /* a removed opcode */
+   inst->Opcode = 22;
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_VERTEX), false);
+   *inst = saved;
+
+   /* operand counts must match the opcode */
+   inst->NumSrcRegs = 1;
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_VERTEX), false);
+   *inst = saved;
+
+   /* NrTokens must agree with what the flags make tgsi_parse read */
+   inst->NrTokens += 1;
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_VERTEX), false);
+   *inst = saved;
+
+   ((struct tgsi_dst_register *)&tokens[pos + 1])->File = TGSI_FILE_COUNT;
+   ck_assert_int_eq(vrend_tgsi_validate(tokens, n, PIPE_SHADER_VERTEX), false);
+}
+END_TEST
+
+START_TEST(tgsi_validate_garbage)
+{
+   unsigned n = translate(fs_tex_text);
+   unsigned rejected = 0;
+   uint32_t seed = 1;
+
+   /* random corruption of the body is either rejected, or leaves tokens
+    * that tgsi_parse walks to exactly the end of the buffer */
+   for (int i = 0; i < 10000; i++) {
+      struct tgsi_token *copy = malloc(n * sizeof(struct tgsi_token));
+      uint32_t *cwords = (uint32_t *)copy;
+      struct tgsi_parse_context parse;
+
+      memcpy(copy, tokens, n * sizeof(struct tgsi_token));
+      for (int j = 0; j < 3; j++) {
+         seed = seed * 1103515245 + 12345;
+         cwords[2 + (seed >> 8) % (n - 2)] ^= 1u << ((seed >> 3) % 32);
+      }
+
+      if (!vrend_tgsi_validate(copy, n, PIPE_SHADER_FRAGMENT)) {
+         rejected++;
+         free(copy);
+         continue;
+      }
+
+      ck_assert_int_eq(tgsi_parse_init(&parse, copy), TGSI_PARSE_OK);
+      while (!tgsi_parse_end_of_tokens(&parse)) {
+         tgsi_parse_token(&parse);
+         ck_assert_uint_le(parse.Position, n);
+      }
+      ck_assert_uint_eq(parse.Position, n);
+      tgsi_parse_free(&parse);
+      free(copy);
+   }
+   ck_assert_uint_gt(rejected, 0);
+   ck_assert_uint_lt(rejected, 10000);
+}
+END_TEST
+
+static Suite *init_suite(void)
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create("vrend_tgsi_validate");
+  tc_core = tcase_create("tgsi_validate");
+
+  suite_add_tcase(s, tc_core);
+
+  tcase_add_test(tc_core, tgsi_validate_translated);
+  tcase_add_test(tc_core, tgsi_validate_header);
+  tcase_add_test(tc_core, tgsi_validate_instruction);
+  tcase_add_test(tc_core, tgsi_validate_garbage);
+  return s;
+}
+
+int main(void)
+{
+   Suite *s;
+   SRunner *sr;
+   int number_failed;
+
+   s = init_suite();
+   sr = srunner_create(s);
+
+   srunner_run_all(sr, CK_NORMAL);
+   number_failed = srunner_ntests_failed(sr);
+   srunner_free(sr);
+   return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -25,6 +25,7 @@
 /* transfer and iov related tests */
 #include <check.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/uio.h>
 #include <errno.h>
 #include <virglrenderer.h>
@@ -321,6 +322,97 @@ START_TEST(virgl_test_transfer_1d)
 }
 END_TEST
 
+/* reads into the backing only land once a later fence signals */
+START_TEST(virgl_test_transfer_1d_async_readback)
+{
+    struct virgl_resource res;
+    unsigned char data[50*4];
+    struct iovec iov = { .iov_base = data, .iov_len = sizeof(data) };
+    int niovs = 1;
+    int ret;
+    unsigned i;
+    struct virgl_box box;
+    unsigned char *ptr;
+
+    context_flags |= VIRGL_RENDERER_ASYNC_READBACK;
+    ret = testvirgl_init_single_ctx();
+    context_flags &= ~VIRGL_RENDERER_ASYNC_READBACK;
+    ck_assert_int_eq(ret, 0);
+
+    ret = testvirgl_create_backed_simple_1d_res(&res, 1);
+    ck_assert_int_eq(ret, 0);
+    virgl_renderer_ctx_attach_resource(1, res.handle);
+
+    box.x = box.y = box.z = 0;
+    box.w = 50;
+    box.h = 1;
+    box.d = 1;
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = i;
+
+    ret = virgl_renderer_transfer_write_iov(res.handle, 1, 0, 0, 0, &box, 0, &iov, niovs);
+    ck_assert_int_eq(ret, 0);
+
+    ptr = res.iovs[0].iov_base;
+    memset(ptr, 0, res.iovs[0].iov_len);
+    ret = virgl_renderer_transfer_read_iov(res.handle, 1, 0, 0, 0, &box, 0, NULL, 0);
+    ck_assert_int_eq(ret, 0);
+
+    testvirgl_reset_fence();
+    ret = virgl_renderer_create_fence(1, 1);
+    ck_assert_int_eq(ret, 0);
+    while (testvirgl_get_last_fence() != 1)
+        virgl_renderer_poll();
+
+    for (i = 0; i < sizeof(data); i++) {
+        ck_assert_int_eq(ptr[i], i);
+    }
+
+    virgl_renderer_ctx_detach_resource(1, res.handle);
+    testvirgl_destroy_backed_res(&res);
+    testvirgl_fini_single_ctx();
+}
+END_TEST
+
+/* rows straddling iovecs go through a bounce, the others are used in place */
+START_TEST(virgl_test_transfer_2d_split_iovs)
+{
+    struct virgl_resource res;
+    unsigned char data[50*50*4], result[50*50*4];
+    struct iovec iovs[2];
+    int ret;
+    unsigned i;
+    struct virgl_box box = { .w = 50, .h = 50, .d = 1 };
+
+    ret = testvirgl_create_backed_simple_2d_res(&res, 1, 50, 50);
+    ck_assert_int_eq(ret, 0);
+    virgl_renderer_ctx_attach_resource(1, res.handle);
+
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = i * 7;
+
+    /* row 20 straddles the two iovecs */
+    iovs[0].iov_base = data;
+    iovs[0].iov_len = 4100;
+    iovs[1].iov_base = data + 4100;
+    iovs[1].iov_len = sizeof(data) - 4100;
+    ret = virgl_renderer_transfer_write_iov(res.handle, 1, 0, 0, 0, &box, 0, iovs, 2);
+    ck_assert_int_eq(ret, 0);
+
+    memset(result, 0, sizeof(result));
+    iovs[0].iov_base = result;
+    iovs[0].iov_len = 6000;
+    iovs[1].iov_base = result + 6000;
+    iovs[1].iov_len = sizeof(result) - 6000;
+    ret = virgl_renderer_transfer_read_iov(res.handle, 1, 0, 0, 0, &box, 0, iovs, 2);
+    ck_assert_int_eq(ret, 0);
+    ck_assert_int_eq(memcmp(data, result, sizeof(data)), 0);
+
+    virgl_renderer_ctx_detach_resource(1, res.handle);
+    testvirgl_destroy_backed_res(&res);
+}
+END_TEST
+
 START_TEST(virgl_test_transfer_1d_bad_iov)
 {
     struct virgl_renderer_resource_create_args res;
@@ -717,6 +809,100 @@ START_TEST(virgl_test_transfer_inline_valid_large)
 }
 END_TEST
 
+/* write a buffer often enough to wrap the upload ring, the last write wins */
+START_TEST(virgl_test_transfer_inline_buffer_ring)
+{
+  struct virgl_context ctx;
+  struct virgl_resource res;
+  struct pipe_box box;
+  unsigned size = 32 * 1024;
+  unsigned char *data;
+  unsigned char *ptr;
+  unsigned i;
+  int ret;
+
+  setenv("VREND_STREAM_RING_SIZE", "1", 1);
+  ret = testvirgl_init_ctx_cmdbuf(&ctx);
+  ck_assert_int_eq(ret, 0);
+
+  ret = testvirgl_create_backed_simple_buffer(&res, 1, size, PIPE_BIND_VERTEX_BUFFER);
+  ck_assert_int_eq(ret, 0);
+  virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+  data = malloc(size);
+  box.x = 0;
+  box.y = 0;
+  box.z = 0;
+  box.width = size;
+  box.height = 1;
+  box.depth = 1;
+  for (i = 0; i < 40; i++) {
+    memset(data, i, size);
+    virgl_encoder_inline_write(&ctx, &res, 0, 0, &box, data, size, 0);
+    ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+    ck_assert_int_eq(ret, 0);
+    ctx.cbuf->cdw = 0;
+  }
+
+  ret = virgl_renderer_transfer_read_iov(res.handle, ctx.ctx_id, 0, 0, 0,
+                                         (struct virgl_box *)&box, 0, NULL, 0);
+  ck_assert_int_eq(ret, 0);
+  ptr = res.iovs[0].iov_base;
+  for (i = 0; i < size; i++)
+    ck_assert_int_eq(ptr[i], 39);
+
+  free(data);
+  virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+  testvirgl_destroy_backed_res(&res);
+  testvirgl_fini_ctx_cmdbuf(&ctx);
+  unsetenv("VREND_STREAM_RING_SIZE");
+}
+END_TEST
+
+/* a texture upload large enough for the staging ring keeps its contents */
+START_TEST(virgl_test_transfer_inline_texture_staged)
+{
+  struct virgl_renderer_upload_stats stats;
+  struct virgl_context ctx;
+  struct virgl_resource res;
+  struct pipe_box box = { .width = 50, .height = 50, .depth = 1 };
+  struct virgl_box vbox = { .w = 50, .h = 50, .d = 1 };
+  unsigned char data[50 * 50 * 4], result[50 * 50 * 4];
+  struct iovec iov = { .iov_base = result, .iov_len = sizeof(result) };
+  unsigned i;
+  int ret;
+
+  context_flags |= VIRGL_RENDERER_CMD_STATS;
+  ret = testvirgl_init_ctx_cmdbuf(&ctx);
+  context_flags &= ~VIRGL_RENDERER_CMD_STATS;
+  ck_assert_int_eq(ret, 0);
+
+  ret = testvirgl_create_backed_simple_2d_res(&res, 1, 50, 50);
+  ck_assert_int_eq(ret, 0);
+  virgl_renderer_ctx_attach_resource(ctx.ctx_id, res.handle);
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i;
+  virgl_encoder_inline_write(&ctx, &res, 0, 0, &box, data, box.width * 4, 0);
+  ret = virgl_renderer_submit_cmd(ctx.cbuf->buf, ctx.ctx_id, ctx.cbuf->cdw);
+  ck_assert_int_eq(ret, 0);
+
+  ret = virgl_renderer_transfer_read_iov(res.handle, ctx.ctx_id, 0, 0, 0,
+                                         &vbox, 0, &iov, 1);
+  ck_assert_int_eq(ret, 0);
+  ck_assert_int_eq(memcmp(data, result, sizeof(data)), 0);
+
+  /* staged or not depends on the host GL, but the upload is accounted */
+  virgl_renderer_get_upload_stats(&stats);
+  ck_assert_int_eq(stats.staged_count + stats.direct_count, 1);
+  ck_assert_int_eq(stats.staged_bytes + stats.direct_bytes, sizeof(data));
+
+  virgl_renderer_ctx_detach_resource(ctx.ctx_id, res.handle);
+  testvirgl_destroy_backed_res(&res);
+  testvirgl_fini_ctx_cmdbuf(&ctx);
+}
+END_TEST
+
 START_TEST(virgl_test_transfer_to_staging_without_iov_fails)
 {
   static const unsigned bufsize = 50;
@@ -960,6 +1146,7 @@ static Suite *virgl_init_suite(void)
   tcase_add_test(tc_core, virgl_test_transfer_read_1d_array_bad_box);
   tcase_add_test(tc_core, virgl_test_transfer_read_3d_bad_box);
   tcase_add_test(tc_core, virgl_test_transfer_1d);
+  tcase_add_test(tc_core, virgl_test_transfer_2d_split_iovs);
   tcase_add_test(tc_core, virgl_test_transfer_1d_bad_iov);
   tcase_add_test(tc_core, virgl_test_transfer_1d_bad_iov_offset);
   tcase_add_test(tc_core, virgl_test_transfer_1d_bad_strides);
@@ -978,6 +1165,8 @@ static Suite *virgl_init_suite(void)
   tcase_add_loop_test(tc_core, virgl_test_transfer_inline_valid, 0, PIPE_MAX_TEXTURE_TYPES);
   tcase_add_loop_test(tc_core, virgl_test_transfer_inline_invalid, 0, PIPE_MAX_TEXTURE_TYPES);
   tcase_add_loop_test(tc_core, virgl_test_transfer_inline_valid_large, 0, PIPE_MAX_TEXTURE_TYPES);
+  tcase_add_test(tc_core, virgl_test_transfer_inline_buffer_ring);
+  tcase_add_test(tc_core, virgl_test_transfer_inline_texture_staged);
 
   suite_add_tcase(s, tc_core);
 
@@ -996,6 +1185,11 @@ static Suite *virgl_init_suite(void)
 
   suite_add_tcase(s, tc_core);
 
+  tc_core = tcase_create("transfer_async_readback");
+  tcase_add_test(tc_core, virgl_test_transfer_1d_async_readback);
+
+  suite_add_tcase(s, tc_core);
+
   return s;
 
 }
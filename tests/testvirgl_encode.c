@@ -300,6 +300,50 @@ int virgl_encode_shader_state(struct virgl_context *ctx,
    return 0;
 }
 
+int virgl_encode_shader_state_tokens(struct virgl_context *ctx,
+                                     uint32_t handle,
+                                     uint32_t type,
+                                     const struct pipe_shader_state *shader)
+{
+   const uint8_t *data = (const uint8_t *)shader->tokens;
+   uint32_t num_tokens = tgsi_num_tokens(shader->tokens);
+   uint32_t total_size = num_tokens * sizeof(struct tgsi_token);
+   uint32_t left_bytes = total_size;
+   uint32_t base_hdr_size, strm_hdr_size, thispass;
+   bool first_pass = true;
+
+   base_hdr_size = 5;
+   strm_hdr_size = shader->stream_output.num_outputs ? shader->stream_output.num_outputs * 2 + 4 : 0;
+   while (left_bytes) {
+      uint32_t length, offlen, len;
+      int hdr_len = base_hdr_size + (first_pass ? strm_hdr_size : 0);
+      if (ctx->cbuf->cdw + hdr_len + 1 > VIRGL_MAX_CMDBUF_DWORDS)
+         ctx->flush(ctx);
+
+      thispass = (VIRGL_MAX_CMDBUF_DWORDS - ctx->cbuf->cdw - hdr_len - 1) * 4;
+
+      length = MIN2(thispass, left_bytes);
+      len = (length / 4) + hdr_len;
+
+      if (first_pass)
+         offlen = VIRGL_OBJ_SHADER_OFFSET_VAL(total_size);
+      else
+         offlen = VIRGL_OBJ_SHADER_OFFSET_VAL(total_size - left_bytes) | VIRGL_OBJ_SHADER_OFFSET_CONT;
+
+      virgl_emit_shader_header(ctx, handle, len, type | VIRGL_OBJ_SHADER_TYPE_FORMAT(VIRGL_OBJ_SHADER_FORMAT_TGSI_TOKENS),
+                               offlen, num_tokens);
+
+      virgl_emit_shader_streamout(ctx, first_pass ? &shader->stream_output : NULL);
+
+      virgl_encoder_write_block(ctx->cbuf, data, length);
+
+      data += length;
+      first_pass = false;
+      left_bytes -= length;
+   }
+   return 0;
+}
+
 
 int virgl_encode_clear(struct virgl_context *ctx,
                       unsigned buffers,
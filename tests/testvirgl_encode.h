@@ -81,6 +81,12 @@ extern int virgl_encode_shader_state(struct virgl_context *ctx,
 				     const struct pipe_shader_state *shader,
 				     const char *shad_str);
 
+/* send the shader as binary tokens instead of text */
+extern int virgl_encode_shader_state_tokens(struct virgl_context *ctx,
+                                            uint32_t handle,
+                                            uint32_t type,
+                                            const struct pipe_shader_state *shader);
+
 int virgl_encode_stream_output_info(struct virgl_context *ctx,
                                    uint32_t handle,
                                    uint32_t type,
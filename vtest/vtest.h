@@ -73,5 +73,8 @@ void vtest_destroy_renderer(void);
 
 void vtest_set_max_length(uint32_t length);
 
+/* print the per command stats of ctx_id, or of all contexts if it is 0 */
+void vtest_dump_cmd_stats(uint32_t ctx_id);
+
 #endif
 
@@ -67,6 +67,7 @@ struct vtest_renderer {
    int out_fd;
    unsigned protocol_version;
    struct util_hash_table *iovec_hash;
+   bool cmd_stats;
 };
 
 struct vtest_renderer renderer;
@@ -215,6 +216,11 @@ int vtest_create_renderer(struct vtest_input *input, int out_fd, uint32_t length
    /* By default we support version 0 unless VCMD_PROTOCOL_VERSION is sent */
    renderer.protocol_version = 0;
 
+   /* VTEST_CMD_STATS dumps the time spent per command on exit */
+   renderer.cmd_stats = getenv("VTEST_CMD_STATS") != NULL;
+   if (renderer.cmd_stats)
+      ctx_flags |= VIRGL_RENDERER_CMD_STATS;
+
    ret = virgl_renderer_init(&renderer,
          ctx_flags | VIRGL_RENDERER_THREAD_SYNC, &vtest_cbs);
    if (ret) {
@@ -306,8 +312,53 @@ int vtest_protocol_version(UNUSED uint32_t length_dw)
    return 0;
 }
 
+void vtest_dump_cmd_stats(uint32_t stats_ctx_id)
+{
+   struct virgl_renderer_cmd_stats stats;
+   struct virgl_renderer_upload_stats uploads;
+   struct virgl_renderer_alloc_stats allocs;
+   uint32_t cmd;
+   int i;
+
+   fprintf(stderr, "%-28s %10s %10s %12s %12s  histogram (log2 ns: count)\n",
+           "command", "count", "elided", "avg ns", "max ns");
+   for (cmd = 0; !virgl_renderer_get_cmd_stats(stats_ctx_id, cmd, &stats); cmd++) {
+      if (!stats.count && !stats.elided)
+         continue;
+
+      fprintf(stderr, "%-28s %10llu %10llu %12llu %12llu ", stats.name,
+              (unsigned long long)stats.count,
+              (unsigned long long)stats.elided,
+              (unsigned long long)(stats.count ? stats.total_ns / stats.count : 0),
+              (unsigned long long)stats.max_ns);
+      for (i = 0; i < VIRGL_RENDERER_CMD_STATS_BUCKETS; i++) {
+         if (stats.buckets[i])
+            fprintf(stderr, " %d:%llu", i, (unsigned long long)stats.buckets[i]);
+      }
+      fprintf(stderr, "\n");
+   }
+
+   virgl_renderer_get_upload_stats(&uploads);
+   fprintf(stderr, "texture uploads: %llu staged (%llu bytes), %llu direct (%llu bytes)\n",
+           (unsigned long long)uploads.staged_count,
+           (unsigned long long)uploads.staged_bytes,
+           (unsigned long long)uploads.direct_count,
+           (unsigned long long)uploads.direct_bytes);
+
+   virgl_renderer_get_alloc_stats(&allocs);
+   fprintf(stderr, "slab allocations: %llu (%llu live) from %llu heap allocations, %.0f allocations/s saved\n",
+           (unsigned long long)allocs.allocs,
+           (unsigned long long)allocs.live,
+           (unsigned long long)allocs.page_allocs,
+           allocs.elapsed_ns ?
+           (allocs.allocs - allocs.page_allocs) * 1e9 / allocs.elapsed_ns : 0.0);
+}
+
 void vtest_destroy_renderer(void)
 {
+   if (renderer.cmd_stats)
+      vtest_dump_cmd_stats(ctx_id);
+
    virgl_renderer_context_destroy(ctx_id);
    virgl_renderer_cleanup(&renderer);
    util_hash_table_destroy(renderer.iovec_hash);
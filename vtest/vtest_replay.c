@@ -0,0 +1,467 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2026 virglrenderer contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Replays a capture written with VIRGL_CAPTURE_FILE as fast as possible
+ * and reports the throughput, the time between fences, taken as frame
+ * times, and the cost of every command type.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "util.h"
+#include "util/u_memory.h"
+#include "util/u_hash_table.h"
+#include "util/u_pointer.h"
+#include "util/u_math.h"
+#include "vtest.h"
+#include "virglrenderer.h"
+#include "virgl_hw.h"
+#include "virgl_capture.h"
+
+struct replay_backing {
+   struct iovec iov;
+};
+
+static struct {
+   struct vtest_input input;
+   struct vtest_buffer buffer;
+   struct util_hash_table *backings;
+   uint32_t *payload;
+   uint32_t payload_size;
+
+   bool use_glx;
+   bool use_egl_surfaceless;
+   bool use_gles;
+
+   uint32_t last_fence;
+   uint32_t max_fence;
+
+   uint64_t records;
+   uint64_t submits;
+   uint64_t commands;
+   uint64_t frames;
+   uint64_t frame_start;
+   uint64_t frame_total;
+   uint64_t frame_min;
+   uint64_t frame_max;
+} replay;
+
+static void replay_write_fence(UNUSED void *cookie, uint32_t fence_id)
+{
+   replay.last_fence = fence_id;
+}
+
+static struct virgl_renderer_callbacks replay_cbs = {
+   .version = 1,
+   .write_fence = replay_write_fence,
+};
+
+static uint64_t replay_time_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void free_backing(void *value)
+{
+   struct replay_backing *backing = value;
+   free(backing->iov.iov_base);
+   free(backing);
+}
+
+static int replay_attach_backing(const uint32_t *payload, uint32_t len)
+{
+   struct replay_backing *backing;
+   uint32_t handle;
+
+   if (len < 2)
+      return -1;
+
+   handle = payload[0];
+   if (util_hash_table_get(replay.backings, intptr_to_pointer(handle)))
+      return 0;
+
+   backing = CALLOC_STRUCT(replay_backing);
+   if (!backing)
+      return -1;
+   backing->iov.iov_len = payload[1];
+   backing->iov.iov_base = calloc(1, MAX2(payload[1], 1));
+   if (!backing->iov.iov_base) {
+      free(backing);
+      return -1;
+   }
+
+   util_hash_table_set(replay.backings, intptr_to_pointer(handle), backing);
+   virgl_renderer_resource_attach_iov(handle, &backing->iov, 1);
+   return 0;
+}
+
+static int replay_backing_data(const uint32_t *payload, uint32_t len)
+{
+   struct replay_backing *backing;
+   uint32_t size;
+
+   if (len < 2)
+      return -1;
+
+   size = payload[1];
+   if (size > (len - 2) * 4)
+      return -1;
+
+   backing = util_hash_table_get(replay.backings, intptr_to_pointer(payload[0]));
+   if (backing)
+      memcpy(backing->iov.iov_base, payload + 2, MIN2(size, backing->iov.iov_len));
+   return 0;
+}
+
+static int replay_transfer(bool write, const uint32_t *payload, uint32_t len)
+{
+   struct virgl_box box;
+   struct iovec iov, *iovp = NULL;
+   uint32_t data_size;
+   uint64_t offset;
+   void *scratch = NULL;
+   int ret;
+
+   if (len < VIRGL_CAPTURE_TRANSFER_HDR_SIZE)
+      return -1;
+
+   box.x = payload[VIRGL_CAPTURE_TRANSFER_X];
+   box.y = payload[VIRGL_CAPTURE_TRANSFER_Y];
+   box.z = payload[VIRGL_CAPTURE_TRANSFER_Z];
+   box.w = payload[VIRGL_CAPTURE_TRANSFER_WIDTH];
+   box.h = payload[VIRGL_CAPTURE_TRANSFER_HEIGHT];
+   box.d = payload[VIRGL_CAPTURE_TRANSFER_DEPTH];
+   offset = payload[VIRGL_CAPTURE_TRANSFER_OFFSET_LO] |
+            (uint64_t)payload[VIRGL_CAPTURE_TRANSFER_OFFSET_HI] << 32;
+
+   data_size = payload[VIRGL_CAPTURE_TRANSFER_DATA_SIZE];
+   if (data_size) {
+      if (write) {
+         if (data_size > (len - VIRGL_CAPTURE_TRANSFER_HDR_SIZE) * 4)
+            return -1;
+         iov.iov_base = (void *)(payload + VIRGL_CAPTURE_TRANSFER_HDR_SIZE);
+      } else {
+         scratch = malloc(data_size);
+         if (!scratch)
+            return -1;
+         iov.iov_base = scratch;
+      }
+      iov.iov_len = data_size;
+      iovp = &iov;
+   }
+
+   if (write)
+      ret = virgl_renderer_transfer_write_iov(payload[VIRGL_CAPTURE_TRANSFER_HANDLE],
+                                              payload[VIRGL_CAPTURE_TRANSFER_CTX_ID],
+                                              payload[VIRGL_CAPTURE_TRANSFER_LEVEL],
+                                              payload[VIRGL_CAPTURE_TRANSFER_STRIDE],
+                                              payload[VIRGL_CAPTURE_TRANSFER_LAYER_STRIDE],
+                                              &box, offset, iovp, iovp ? 1 : 0);
+   else
+      ret = virgl_renderer_transfer_read_iov(payload[VIRGL_CAPTURE_TRANSFER_HANDLE],
+                                             payload[VIRGL_CAPTURE_TRANSFER_CTX_ID],
+                                             payload[VIRGL_CAPTURE_TRANSFER_LEVEL],
+                                             payload[VIRGL_CAPTURE_TRANSFER_STRIDE],
+                                             payload[VIRGL_CAPTURE_TRANSFER_LAYER_STRIDE],
+                                             &box, offset, iovp, iovp ? 1 : 0);
+   free(scratch);
+   if (ret)
+      fprintf(stderr, "transfer on resource %u failed: %d\n",
+              payload[VIRGL_CAPTURE_TRANSFER_HANDLE], ret);
+   return 0;
+}
+
+static int replay_submit(const uint32_t *payload, uint32_t len)
+{
+   uint32_t ndw, i;
+
+   if (len < 1)
+      return -1;
+
+   ndw = len - 1;
+   for (i = 0; i < ndw; i += (payload[1 + i] >> 16) + 1)
+      replay.commands++;
+   replay.submits++;
+
+   virgl_renderer_submit_cmd((void *)(payload + 1), payload[0], ndw);
+   return 0;
+}
+
+static int replay_fence(const uint32_t *payload, uint32_t len)
+{
+   uint64_t now = replay_time_ns();
+   uint64_t frame = now - replay.frame_start;
+
+   if (len < 2)
+      return -1;
+
+   replay.frames++;
+   replay.frame_total += frame;
+   replay.frame_min = replay.frames == 1 ? frame : MIN2(replay.frame_min, frame);
+   replay.frame_max = MAX2(replay.frame_max, frame);
+   replay.frame_start = now;
+
+   replay.max_fence = MAX2(replay.max_fence, payload[0]);
+   virgl_renderer_create_fence(payload[0], payload[1]);
+   virgl_renderer_poll();
+   return 0;
+}
+
+static int replay_record(uint32_t type, const uint32_t *payload, uint32_t len)
+{
+   struct virgl_renderer_resource_create_args args;
+
+   switch (type) {
+   case VIRGL_CAPTURE_HEADER:
+      if (len < 2 || payload[0] != VIRGL_CAPTURE_MAGIC ||
+          payload[1] != VIRGL_CAPTURE_VERSION) {
+         fprintf(stderr, "not a capture, or an unsupported version\n");
+         return -1;
+      }
+      return 0;
+   case VIRGL_CAPTURE_CTX_CREATE:
+      if (len < 2 || payload[1] > (len - 2) * 4)
+         return -1;
+      return virgl_renderer_context_create(payload[0], payload[1],
+                                           (const char *)(payload + 2)) ? -1 : 0;
+   case VIRGL_CAPTURE_CTX_DESTROY:
+      if (len < 1)
+         return -1;
+      virgl_renderer_context_destroy(payload[0]);
+      return 0;
+   case VIRGL_CAPTURE_RES_CREATE:
+      if (len < sizeof(args) / 4)
+         return -1;
+      memcpy(&args, payload, sizeof(args));
+      return virgl_renderer_resource_create(&args, NULL, 0) ? -1 : 0;
+   case VIRGL_CAPTURE_RES_UNREF:
+      if (len < 1)
+         return -1;
+      virgl_renderer_resource_unref(payload[0]);
+      util_hash_table_remove(replay.backings, intptr_to_pointer(payload[0]));
+      return 0;
+   case VIRGL_CAPTURE_ATTACH_BACKING:
+      return replay_attach_backing(payload, len);
+   case VIRGL_CAPTURE_DETACH_BACKING:
+      if (len < 1)
+         return -1;
+      virgl_renderer_resource_detach_iov(payload[0], NULL, NULL);
+      util_hash_table_remove(replay.backings, intptr_to_pointer(payload[0]));
+      return 0;
+   case VIRGL_CAPTURE_BACKING_DATA:
+      return replay_backing_data(payload, len);
+   case VIRGL_CAPTURE_CTX_ATTACH_RES:
+   case VIRGL_CAPTURE_CTX_DETACH_RES:
+      if (len < 2)
+         return -1;
+      if (type == VIRGL_CAPTURE_CTX_ATTACH_RES)
+         virgl_renderer_ctx_attach_resource(payload[0], payload[1]);
+      else
+         virgl_renderer_ctx_detach_resource(payload[0], payload[1]);
+      return 0;
+   case VIRGL_CAPTURE_TRANSFER_WRITE:
+   case VIRGL_CAPTURE_TRANSFER_READ:
+      return replay_transfer(type == VIRGL_CAPTURE_TRANSFER_WRITE, payload, len);
+   case VIRGL_CAPTURE_SUBMIT:
+      return replay_submit(payload, len);
+   case VIRGL_CAPTURE_FENCE:
+      return replay_fence(payload, len);
+   case VIRGL_CAPTURE_RESET:
+      virgl_renderer_reset();
+      util_hash_table_clear(replay.backings);
+      return 0;
+   default:
+      fprintf(stderr, "unknown capture record %u\n", type);
+      return -1;
+   }
+}
+
+static int replay_run(void)
+{
+   uint32_t header[VIRGL_CAPTURE_HDR_SIZE];
+   int ret;
+
+   while (replay.input.read(&replay.input, header, sizeof(header)) == sizeof(header)) {
+      uint32_t len = header[VIRGL_CAPTURE_LEN];
+
+      if (len > replay.payload_size) {
+         uint32_t *payload = realloc(replay.payload, len * 4);
+         if (!payload)
+            return -1;
+         replay.payload = payload;
+         replay.payload_size = len;
+      }
+
+      if (replay.input.read(&replay.input, replay.payload, len * 4) != (int)(len * 4)) {
+         fprintf(stderr, "truncated capture\n");
+         return -1;
+      }
+
+      ret = replay_record(header[VIRGL_CAPTURE_TYPE], replay.payload, len);
+      if (ret) {
+         fprintf(stderr, "record %" PRIu64 " (type %u) failed\n",
+                 replay.records, header[VIRGL_CAPTURE_TYPE]);
+         return ret;
+      }
+      replay.records++;
+   }
+
+   /* wait for the GPU to catch up with the last fence */
+   while (replay.max_fence && replay.last_fence < replay.max_fence) {
+      virgl_renderer_poll();
+      usleep(100);
+   }
+   return 0;
+}
+
+static void *replay_read_file(const char *path, int *size)
+{
+   struct stat st;
+   void *data;
+   FILE *file;
+
+   file = fopen(path, "rb");
+   if (!file || fstat(fileno(file), &st)) {
+      perror(path);
+      if (file)
+         fclose(file);
+      return NULL;
+   }
+
+   data = malloc(st.st_size);
+   if (data && fread(data, 1, st.st_size, file) != (size_t)st.st_size) {
+      perror(path);
+      free(data);
+      data = NULL;
+   }
+   fclose(file);
+
+   *size = st.st_size;
+   return data;
+}
+
+#define OPT_USE_GLX 'x'
+#define OPT_USE_EGL_SURFACELESS 's'
+#define OPT_USE_GLES 'e'
+
+int main(int argc, char **argv)
+{
+   static struct option long_options[] = {
+      {"use-glx",             no_argument, NULL, OPT_USE_GLX},
+      {"use-egl-surfaceless", no_argument, NULL, OPT_USE_EGL_SURFACELESS},
+      {"use-gles",            no_argument, NULL, OPT_USE_GLES},
+      {0, 0, 0, 0}
+   };
+   int option_index = 0, ctx_flags, size, ret;
+   uint64_t start, elapsed;
+   void *data;
+   double secs;
+
+   while ((ret = getopt_long(argc, argv, "", long_options, &option_index)) != -1) {
+      switch (ret) {
+      case OPT_USE_GLX:
+         replay.use_glx = true;
+         break;
+      case OPT_USE_EGL_SURFACELESS:
+         replay.use_egl_surfaceless = true;
+         break;
+      case OPT_USE_GLES:
+         replay.use_gles = true;
+         break;
+      default:
+         optind = argc;
+         break;
+      }
+   }
+
+   if (optind != argc - 1) {
+      printf("Usage: %s [--use-glx] [--use-egl-surfaceless] [--use-gles] capture\n",
+             argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   ctx_flags = VIRGL_RENDERER_USE_EGL;
+   if (replay.use_glx) {
+      ctx_flags = VIRGL_RENDERER_USE_GLX;
+   } else {
+      if (replay.use_egl_surfaceless)
+         ctx_flags |= VIRGL_RENDERER_USE_SURFACELESS;
+      if (replay.use_gles)
+         ctx_flags |= VIRGL_RENDERER_USE_GLES;
+   }
+
+   /* read the whole capture up front so disk io does not show up */
+   data = replay_read_file(argv[optind], &size);
+   if (!data)
+      return EXIT_FAILURE;
+   replay.buffer.buffer = data;
+   replay.buffer.size = size;
+   replay.input.data.buffer = &replay.buffer;
+   replay.input.read = vtest_buf_read;
+
+   replay.backings = util_hash_table_create_ptr_keys(free_backing);
+   if (!replay.backings)
+      return EXIT_FAILURE;
+
+   if (virgl_renderer_init(&replay, ctx_flags | VIRGL_RENDERER_CMD_STATS, &replay_cbs)) {
+      fprintf(stderr, "failed to initialise renderer.\n");
+      return EXIT_FAILURE;
+   }
+
+   start = replay_time_ns();
+   replay.frame_start = start;
+   ret = replay_run();
+   elapsed = replay_time_ns() - start;
+   secs = elapsed / 1e9;
+
+   printf("%" PRIu64 " records, %" PRIu64 " submits, %" PRIu64 " commands in %.3f s\n",
+          replay.records, replay.submits, replay.commands, secs);
+   if (secs > 0)
+      printf("%.0f submits/s, %.0f commands/s\n",
+             replay.submits / secs, replay.commands / secs);
+   if (replay.frames)
+      printf("%" PRIu64 " frames: avg %.3f ms, min %.3f ms, max %.3f ms\n",
+             replay.frames, replay.frame_total / 1e6 / replay.frames,
+             replay.frame_min / 1e6, replay.frame_max / 1e6);
+   vtest_dump_cmd_stats(0);
+
+   util_hash_table_destroy(replay.backings);
+   virgl_renderer_cleanup(&replay);
+   free(replay.payload);
+   free(data);
+   return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}